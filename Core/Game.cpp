@@ -23,11 +23,14 @@
 
 #include <cassert>
 #include <sstream>
+#include <thread>
 
 namespace Farlor
 {
-    Game::Game()
-        : m_running{true}
+    Game::Game(FarlorJobs::JobSystem& jobSystem)
+        : m_jobSystem{ jobSystem }
+        , m_submitThreadIndex{ 0 }
+        , m_running{true}
         , m_pGameWindow{ nullptr }
         , m_upInputStateManager{nullptr}
         , m_upGameTimer{nullptr}
@@ -199,7 +202,7 @@ namespace Farlor
         m_upGameTimer = std::make_unique<Farlor::Timer>();
 
         // This needs to be generalized for other render types
-        m_upRenderer = std::make_unique<Renderer>(m_cameraManager, m_resourceDir);
+        m_upRenderer = std::make_unique<Renderer>(m_resourceDir);
 
         float windowScale = 0.5f;
         const int width = 1920 * windowScale;
@@ -330,6 +333,53 @@ namespace Farlor
         return std::move(upLoadedScene);
     }
 
+    template <class Function>
+    FarlorJobs::JobSystem::CounterHandle Game::LaunchFrameStage(Function&& function, uint32_t threadAffinity)
+    {
+        if (m_jobSystem.GetCurrentJobSystemThreadIndex() == 0)
+        {
+            function();
+            return FarlorJobs::JobSystem::CounterHandle();
+        }
+
+        FarlorJobs::JobSystem::Job job = m_jobSystem.MakeJob(std::forward<Function>(function));
+        // Frame stages hold up the next frame, they go ahead of anything that isn't
+        job.m_priority = FarlorJobs::JobSystem::Priority::High;
+        job.m_threadAffinity = threadAffinity;
+        return m_jobSystem.SubmitJobs(&job, 1);
+    }
+
+    void Game::WaitForFrameStage(FarlorJobs::JobSystem::CounterHandle& counterHandle)
+    {
+        if (counterHandle.IsValid())
+        {
+            m_jobSystem.Wait(counterHandle);
+            counterHandle = FarlorJobs::JobSystem::CounterHandle();
+        }
+    }
+
+    void Game::WaitForSubmitStage(FarlorJobs::JobSystem::CounterHandle& counterHandle)
+    {
+        // Present can send messages to the window and block until they are handled, so the window thread must not
+        // suspend on the submit stage. Unless submit runs on it too, then the wait is what runs it.
+        const bool isSubmitThread = (m_jobSystem.GetCurrentJobSystemThreadIndex() == m_submitThreadIndex);
+        while (!isSubmitThread && counterHandle.IsValid() && !m_jobSystem.IsCounterComplete(counterHandle))
+        {
+            m_pGameWindow->ProcessEvent();
+            std::this_thread::yield();
+        }
+        WaitForFrameStage(counterHandle);
+    }
+
+    void Game::PrepareRenderFrame(const SimFrame& simFrame, Renderer::FrameData& renderFrame)
+    {
+        renderFrame.m_frameIndex = simFrame.m_frameIndex;
+        renderFrame.m_deltaTime = simFrame.m_deltaTime;
+        renderFrame.m_totalTime = simFrame.m_totalTime;
+        renderFrame.m_cameraEntry = simFrame.m_cameraEntry;
+        m_upRenderer->PrepareFrame(renderFrame);
+    }
+
     int Game::Run()
     {
         // Frame counting averages
@@ -437,6 +487,20 @@ namespace Farlor
             }
         }
 
+        // The frame runs as three stages, each on its own frame. Simulation of frame N runs here on the main thread,
+        // which owns the window, while render prep of frame N - 1 and the backend submit of frame N - 2 run as jobs.
+        // Every hand off between stages is double buffered. Submit is pinned to a thread of its own, which owns the
+        // device context and the swap chain from here on, so a frame costs about as long as the slowest stage.
+        // With a single job system thread everything shares the main thread.
+        const uint32_t mainThreadIndex = m_jobSystem.GetCurrentJobSystemThreadIndex();
+        m_submitThreadIndex = (m_jobSystem.GetNumThreads() > 1) ? (mainThreadIndex % m_jobSystem.GetNumThreads()) + 1 : mainThreadIndex;
+        std::array<SimFrame, NumBufferedFrames> simFrames;
+        std::array<Renderer::FrameData, NumBufferedFrames> renderFrames;
+        FarlorJobs::JobSystem::CounterHandle prepCounter;
+        FarlorJobs::JobSystem::CounterHandle submitCounter;
+        uint64_t frameIndex = 0;
+        float totalTime = 0.0f;
+
         while(m_running)
         {
             m_upGameTimer->Tick();
@@ -498,11 +562,39 @@ namespace Farlor
                 pCurrentCam->Update(deltaTime, latestInputState);
             }
 
-            static float totalTime = 0.0f;
             totalTime += deltaTime;
             //std::cout << "Total time: " << totalTime << std::endl;
 
-            m_upRenderer->RenderFrame(deltaTime, totalTime);
+            // The simulation is done with the frame, everything after this reads the copy
+            SimFrame& simFrame = simFrames[frameIndex % NumBufferedFrames];
+            simFrame.m_frameIndex = frameIndex;
+            simFrame.m_deltaTime = deltaTime;
+            simFrame.m_totalTime = totalTime;
+            simFrame.m_cameraEntry = m_cameraManager.CaptureCamera();
+
+            // Once the last frame is prepared and the one before it submitted, both buffers of each hand off are free
+            WaitForFrameStage(prepCounter);
+            WaitForSubmitStage(submitCounter);
+            if (frameIndex > 0)
+            {
+                const Renderer::FrameData* pLastRenderFrame = &renderFrames[(frameIndex - 1) % NumBufferedFrames];
+                submitCounter = LaunchFrameStage([this, pLastRenderFrame]() { m_upRenderer->SubmitFrame(*pLastRenderFrame); },
+                    m_submitThreadIndex);
+            }
+            Renderer::FrameData* pRenderFrame = &renderFrames[frameIndex % NumBufferedFrames];
+            prepCounter = LaunchFrameStage([this, &simFrame, pRenderFrame]() { PrepareRenderFrame(simFrame, *pRenderFrame); });
+            ++frameIndex;
+        }
+
+        // Drain the pipeline, the last frame is prepared but not yet submitted
+        WaitForFrameStage(prepCounter);
+        WaitForSubmitStage(submitCounter);
+        if (frameIndex > 0)
+        {
+            const Renderer::FrameData* pLastRenderFrame = &renderFrames[(frameIndex - 1) % NumBufferedFrames];
+            submitCounter = LaunchFrameStage([this, pLastRenderFrame]() { m_upRenderer->SubmitFrame(*pLastRenderFrame); },
+                m_submitThreadIndex);
+            WaitForSubmitStage(submitCounter);
         }
 
         m_pGameWindow->Shutdown();
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "FixedUpdate.h"
+#include "Threading/JobSystem.h"
 
+#include <CameraManager.h>
 #include <Input/InputStateManager.h>
 #include <Renderer.h>
 
 #include <Timer.h>
 
+#include <array>
 #include <map>
 #include <memory>
 #include <optional>
@@ -21,16 +24,56 @@ namespace Farlor
     class Game
     {
     public:
-        Game();
+        explicit Game(FarlorJobs::JobSystem& jobSystem);
         ~Game();
 
         bool Initialize(const std::string& resourceDir);
         int Run();
 
+        // For subsystems that want to submit work of their own
+        FarlorJobs::JobSystem& GetJobSystem()
+        {
+            return m_jobSystem;
+        }
+
+    private:
+        // What the simulation hands over to render prep for one frame
+        struct SimFrame
+        {
+            explicit SimFrame()
+                : m_frameIndex{ 0 }
+                , m_deltaTime{ 0.0f }
+                , m_totalTime{ 0.0f }
+                , m_cameraEntry{}
+            {
+            }
+
+            uint64_t m_frameIndex;
+            float m_deltaTime;
+            float m_totalTime;
+            CameraEntry m_cameraEntry;
+        };
+
+        // Frames handed from one stage to the next are double buffered
+        static constexpr uint32_t NumBufferedFrames = 2;
+
     private:
         std::optional<std::unique_ptr<Scene>> LoadSceneFarlor(const std::string& envFilename);
 
+        // Runs a frame stage as a job, on the given job system thread if threadAffinity is not 0.
+        // Outside the job system it runs right away and the handle stays invalid.
+        template <class Function>
+        FarlorJobs::JobSystem::CounterHandle LaunchFrameStage(Function&& function, uint32_t threadAffinity = 0);
+        void WaitForFrameStage(FarlorJobs::JobSystem::CounterHandle& counterHandle);
+        // WaitForFrameStage for the submit stage, keeps the window's messages pumped until it is done
+        void WaitForSubmitStage(FarlorJobs::JobSystem::CounterHandle& counterHandle);
+
+        void PrepareRenderFrame(const SimFrame& simFrame, Renderer::FrameData& renderFrame);
+
 private:
+        FarlorJobs::JobSystem& m_jobSystem;
+        // Job system thread that owns the device context and the swap chain once the game runs
+        uint32_t m_submitThreadIndex;
         bool m_running;
 
         IWindow* m_pGameWindow;
@@ -0,0 +1,87 @@
+#include "ClosureArena.h"
+
+#include <algorithm>
+#include <new>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        ClosureArena::Block::Block(std::size_t size)
+            : m_upMemory{ std::make_unique<uint8_t[]>(size) }
+            , m_size{ size }
+            , m_used{ 0 }
+            , m_numLiveAllocations{ 0 }
+        {
+        }
+
+        ClosureArena::ClosureArena(std::size_t blockSize)
+            : m_blockSize{ blockSize }
+            , m_blocks{}
+            , m_pCurrentBlock{ nullptr }
+        {
+        }
+
+        ClosureArena::~ClosureArena()
+        {
+        }
+
+        void* ClosureArena::Allocate(std::size_t size)
+        {
+            // Keep every allocation, and so every header, on the maximum alignment
+            const std::size_t allocationSize = sizeof(AllocationHeader) + ((size + MaxAlignment - 1) & ~(MaxAlignment - 1));
+
+            if (!m_pCurrentBlock || m_pCurrentBlock->m_used + allocationSize > m_pCurrentBlock->m_size)
+            {
+                m_pCurrentBlock = FindBlock(allocationSize);
+            }
+
+            Block& block = *m_pCurrentBlock;
+            AllocationHeader* pHeader = new (block.m_upMemory.get() + block.m_used) AllocationHeader();
+            pHeader->m_pBlock = &block;
+            block.m_used += allocationSize;
+            block.m_numLiveAllocations.fetch_add(1, std::memory_order_relaxed);
+            return pHeader + 1;
+        }
+
+        void ClosureArena::Free(void* pMemory)
+        {
+            AllocationHeader* pHeader = static_cast<AllocationHeader*>(pMemory) - 1;
+            Block* pBlock = pHeader->m_pBlock;
+            if (!pBlock)
+            {
+                ::operator delete(pHeader);
+                return;
+            }
+
+            // Pairs with the acquire in FindBlock, so the owner only reuses memory everyone is done with
+            pBlock->m_numLiveAllocations.fetch_sub(1, std::memory_order_release);
+        }
+
+        void* ClosureArena::AllocateFallback(std::size_t size)
+        {
+            // operator new is aligned for any fundamental type, which covers MaxAlignment
+            AllocationHeader* pHeader = new (::operator new(sizeof(AllocationHeader) + size)) AllocationHeader();
+            pHeader->m_pBlock = nullptr;
+            return pHeader + 1;
+        }
+
+        ClosureArena::Block* ClosureArena::FindBlock(std::size_t size)
+        {
+            // Reuse any block that is big enough and has nothing live left in it
+            for (const std::unique_ptr<Block>& upBlock : m_blocks)
+            {
+                if (upBlock.get() != m_pCurrentBlock && upBlock->m_size >= size
+                    && upBlock->m_numLiveAllocations.load(std::memory_order_acquire) == 0)
+                {
+                    upBlock->m_used = 0;
+                    return upBlock.get();
+                }
+            }
+
+            // Closures bigger than a block get a block of their own, which is reused like any other
+            m_blocks.push_back(std::make_unique<Block>(std::max(size, m_blockSize)));
+            return m_blocks.back().get();
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Memory for job closures too big to live inside the job, one arena per job system thread.
+        // The owning thread bump allocates out of fixed size blocks. Any thread frees, which only counts down the
+        // block's live allocations, and a block is reused once everything allocated from it has been freed.
+        class ClosureArena
+        {
+        public:
+            static constexpr std::size_t MaxAlignment = 16;
+
+        public:
+            explicit ClosureArena(std::size_t blockSize = 64 * 1024);
+            ~ClosureArena();
+
+            ClosureArena(const ClosureArena&) = delete;
+            ClosureArena& operator=(const ClosureArena&) = delete;
+
+            // Owning thread only
+            void* Allocate(std::size_t size);
+
+            // Any thread. Also takes memory from AllocateFallback.
+            static void Free(void* pMemory);
+            // For threads without an arena, plain heap memory that Free still understands
+            static void* AllocateFallback(std::size_t size);
+
+        private:
+            struct Block
+            {
+                explicit Block(std::size_t size);
+
+                std::unique_ptr<uint8_t[]> m_upMemory;
+                std::size_t m_size;
+                std::size_t m_used;
+                std::atomic<uint32_t> m_numLiveAllocations;
+            };
+
+            // Sits in front of every allocation so Free can find the block. Null block for fallback allocations.
+            struct alignas(MaxAlignment) AllocationHeader
+            {
+                Block* m_pBlock;
+            };
+
+            Block* FindBlock(std::size_t size);
+
+        private:
+            std::size_t m_blockSize;
+            std::vector<std::unique_ptr<Block>> m_blocks;
+            Block* m_pCurrentBlock;
+        };
+    }
+}
@@ -0,0 +1,549 @@
+#include "CpuTopology.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#if defined(_WIN32)
+// Keeps the min and max macros out of the way of std::min and std::max below
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        struct CpuTopology::RawCpu
+        {
+            explicit RawCpu()
+                : m_osIndex{ 0 }
+                , m_packageId{ 0 }
+                , m_coreId{ 0 }
+                , m_cacheId{ 0 }
+                , m_numaNode{ 0 }
+            {
+            }
+
+            uint32_t m_osIndex;
+            uint32_t m_packageId;
+            // Unique within the package
+            uint32_t m_coreId;
+            // Unique across the machine, any CPU of the last level cache will do
+            uint32_t m_cacheId;
+            uint32_t m_numaNode;
+        };
+
+#if defined(__linux__)
+        namespace
+        {
+            bool ReadFileLine(const std::string& path, std::string& line)
+            {
+                std::ifstream file(path);
+                return file && std::getline(file, line);
+            }
+
+            bool ReadFileUint(const std::string& path, uint32_t& value)
+            {
+                std::string line;
+                if (!ReadFileLine(path, line))
+                {
+                    return false;
+                }
+
+                // Some hypervisors report -1 for ids they do not expose
+                const long parsed = std::strtol(line.c_str(), nullptr, 10);
+                value = (parsed < 0) ? 0 : static_cast<uint32_t>(parsed);
+                return true;
+            }
+
+            // Parses the kernel's list format, for example "0-3,8-11"
+            std::vector<uint32_t> ParseCpuList(const std::string& cpuList)
+            {
+                std::vector<uint32_t> cpus;
+                std::stringstream stream(cpuList);
+                std::string range;
+                while (std::getline(stream, range, ','))
+                {
+                    if (range.empty())
+                    {
+                        continue;
+                    }
+
+                    const size_t dash = range.find('-');
+                    const uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+                    const uint32_t last = (dash == std::string::npos) ? first : static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+                    for (uint32_t cpu = first; cpu <= last; ++cpu)
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+                return cpus;
+            }
+
+            // NUMA node of every CPU that has one, indexed by OS index
+            std::map<uint32_t, uint32_t> ReadNumaNodes()
+            {
+                std::map<uint32_t, uint32_t> numaNodes;
+                std::string onlineNodes;
+                if (!ReadFileLine("/sys/devices/system/node/online", onlineNodes))
+                {
+                    return numaNodes;
+                }
+
+                for (uint32_t node : ParseCpuList(onlineNodes))
+                {
+                    std::string cpuList;
+                    if (ReadFileLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpuList))
+                    {
+                        for (uint32_t cpu : ParseCpuList(cpuList))
+                        {
+                            numaNodes[cpu] = node;
+                        }
+                    }
+                }
+                return numaNodes;
+            }
+
+            // The cache shared by the most CPUs is the last level one, named after its lowest CPU
+            uint32_t ReadLastLevelCacheId(uint32_t osIndex)
+            {
+                const std::string cacheDirectory = "/sys/devices/system/cpu/cpu" + std::to_string(osIndex) + "/cache/index";
+                uint32_t bestLevel = 0;
+                uint32_t cacheId = osIndex;
+                for (uint32_t cacheIndex = 0; ; ++cacheIndex)
+                {
+                    uint32_t level = 0;
+                    std::string sharedCpuList;
+                    if (!ReadFileUint(cacheDirectory + std::to_string(cacheIndex) + "/level", level)
+                        || !ReadFileLine(cacheDirectory + std::to_string(cacheIndex) + "/shared_cpu_list", sharedCpuList))
+                    {
+                        break;
+                    }
+
+                    const std::vector<uint32_t> sharedCpus = ParseCpuList(sharedCpuList);
+                    if (level > bestLevel && !sharedCpus.empty())
+                    {
+                        bestLevel = level;
+                        cacheId = *std::min_element(sharedCpus.begin(), sharedCpus.end());
+                    }
+                }
+                return cacheId;
+            }
+        }
+#endif
+
+        CpuTopology::CpuTopology()
+            : m_logicalCpus{}
+            , m_numCores{ 0 }
+            , m_numCacheDomains{ 0 }
+            , m_numNumaNodes{ 0 }
+            , m_numPackages{ 0 }
+        {
+        }
+
+        CpuTopology CpuTopology::Discover()
+        {
+            CpuTopology cpuTopology;
+            std::vector<RawCpu> rawCpus;
+
+#if defined(_WIN32)
+            // The process affinity mask only covers the process' primary group, CPUs in other groups are listed as long
+            // as they are active
+            DWORD_PTR processMask = 0;
+            DWORD_PTR systemMask = 0;
+            const bool hasProcessMask = GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) != 0;
+
+            DWORD length = 0;
+            GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+            std::vector<uint8_t> buffer(length);
+            if (length > 0 && GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length))
+            {
+                // Every relationship lists its CPUs as group masks, so collect one id of each kind per CPU
+                std::map<uint32_t, RawCpu> cpus;
+                std::map<uint32_t, uint32_t> cacheLevels;
+                uint32_t nextCoreId = 0;
+                uint32_t nextPackageId = 0;
+
+                auto forEachCpu = [](const GROUP_AFFINITY& groupAffinity, auto&& function)
+                {
+                    for (uint32_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit)
+                    {
+                        if (groupAffinity.Mask & (static_cast<KAFFINITY>(1) << bit))
+                        {
+                            function(groupAffinity.Group * static_cast<uint32_t>(sizeof(KAFFINITY) * 8) + bit);
+                        }
+                    }
+                };
+
+                for (DWORD offset = 0; offset < length; )
+                {
+                    const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& info = *reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+                    switch (info.Relationship)
+                    {
+                    case RelationProcessorCore:
+                        for (WORD group = 0; group < info.Processor.GroupCount; ++group)
+                        {
+                            forEachCpu(info.Processor.GroupMask[group], [&](uint32_t osIndex)
+                                {
+                                    cpus[osIndex].m_osIndex = osIndex;
+                                    cpus[osIndex].m_coreId = nextCoreId;
+                                });
+                        }
+                        ++nextCoreId;
+                        break;
+                    case RelationProcessorPackage:
+                        for (WORD group = 0; group < info.Processor.GroupCount; ++group)
+                        {
+                            forEachCpu(info.Processor.GroupMask[group], [&](uint32_t osIndex) { cpus[osIndex].m_packageId = nextPackageId; });
+                        }
+                        ++nextPackageId;
+                        break;
+                    case RelationNumaNode:
+                        forEachCpu(info.NumaNode.GroupMask, [&](uint32_t osIndex) { cpus[osIndex].m_numaNode = info.NumaNode.NodeNumber; });
+                        break;
+                    case RelationCache:
+                    {
+                        uint32_t firstCpu = UINT32_MAX;
+                        forEachCpu(info.Cache.GroupMask, [&](uint32_t osIndex) { firstCpu = std::min(firstCpu, osIndex); });
+                        forEachCpu(info.Cache.GroupMask, [&](uint32_t osIndex)
+                            {
+                                if (info.Cache.Level >= cacheLevels[osIndex])
+                                {
+                                    cacheLevels[osIndex] = info.Cache.Level;
+                                    cpus[osIndex].m_cacheId = firstCpu;
+                                }
+                            });
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+                    offset += info.Size;
+                }
+
+                const uint32_t groupSize = static_cast<uint32_t>(sizeof(KAFFINITY) * 8);
+                for (const std::pair<const uint32_t, RawCpu>& cpu : cpus)
+                {
+                    const uint32_t osIndex = cpu.first;
+                    const bool allowed = !hasProcessMask || osIndex >= groupSize || (processMask & (static_cast<DWORD_PTR>(1) << osIndex));
+                    if (allowed)
+                    {
+                        rawCpus.push_back(cpu.second);
+                    }
+                }
+            }
+#elif defined(__linux__)
+            // Containers and taskset narrow the CPUs we may use, so start from the affinity mask
+            const std::vector<uint32_t> allowedCpus = GetCurrentThreadAffinity();
+            const std::map<uint32_t, uint32_t> numaNodes = ReadNumaNodes();
+
+            bool hasSysfsTopology = true;
+            for (uint32_t osIndex : allowedCpus)
+            {
+                const std::string topologyDirectory = "/sys/devices/system/cpu/cpu" + std::to_string(osIndex) + "/topology/";
+
+                RawCpu rawCpu;
+                rawCpu.m_osIndex = osIndex;
+                if (!ReadFileUint(topologyDirectory + "physical_package_id", rawCpu.m_packageId)
+                    || !ReadFileUint(topologyDirectory + "core_id", rawCpu.m_coreId))
+                {
+                    hasSysfsTopology = false;
+                    break;
+                }
+                rawCpu.m_cacheId = ReadLastLevelCacheId(osIndex);
+
+                const auto numaNode = numaNodes.find(osIndex);
+                rawCpu.m_numaNode = (numaNode != numaNodes.end()) ? numaNode->second : 0;
+                rawCpus.push_back(rawCpu);
+            }
+
+            // Older kernels and some containers hide the sysfs topology, /proc/cpuinfo has the basics.
+            // Without cache information the package stands in for the last level cache.
+            if (!hasSysfsTopology)
+            {
+                rawCpus.clear();
+                std::ifstream cpuInfo("/proc/cpuinfo");
+                std::string line;
+                RawCpu rawCpu;
+                bool hasCpu = false;
+                auto flushCpu = [&]()
+                {
+                    if (hasCpu && std::find(allowedCpus.begin(), allowedCpus.end(), rawCpu.m_osIndex) != allowedCpus.end())
+                    {
+                        rawCpu.m_cacheId = rawCpu.m_packageId;
+                        const auto numaNode = numaNodes.find(rawCpu.m_osIndex);
+                        rawCpu.m_numaNode = (numaNode != numaNodes.end()) ? numaNode->second : 0;
+                        rawCpus.push_back(rawCpu);
+                    }
+                    rawCpu = RawCpu();
+                    hasCpu = false;
+                };
+
+                // Blank lines separate the CPUs, the fields we want are "processor", "physical id" and "core id"
+                while (std::getline(cpuInfo, line))
+                {
+                    const size_t colon = line.find(':');
+                    if (colon == std::string::npos)
+                    {
+                        flushCpu();
+                        continue;
+                    }
+
+                    std::string key = line.substr(0, colon);
+                    key.erase(key.find_last_not_of(" \t") + 1);
+                    const uint32_t value = static_cast<uint32_t>(std::strtoul(line.c_str() + colon + 1, nullptr, 10));
+                    if (key == "processor")
+                    {
+                        flushCpu();
+                        rawCpu.m_osIndex = value;
+                        // Without core ids every CPU is its own core
+                        rawCpu.m_coreId = value;
+                        hasCpu = true;
+                    }
+                    else if (key == "physical id")
+                    {
+                        rawCpu.m_packageId = value;
+                    }
+                    else if (key == "core id")
+                    {
+                        rawCpu.m_coreId = value;
+                    }
+                }
+                flushCpu();
+            }
+#endif
+
+            if (rawCpus.empty())
+            {
+                cpuTopology.BuildFlat(std::max(std::thread::hardware_concurrency(), 1u));
+            }
+            else
+            {
+                cpuTopology.Build(rawCpus);
+            }
+            return cpuTopology;
+        }
+
+        void CpuTopology::Build(const std::vector<RawCpu>& rawCpus)
+        {
+            std::vector<RawCpu> sortedCpus = rawCpus;
+            std::sort(sortedCpus.begin(), sortedCpus.end(), [](const RawCpu& a, const RawCpu& b)
+                {
+                    return std::tie(a.m_packageId, a.m_numaNode, a.m_cacheId, a.m_coreId, a.m_osIndex)
+                        < std::tie(b.m_packageId, b.m_numaNode, b.m_cacheId, b.m_coreId, b.m_osIndex);
+                });
+
+            // Dense indices in order of first appearance, which the sort keeps in topology order
+            std::map<uint32_t, uint32_t> packageIndices;
+            std::map<uint32_t, uint32_t> numaNodeIndices;
+            std::map<uint32_t, uint32_t> cacheDomainIndices;
+            std::map<std::pair<uint32_t, uint32_t>, uint32_t> coreIndices;
+            std::vector<uint32_t> numSmtSiblings;
+
+            m_logicalCpus.clear();
+            for (const RawCpu& rawCpu : sortedCpus)
+            {
+                LogicalCpu logicalCpu;
+                logicalCpu.m_osIndex = rawCpu.m_osIndex;
+                logicalCpu.m_packageIndex = packageIndices.emplace(rawCpu.m_packageId, static_cast<uint32_t>(packageIndices.size())).first->second;
+                logicalCpu.m_numaNodeIndex = numaNodeIndices.emplace(rawCpu.m_numaNode, static_cast<uint32_t>(numaNodeIndices.size())).first->second;
+                logicalCpu.m_cacheDomainIndex = cacheDomainIndices.emplace(rawCpu.m_cacheId, static_cast<uint32_t>(cacheDomainIndices.size())).first->second;
+                logicalCpu.m_coreIndex = coreIndices.emplace(std::make_pair(rawCpu.m_packageId, rawCpu.m_coreId), static_cast<uint32_t>(coreIndices.size())).first->second;
+
+                if (logicalCpu.m_coreIndex >= numSmtSiblings.size())
+                {
+                    numSmtSiblings.resize(logicalCpu.m_coreIndex + 1, 0);
+                }
+                logicalCpu.m_smtIndex = numSmtSiblings[logicalCpu.m_coreIndex]++;
+                m_logicalCpus.push_back(logicalCpu);
+            }
+
+            m_numCores = static_cast<uint32_t>(coreIndices.size());
+            m_numCacheDomains = static_cast<uint32_t>(cacheDomainIndices.size());
+            m_numNumaNodes = static_cast<uint32_t>(numaNodeIndices.size());
+            m_numPackages = static_cast<uint32_t>(packageIndices.size());
+        }
+
+        void CpuTopology::BuildFlat(uint32_t numLogicalCpus)
+        {
+            m_logicalCpus.resize(numLogicalCpus);
+            for (uint32_t i = 0; i < numLogicalCpus; ++i)
+            {
+                m_logicalCpus[i].m_osIndex = i;
+                m_logicalCpus[i].m_coreIndex = i;
+            }
+
+            m_numCores = numLogicalCpus;
+            m_numCacheDomains = 1;
+            m_numNumaNodes = 1;
+            m_numPackages = 1;
+        }
+
+        uint32_t CpuTopology::GetNumLogicalCpus() const
+        {
+            return static_cast<uint32_t>(m_logicalCpus.size());
+        }
+
+        uint32_t CpuTopology::GetNumCores() const
+        {
+            return m_numCores;
+        }
+
+        uint32_t CpuTopology::GetNumCacheDomains() const
+        {
+            return m_numCacheDomains;
+        }
+
+        uint32_t CpuTopology::GetNumNumaNodes() const
+        {
+            return m_numNumaNodes;
+        }
+
+        uint32_t CpuTopology::GetNumPackages() const
+        {
+            return m_numPackages;
+        }
+
+        const CpuTopology::LogicalCpu& CpuTopology::GetLogicalCpu(uint32_t cpuIndex) const
+        {
+            return m_logicalCpus[cpuIndex];
+        }
+
+        CpuTopology::Distance CpuTopology::GetDistance(uint32_t cpuIndexA, uint32_t cpuIndexB) const
+        {
+            const LogicalCpu& a = m_logicalCpus[cpuIndexA];
+            const LogicalCpu& b = m_logicalCpus[cpuIndexB];
+            if (a.m_coreIndex == b.m_coreIndex)
+            {
+                return Distance::SameCore;
+            }
+            if (a.m_cacheDomainIndex == b.m_cacheDomainIndex)
+            {
+                return Distance::SameCache;
+            }
+            if (a.m_numaNodeIndex == b.m_numaNodeIndex)
+            {
+                return Distance::SameNumaNode;
+            }
+            if (a.m_packageIndex == b.m_packageIndex)
+            {
+                return Distance::SamePackage;
+            }
+            return Distance::Remote;
+        }
+
+        std::vector<uint32_t> CpuTopology::GetPlacementOrder(bool includeSmtSiblings) const
+        {
+            uint32_t numSmtIndices = 1;
+            for (const LogicalCpu& logicalCpu : m_logicalCpus)
+            {
+                numSmtIndices = std::max(numSmtIndices, logicalCpu.m_smtIndex + 1);
+            }
+            if (!includeSmtSiblings)
+            {
+                numSmtIndices = 1;
+            }
+
+            // The CPUs are already in topology order, so one pass per SMT index does it
+            std::vector<uint32_t> placementOrder;
+            for (uint32_t smtIndex = 0; smtIndex < numSmtIndices; ++smtIndex)
+            {
+                for (uint32_t cpuIndex = 0; cpuIndex < static_cast<uint32_t>(m_logicalCpus.size()); ++cpuIndex)
+                {
+                    if (m_logicalCpus[cpuIndex].m_smtIndex == smtIndex)
+                    {
+                        placementOrder.push_back(cpuIndex);
+                    }
+                }
+            }
+            return placementOrder;
+        }
+
+        std::vector<uint32_t> CpuTopology::GetCurrentThreadAffinity()
+        {
+            std::vector<uint32_t> osIndices;
+#if defined(_WIN32)
+            GROUP_AFFINITY groupAffinity = {};
+            if (GetThreadGroupAffinity(GetCurrentThread(), &groupAffinity))
+            {
+                const uint32_t groupSize = static_cast<uint32_t>(sizeof(KAFFINITY) * 8);
+                for (uint32_t bit = 0; bit < groupSize; ++bit)
+                {
+                    if (groupAffinity.Mask & (static_cast<KAFFINITY>(1) << bit))
+                    {
+                        osIndices.push_back(groupAffinity.Group * groupSize + bit);
+                    }
+                }
+            }
+#elif defined(__linux__)
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            if (pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0)
+            {
+                for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                {
+                    if (CPU_ISSET(cpu, &cpuSet))
+                    {
+                        osIndices.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            return osIndices;
+        }
+
+        bool CpuTopology::SetCurrentThreadAffinity(const std::vector<uint32_t>& osIndices)
+        {
+            if (osIndices.empty())
+            {
+                return false;
+            }
+
+#if defined(_WIN32)
+            // A thread lives in one processor group, the group of the first CPU wins
+            const uint32_t groupSize = static_cast<uint32_t>(sizeof(KAFFINITY) * 8);
+            GROUP_AFFINITY groupAffinity = {};
+            groupAffinity.Group = static_cast<WORD>(osIndices[0] / groupSize);
+            for (uint32_t osIndex : osIndices)
+            {
+                if (osIndex / groupSize == groupAffinity.Group)
+                {
+                    groupAffinity.Mask |= static_cast<KAFFINITY>(1) << (osIndex % groupSize);
+                }
+            }
+            return SetThreadGroupAffinity(GetCurrentThread(), &groupAffinity, nullptr) != 0;
+#elif defined(__linux__)
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            for (uint32_t osIndex : osIndices)
+            {
+                if (osIndex < CPU_SETSIZE)
+                {
+                    CPU_SET(osIndex, &cpuSet);
+                }
+            }
+            return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+            return false;
+#endif
+        }
+
+        bool CpuTopology::PinCurrentThread(const LogicalCpu& logicalCpu)
+        {
+            return SetCurrentThreadAffinity({ logicalCpu.m_osIndex });
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Which logical CPUs the process may run on and how they share cores, caches, NUMA nodes and sockets.
+        // Read from sysfs on Linux, falling back to /proc/cpuinfo, and from GetLogicalProcessorInformationEx on Win32.
+        // Elsewhere, or when discovery fails, every logical CPU counts as its own core with nothing shared.
+        class CpuTopology
+        {
+        public:
+            struct LogicalCpu
+            {
+                explicit LogicalCpu()
+                    : m_osIndex{ 0 }
+                    , m_coreIndex{ 0 }
+                    , m_smtIndex{ 0 }
+                    , m_cacheDomainIndex{ 0 }
+                    , m_numaNodeIndex{ 0 }
+                    , m_packageIndex{ 0 }
+                {
+                }
+
+                // Number the OS knows the CPU by, what pinning takes
+                uint32_t m_osIndex;
+                // Physical core, dense over the cores we may run on
+                uint32_t m_coreIndex;
+                // Position among the SMT siblings of its core, 0 for the first hardware thread
+                uint32_t m_smtIndex;
+                // CPUs sharing the last level cache, dense like the core index
+                uint32_t m_cacheDomainIndex;
+                uint32_t m_numaNodeIndex;
+                uint32_t m_packageIndex;
+            };
+
+            // How close two logical CPUs are, from sharing everything to only sharing the machine
+            enum class Distance : uint32_t
+            {
+                SameCore = 0,
+                SameCache = SameCore + 1,
+                SameNumaNode = SameCache + 1,
+                SamePackage = SameNumaNode + 1,
+                Remote = SamePackage + 1,
+            };
+
+        public:
+            // Only the CPUs in the process' affinity mask are listed
+            static CpuTopology Discover();
+
+            uint32_t GetNumLogicalCpus() const;
+            uint32_t GetNumCores() const;
+            uint32_t GetNumCacheDomains() const;
+            uint32_t GetNumNumaNodes() const;
+            uint32_t GetNumPackages() const;
+            // Indexed [0, num logical cpus), sorted by package, NUMA node, cache domain and core
+            const LogicalCpu& GetLogicalCpu(uint32_t cpuIndex) const;
+
+            Distance GetDistance(uint32_t cpuIndexA, uint32_t cpuIndexB) const;
+
+            // Order to hand CPUs to threads in. The first hardware thread of every core comes first, filling one cache
+            // domain before moving to the next so neighbouring threads share caches, then the SMT siblings in the same
+            // order. Without SMT siblings the list stops at one CPU per core.
+            std::vector<uint32_t> GetPlacementOrder(bool includeSmtSiblings) const;
+
+            // OS indices of the CPUs the calling thread may run on, empty where that is unknown
+            static std::vector<uint32_t> GetCurrentThreadAffinity();
+            // Restricts the calling thread to the given OS CPU indices
+            static bool SetCurrentThreadAffinity(const std::vector<uint32_t>& osIndices);
+            static bool PinCurrentThread(const LogicalCpu& logicalCpu);
+
+        private:
+            // Ids as the OS reports them, only unique within whatever contains them
+            struct RawCpu;
+
+        private:
+            CpuTopology();
+
+            // Sorts the CPUs and turns the raw ids into dense indices
+            void Build(const std::vector<RawCpu>& rawCpus);
+            // Every CPU on its own core, for when the OS tells us nothing
+            void BuildFlat(uint32_t numLogicalCpus);
+
+        private:
+            std::vector<LogicalCpu> m_logicalCpus;
+            uint32_t m_numCores;
+            uint32_t m_numCacheDomains;
+            uint32_t m_numNumaNodes;
+            uint32_t m_numPackages;
+        };
+    }
+}
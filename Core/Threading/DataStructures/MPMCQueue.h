@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace Farlor
+{
+    // Bounded multi producer, multi consumer queue over a ring of sequenced cells (Dmitry Vyukov's design).
+    // Producers and consumers each claim a position with a single CAS, the cell's sequence number tells them
+    // whether the slot is free to write or ready to read, so nobody ever takes a lock.
+    // Same interface as MultithreadedQueue, except the queue can fill up: TryPush fails and Push waits instead.
+    template <class T>
+    class MPMCQueue
+    {
+    public:
+        // Rounded up to a power of two
+        explicit MPMCQueue(uint32_t capacity = 1024);
+        ~MPMCQueue();
+
+        MPMCQueue(const MPMCQueue&) = delete;
+        MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+        // Only a snapshot while other threads push and pop
+        bool Empty() const;
+        std::size_t Size() const;
+        std::size_t Capacity() const;
+
+        // Moves from t, only if it succeeds
+        bool TryPush(T& t);
+        // Yields while the queue is full
+        void Push(T& t);
+        bool TryPop(T& result);
+        // Yields while the queue is empty
+        T WaitPop();
+
+        // Claim a run of cells with one CAS. Return how many items were moved, which is less than asked for
+        // when the queue is close to full or empty.
+        uint32_t TryPushBulk(T* pItems, uint32_t numItems);
+        uint32_t TryPopBulk(T* pResults, uint32_t maxNumItems);
+
+    private:
+        struct Cell
+        {
+            explicit Cell()
+                : m_sequence{ 0 }
+                , m_data{}
+            {
+            }
+
+            // Equal to the position while free to push, position + 1 once it holds an item for that position
+            std::atomic<uint64_t> m_sequence;
+            T m_data;
+        };
+
+    private:
+        uint64_t m_mask;
+        std::unique_ptr<Cell[]> m_upCells;
+
+        // Producers and consumers hammer different ends, keep them off each other's cache lines
+        alignas(64) std::atomic<uint64_t> m_enqueuePosition;
+        alignas(64) std::atomic<uint64_t> m_dequeuePosition;
+    };
+}
+
+#include "MPMCQueue.inc"
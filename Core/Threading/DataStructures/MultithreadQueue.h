@@ -23,6 +23,8 @@ namespace Farlor
         std::queue<T> m_queue;
         mutable std::mutex m_mutex;
         std::condition_variable m_conditionVariable;
+        // Threads blocked in WaitPop, so Push can skip the notify when nobody is listening
+        uint32_t m_numWaiters;
     };
 }
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace Farlor
+{
+    // Chase-Lev work stealing deque.
+    // Only the owning thread may Push and TryPop, which work on the bottom of the deque in LIFO order.
+    // Any other thread may TrySteal from the top. The storage grows on demand, retired buffers are kept until
+    // the deque is destroyed because a thief may still be reading from them.
+    template <class T>
+    class WorkStealingDeque
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque elements are read racily and must be trivially copyable");
+
+    public:
+        explicit WorkStealingDeque(uint32_t initialCapacity = 1024);
+        ~WorkStealingDeque();
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+        bool Empty() const;
+        std::size_t Size() const;
+
+        // Owner only
+        void Push(const T& t);
+        bool TryPop(T& result);
+
+        // Any thread
+        bool TrySteal(T& result);
+
+    private:
+        struct Buffer
+        {
+            explicit Buffer(int64_t capacity);
+
+            T Get(int64_t index) const;
+            void Put(int64_t index, const T& t);
+
+            // Elements are copied in and out a word at a time, so types wider than the native atomics
+            // do not fall back to lock based std::atomic. A torn read is only ever kept by the thread that wins
+            // the race on top, at which point nobody can be writing that slot.
+            static constexpr std::size_t WordsPerItem = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+            int64_t m_capacity;
+            int64_t m_mask;
+            std::unique_ptr<std::atomic<uint64_t>[]> m_upWords;
+        };
+
+        Buffer* Grow(Buffer* pBuffer, int64_t bottom, int64_t top);
+
+    private:
+        // Top and bottom are written by different threads, keep them on separate cache lines
+        alignas(64) std::atomic<int64_t> m_top;
+        alignas(64) std::atomic<int64_t> m_bottom;
+        alignas(64) std::atomic<Buffer*> m_pBuffer;
+
+        // Owned by the pushing thread
+        std::vector<std::unique_ptr<Buffer>> m_buffers;
+    };
+}
+
+#include "WorkStealingDeque.inc"
@@ -0,0 +1,322 @@
+#include "Fiber.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(FARLOR_FIBER_WIN32)
+#include <Windows.h>
+#endif
+
+#if defined(FARLOR_FIBER_ASM)
+
+// Context switch for the System V x86-64 and AAPCS64 calling conventions.
+// Only the callee saved registers need to survive a switch, since to the compiler it is just a function call.
+// A suspended context is nothing more than its stack pointer, with the saved registers sitting on top of its stack.
+extern "C" void farlor_fiber_switch(void** ppFromStackPointer, void* pToStackPointer);
+// First code run on a new fiber. Pulls the entry function and argument out of the callee saved registers
+// the initial frame was seeded with.
+extern "C" void farlor_fiber_trampoline();
+
+#if defined(__x86_64__)
+
+// Saved frame, from the stack pointer up:
+// [0] x87 control word, [8] mxcsr, [16] r15, [24] r14, [32] r13, [40] r12, [48] rbx, [56] rbp, [64] return address
+asm(R"(
+    .text
+    .globl farlor_fiber_switch
+    .hidden farlor_fiber_switch
+    .type farlor_fiber_switch, @function
+    .p2align 4
+farlor_fiber_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $16, %rsp
+    stmxcsr 8(%rsp)
+    fnstcw (%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr 8(%rsp)
+    fldcw (%rsp)
+    addq $16, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size farlor_fiber_switch, .-farlor_fiber_switch
+
+    .globl farlor_fiber_trampoline
+    .hidden farlor_fiber_trampoline
+    .type farlor_fiber_trampoline, @function
+    .p2align 4
+farlor_fiber_trampoline:
+    movq %r13, %rdi
+    callq *%r12
+    ud2
+    .size farlor_fiber_trampoline, .-farlor_fiber_trampoline
+)");
+
+namespace
+{
+    constexpr size_t SavedFrameSize = 9 * sizeof(uint64_t);
+
+    void* PrepareInitialFrame(uint8_t* pStackTop, Farlor::FarlorJobs::FiberContext::EntryFunction entry, void* pArg)
+    {
+        // The return address sits 24 bytes below the aligned top, so the trampoline is entered with a 16 byte
+        // aligned stack and its call leaves the entry function with the usual alignment.
+        // The two words above it stay zero so unwinders see the end of the stack.
+        uint64_t* pFrame = reinterpret_cast<uint64_t*>(pStackTop - 24 - (SavedFrameSize - sizeof(uint64_t)));
+        memset(pFrame, 0, SavedFrameSize + 2 * sizeof(uint64_t));
+        pFrame[0] = 0x037F; // Default x87 control word
+        pFrame[1] = 0x1F80; // Default mxcsr
+        pFrame[4] = reinterpret_cast<uint64_t>(pArg); // r13
+        pFrame[5] = reinterpret_cast<uint64_t>(entry); // r12
+        pFrame[8] = reinterpret_cast<uint64_t>(&farlor_fiber_trampoline);
+        return pFrame;
+    }
+}
+
+#elif defined(__aarch64__)
+
+// Saved frame, from the stack pointer up:
+// [0] x19-x28, [80] x29 (frame pointer), [88] x30 (return address), [96] d8-d15, [160] fpcr
+asm(R"(
+    .text
+    .globl farlor_fiber_switch
+    .hidden farlor_fiber_switch
+    .type farlor_fiber_switch, %function
+    .p2align 4
+farlor_fiber_switch:
+    sub sp, sp, #176
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mrs x2, fpcr
+    str x2, [sp, #160]
+    mov x2, sp
+    str x2, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    ldr x2, [sp, #160]
+    msr fpcr, x2
+    add sp, sp, #176
+    ret
+    .size farlor_fiber_switch, .-farlor_fiber_switch
+
+    .globl farlor_fiber_trampoline
+    .hidden farlor_fiber_trampoline
+    .type farlor_fiber_trampoline, %function
+    .p2align 4
+farlor_fiber_trampoline:
+    mov x0, x20
+    blr x19
+    brk #0
+    .size farlor_fiber_trampoline, .-farlor_fiber_trampoline
+)");
+
+namespace
+{
+    constexpr size_t SavedFrameSize = 176;
+
+    void* PrepareInitialFrame(uint8_t* pStackTop, Farlor::FarlorJobs::FiberContext::EntryFunction entry, void* pArg)
+    {
+        uint64_t* pFrame = reinterpret_cast<uint64_t*>(pStackTop - SavedFrameSize);
+        memset(pFrame, 0, SavedFrameSize);
+        pFrame[0] = reinterpret_cast<uint64_t>(entry); // x19
+        pFrame[1] = reinterpret_cast<uint64_t>(pArg); // x20
+        pFrame[11] = reinterpret_cast<uint64_t>(&farlor_fiber_trampoline); // x30
+        return pFrame;
+    }
+}
+
+#endif
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        FiberContext::FiberContext()
+            : m_entry{ nullptr }
+            , m_pArg{ nullptr }
+            , m_isThreadContext{ false }
+#if defined(FARLOR_FIBER_WIN32)
+            , m_pFiber{ nullptr }
+#else
+            , m_pStack{ nullptr }
+            , m_stackSize{ 0 }
+#endif
+#if defined(FARLOR_FIBER_ASM)
+            , m_pStackPointer{ nullptr }
+#endif
+        {
+        }
+
+        FiberContext::~FiberContext()
+        {
+            Destroy();
+        }
+
+        bool FiberContext::Create(EntryFunction entry, void* pArg, const FiberStack& stack)
+        {
+            assert(!IsValid());
+            m_entry = entry;
+            m_pArg = pArg;
+            m_isThreadContext = false;
+
+#if defined(FARLOR_FIBER_WIN32)
+            // Only reserve the stack, a commit size of 0 takes the executable's default and the rest is committed
+            // page by page through the guard page the OS keeps below it
+            m_pFiber = CreateFiberEx(0, stack.m_size, 0, &FiberContext::Win32Entry, this);
+            return m_pFiber != nullptr;
+#else
+            if (!stack.m_pBottom)
+            {
+                return false;
+            }
+
+            // Keep the top of the stack 16 byte aligned for both ABIs
+            m_pStack = stack.m_pBottom;
+            m_stackSize = stack.m_size & ~static_cast<size_t>(15);
+
+#if defined(FARLOR_FIBER_ASM)
+            m_pStackPointer = PrepareInitialFrame(m_pStack + m_stackSize, entry, pArg);
+#else
+            if (getcontext(&m_context) != 0)
+            {
+                Destroy();
+                return false;
+            }
+            m_context.uc_stack.ss_sp = m_pStack;
+            m_context.uc_stack.ss_size = m_stackSize;
+            m_context.uc_link = nullptr;
+
+            // makecontext only passes int arguments, so the context pointer is split in two
+            const uint64_t contextBits = reinterpret_cast<uint64_t>(this);
+            makecontext(&m_context, reinterpret_cast<void(*)()>(&FiberContext::UContextEntry), 2,
+                static_cast<uint32_t>(contextBits >> 32), static_cast<uint32_t>(contextBits));
+#endif
+            return true;
+#endif
+        }
+
+        bool FiberContext::ConvertFromThread()
+        {
+            assert(!IsValid());
+            m_isThreadContext = true;
+
+#if defined(FARLOR_FIBER_WIN32)
+            m_pFiber = ConvertThreadToFiber(nullptr);
+            if (!m_pFiber)
+            {
+                m_isThreadContext = false;
+                return false;
+            }
+#endif
+            // On the other platforms the thread context is filled in the first time we switch away from it
+            return true;
+        }
+
+        void FiberContext::ConvertToThread()
+        {
+            assert(m_isThreadContext);
+
+#if defined(FARLOR_FIBER_WIN32)
+            ConvertFiberToThread();
+            m_pFiber = nullptr;
+#elif defined(FARLOR_FIBER_ASM)
+            m_pStackPointer = nullptr;
+#endif
+            m_isThreadContext = false;
+        }
+
+        bool FiberContext::IsValid() const
+        {
+            if (m_isThreadContext)
+            {
+                return true;
+            }
+
+#if defined(FARLOR_FIBER_WIN32)
+            return m_pFiber != nullptr;
+#else
+            return m_pStack != nullptr;
+#endif
+        }
+
+        void FiberContext::Switch(FiberContext& from, FiberContext& to)
+        {
+            assert(&from != &to);
+
+#if defined(FARLOR_FIBER_WIN32)
+            SwitchToFiber(to.m_pFiber);
+#elif defined(FARLOR_FIBER_ASM)
+            farlor_fiber_switch(&from.m_pStackPointer, to.m_pStackPointer);
+#else
+            swapcontext(&from.m_context, &to.m_context);
+#endif
+        }
+
+        void FiberContext::Destroy()
+        {
+#if defined(FARLOR_FIBER_WIN32)
+            if (m_pFiber && !m_isThreadContext)
+            {
+                DeleteFiber(m_pFiber);
+            }
+            m_pFiber = nullptr;
+#else
+            // The stack belongs to its pool
+            m_pStack = nullptr;
+            m_stackSize = 0;
+#endif
+#if defined(FARLOR_FIBER_ASM)
+            m_pStackPointer = nullptr;
+#endif
+            m_isThreadContext = false;
+        }
+
+#if defined(FARLOR_FIBER_UCONTEXT)
+        void FiberContext::UContextEntry(uint32_t contextHigh, uint32_t contextLow)
+        {
+            const uint64_t contextBits = (static_cast<uint64_t>(contextHigh) << 32) | static_cast<uint64_t>(contextLow);
+            FiberContext* pContext = reinterpret_cast<FiberContext*>(contextBits);
+            pContext->m_entry(pContext->m_pArg);
+
+            // Fibers must switch away instead of returning
+            assert(false);
+        }
+#elif defined(FARLOR_FIBER_WIN32)
+        void __stdcall FiberContext::Win32Entry(void* pArg)
+        {
+            FiberContext* pContext = static_cast<FiberContext*>(pArg);
+            pContext->m_entry(pContext->m_pArg);
+
+            // Fibers must switch away instead of returning, returning here would exit the thread
+            assert(false);
+        }
+#endif
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pick the context switch implementation for this platform.
+// Win32 uses the OS fibers, ELF platforms on x86-64 and AArch64 use the hand written switch in Fiber.cpp,
+// and everything else (or a build with FARLOR_FIBER_FORCE_UCONTEXT) falls back to ucontext.
+#if defined(_WIN32)
+#define FARLOR_FIBER_WIN32 1
+#elif !defined(FARLOR_FIBER_FORCE_UCONTEXT) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+#define FARLOR_FIBER_ASM 1
+#else
+#define FARLOR_FIBER_UCONTEXT 1
+#endif
+
+#if defined(FARLOR_FIBER_UCONTEXT)
+#include <ucontext.h>
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Stack memory for a fiber, owned by a FiberStackPool
+        struct FiberStack
+        {
+            explicit FiberStack()
+                : m_pBottom{ nullptr }
+                , m_size{ 0 }
+            {
+            }
+
+            // Lowest usable address, the stack grows down from m_pBottom + m_size.
+            // Null on Win32, where the OS allocates fiber stacks itself and m_size is only the reservation.
+            uint8_t* m_pBottom;
+            size_t m_size;
+        };
+
+        // Wraps a single execution context: either a fiber with its own stack, or a thread that has been converted
+        // so that it can be switched away from and back to.
+        // Fiber entry functions must never return, they have to switch to another context when they are done.
+        class FiberContext
+        {
+        public:
+            using EntryFunction = void(*)(void*);
+
+        public:
+            FiberContext();
+            ~FiberContext();
+
+            FiberContext(const FiberContext&) = delete;
+            FiberContext& operator=(const FiberContext&) = delete;
+
+            // Creates a new fiber that starts running entry(pArg) the first time it is switched to.
+            // The stack must outlive the fiber.
+            bool Create(EntryFunction entry, void* pArg, const FiberStack& stack);
+
+            // Turns the calling thread into a context we can switch away from and later resume
+            bool ConvertFromThread();
+            // Must be called on the same thread once it is running on its original context again
+            void ConvertToThread();
+
+            bool IsValid() const;
+
+            // Saves the running context into from and resumes to.
+            // When something later switches back to from, this call returns.
+            static void Switch(FiberContext& from, FiberContext& to);
+
+        private:
+            void Destroy();
+
+#if defined(FARLOR_FIBER_UCONTEXT)
+            static void UContextEntry(uint32_t contextHigh, uint32_t contextLow);
+#elif defined(FARLOR_FIBER_WIN32)
+            static void __stdcall Win32Entry(void* pArg);
+#endif
+
+        private:
+            EntryFunction m_entry;
+            void* m_pArg;
+            bool m_isThreadContext;
+
+#if defined(FARLOR_FIBER_WIN32)
+            // OS fiber handle
+            void* m_pFiber;
+#else
+            // Stack memory, null for a converted thread
+            uint8_t* m_pStack;
+            size_t m_stackSize;
+#endif
+
+#if defined(FARLOR_FIBER_ASM)
+            // Stack pointer saved by the context switch while this context is not running
+            void* m_pStackPointer;
+#elif defined(FARLOR_FIBER_UCONTEXT)
+            ucontext_t m_context;
+#endif
+        };
+    }
+}
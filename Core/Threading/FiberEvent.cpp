@@ -0,0 +1,75 @@
+#include "FiberEvent.h"
+
+#include <thread>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        FiberEvent::FiberEvent(JobSystem& jobSystem, bool isSet)
+            : m_jobSystem{ jobSystem }
+            , m_isSet{ isSet }
+            , m_waitList{}
+        {
+        }
+
+        void FiberEvent::Set()
+        {
+            if (m_isSet.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            // Take the whole list while holding the lock, nobody can join it once the flag is up. The fibers stay
+            // linked through Fiber::m_nextWaitingFiber, so it moves over without copying.
+            m_waitList.Lock();
+            m_isSet.store(true, std::memory_order_release);
+            JobSystem::FiberWaitList resumeList;
+            resumeList.m_firstFiber = m_waitList.m_firstFiber;
+            resumeList.m_lastFiber = m_waitList.m_lastFiber;
+            m_waitList.m_firstFiber = 0;
+            m_waitList.m_lastFiber = 0;
+            m_waitList.Unlock();
+
+            // Pop before resuming, a resumed fiber can go on to wait elsewhere and relink itself
+            while (!resumeList.Empty())
+            {
+                m_jobSystem.ResumeFiber(m_jobSystem.PopWaitingFiber(resumeList));
+            }
+        }
+
+        void FiberEvent::Reset()
+        {
+            m_isSet.store(false, std::memory_order_relaxed);
+        }
+
+        void FiberEvent::Wait()
+        {
+            while (!m_isSet.load(std::memory_order_acquire))
+            {
+                m_waitList.Lock();
+
+                // Set raises the flag under the list lock, so seeing it clear here means Set will find us
+                if (m_isSet.load(std::memory_order_acquire))
+                {
+                    m_waitList.Unlock();
+                    return;
+                }
+
+                if (m_jobSystem.TrySuspendOnWaitList(m_waitList))
+                {
+                    // Set resumed us, a Reset since then does not send us back to waiting
+                    return;
+                }
+
+                m_waitList.Unlock();
+                std::this_thread::yield();
+            }
+        }
+
+        bool FiberEvent::IsSet() const
+        {
+            return m_isSet.load(std::memory_order_acquire);
+        }
+    }
+}
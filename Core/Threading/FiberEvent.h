@@ -0,0 +1,35 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Manual reset event for code running in jobs, for example to hold jobs back until an asset has loaded.
+        // Wait suspends the job's fiber until the event is set, Set resumes every waiting fiber at once.
+        // The event stays set until Reset. Threads the job system does not own spin and yield instead of suspending.
+        class FiberEvent
+        {
+        public:
+            explicit FiberEvent(JobSystem& jobSystem, bool isSet = false);
+
+            FiberEvent(const FiberEvent&) = delete;
+            FiberEvent& operator=(const FiberEvent&) = delete;
+
+            void Set();
+            void Reset();
+            void Wait();
+
+            bool IsSet() const;
+
+        private:
+            JobSystem& m_jobSystem;
+            std::atomic<bool> m_isSet;
+            JobSystem::FiberWaitList m_waitList;
+        };
+    }
+}
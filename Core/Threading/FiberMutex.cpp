@@ -0,0 +1,114 @@
+#include "FiberMutex.h"
+
+#include "Futex.h"
+
+#include <assert.h>
+#include <thread>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        namespace
+        {
+            // Short critical sections are usually over within this many pauses, which is far cheaper than a switch
+            constexpr uint32_t NumLockSpins = 64;
+        }
+
+        FiberMutex::FiberMutex(JobSystem& jobSystem)
+            : m_jobSystem{ jobSystem }
+            , m_state{ State::Unlocked }
+            , m_waitList{}
+        {
+        }
+
+        bool FiberMutex::TryLock()
+        {
+            State state = State::Unlocked;
+            return m_state.compare_exchange_strong(state, State::Locked, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        void FiberMutex::Lock()
+        {
+            for (uint32_t spin = 0; spin < NumLockSpins; ++spin)
+            {
+                if (m_state.load(std::memory_order_relaxed) == State::Unlocked && TryLock())
+                {
+                    return;
+                }
+                CpuPause();
+            }
+
+            while (true)
+            {
+                m_waitList.Lock();
+
+                // Unlock only clears the state when nobody is waiting, and hands over under the list lock otherwise
+                State state = m_state.load(std::memory_order_relaxed);
+                while (true)
+                {
+                    if (state == State::Unlocked)
+                    {
+                        if (m_state.compare_exchange_weak(state, State::Locked, std::memory_order_acquire, std::memory_order_relaxed))
+                        {
+                            m_waitList.Unlock();
+                            return;
+                        }
+                    }
+                    else if (state == State::Locked)
+                    {
+                        // Make the owner take the slow path in Unlock so it sees us on the list
+                        m_state.compare_exchange_weak(state, State::Contended, std::memory_order_relaxed, std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+
+                if (m_jobSystem.TrySuspendOnWaitList(m_waitList))
+                {
+                    // Unlock handed the mutex to us
+                    return;
+                }
+
+                // Not on a fiber we can suspend, back off and try again. If that leaves the state Contended with
+                // nobody waiting, the next Unlock just finds an empty list.
+                m_waitList.Unlock();
+                std::this_thread::yield();
+                if (TryLock())
+                {
+                    return;
+                }
+            }
+        }
+
+        void FiberMutex::Unlock()
+        {
+            State state = State::Locked;
+            if (m_state.compare_exchange_strong(state, State::Unlocked, std::memory_order_release, std::memory_order_relaxed))
+            {
+                return;
+            }
+            assert(state == State::Contended);
+
+            m_waitList.Lock();
+            const uint32_t waitingFiberIndex = m_jobSystem.PopWaitingFiber(m_waitList);
+            if (waitingFiberIndex == 0)
+            {
+                m_state.store(State::Unlocked, std::memory_order_release);
+            }
+            else
+            {
+                // Stays locked, it now belongs to the fiber we resume
+                m_state.store(m_waitList.Empty() ? State::Locked : State::Contended, std::memory_order_release);
+            }
+            m_waitList.Unlock();
+
+            if (waitingFiberIndex > 0)
+            {
+                m_jobSystem.ResumeFiber(waitingFiberIndex);
+            }
+        }
+    }
+}
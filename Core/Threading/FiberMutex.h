@@ -0,0 +1,59 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Mutex for code running in jobs. A contended Lock suspends the job's fiber instead of blocking the thread,
+        // so the thread keeps running other jobs until the mutex is handed over.
+        // Unlock passes ownership straight to the longest waiting fiber, nobody can barge in ahead of it.
+        // Threads the job system does not own can use it too, they spin and yield while it is held.
+        class FiberMutex
+        {
+        public:
+            explicit FiberMutex(JobSystem& jobSystem);
+
+            FiberMutex(const FiberMutex&) = delete;
+            FiberMutex& operator=(const FiberMutex&) = delete;
+
+            void Lock();
+            bool TryLock();
+            void Unlock();
+
+            // Lower case aliases so std::lock_guard and std::unique_lock work
+            void lock()
+            {
+                Lock();
+            }
+
+            bool try_lock()
+            {
+                return TryLock();
+            }
+
+            void unlock()
+            {
+                Unlock();
+            }
+
+        private:
+            enum class State : uint32_t
+            {
+                Unlocked = 0,
+                Locked = Unlocked + 1,
+                // Locked with fibers on the wait list, Unlock has to hand over
+                Contended = Locked + 1,
+            };
+
+        private:
+            JobSystem& m_jobSystem;
+            std::atomic<State> m_state;
+            JobSystem::FiberWaitList m_waitList;
+        };
+    }
+}
@@ -0,0 +1,103 @@
+#include "FiberSemaphore.h"
+
+#include <thread>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        namespace
+        {
+            // Fibers resumed per pass over the wait list in Release
+            constexpr uint32_t MaxResumesPerPass = 16;
+        }
+
+        FiberSemaphore::FiberSemaphore(JobSystem& jobSystem, uint32_t initialCount)
+            : m_jobSystem{ jobSystem }
+            , m_count{ initialCount }
+            , m_numWaiters{ 0 }
+            , m_waitList{}
+        {
+        }
+
+        bool FiberSemaphore::TryAcquire()
+        {
+            uint32_t count = m_count.load(std::memory_order_relaxed);
+            while (count > 0)
+            {
+                if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void FiberSemaphore::Acquire()
+        {
+            while (!TryAcquire())
+            {
+                m_waitList.Lock();
+
+                // Announce ourselves before the last look, Release bumps the count before it looks for waiters.
+                // With the fences on both sides at least one of us sees the other.
+                m_numWaiters.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (TryAcquire())
+                {
+                    m_numWaiters.fetch_sub(1);
+                    m_waitList.Unlock();
+                    return;
+                }
+
+                if (m_jobSystem.TrySuspendOnWaitList(m_waitList))
+                {
+                    // Release took the permit for us and took us off the count of waiters
+                    return;
+                }
+
+                m_numWaiters.fetch_sub(1);
+                m_waitList.Unlock();
+                std::this_thread::yield();
+            }
+        }
+
+        void FiberSemaphore::Release(uint32_t count)
+        {
+            m_count.fetch_add(count);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_numWaiters.load(std::memory_order_relaxed) == 0)
+            {
+                return;
+            }
+
+            // Move permits to waiting fibers one at a time, as long as both are left
+            m_waitList.Lock();
+            uint32_t resumeFiberIndices[MaxResumesPerPass];
+            uint32_t numResumeFibers = 0;
+            while (numResumeFibers < MaxResumesPerPass && !m_waitList.Empty() && TryAcquire())
+            {
+                resumeFiberIndices[numResumeFibers++] = m_jobSystem.PopWaitingFiber(m_waitList);
+                m_numWaiters.fetch_sub(1);
+            }
+            const bool hasMoreWaiters = !m_waitList.Empty();
+            m_waitList.Unlock();
+
+            for (uint32_t i = 0; i < numResumeFibers; ++i)
+            {
+                m_jobSystem.ResumeFiber(resumeFiberIndices[i]);
+            }
+
+            // Big releases with a long wait list go around again for the rest
+            if (numResumeFibers == MaxResumesPerPass && hasMoreWaiters)
+            {
+                Release(0);
+            }
+        }
+
+        uint32_t FiberSemaphore::GetCount() const
+        {
+            return m_count.load(std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Counting semaphore for code running in jobs, for example to cap how many jobs stream from disk at once.
+        // Acquire suspends the job's fiber while no permits are left, Release hands permits straight to waiting fibers.
+        // Threads the job system does not own spin and yield instead of suspending.
+        class FiberSemaphore
+        {
+        public:
+            FiberSemaphore(JobSystem& jobSystem, uint32_t initialCount);
+
+            FiberSemaphore(const FiberSemaphore&) = delete;
+            FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+            void Acquire();
+            bool TryAcquire();
+            void Release(uint32_t count = 1);
+
+            // Permits not held by anyone, only a snapshot
+            uint32_t GetCount() const;
+
+        private:
+            JobSystem& m_jobSystem;
+            std::atomic<uint32_t> m_count;
+            // Fibers on the wait list, lets Release skip the list lock while nobody waits
+            std::atomic<uint32_t> m_numWaiters;
+            JobSystem::FiberWaitList m_waitList;
+        };
+    }
+}
@@ -0,0 +1,127 @@
+#include "FiberStackPool.h"
+
+#include <cassert>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        namespace
+        {
+            size_t GetPageSize()
+            {
+#if defined(_WIN32)
+                SYSTEM_INFO systemInfo;
+                GetSystemInfo(&systemInfo);
+                return static_cast<size_t>(systemInfo.dwPageSize);
+#else
+                const long pageSize = sysconf(_SC_PAGESIZE);
+                return (pageSize > 0) ? static_cast<size_t>(pageSize) : 4096;
+#endif
+            }
+        }
+
+        FiberStackPool::FiberStackPool()
+            : m_pReservation{ nullptr }
+            , m_reservationSize{ 0 }
+            , m_stackSize{ 0 }
+            , m_guardSize{ 0 }
+            , m_numStacks{ 0 }
+        {
+        }
+
+        FiberStackPool::~FiberStackPool()
+        {
+            Release();
+        }
+
+        bool FiberStackPool::Initialize(uint32_t numStacks, size_t stackSize)
+        {
+            Release();
+
+            const size_t pageSize = GetPageSize();
+            m_stackSize = (stackSize + pageSize - 1) & ~(pageSize - 1);
+            m_guardSize = pageSize;
+            m_numStacks = numStacks;
+
+#if defined(_WIN32)
+            // CreateFiberEx reserves and commits the stacks itself
+            return true;
+#else
+            if (numStacks == 0)
+            {
+                return true;
+            }
+
+            // Reserve everything inaccessible, then open up each stack and leave the page below it as the guard.
+            // Nothing is backed by memory until it is first touched, and MAP_NORESERVE keeps the untouched part
+            // out of the commit charge.
+            m_reservationSize = static_cast<size_t>(numStacks) * (m_guardSize + m_stackSize);
+            void* pReservation = mmap(nullptr, m_reservationSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (pReservation == MAP_FAILED)
+            {
+                std::cout << "Failed to reserve " << m_reservationSize << " bytes of fiber stacks" << std::endl;
+                m_reservationSize = 0;
+                m_numStacks = 0;
+                return false;
+            }
+            m_pReservation = static_cast<uint8_t*>(pReservation);
+
+            for (uint32_t stackIndex = 0; stackIndex < numStacks; ++stackIndex)
+            {
+                const FiberStack stack = GetStack(stackIndex);
+                if (mprotect(stack.m_pBottom, stack.m_size, PROT_READ | PROT_WRITE) != 0)
+                {
+                    std::cout << "Failed to make fiber stack " << stackIndex << " accessible" << std::endl;
+                    Release();
+                    return false;
+                }
+            }
+            return true;
+#endif
+        }
+
+        FiberStack FiberStackPool::GetStack(uint32_t stackIndex) const
+        {
+            assert(stackIndex < m_numStacks);
+
+            FiberStack stack;
+            stack.m_size = m_stackSize;
+#if !defined(_WIN32)
+            stack.m_pBottom = m_pReservation + static_cast<size_t>(stackIndex) * (m_guardSize + m_stackSize) + m_guardSize;
+#endif
+            return stack;
+        }
+
+        uint32_t FiberStackPool::GetNumStacks() const
+        {
+            return m_numStacks;
+        }
+
+        size_t FiberStackPool::GetStackSize() const
+        {
+            return m_stackSize;
+        }
+
+        void FiberStackPool::Release()
+        {
+#if !defined(_WIN32)
+            if (m_pReservation)
+            {
+                munmap(m_pReservation, m_reservationSize);
+            }
+#endif
+            m_pReservation = nullptr;
+            m_reservationSize = 0;
+            m_numStacks = 0;
+        }
+    }
+}
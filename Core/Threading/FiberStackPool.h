@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Fiber.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Hands out fixed size fiber stacks carved from one address space reservation.
+        // Every stack has an inaccessible guard page below it, so an overflow faults instead of silently
+        // corrupting the neighbouring stack. Pages are only backed by memory once a fiber touches them,
+        // so a large pool of mostly shallow fibers costs little more than its address space.
+        // On Win32 the OS owns fiber stacks, there the pool only carries the size for CreateFiberEx.
+        class FiberStackPool
+        {
+        public:
+            FiberStackPool();
+            ~FiberStackPool();
+
+            FiberStackPool(const FiberStackPool&) = delete;
+            FiberStackPool& operator=(const FiberStackPool&) = delete;
+
+            // Reserves numStacks stacks of at least stackSize bytes each
+            bool Initialize(uint32_t numStacks, size_t stackSize);
+
+            // Stacks are indexed [0, numStacks)
+            FiberStack GetStack(uint32_t stackIndex) const;
+            uint32_t GetNumStacks() const;
+            size_t GetStackSize() const;
+
+        private:
+            void Release();
+
+        private:
+            uint8_t* m_pReservation;
+            size_t m_reservationSize;
+            // Stack size rounded up to whole pages, plus the guard page below each stack
+            size_t m_stackSize;
+            size_t m_guardSize;
+            uint32_t m_numStacks;
+        };
+    }
+}
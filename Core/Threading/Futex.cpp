@@ -0,0 +1,58 @@
+#include "Futex.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex words must be plain 32 bit values");
+
+#if defined(_WIN32)
+        // WaitOnAddress lives in Synchronization.lib
+
+        void FutexWait(std::atomic<uint32_t>& word, uint32_t expectedValue)
+        {
+            WaitOnAddress(&word, &expectedValue, sizeof(expectedValue), INFINITE);
+        }
+
+        void FutexWakeOne(std::atomic<uint32_t>& word)
+        {
+            WakeByAddressSingle(&word);
+        }
+#elif defined(__linux__)
+        void FutexWait(std::atomic<uint32_t>& word, uint32_t expectedValue)
+        {
+            // Returns straight away with EAGAIN if the word already changed
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expectedValue, nullptr, nullptr, 0);
+        }
+
+        void FutexWakeOne(std::atomic<uint32_t>& word)
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+#else
+        // No address based wait here, nap briefly instead. Slower to wake, but still off the core.
+        void FutexWait(std::atomic<uint32_t>& word, uint32_t expectedValue)
+        {
+            if (word.load(std::memory_order_relaxed) == expectedValue)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+
+        void FutexWakeOne(std::atomic<uint32_t>&)
+        {
+        }
+#endif
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Tells the core we are in a spin wait, so it can back off and give the pipeline to its sibling hyperthread
+        inline void CpuPause()
+        {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            _mm_pause();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+            __yield();
+#elif defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+
+        // Sleeps the calling thread while word still holds expectedValue.
+        // May return spuriously, callers have to re-check their condition.
+        void FutexWait(std::atomic<uint32_t>& word, uint32_t expectedValue);
+        // Wakes one thread sleeping in FutexWait on word
+        void FutexWakeOne(std::atomic<uint32_t>& word);
+    }
+}
@@ -1,68 +1,262 @@
 #include "JobSystem.h"
 
 #include "DataStructures/MultithreadQueue.h"
+#include "Futex.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <cstdint>
 #include <iostream>
+#include <utility>
+
+#if defined(_MSC_VER)
+#define FARLOR_JOBS_NOINLINE __declspec(noinline)
+#else
+#define FARLOR_JOBS_NOINLINE __attribute__((noinline))
+#endif
 
 namespace Farlor
 {
     namespace FarlorJobs
     {
+        namespace
+        {
+            // Job system id of the calling thread, 0 for threads the job system does not own
+            thread_local uint32_t t_jobSystemThreadIndex = 0;
+
+            // Fibers move between threads, and the compiler is free to cache the address of a thread local across
+            // a function call. Going through these keeps every read and write looking at the thread we are on now.
+            FARLOR_JOBS_NOINLINE uint32_t ReadJobSystemThreadIndex()
+            {
+                return t_jobSystemThreadIndex;
+            }
+
+            FARLOR_JOBS_NOINLINE void WriteJobSystemThreadIndex(uint32_t jobSystemThreadIndex)
+            {
+                t_jobSystemThreadIndex = jobSystemThreadIndex;
+            }
+
+            // Every thread sits on a fiber of its own and each Wait takes another, so the pool grows with the threads
+            constexpr uint32_t MinFibersPerThread = 4;
+        }
+
         JobSystem::JobSystem(uint32_t numFibers, uint32_t maxNumThreads)
-            : m_jobQueue{}
-            , m_numFibers{ numFibers }
+            : JobSystem(Config(numFibers, maxNumThreads))
+        {
+        }
+
+        JobSystem::JobSystem(const Config& config)
+            : m_queueMode{ config.m_queueMode }
+            , m_executionMode{ config.m_executionMode }
+            , m_normalJobsPerBackgroundJob{ config.m_normalJobsPerBackgroundJob }
+            , m_jobQueues{}
+            , m_numQueuedJobs{}
+            , m_workerQueues{}
+            , m_counters( config.m_numCounters )
+            , m_freeCounterHead{ 0 }
+            , m_cpuTopology{ CpuTopology::Discover() }
+            , m_cpuPlacementOrder{ m_cpuTopology.GetPlacementOrder(!config.m_skipSmtSiblings) }
+            , m_pinThreads{ config.m_pinThreads }
+            , m_numHwThreads{ ComputeNumThreads(config.m_maxNumThreads, static_cast<uint32_t>(m_cpuPlacementOrder.size())) }
+            , m_numFibers{ std::max(config.m_numFibers, m_numHwThreads * MinFibersPerThread) }
+            , m_numLargeFibers{ std::max(config.m_numLargeFibers, 1u) }
+            , m_smallFiberStackSize{ config.m_smallFiberStackSize }
+            , m_largeFiberStackSize{ config.m_largeFiberStackSize }
             , m_quitting{ false }
-            , m_threads {}
-            , m_threadIdMap{}
-            , m_fiberIdMap{}
-            , m_threadLocalStorage{}
-            , m_fiberLocalStorage{}
-            , m_fibers( m_numFibers )
+            , m_numIdleSpins{ config.m_numIdleSpins }
+            , m_numParkedThreads{ 0 }
+            , m_numParks{ 0 }
+            , m_numWakes{ 0 }
+            , m_smallStackPool{}
+            , m_largeStackPool{}
+            , m_threads( m_numHwThreads )
+            , m_fibers( m_numFibers + m_numLargeFibers )
             , m_freeFibers( m_numFibers )
-            , m_waitingFibers( m_numFibers )
+            , m_freeLargeFibers( m_numLargeFibers + 1 )
+            , m_readyFibers( m_numFibers + m_numLargeFibers )
+            , m_numReadyFibers{ 0 }
+            , m_blockedLargeJobs{}
+            , m_numBlockedLargeJobs{ 0 }
+            , m_threadLocalStorage( m_numHwThreads )
+            , m_fiberLocalStorage( m_numFibers + m_numLargeFibers )
+            , m_trace( m_numHwThreads, m_numFibers + m_numLargeFibers, config.m_numTraceEventsPerThread )
         {
-            m_numHwThreads = std::thread::hardware_concurrency();
-            // Cap the number of threads to a given max number
-            if (m_numHwThreads > maxNumThreads && maxNumThreads != 0)
+            for (uint32_t i = 0; i < m_numHwThreads; ++i)
             {
-                m_numHwThreads = maxNumThreads;
+                if (m_queueMode == QueueMode::WorkStealing)
+                {
+                    for (uint32_t priority = 0; priority < NumPriorities; ++priority)
+                    {
+                        m_workerQueues.push_back(std::make_unique<WorkStealingDeque<Job>>());
+                    }
+                }
+                // Any non zero seed works for xorshift
+                m_threadLocalStorage[i].m_randomState = 0x9E3779B9u * (i + 1);
+            }
+
+            // Every counter starts out in the pool
+            for (uint32_t i = 0; i < static_cast<uint32_t>(m_counters.size()); ++i)
+            {
+                m_counters[i].m_index = i + 1;
+                FreeCounter(m_counters[i]);
+            }
+
+            PlaceThreads();
+        }
+
+        uint32_t JobSystem::ComputeNumThreads(uint32_t maxNumThreads, uint32_t numAvailableCpus)
+        {
+            uint32_t numHwThreads = numAvailableCpus;
+            if (numHwThreads == 0)
+            {
+                numHwThreads = 1;
             }
 
-            // We want total number of fibers to be desired + num hw threads
-            for (uint32_t i = 0; i < m_numFibers; ++i)
+            // Cap the number of threads to a given max number
+            if (numHwThreads > maxNumThreads && maxNumThreads != 0)
             {
-                m_freeFibers[i].store(false);
-                m_waitingFibers[i].store(false);
+                numHwThreads = maxNumThreads;
             }
+            return numHwThreads;
+        }
 
+        void JobSystem::PlaceThreads()
+        {
+            // Thread i takes the i-th CPU of the placement order. Without pinning nothing is known about where threads
+            // run, so every victim is as good as any other.
+            const bool pinThreads = m_pinThreads && !m_cpuPlacementOrder.empty();
             for (uint32_t i = 0; i < m_numHwThreads; ++i)
             {
-                m_threads.emplace_back();
-                m_threadLocalStorage.emplace_back();
+                m_threads[i].m_cpuIndex = pinThreads ? m_cpuPlacementOrder[i % m_cpuPlacementOrder.size()] + 1 : 0;
             }
 
-            for (uint32_t i = 0; i < m_numFibers; ++i)
+            for (uint32_t thiefIndex = 0; thiefIndex < m_numHwThreads; ++thiefIndex)
             {
-                m_fiberLocalStorage.emplace_back();
+                std::vector<std::pair<CpuTopology::Distance, uint32_t>> victims;
+                for (uint32_t victimIndex = 0; victimIndex < m_numHwThreads; ++victimIndex)
+                {
+                    if (victimIndex == thiefIndex)
+                    {
+                        continue;
+                    }
+
+                    const CpuTopology::Distance distance = pinThreads
+                        ? m_cpuTopology.GetDistance(m_threads[thiefIndex].m_cpuIndex - 1, m_threads[victimIndex].m_cpuIndex - 1)
+                        : CpuTopology::Distance::Remote;
+                    victims.emplace_back(distance, victimIndex + 1);
+                }
+                std::sort(victims.begin(), victims.end());
+
+                ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[thiefIndex];
+                threadLocalStorage.m_stealVictims.clear();
+                threadLocalStorage.m_stealTierEnds.clear();
+                for (uint32_t i = 0; i < static_cast<uint32_t>(victims.size()); ++i)
+                {
+                    if (i > 0 && victims[i].first != victims[i - 1].first)
+                    {
+                        threadLocalStorage.m_stealTierEnds.push_back(i);
+                    }
+                    threadLocalStorage.m_stealVictims.push_back(victims[i].second);
+                }
+                if (!victims.empty())
+                {
+                    threadLocalStorage.m_stealTierEnds.push_back(static_cast<uint32_t>(victims.size()));
+                }
+            }
+        }
+
+        void JobSystem::PinCurrentThread(uint32_t threadIndex)
+        {
+            const uint32_t cpuIndex = m_threads[threadIndex - 1].m_cpuIndex;
+            if (cpuIndex > 0 && !CpuTopology::PinCurrentThread(m_cpuTopology.GetLogicalCpu(cpuIndex - 1)))
+            {
+                // Not fatal, the thread just runs wherever the OS puts it
+                std::cout << "Could not pin thread " << threadIndex << " to cpu " << m_cpuTopology.GetLogicalCpu(cpuIndex - 1).m_osIndex << std::endl;
             }
         }
 
         uint32_t JobSystem::GetCurrentJobSystemThreadIndex()
         {
-            // Calls os specific call to get the current thread id, which hashes into the map to get the job system index
-            return m_threadIdMap[GetCurrentThreadId()];
+            return ReadJobSystemThreadIndex();
         }
 
         uint32_t JobSystem::GetCurrentJobSystemFiberIndex()
         {
-            // Calls os specific call to get the current fiber id, which hashes into the map to get the job system index
-            return m_fiberIdMap[GetCurrentFiber()];
+            // The switch helpers keep track of which fiber each thread is running
+            return m_threadLocalStorage[GetCurrentJobSystemThreadIndex() - 1].m_currentFiberIndex;
+        }
+
+        JobSystem::Priority JobSystem::GetCurrentJobPriority()
+        {
+            const uint32_t threadIndex = GetCurrentJobSystemThreadIndex();
+            if (threadIndex == 0)
+            {
+                return Priority::Normal;
+            }
+
+            if (m_executionMode == ExecutionMode::ThreadPool)
+            {
+                return m_threadLocalStorage[threadIndex - 1].m_currentJobPriority;
+            }
+
+            const uint32_t fiberIndex = GetCurrentJobSystemFiberIndex();
+            return (fiberIndex > 0) ? m_fibers[fiberIndex - 1].m_priority : Priority::Normal;
+        }
+
+        uint32_t JobSystem::GetNumThreads() const
+        {
+            return m_numHwThreads;
+        }
+
+        JobSystem::ExecutionMode JobSystem::GetExecutionMode() const
+        {
+            return m_executionMode;
+        }
+
+        const CpuTopology& JobSystem::GetCpuTopology() const
+        {
+            return m_cpuTopology;
+        }
+
+        JobSystem::IdleStats JobSystem::GetIdleStats() const
+        {
+            IdleStats idleStats;
+            idleStats.m_numParks = m_numParks.load(std::memory_order_relaxed);
+            idleStats.m_numWakes = m_numWakes.load(std::memory_order_relaxed);
+            return idleStats;
+        }
+
+        JobTrace& JobSystem::GetTrace()
+        {
+            return m_trace;
+        }
+
+        void JobSystem::SwitchToJobFiber(uint32_t fromFiberIndex, uint32_t toFiberIndex)
+        {
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[GetCurrentJobSystemThreadIndex() - 1];
+            FiberContext& fromContext = (fromFiberIndex > 0) ? m_fibers[fromFiberIndex - 1].m_context : threadLocalStorage.m_threadFiber;
+
+            threadLocalStorage.m_currentFiberIndex = toFiberIndex;
+            FiberContext::Switch(fromContext, m_fibers[toFiberIndex - 1].m_context);
+        }
+
+        void JobSystem::SwitchToThreadFiber(uint32_t fromFiberIndex)
+        {
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[GetCurrentJobSystemThreadIndex() - 1];
+            threadLocalStorage.m_currentFiberIndex = 0;
+            FiberContext::Switch(m_fibers[fromFiberIndex - 1].m_context, threadLocalStorage.m_threadFiber);
         }
 
-        // This sets up all the job threads
         void JobSystem::BootstrapMainTask(JobFunction mainTask, void* pMainTaskArg)
+        {
+            Job mainJob;
+            mainJob.m_jobFunction = mainTask;
+            mainJob.m_jobArgument = pMainTaskArg;
+            BootstrapMainTask(mainJob);
+        }
+
+        // This sets up all the job threads
+        void JobSystem::BootstrapMainTask(const Job& mainJob)
         {
             // Structures to ensure that the values are destroyed at some point
             std::vector<std::unique_ptr<MainFiberFuncArg>> mainFiberFuncArgs;
@@ -70,71 +264,69 @@ namespace Farlor
             std::vector<std::unique_ptr<ThreadFuncArg>> threadFuncArgs;
 
             // First, we want to create the main fiber thread and bootstrap to the main thread
-            // Create a counter for the main job
-            std::shared_ptr<Counter> spCounter = std::make_shared<Counter>();
-            spCounter->m_atomicCounter.store(0);
-            spCounter->m_desiredValue = 1;
-
-            // We bootstrap the main job with this
-            Job mainJob;
-            mainJob.m_jobFunction = mainTask;
-            mainJob.m_jobArgument = pMainTaskArg;
-            mainJob.m_spCounter = spCounter;
-
+            // We bootstrap the main job with this. Nothing waits on it, so it does not need a counter.
             std::unique_ptr<MainFiberFuncArg> upMainFiberFuncArg = std::make_unique<MainFiberFuncArg>();
             upMainFiberFuncArg->pJobSystem = this;
             upMainFiberFuncArg->bootstrapJob = mainJob;
-            
-            // Fiber creation
+
+            // Fiber creation, the thread pool runs everything on the threads' own stacks
+            if (m_executionMode == ExecutionMode::Fibers)
             {
-                const uint32_t fiberStackSize = 512 * 1024;
-                // Only the first fiber in the array is special
-                FiberPtr mainThreadFiber = CreateFiber(fiberStackSize, &JobSystem::MainFiberFunc, upMainFiberFuncArg.get());
-                mainFiberFuncArgs.push_back(std::move(upMainFiberFuncArg));
-                if (!mainThreadFiber)
+                // The main fiber runs the game loop and whatever it calls, so it always gets a large stack
+                if (!m_smallStackPool.Initialize(m_numFibers - 1, m_smallFiberStackSize)
+                    || !m_largeStackPool.Initialize(m_numLargeFibers + 1, m_largeFiberStackSize))
                 {
-                    // TODO: Log cause we have hell to pay
-                    // Blow up
+                    std::cout << "Error, could not reserve fiber stacks" << std::endl;
                     assert(false);
+                    return;
                 }
 
+                // Only the first fiber in the array is special
                 // The first fiber is the main thread fiber
                 // Note: Always one more than the actual array index we want when using arrays
                 uint32_t jobSystemFiberIndex = 1;
                 uint32_t jobSystemFiberArrayIndex = jobSystemFiberIndex - 1;
 
-                m_fibers[jobSystemFiberArrayIndex].m_pFiber = mainThreadFiber;
-                // Require that its run on the creation thread
+                if (!m_fibers[jobSystemFiberArrayIndex].m_context.Create(&JobSystem::MainFiberFunc, upMainFiberFuncArg.get(), m_largeStackPool.GetStack(0)))
+                {
+                    // TODO: Log cause we have hell to pay
+                    // Blow up
+                    assert(false);
+                }
+                mainFiberFuncArgs.push_back(std::move(upMainFiberFuncArg));
+
+                // Require that its run on the creation thread, it owns the window and its message pump
+                // The main fiber is never put on the free list, it is running from the start
                 m_fibers[jobSystemFiberArrayIndex].m_jobSystemId = jobSystemFiberIndex;
-                // NOTE: Can this start as false to ensure its avalible when we need it
-                m_freeFibers[jobSystemFiberArrayIndex].store(false);
-                m_waitingFibers[jobSystemFiberArrayIndex].store(false);
-                m_fiberIdMap.insert(std::make_pair(mainThreadFiber, jobSystemFiberIndex));
+                m_fibers[jobSystemFiberArrayIndex].m_threadAffinity = 1;
+                m_fibers[jobSystemFiberArrayIndex].m_priority = mainJob.m_priority;
+                m_fibers[jobSystemFiberArrayIndex].m_stackClass = StackClass::Large;
                 // Increment to the next fiber index
                 ++jobSystemFiberIndex;
                 jobSystemFiberArrayIndex = jobSystemFiberIndex - 1;
 
-                // Created all the fibers we need
-                for (uint32_t i = 1; i < m_numFibers; ++i)
+                // Created all the fibers we need, the small ones first and then the large ones
+                for (uint32_t i = 1; i < m_numFibers + m_numLargeFibers; ++i)
                 {
+                    const bool isLarge = i >= m_numFibers;
+                    const FiberStack stack = isLarge ? m_largeStackPool.GetStack(i - m_numFibers + 1) : m_smallStackPool.GetStack(i - 1);
+
                     std::unique_ptr<FiberFuncArg> upFiberFuncArg = std::make_unique<FiberFuncArg>();
                     upFiberFuncArg->pJobSystem = this;
-                    FiberPtr newOsFiber = CreateFiber(fiberStackSize, &JobSystem::FiberFunc, upFiberFuncArg.get());
+                    const bool created = m_fibers[jobSystemFiberArrayIndex].m_context.Create(&JobSystem::FiberFunc, upFiberFuncArg.get(), stack);
                     fiberFuncArgs.push_back(std::move(upFiberFuncArg));
-                    if (!newOsFiber)
+                    if (!created)
                     {
                         // Log, we have hell to pay
                         assert(false);
                         continue;
                     }
 
-                    m_fibers[jobSystemFiberArrayIndex].m_pFiber = newOsFiber;
                     m_fibers[jobSystemFiberArrayIndex].m_jobSystemId = jobSystemFiberIndex;
                     m_fibers[jobSystemFiberArrayIndex].m_pJob = nullptr;
+                    m_fibers[jobSystemFiberArrayIndex].m_stackClass = isLarge ? StackClass::Large : StackClass::Small;
                     // We want this to start in a free state
-                    m_freeFibers[jobSystemFiberArrayIndex].store(true);
-                    m_waitingFibers[jobSystemFiberArrayIndex].store(false);
-                    m_fiberIdMap.insert(std::make_pair(newOsFiber, jobSystemFiberIndex));
+                    PushFreeFiber(jobSystemFiberIndex);
 
                     ++jobSystemFiberIndex;
                     jobSystemFiberArrayIndex = jobSystemFiberIndex - 1;
@@ -142,15 +334,16 @@ namespace Farlor
             }
 
             // Creation of threads
+            std::vector<uint32_t> callerAffinity;
             {
                 uint32_t jobSystemThreadId = 1;
                 uint32_t jobSystemThreadArrayId = jobSystemThreadId - 1;
-                Thread mainThread;
-                mainThread.m_thread = GetCurrentThread();
-                mainThread.m_jobSystemId = jobSystemThreadId;
-                mainThread.m_osThreadId = GetCurrentThreadId();
-                m_threads[jobSystemThreadArrayId] = mainThread;
-                m_threadIdMap.insert(std::make_pair(mainThread.m_osThreadId, mainThread.m_jobSystemId));
+                m_threads[jobSystemThreadArrayId].m_jobSystemId = jobSystemThreadId;
+                m_threads[jobSystemThreadArrayId].m_osThreadId = std::this_thread::get_id();
+                WriteJobSystemThreadIndex(jobSystemThreadId);
+                // The calling thread gets its own affinity back once the job system shuts down
+                callerAffinity = CpuTopology::GetCurrentThreadAffinity();
+                PinCurrentThread(jobSystemThreadId);
 
                 ++jobSystemThreadId;
                 jobSystemThreadArrayId = jobSystemThreadId - 1;
@@ -159,58 +352,64 @@ namespace Farlor
                 {
                     std::unique_ptr<ThreadFuncArg> upThreadFuncArg = std::make_unique<ThreadFuncArg>();
                     upThreadFuncArg->pJobSystem = this;
+                    upThreadFuncArg->jobSystemThreadId = jobSystemThreadId;
 
-                    Thread workerThread;
-                    workerThread.m_thread = CreateThread(0, 0, FarlorJobs::JobSystem::ThreadFunc, upThreadFuncArg.get(), 0, nullptr);
-                    workerThread.m_osThreadId = GetThreadId(workerThread.m_thread);
+                    Thread& workerThread = m_threads[jobSystemThreadArrayId];
                     workerThread.m_jobSystemId = jobSystemThreadId;
+                    workerThread.m_thread = std::thread(&JobSystem::ThreadFunc, upThreadFuncArg.get());
+                    workerThread.m_osThreadId = workerThread.m_thread.get_id();
                     threadFuncArgs.push_back(std::move(upThreadFuncArg));
-                    m_threads[jobSystemThreadArrayId] = workerThread;
-                    m_threadIdMap.insert(std::make_pair(workerThread.m_osThreadId, workerThread.m_jobSystemId));
-
-                    if (workerThread.m_thread == 0)
-                    {
-                        std::cout << "Failed to create thread: " << i << std::endl;
-                    }
 
                     ++jobSystemThreadId;
                     jobSystemThreadArrayId = jobSystemThreadId - 1;
                 }
             }
 
-            // Main thread must convert to a thread
-            FiberPtr mainThreadFiber = ConvertThreadToFiber(0);
-            if (mainThreadFiber == 0)
+            if (m_executionMode == ExecutionMode::ThreadPool)
             {
-                std::cout << "Error, could not convert thread to fiber" << std::endl;
-                assert(false);
-            }
+                // The main job runs right here, and Wait inside it runs other jobs inline
+                Job mainThreadJob = mainJob;
+                m_threadLocalStorage[0].m_currentJobPriority = mainThreadJob.m_priority;
+                mainThreadJob.Run();
 
-            m_threadLocalStorage[0].m_threadFiber = mainThreadFiber;
+                m_quitting.store(true);
+                WakeIdleThreads(m_numHwThreads);
+            }
+            else
+            {
+                // Main thread must convert to a thread
+                if (!m_threadLocalStorage[0].m_threadFiber.ConvertFromThread())
+                {
+                    std::cout << "Error, could not convert thread to fiber" << std::endl;
+                    assert(false);
+                }
 
-            // Once we do this, we want to switch to the main thread
-            SwitchToFiber(m_fibers[0].m_pFiber);
+                // Once we do this, we want to switch to the main thread
+                SwitchToJobFiber(0, 1);
 
-            // Once we return from this, we want to switch back to a thread and finish out
-            if (!ConvertFiberToThread())
-            {
-                std::cout << "Error, could not convert main fiber back to thread" << std::endl;
-                assert(false);
+                // Once we return from this, we want to switch back to a thread and finish out
+                m_threadLocalStorage[0].m_threadFiber.ConvertToThread();
             }
 
             // Finally, wait for all the threads that arent the main thread
             const uint32_t childThreadStartIndex = 1;
             for (uint32_t i = childThreadStartIndex; i < m_numHwThreads; ++i)
             {
-                WaitForSingleObject(m_threads[i].m_thread, INFINITE);
+                m_threads[i].m_thread.join();
+            }
+
+            if (m_threads[0].m_cpuIndex > 0)
+            {
+                CpuTopology::SetCurrentThreadAffinity(callerAffinity);
             }
+            WriteJobSystemThreadIndex(0);
 
             // Finally, we can return as all threads are shutdown at this point
         }
 
         // This is the main fiber job
         // This is only for the fiber created from the thread that calls the bootstrap method on the job system
-        void CALLBACK JobSystem::MainFiberFunc(void* pArg)
+        void JobSystem::MainFiberFunc(void* pArg)
         {
             // NOTE: This fiber should start not being free
             MainFiberFuncArg* pFuncArg = static_cast<MainFiberFuncArg*>(pArg);
@@ -218,215 +417,1036 @@ namespace Farlor
 
             // Grab the main job and run
             Job& mainJob = pFuncArg->bootstrapJob;
-            mainJob.m_jobFunction(mainJob.m_jobArgument);
+            mainJob.Run();
 
             // We are done, quit the job system
             jobSystem.m_quitting.store(true);
+            jobSystem.WakeIdleThreads(jobSystem.m_numHwThreads);
 
-            // We need to switch back to the main function
-            const uint32_t mainThreadIndex = 0;
-            SwitchToFiber(jobSystem.m_threadLocalStorage[mainThreadIndex].m_threadFiber);
+            // We need to switch back to the thread we are on now.
+            // The main fiber is pinned, so even if the main job waited this is still the bootstrapping thread.
+            const uint32_t mainFiberIndex = 1;
+            jobSystem.SwitchToThreadFiber(mainFiberIndex);
         }
 
         // This is the loop that each fiber executes
-        void CALLBACK JobSystem::FiberFunc(void* pArg)
+        void JobSystem::FiberFunc(void* pArg)
         {
             const FiberFuncArg* pFuncArg = static_cast<FiberFuncArg*>(pArg);
             JobSystem& jobSystem = *pFuncArg->pJobSystem;
 
+            // How long this fiber has been looking for work without finding any
+            uint32_t numIdleSpins = 0;
+
             // Until we are quitting, run this loop
             while (jobSystem.m_quitting.load() == false)
             {
-                // We enter back here, so mark the previous fiber as waiting
-                auto currentFiberIndex = jobSystem.GetCurrentJobSystemFiberIndex();
-                uint32_t markWaitingIndex = jobSystem.m_fiberLocalStorage[currentFiberIndex - 1].m_markWaitingIndex;
-                if (markWaitingIndex > 0)
+                // We enter back here, so finish parking or freeing the fiber we came from
+                jobSystem.OnFiberSwitchedIn();
+                // Read every time around, the fiber may have been resumed on a different thread
+                const uint32_t currentThreadIndex = jobSystem.GetCurrentJobSystemThreadIndex();
+                auto currentFiberIndex = jobSystem.m_threadLocalStorage[currentThreadIndex - 1].m_currentFiberIndex;
+                FiberLocalStorage& fiberLocalStorage = jobSystem.m_fiberLocalStorage[currentFiberIndex - 1];
+                Fiber& fiber = jobSystem.m_fibers[currentFiberIndex - 1];
+
+                // Jobs are waiting for a large stack. Once a small fiber takes over the thread this one goes back on
+                // the free list, where it picks one of them up.
+                if (fiber.m_stackClass == StackClass::Large && !fiberLocalStorage.m_hasHandoffJob
+                    && jobSystem.m_numBlockedLargeJobs.load(std::memory_order_relaxed) > 0
+                    && jobSystem.TryHandBackToSmallFiber(currentFiberIndex))
                 {
-                    jobSystem.m_waitingFibers[markWaitingIndex - 1].store(true);
-                    jobSystem.m_fiberLocalStorage[currentFiberIndex - 1].m_markWaitingIndex = 0;
+                    continue;
                 }
 
-                // We want to see if we can switch to a waiting fiber
-                bool switchToWaitFiber = false;
-                FiberPtr waitFiberSwitch = nullptr;
+                // Fibers whose counter completed are handed to us by the job that completed it.
+                // A job handed over from a small fiber was already taken off the queues, so it has to run first.
+                uint32_t readyFiberIndex = 0;
+                if (!fiberLocalStorage.m_hasHandoffJob && jobSystem.TryGetReadyFiber(currentThreadIndex, readyFiberIndex))
+                {
+                    numIdleSpins = 0;
+                    FARLOR_JOBS_TRACE(jobSystem.m_trace, EndIdle(currentThreadIndex));
+                    jobSystem.m_fiberLocalStorage[readyFiberIndex - 1].m_markFreeIndex = currentFiberIndex;
+
+                    jobSystem.SwitchToJobFiber(currentFiberIndex, readyFiberIndex);
+                    // Coming back from this, we are now a free fiber again
+                    continue;
+                }
 
-                // We want to check if we should switch to a waiting thread
-                // Iterate over all waiting threads
-                for (uint32_t i = 0; i < jobSystem.m_numFibers; ++i)
+                // If we are not running a waiting thread, lets go ahead and grab a job off the stack.
+                // Pinned jobs only ever show up in the queues of the thread they are pinned to.
+                Job job;
+                bool hasJob = false;
+                if (fiberLocalStorage.m_hasHandoffJob)
                 {
-                    // We want to check that waiting thread is set to true
-                    bool expected = true;
+                    job = fiberLocalStorage.m_handoffJob;
+                    fiberLocalStorage.m_hasHandoffJob = false;
+                    hasJob = true;
+                }
+                else
+                {
+                    hasJob = jobSystem.TryGetJob(currentThreadIndex, job);
+                }
 
-                    // Get current thread id
-                    uint32_t currentJobSystemThreadId = jobSystem.GetCurrentJobSystemThreadIndex();
-                    if (jobSystem.m_waitingFibers[i].compare_exchange_weak(expected, false))
+                if (hasJob)
+                {
+                    if (job.m_stackClass == StackClass::Large && fiber.m_stackClass == StackClass::Small)
                     {
-                        uint32_t jobSystemFiberId = jobSystem.m_fiberIdMap[jobSystem.m_fibers[i].m_pFiber];
-
-                        if (jobSystem.m_fiberLocalStorage[jobSystemFiberId - 1].m_spWaitingCounter->m_atomicCounter.load() == jobSystem.m_fiberLocalStorage[jobSystemFiberId - 1].m_spWaitingCounter->m_desiredValue)
-                        {
-                            waitFiberSwitch = jobSystem.m_fibers[i].m_pFiber;
-                            switchToWaitFiber = true;
-                            break;
-                        }
-                        else
+                        if (!jobSystem.TryHandOffToLargeFiber(currentFiberIndex, job))
                         {
-                            jobSystem.m_waitingFibers[i].store(true);
-                            continue;
+                            // Every large fiber is busy. The first one to come free picks the job up.
+                            jobSystem.PushBlockedLargeJob(job);
                         }
+                        // Coming back from a hand off, we are now a free fiber again
+                        continue;
                     }
-                }
 
-                // If we found a fiber to switch to, we want to do that switch
-                if (switchToWaitFiber)
-                {
-                    uint32_t waitFiberId = jobSystem.m_fiberIdMap[waitFiberSwitch];
-                    auto currentFiberJobIndex = jobSystem.GetCurrentJobSystemFiberIndex();
-                    jobSystem.m_fiberLocalStorage[waitFiberId - 1].m_markFreeIndex = currentFiberJobIndex;
+                    // Carry the affinity on the fiber so a wait inside the job resumes on the same thread
+                    fiber.m_threadAffinity = job.m_threadAffinity;
+                    fiber.m_priority = job.m_priority;
 
-                    SwitchToFiber(waitFiberSwitch);
-                    // Coming back from this, we are now a free fiber again
-                    continue;
-                }
+                    FARLOR_JOBS_TRACE(jobSystem.m_trace, EndIdle(currentThreadIndex));
+                    FARLOR_JOBS_TRACE(jobSystem.m_trace, Record(currentThreadIndex, JobTrace::EventType::JobBegin, currentFiberIndex, reinterpret_cast<uint64_t>(job.m_jobFunction)));
 
+                    job.Run();
 
-                // If we are not running a waiting thread, lets go ahead and grab a job off the stack
-                // Currently, this does not support checking if a job can execute on the current thread
-                Job job;
-                if (jobSystem.m_jobQueue.TryPop(job))
-                {
-                    // We might need to have some logic here for thread afinity for jobs...?
-                    // TODO: If the job cannot be run on this thread, throw it back in the job queue
-                    // For now, we have nothing.
+                    // The job may have waited and been resumed on another thread
+                    FARLOR_JOBS_TRACE(jobSystem.m_trace, Record(jobSystem.GetCurrentJobSystemThreadIndex(), JobTrace::EventType::JobEnd, currentFiberIndex, 0));
+                    fiber.m_threadAffinity = 0;
+                    fiber.m_priority = Priority::Normal;
+                    jobSystem.ReleaseCounterReference(*job.m_pCounter);
+                    numIdleSpins = 0;
 
-                    uint32_t fiberId = jobSystem.GetCurrentJobSystemFiberIndex();
-                    job.m_jobFunction(job.m_jobArgument);
-                    job.m_spCounter->m_atomicCounter.fetch_add(1);
+                    if (fiber.m_stackClass == StackClass::Large && job.m_stackClass == StackClass::Large)
+                    {
+                        jobSystem.TryHandBackToSmallFiber(currentFiberIndex);
+                    }
+                }
+                else
+                {
+                    jobSystem.WaitForWork(currentThreadIndex, numIdleSpins);
                 }
             }
 
             // Now we are done with the game
             // Switch to the main thread fiber for shutdown of thread
-            uint32_t currentTheadIndex = jobSystem.GetCurrentJobSystemThreadIndex();
-            SwitchToFiber(jobSystem.m_threadLocalStorage[currentTheadIndex - 1].m_threadFiber);
+            jobSystem.SwitchToThreadFiber(jobSystem.GetCurrentJobSystemFiberIndex());
         }
 
         // This is the main function run by each thread
-        DWORD WINAPI JobSystem::ThreadFunc(void* pArg)
+        void JobSystem::ThreadFunc(ThreadFuncArg* pThreadMainArg)
         {
-            ThreadFuncArg* pThreadMainArg = static_cast<ThreadFuncArg*>(pArg);
             JobSystem& jobSystem = *pThreadMainArg->pJobSystem;
 
-            auto currentThreadId = GetCurrentThreadId();
-            auto currentJobSystemThreadId = jobSystem.m_threadIdMap[currentThreadId];
+            const uint32_t currentJobSystemThreadId = pThreadMainArg->jobSystemThreadId;
+            WriteJobSystemThreadIndex(currentJobSystemThreadId);
+            jobSystem.PinCurrentThread(currentJobSystemThreadId);
+
+            if (jobSystem.m_executionMode == ExecutionMode::ThreadPool)
+            {
+                jobSystem.RunWorkerLoop(currentJobSystemThreadId);
+                WriteJobSystemThreadIndex(0);
+                return;
+            }
 
             // Threads must be converted to fibers
-            FiberPtr fiberHandle = ConvertThreadToFiber(0);
-            if (fiberHandle == 0)
+            // We want to store the fiber in thread local storage
+            // It is important for the main fiber to be saved so the thread goes back to the same fiber it started as
+            FiberContext& threadFiber = jobSystem.m_threadLocalStorage[currentJobSystemThreadId - 1].m_threadFiber;
+            if (!threadFiber.ConvertFromThread())
             {
                 std::cout << "Error, could not convert thread to fiber" << std::endl;
                 assert(false);
             }
 
-            // We want to store the fiber in thread local storage
-            // It is important for the main fiber to be saved so the thread goes back to the same fiber it started as
-            jobSystem.m_threadLocalStorage[currentJobSystemThreadId - 1].m_threadFiber = fiberHandle;
+            // Now, we need to get a new free fiber to jump to next. It will simply start running jobs and will return to this point when finished
+            uint32_t fiberToStartOn = 0;
+            if (jobSystem.TryPopFreeFiber(fiberToStartOn))
+            {
+                jobSystem.SwitchToJobFiber(0, fiberToStartOn);
+            }
+            else
+            {
+                std::cout << "No free fiber for thread: " << currentJobSystemThreadId << std::endl;
+            }
 
+            threadFiber.ConvertToThread();
+            WriteJobSystemThreadIndex(0);
+        }
 
-            // Now, we need to get a new free fiber to jump to next. It will simply start running jobs and will return to this point when finished
-            FiberPtr fiberToStartOn = 0;
-            for (uint32_t i = 0; i < jobSystem.m_numFibers; ++i)
+        void JobSystem::RunWorkerLoop(uint32_t threadIndex)
+        {
+            uint32_t numIdleSpins = 0;
+            while (m_quitting.load() == false)
             {
-                bool expected = true;
-                if (jobSystem.m_freeFibers[i].compare_exchange_weak(expected, false))
+                Job job;
+                if (TryGetJob(threadIndex, job))
                 {
-                    fiberToStartOn = jobSystem.m_fibers[i].m_pFiber;
-                    break;
+                    RunJobInline(threadIndex, job);
+                    numIdleSpins = 0;
+                }
+                else
+                {
+                    WaitForWork(threadIndex, numIdleSpins);
                 }
             }
-            
-            SwitchToFiber(fiberToStartOn);
+        }
 
+        void JobSystem::RunJobsUntilComplete(Counter& counter)
+        {
+            FARLOR_JOBS_TRACE(m_trace, Record(GetCurrentJobSystemThreadIndex(), JobTrace::EventType::WaitBegin, 0, counter.m_index));
 
-            if (!ConvertFiberToThread())
+            // Nothing wakes a thread for a counter completing, so run whatever is queued and spin in between.
+            // Threads the job system does not own have no queues to take from and only spin.
+            uint32_t numIdleSpins = 0;
+            while (counter.m_pendingCount.load(std::memory_order_acquire) != 1)
             {
-                std::cout << "Failed to convert fiber back to thread" << std::endl;
+                // On a fiber, a job run here may have waited and been resumed on another thread
+                const uint32_t threadIndex = GetCurrentJobSystemThreadIndex();
+                Job job;
+                if (threadIndex > 0 && TryGetJob(threadIndex, job))
+                {
+                    if (CanRunJobInline(job))
+                    {
+                        RunJobInline(threadIndex, job);
+                        numIdleSpins = 0;
+                        continue;
+                    }
+                    PushBlockedLargeJob(job);
+                }
+
+                if (numIdleSpins < m_numIdleSpins)
+                {
+                    ++numIdleSpins;
+                    CpuPause();
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
             }
 
-            return 0;
+            FARLOR_JOBS_TRACE(m_trace, Record(GetCurrentJobSystemThreadIndex(), JobTrace::EventType::WaitEnd, 0, 0));
         }
 
-        std::shared_ptr<JobSystem::Counter> JobSystem::SubmitJobs(Job* pJobs, uint32_t numJobs)
+        bool JobSystem::CanRunJobInline(const Job& job)
         {
-            // Get a new counter
-            std::shared_ptr<Counter> spCounter = std::make_shared<Counter>();
-            spCounter->m_atomicCounter.store(0);
-            spCounter->m_desiredValue = numJobs;
+            if (m_executionMode == ExecutionMode::ThreadPool || job.m_stackClass == StackClass::Small)
+            {
+                return true;
+            }
+            return m_fibers[GetCurrentJobSystemFiberIndex() - 1].m_stackClass == StackClass::Large;
+        }
 
-            for (uint32_t i = 0; i < numJobs; ++i)
+        void JobSystem::RunJobInline(uint32_t threadIndex, Job& job)
+        {
+            FARLOR_JOBS_TRACE(m_trace, EndIdle(threadIndex));
+            FARLOR_JOBS_TRACE(m_trace, Record(threadIndex, JobTrace::EventType::JobBegin, 0, reinterpret_cast<uint64_t>(job.m_jobFunction)));
+
+            // On a fiber, a job that waits inside has to be resumed here when either it or the job it is nested in is
+            // pinned. Both can only be pinned to this thread.
+            Fiber* pFiber = (m_executionMode == ExecutionMode::Fibers) ? &m_fibers[GetCurrentJobSystemFiberIndex() - 1] : nullptr;
+            Priority& currentJobPriority = pFiber ? pFiber->m_priority : m_threadLocalStorage[threadIndex - 1].m_currentJobPriority;
+            const uint32_t fiberAffinity = pFiber ? pFiber->m_threadAffinity : 0;
+            const Priority outerJobPriority = currentJobPriority;
+            if (pFiber && job.m_threadAffinity > 0)
             {
-                // We copy the job into the queue
-                Job job = pJobs[i];
-                job.m_spCounter = spCounter;
-                m_jobQueue.Push(job);
+                pFiber->m_threadAffinity = job.m_threadAffinity;
+            }
+            currentJobPriority = job.m_priority;
+
+            job.Run();
+
+            currentJobPriority = outerJobPriority;
+            if (pFiber)
+            {
+                pFiber->m_threadAffinity = fiberAffinity;
             }
 
-            return spCounter;
+            FARLOR_JOBS_TRACE(m_trace, Record(GetCurrentJobSystemThreadIndex(), JobTrace::EventType::JobEnd, 0, 0));
+            ReleaseCounterReference(*job.m_pCounter);
         }
 
-        // Calling thus function waits on a counter until it is equal to a correct value.
-        // This is used to yield a thread from a job and instaead switch to a free fiber.
-        void JobSystem::Wait(std::shared_ptr<Counter> spCounter)
+        bool JobSystem::TryGetJob(uint32_t threadIndex, Job& job)
         {
-            // Wait for counter to be correct value
-            // If we are done, simply return
-            if (spCounter->m_atomicCounter.load() == spCounter->m_desiredValue)
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadIndex - 1];
+
+            // High priority always goes first. Background work waits behind normal work, until this thread has
+            // taken enough normal jobs in a row that the oldest background job gets a turn.
+            Priority priorityOrder[NumPriorities] = { Priority::High, Priority::Normal, Priority::Background };
+            const bool backgroundJobFirst = threadLocalStorage.m_normalJobsSinceBackgroundJob >= m_normalJobsPerBackgroundJob;
+            if (backgroundJobFirst)
             {
-                return;
+                std::swap(priorityOrder[1], priorityOrder[2]);
             }
 
-            // We need to wait, so find a free fiber and switch to it
-            FiberPtr currentFiber = GetCurrentFiber();
-            uint32_t jobSystemFiberId = m_fiberIdMap[currentFiber];
+            for (Priority priority : priorityOrder)
+            {
+                if (TryGetJob(threadIndex, priority, job))
+                {
+                    // If background work got its turn, or had nothing queued when offered one, start counting again
+                    if (backgroundJobFirst || priority == Priority::Background)
+                    {
+                        threadLocalStorage.m_normalJobsSinceBackgroundJob = 0;
+                    }
+                    else if (priority == Priority::Normal)
+                    {
+                        ++threadLocalStorage.m_normalJobsSinceBackgroundJob;
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
 
-            // Get and switch to local fiber
-            FiberPtr freeFiber = nullptr;
-            uint32_t freeFiberIndex = 0;
-            for (uint32_t i = 0; i < m_numFibers; ++i)
+        bool JobSystem::TryGetJob(uint32_t threadIndex, Priority priority, Job& job)
+        {
+            const uint32_t priorityIndex = static_cast<uint32_t>(priority);
+
+            // Jobs pinned to this thread, nobody else can run them
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadIndex - 1];
+            if (threadLocalStorage.m_numPinnedJobs.load(std::memory_order_relaxed) > 0 && threadLocalStorage.m_pinnedJobs[priorityIndex].TryPop(job))
+            {
+                threadLocalStorage.m_numPinnedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            // Our own work next, newest first while it is still hot in cache
+            if (m_queueMode == QueueMode::WorkStealing && GetWorkerQueue(threadIndex, priority).TryPop(job))
+            {
+                return true;
+            }
+
+            // Then the shared queue, which with work stealing only has jobs submitted from outside the job system
+            if (m_numQueuedJobs[priorityIndex].load(std::memory_order_relaxed) > 0 && m_jobQueues[priorityIndex].TryPop(job))
+            {
+                m_numQueuedJobs[priorityIndex].fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            if (m_queueMode == QueueMode::SharedQueue)
             {
-                bool expected = true;
-                if (m_freeFibers[i].compare_exchange_weak(expected, false))
+                return false;
+            }
+            return TryStealJob(threadIndex, priority, job);
+        }
+
+        bool JobSystem::TryStealJob(uint32_t thiefThreadIndex, Priority priority, Job& job)
+        {
+            if (m_numHwThreads < 2)
+            {
+                return false;
+            }
+
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[thiefThreadIndex - 1];
+            uint32_t& randomState = threadLocalStorage.m_randomState;
+
+            // Victims sharing a cache with us first, their jobs' data is likely still warm in it.
+            // Starting at random within a tier keeps the thieves from all piling onto the same victim.
+            uint32_t tierBegin = 0;
+            for (uint32_t tierEnd : threadLocalStorage.m_stealTierEnds)
+            {
+                randomState ^= randomState << 13;
+                randomState ^= randomState >> 17;
+                randomState ^= randomState << 5;
+
+                const uint32_t tierSize = tierEnd - tierBegin;
+                const uint32_t firstVictim = randomState % tierSize;
+                for (uint32_t i = 0; i < tierSize; ++i)
                 {
-                    freeFiber = m_fibers[i].m_pFiber;
-                    freeFiberIndex = i + 1;
-                    break;
+                    const uint32_t victimThreadIndex = threadLocalStorage.m_stealVictims[tierBegin + (firstVictim + i) % tierSize];
+                    if (GetWorkerQueue(victimThreadIndex, priority).TrySteal(job))
+                    {
+                        FARLOR_JOBS_TRACE(m_trace, Record(thiefThreadIndex, JobTrace::EventType::Steal, threadLocalStorage.m_currentFiberIndex, victimThreadIndex));
+                        return true;
+                    }
                 }
+                tierBegin = tierEnd;
             }
+            return false;
+        }
 
-            if (freeFiber == nullptr)
+        bool JobSystem::TryGetReadyFiber(uint32_t threadIndex, uint32_t& fiberIndex)
+        {
+            // Only a plain load while there are none, so idle workers leave the queues' cache lines alone
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadIndex - 1];
+            if (threadLocalStorage.m_numPinnedReadyFibers.load(std::memory_order_relaxed) > 0 && threadLocalStorage.m_pinnedReadyFibers.TryPop(fiberIndex))
             {
-                std::cout << "We are out of freaking fibers" << std::endl;
-                assert(false);
+                threadLocalStorage.m_numPinnedReadyFibers.fetch_sub(1, std::memory_order_relaxed);
+                return true;
             }
 
-            m_fiberLocalStorage[freeFiberIndex - 1].m_markWaitingIndex = jobSystemFiberId;
-            m_fiberLocalStorage[jobSystemFiberId - 1].m_spWaitingCounter = spCounter;
+            if (m_numReadyFibers.load(std::memory_order_relaxed) > 0 && m_readyFibers.TryPop(fiberIndex))
+            {
+                m_numReadyFibers.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
 
-            // TODO: This might just be a race condition... we might want to do something to mitigate this... I am unsure.
-            // Could we defer this...? Maybe on a unique fiber that is in charge of performing these kinds of updates. Or thread?
-            // This must be marked or it will never be restarted.
-            SwitchToFiber(freeFiber);
+        void JobSystem::WaitForWork(uint32_t threadIndex, uint32_t& numIdleSpins)
+        {
+            FARLOR_JOBS_TRACE(m_trace, BeginIdle(threadIndex));
 
-            // We want to mark the fiber we came from as a free thread again
-            auto currentFiberIndex = GetCurrentJobSystemFiberIndex();
-            uint32_t markFreeIndex = m_fiberLocalStorage[currentFiberIndex - 1].m_markFreeIndex;
-            if (markFreeIndex > 0)
+            // Spin a little first, new work often shows up within microseconds and waking up costs a syscall
+            if (numIdleSpins < m_numIdleSpins)
+            {
+                ++numIdleSpins;
+                CpuPause();
+                return;
+            }
+            numIdleSpins = 0;
+
+            // Say we are going to sleep before the last look for work. Submitters publish their work before
+            // looking for sleepers, so with the fences on both sides at least one of us sees the other.
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadIndex - 1];
+            threadLocalStorage.m_parked.store(1);
+            m_numParkedThreads.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (HasWork(threadIndex) || m_quitting.load())
             {
-                m_freeFibers[markFreeIndex - 1].store(true);
-                m_fiberLocalStorage[currentFiberIndex - 1].m_markFreeIndex = 0;
+                // Unless a submitter got to us first, in which case it already did the bookkeeping
+                uint32_t parked = 1;
+                if (threadLocalStorage.m_parked.compare_exchange_strong(parked, 0))
+                {
+                    m_numParkedThreads.fetch_sub(1);
+                }
+                return;
             }
 
-            m_fiberLocalStorage[currentFiberIndex - 1].m_spWaitingCounter = nullptr;
+            m_numParks.fetch_add(1, std::memory_order_relaxed);
+            FARLOR_JOBS_TRACE(m_trace, Record(threadIndex, JobTrace::EventType::Park, threadLocalStorage.m_currentFiberIndex, 0));
+            while (threadLocalStorage.m_parked.load(std::memory_order_acquire) == 1)
+            {
+                FutexWait(threadLocalStorage.m_parked, 1);
+            }
+            FARLOR_JOBS_TRACE(m_trace, Record(threadIndex, JobTrace::EventType::Unpark, threadLocalStorage.m_currentFiberIndex, 0));
+        }
+
+        bool JobSystem::HasWork(uint32_t threadIndex)
+        {
+            const ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadIndex - 1];
+            if (threadLocalStorage.m_numPinnedReadyFibers.load(std::memory_order_relaxed) > 0
+                || threadLocalStorage.m_numPinnedJobs.load(std::memory_order_relaxed) > 0
+                || m_numReadyFibers.load(std::memory_order_relaxed) > 0)
+            {
+                return true;
+            }
+
+            for (const std::atomic<uint32_t>& numQueuedJobs : m_numQueuedJobs)
+            {
+                if (numQueuedJobs.load(std::memory_order_relaxed) > 0)
+                {
+                    return true;
+                }
+            }
+
+            for (const std::unique_ptr<WorkStealingDeque<Job>>& upWorkerQueue : m_workerQueues)
+            {
+                if (!upWorkerQueue->Empty())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void JobSystem::WakeIdleThreads(uint32_t numThreads)
+        {
+            // Pairs with the fence in WaitForWork. Nearly always nobody is asleep and this is all it costs.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (numThreads == 0 || m_numParkedThreads.load(std::memory_order_relaxed) == 0)
+            {
+                return;
+            }
+
+            for (uint32_t threadIndex = 1; threadIndex <= m_numHwThreads && numThreads > 0; ++threadIndex)
+            {
+                if (TryWakeThread(threadIndex))
+                {
+                    --numThreads;
+                }
+            }
+        }
+
+        void JobSystem::WakeThread(uint32_t threadIndex)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_numParkedThreads.load(std::memory_order_relaxed) == 0)
+            {
+                return;
+            }
+            TryWakeThread(threadIndex);
+        }
+
+        bool JobSystem::TryWakeThread(uint32_t threadIndex)
+        {
+            ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadIndex - 1];
+            uint32_t parked = 1;
+            if (threadLocalStorage.m_parked.load(std::memory_order_relaxed) == 0
+                || !threadLocalStorage.m_parked.compare_exchange_strong(parked, 0))
+            {
+                return false;
+            }
+
+            m_numParkedThreads.fetch_sub(1);
+            m_numWakes.fetch_add(1, std::memory_order_relaxed);
+            FutexWakeOne(threadLocalStorage.m_parked);
+            return true;
+        }
+
+        void* JobSystem::AllocateClosure(size_t size)
+        {
+            const uint32_t currentThreadIndex = GetCurrentJobSystemThreadIndex();
+            if (currentThreadIndex == 0)
+            {
+                return ClosureArena::AllocateFallback(size);
+            }
+            return m_threadLocalStorage[currentThreadIndex - 1].m_closureArena.Allocate(size);
+        }
+
+        WorkStealingDeque<JobSystem::Job>& JobSystem::GetWorkerQueue(uint32_t threadIndex, Priority priority)
+        {
+            return *m_workerQueues[(threadIndex - 1) * NumPriorities + static_cast<uint32_t>(priority)];
+        }
+
+        uint64_t JobSystem::GetQueueDepth(uint32_t threadIndex)
+        {
+            uint64_t queueDepth = 0;
+            for (uint32_t priority = 0; priority < NumPriorities; ++priority)
+            {
+                if (m_queueMode == QueueMode::WorkStealing && threadIndex > 0)
+                {
+                    queueDepth += GetWorkerQueue(threadIndex, static_cast<Priority>(priority)).Size();
+                }
+                else
+                {
+                    queueDepth += m_numQueuedJobs[priority].load(std::memory_order_relaxed);
+                }
+            }
+            return queueDepth;
+        }
+
+        JobSystem::CounterHandle JobSystem::SubmitJobs(Job* pJobs, uint32_t numJobs)
+        {
+            // Get a new counter
+            Counter* pCounter = AllocateCounter(numJobs);
+            EnqueueJobs(pJobs, numJobs, pCounter);
+
+            CounterHandle counterHandle;
+            counterHandle.m_index = pCounter->m_index;
+            counterHandle.m_generation = pCounter->m_generation.load(std::memory_order_relaxed);
+            return counterHandle;
+        }
+
+        JobSystem::CounterHandle JobSystem::ReserveCounter(uint32_t numJobs)
+        {
+            Counter* pCounter = AllocateCounter(numJobs);
+
+            CounterHandle counterHandle;
+            counterHandle.m_index = pCounter->m_index;
+            counterHandle.m_generation = pCounter->m_generation.load(std::memory_order_relaxed);
+            return counterHandle;
+        }
+
+        void JobSystem::SubmitReservedJobs(Job* pJobs, uint32_t numJobs, CounterHandle counterHandle)
+        {
+            // The reserved jobs that have not run yet keep the counter alive, even if the handle was already released
+            Counter* pCounter = GetCounter(counterHandle);
+            if (!pCounter)
+            {
+                return;
+            }
+
+            if (pCounter->m_pendingCount.load(std::memory_order_relaxed) < numJobs + 1)
+            {
+                std::cout << "More jobs submitted than the job counter was reserved for" << std::endl;
+                assert(false);
+            }
+            EnqueueJobs(pJobs, numJobs, pCounter);
+        }
+
+        void JobSystem::EnqueueJobs(Job* pJobs, uint32_t numJobs, Counter* pCounter)
+        {
+            // Jobs submitted from one of our threads go on that thread's deque, everything else goes to the shared queue
+            const uint32_t currentThreadIndex = GetCurrentJobSystemThreadIndex();
+            const bool pushToWorkerQueue = (m_queueMode == QueueMode::WorkStealing) && (currentThreadIndex > 0);
+            uint32_t numUnpinnedJobs = 0;
+
+            for (uint32_t i = 0; i < numJobs; ++i)
+            {
+                // We copy the job into the queue
+                Job job = pJobs[i];
+                job.m_pCounter = pCounter;
+                const uint32_t priorityIndex = static_cast<uint32_t>(job.m_priority);
+                assert(priorityIndex < NumPriorities);
+
+                if (job.m_threadAffinity > m_numHwThreads)
+                {
+                    std::cout << "Job pinned to thread " << job.m_threadAffinity << " but there are only " << m_numHwThreads << std::endl;
+                    assert(false);
+                    job.m_threadAffinity = 0;
+                }
+
+                if (job.m_threadAffinity > 0)
+                {
+                    ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[job.m_threadAffinity - 1];
+                    threadLocalStorage.m_pinnedJobs[priorityIndex].Push(job);
+                    threadLocalStorage.m_numPinnedJobs.fetch_add(1, std::memory_order_relaxed);
+                    WakeThread(job.m_threadAffinity);
+                    continue;
+                }
+
+                if (pushToWorkerQueue)
+                {
+                    GetWorkerQueue(currentThreadIndex, job.m_priority).Push(job);
+                }
+                else
+                {
+                    m_jobQueues[priorityIndex].Push(job);
+                    m_numQueuedJobs[priorityIndex].fetch_add(1, std::memory_order_relaxed);
+                }
+                ++numUnpinnedJobs;
+            }
+
+            // One sleeping thread per new job, any more would only wake up to find nothing left
+            WakeIdleThreads(numUnpinnedJobs);
+            FARLOR_JOBS_TRACE(m_trace, Record(currentThreadIndex, JobTrace::EventType::QueueDepth, 0, GetQueueDepth(currentThreadIndex)));
+        }
+
+        // Calling thus function waits on a counter until it is equal to a correct value.
+        // This is used to yield a thread from a job and instaead switch to a free fiber.
+        void JobSystem::Wait(CounterHandle counterHandle)
+        {
+            Counter* pCounter = GetCounter(counterHandle);
+            if (!pCounter)
+            {
+                return;
+            }
+
+            // Wait for counter to be correct value
+            // If we are done, simply return
+            if (pCounter->m_pendingCount.load(std::memory_order_acquire) == 1)
+            {
+                ReleaseCounterReference(*pCounter);
+                return;
+            }
+
+            if (m_executionMode == ExecutionMode::ThreadPool)
+            {
+                RunJobsUntilComplete(*pCounter);
+                ReleaseCounterReference(*pCounter);
+                return;
+            }
+
+            // We need to wait, so find a free fiber and switch to it
+            uint32_t jobSystemFiberId = GetCurrentJobSystemFiberIndex();
+
+            // Get and switch to local fiber
+            uint32_t freeFiberIndex = 0;
+            if (!TryPopFreeFiber(freeFiberIndex))
+            {
+                // Every fiber is taken. Run jobs on this fiber's stack until the counter completes, like the thread
+                // pool does, rather than letting the caller go on before its jobs are done.
+                RunJobsUntilComplete(*pCounter);
+                ReleaseCounterReference(*pCounter);
+                return;
+            }
+
+            // We cannot put ourselves on the counter's wait list yet, whoever completes it could resume us on another
+            // thread before we are off this stack. The free fiber does it for us once we have switched away.
+            m_fiberLocalStorage[freeFiberIndex - 1].m_markWaitingIndex = jobSystemFiberId;
+            m_fiberLocalStorage[jobSystemFiberId - 1].m_pWaitingCounter = pCounter;
+
+            FARLOR_JOBS_TRACE(m_trace, Record(GetCurrentJobSystemThreadIndex(), JobTrace::EventType::WaitBegin, jobSystemFiberId, pCounter->m_index));
+            SwitchToJobFiber(jobSystemFiberId, freeFiberIndex);
+
+            // We want to mark the fiber we came from as a free thread again
+            OnFiberSwitchedIn();
+            FARLOR_JOBS_TRACE(m_trace, RecordWaitEnd(GetCurrentJobSystemThreadIndex(), jobSystemFiberId));
+
+            auto currentFiberIndex = GetCurrentJobSystemFiberIndex();
+            m_fiberLocalStorage[currentFiberIndex - 1].m_pWaitingCounter = nullptr;
+
+            // Give back the handle's reference, this returns the counter to the pool
+            ReleaseCounterReference(*pCounter);
+        }
+
+        void JobSystem::ReleaseCounter(CounterHandle counterHandle)
+        {
+            Counter* pCounter = GetCounter(counterHandle);
+            if (pCounter)
+            {
+                ReleaseCounterReference(*pCounter);
+            }
+        }
+
+        bool JobSystem::IsCounterHandleValid(CounterHandle counterHandle) const
+        {
+            if (!counterHandle.IsValid() || counterHandle.m_index > m_counters.size())
+            {
+                return false;
+            }
+            return m_counters[counterHandle.m_index - 1].m_generation.load(std::memory_order_relaxed) == counterHandle.m_generation;
+        }
+
+        bool JobSystem::IsCounterComplete(CounterHandle counterHandle) const
+        {
+            if (!IsCounterHandleValid(counterHandle))
+            {
+                std::cout << "Stale or invalid job counter handle" << std::endl;
+                assert(false);
+                return true;
+            }
+            // Only the handle's own reference is left
+            return m_counters[counterHandle.m_index - 1].m_pendingCount.load(std::memory_order_acquire) == 1;
+        }
+
+        bool JobSystem::TrySuspendOnWaitList(FiberWaitList& waitList)
+        {
+            const uint32_t threadIndex = GetCurrentJobSystemThreadIndex();
+            if (threadIndex == 0 || m_executionMode == ExecutionMode::ThreadPool)
+            {
+                return false;
+            }
+
+            // A fiber that is ready to go on is the best thing to switch to, it may well be the one holding what we
+            // wait for and it costs no free fiber. Otherwise leave every thread a small fiber for Wait, a crowd of jobs
+            // queued on one mutex would use up the pool. Past that point the primitives back off on the thread.
+            uint32_t nextFiberIndex = 0;
+            if (!TryGetReadyFiber(threadIndex, nextFiberIndex))
+            {
+                if (m_freeFibers.Size() <= m_numHwThreads || !TryPopFreeFiber(StackClass::Small, nextFiberIndex))
+                {
+                    return false;
+                }
+            }
+
+            const uint32_t jobSystemFiberId = GetCurrentJobSystemFiberIndex();
+
+            // Nobody can take us off the list and resume us before the next fiber unlocks it, by which point we are
+            // off this stack
+            Fiber& fiber = m_fibers[jobSystemFiberId - 1];
+            fiber.m_nextWaitingFiber = 0;
+            if (waitList.m_lastFiber > 0)
+            {
+                m_fibers[waitList.m_lastFiber - 1].m_nextWaitingFiber = jobSystemFiberId;
+            }
+            else
+            {
+                waitList.m_firstFiber = jobSystemFiberId;
+            }
+            waitList.m_lastFiber = jobSystemFiberId;
+            // Ready fibers were suspended in here or in Wait, both go through OnFiberSwitchedIn first thing
+            m_fiberLocalStorage[nextFiberIndex - 1].m_pUnlockWaitList = &waitList;
+
+            FARLOR_JOBS_TRACE(m_trace, Record(threadIndex, JobTrace::EventType::WaitBegin, jobSystemFiberId, 0));
+            SwitchToJobFiber(jobSystemFiberId, nextFiberIndex);
+
+            OnFiberSwitchedIn();
+            FARLOR_JOBS_TRACE(m_trace, RecordWaitEnd(GetCurrentJobSystemThreadIndex(), jobSystemFiberId));
+            return true;
+        }
+
+        uint32_t JobSystem::PopWaitingFiber(FiberWaitList& waitList)
+        {
+            const uint32_t fiberIndex = waitList.m_firstFiber;
+            if (fiberIndex == 0)
+            {
+                return 0;
+            }
+
+            Fiber& fiber = m_fibers[fiberIndex - 1];
+            waitList.m_firstFiber = fiber.m_nextWaitingFiber;
+            if (waitList.m_firstFiber == 0)
+            {
+                waitList.m_lastFiber = 0;
+            }
+            fiber.m_nextWaitingFiber = 0;
+            return fiberIndex;
+        }
+
+        void JobSystem::ResumeFiber(uint32_t fiberIndex)
+        {
+            PushReadyFiber(fiberIndex);
+        }
+
+        void JobSystem::OnFiberSwitchedIn()
+        {
+            FiberLocalStorage& fiberLocalStorage = m_fiberLocalStorage[GetCurrentJobSystemFiberIndex() - 1];
+
+            // The fiber we came from is suspended on a primitive's wait list and can be woken from now on
+            FiberWaitList* pUnlockWaitList = fiberLocalStorage.m_pUnlockWaitList;
+            if (pUnlockWaitList)
+            {
+                fiberLocalStorage.m_pUnlockWaitList = nullptr;
+                pUnlockWaitList->Unlock();
+            }
+
+            // The fiber we resumed from has nothing left to do
+            uint32_t markFreeIndex = fiberLocalStorage.m_markFreeIndex;
+            if (markFreeIndex > 0)
+            {
+                fiberLocalStorage.m_markFreeIndex = 0;
+                PushFreeFiber(markFreeIndex);
+            }
+
+            // The fiber we came from is blocked in Wait, park it on its counter
+            const uint32_t markWaitingIndex = fiberLocalStorage.m_markWaitingIndex;
+            if (markWaitingIndex > 0)
+            {
+                fiberLocalStorage.m_markWaitingIndex = 0;
+
+                Counter& counter = *m_fiberLocalStorage[markWaitingIndex - 1].m_pWaitingCounter;
+                counter.LockWaitList();
+                // The counter may have completed while the fiber was switching away, nobody will wake it then
+                const bool completed = counter.m_pendingCount.load(std::memory_order_acquire) == 1;
+                if (!completed)
+                {
+                    m_fibers[markWaitingIndex - 1].m_nextWaitingFiber = counter.m_firstWaitingFiber;
+                    counter.m_firstWaitingFiber = markWaitingIndex;
+                }
+                counter.UnlockWaitList();
+
+                if (completed)
+                {
+                    PushReadyFiber(markWaitingIndex);
+                }
+            }
+        }
+
+        JobSystem::Counter* JobSystem::AllocateCounter(uint32_t numJobs)
+        {
+            uint64_t head = m_freeCounterHead.load(std::memory_order_acquire);
+            while (true)
+            {
+                const uint32_t counterIndex = static_cast<uint32_t>(head);
+                if (counterIndex == 0)
+                {
+                    // Every counter is in flight. Jobs finishing will return some, so wait for that.
+                    std::cout << "We are out of job counters" << std::endl;
+                    assert(false);
+                    std::this_thread::yield();
+                    head = m_freeCounterHead.load(std::memory_order_acquire);
+                    continue;
+                }
+
+                Counter& counter = m_counters[counterIndex - 1];
+                const uint32_t nextCounterIndex = counter.m_nextFreeCounter.load(std::memory_order_relaxed);
+                const uint64_t newHead = ((head >> 32) + 1) << 32 | nextCounterIndex;
+                if (m_freeCounterHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+                {
+                    counter.m_pendingCount.store(numJobs + 1, std::memory_order_relaxed);
+                    return &counter;
+                }
+            }
+        }
+
+        JobSystem::Counter* JobSystem::GetCounter(CounterHandle counterHandle)
+        {
+            if (!IsCounterHandleValid(counterHandle))
+            {
+                // Either never submitted, or already waited on or released
+                std::cout << "Stale or invalid job counter handle" << std::endl;
+                assert(false);
+                return nullptr;
+            }
+            return &m_counters[counterHandle.m_index - 1];
+        }
+
+        void JobSystem::FreeCounter(Counter& counter)
+        {
+            // Outstanding handles to this counter are stale from here on
+            counter.m_generation.fetch_add(1, std::memory_order_relaxed);
+
+            uint64_t head = m_freeCounterHead.load(std::memory_order_relaxed);
+            while (true)
+            {
+                counter.m_nextFreeCounter.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+                const uint64_t newHead = ((head >> 32) + 1) << 32 | counter.m_index;
+                if (m_freeCounterHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed))
+                {
+                    return;
+                }
+            }
+        }
+
+        void JobSystem::ReleaseCounterReference(Counter& counter)
+        {
+            uint32_t pendingCount = counter.m_pendingCount.load(std::memory_order_relaxed);
+            while (true)
+            {
+                if (pendingCount == 2)
+                {
+                    // This completes the counter. Do it under the wait list lock so a fiber that is being parked
+                    // either sees the counter complete or is on the list we take here, and so the handle owner
+                    // cannot free the counter while we still touch the list.
+                    counter.LockWaitList();
+                    if (!counter.m_pendingCount.compare_exchange_strong(pendingCount, 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                    {
+                        counter.UnlockWaitList();
+                        continue;
+                    }
+                    uint32_t waitingFiberIndex = counter.m_firstWaitingFiber;
+                    counter.m_firstWaitingFiber = 0;
+                    counter.UnlockWaitList();
+
+                    // We finished the counter, move everything waiting on it straight to the ready queue
+                    while (waitingFiberIndex > 0)
+                    {
+                        const uint32_t nextWaitingFiberIndex = m_fibers[waitingFiberIndex - 1].m_nextWaitingFiber;
+                        m_fibers[waitingFiberIndex - 1].m_nextWaitingFiber = 0;
+                        PushReadyFiber(waitingFiberIndex);
+                        waitingFiberIndex = nextWaitingFiberIndex;
+                    }
+                    return;
+                }
+
+                if (counter.m_pendingCount.compare_exchange_weak(pendingCount, pendingCount - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    if (pendingCount == 1)
+                    {
+                        // Last reference gone
+                        FreeCounter(counter);
+                    }
+                    return;
+                }
+            }
+        }
+
+        void JobSystem::PushReadyFiber(uint32_t fiberIndex)
+        {
+            FARLOR_JOBS_TRACE(m_trace, MarkFiberReady(fiberIndex));
+
+            const uint32_t threadAffinity = m_fibers[fiberIndex - 1].m_threadAffinity;
+            if (threadAffinity > 0)
+            {
+                ThreadLocalStorage& threadLocalStorage = m_threadLocalStorage[threadAffinity - 1];
+                threadLocalStorage.m_pinnedReadyFibers.Push(fiberIndex);
+                threadLocalStorage.m_numPinnedReadyFibers.fetch_add(1, std::memory_order_relaxed);
+                WakeThread(threadAffinity);
+                return;
+            }
+
+            m_readyFibers.Push(fiberIndex);
+            m_numReadyFibers.fetch_add(1, std::memory_order_relaxed);
+            WakeIdleThreads(1);
+        }
+
+        bool JobSystem::TryPopFreeFiber(uint32_t& fiberIndex)
+        {
+            // Large stacks are kept for the jobs that need them, anything else only takes one when it has to
+            return TryPopFreeFiber(StackClass::Small, fiberIndex) || TryPopFreeFiber(StackClass::Large, fiberIndex);
+        }
+
+        bool JobSystem::TryPopFreeFiber(StackClass stackClass, uint32_t& fiberIndex)
+        {
+            MPMCQueue<uint32_t>& freeFibers = (stackClass == StackClass::Large) ? m_freeLargeFibers : m_freeFibers;
+            return freeFibers.TryPop(fiberIndex);
+        }
+
+        void JobSystem::PushFreeFiber(uint32_t fiberIndex)
+        {
+            if (m_fibers[fiberIndex - 1].m_stackClass == StackClass::Large)
+            {
+                m_freeLargeFibers.Push(fiberIndex);
+                StartBlockedLargeJobs();
+            }
+            else
+            {
+                m_freeFibers.Push(fiberIndex);
+            }
+        }
+
+        bool JobSystem::TryHandOffToLargeFiber(uint32_t fromFiberIndex, const Job& job)
+        {
+            uint32_t largeFiberIndex = 0;
+            if (!TryPopFreeFiber(StackClass::Large, largeFiberIndex))
+            {
+                return false;
+            }
+
+            // The large fiber frees us once we are off this stack, then runs the job
+            FiberLocalStorage& fiberLocalStorage = m_fiberLocalStorage[largeFiberIndex - 1];
+            fiberLocalStorage.m_handoffJob = job;
+            fiberLocalStorage.m_hasHandoffJob = true;
+            fiberLocalStorage.m_markFreeIndex = fromFiberIndex;
+
+            SwitchToJobFiber(fromFiberIndex, largeFiberIndex);
+            return true;
+        }
+
+        bool JobSystem::TryHandBackToSmallFiber(uint32_t fromFiberIndex)
+        {
+            uint32_t smallFiberIndex = 0;
+            if (!TryPopFreeFiber(StackClass::Small, smallFiberIndex))
+            {
+                // Keep going on the large stack, it goes back on the free list the next time it is switched away from
+                return false;
+            }
+
+            m_fiberLocalStorage[smallFiberIndex - 1].m_markFreeIndex = fromFiberIndex;
+            SwitchToJobFiber(fromFiberIndex, smallFiberIndex);
+            return true;
+        }
+
+        void JobSystem::PushBlockedLargeJob(const Job& job)
+        {
+            Job blockedJob = job;
+            m_blockedLargeJobs.Push(blockedJob);
+            m_numBlockedLargeJobs.fetch_add(1, std::memory_order_release);
+            StartBlockedLargeJobs();
+        }
+
+        bool JobSystem::TryPopBlockedLargeJob(Job& job)
+        {
+            // Claim a job before popping it. Jobs are pushed before they are counted, so a claimed one is there.
+            uint32_t numBlockedJobs = m_numBlockedLargeJobs.load(std::memory_order_relaxed);
+            while (numBlockedJobs > 0)
+            {
+                if (m_numBlockedLargeJobs.compare_exchange_weak(numBlockedJobs, numBlockedJobs - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    const bool popped = m_blockedLargeJobs.TryPop(job);
+                    assert(popped);
+                    return popped;
+                }
+            }
+            return false;
+        }
+
+        void JobSystem::StartBlockedLargeJobs()
+        {
+            while (true)
+            {
+                // Both a blocked job and a free large fiber are published before coming here. The fence makes sure
+                // whichever side publishes last sees the other, so neither is left behind.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_numBlockedLargeJobs.load(std::memory_order_relaxed) == 0)
+                {
+                    return;
+                }
+
+                uint32_t largeFiberIndex = 0;
+                if (!TryPopFreeFiber(StackClass::Large, largeFiberIndex))
+                {
+                    return;
+                }
+
+                Job job;
+                if (!TryPopBlockedLargeJob(job))
+                {
+                    // Someone else took it, put the fiber back and look again
+                    m_freeLargeFibers.Push(largeFiberIndex);
+                    continue;
+                }
+
+                // A free fiber resumes at the top of its loop, where it runs the job handed to it before anything else
+                FiberLocalStorage& fiberLocalStorage = m_fiberLocalStorage[largeFiberIndex - 1];
+                fiberLocalStorage.m_handoffJob = job;
+                fiberLocalStorage.m_hasHandoffJob = true;
+                m_fibers[largeFiberIndex - 1].m_threadAffinity = job.m_threadAffinity;
+                PushReadyFiber(largeFiberIndex);
+            }
         }
     }
-}
\ No newline at end of file
+}
@@ -1,7 +1,15 @@
 #pragma once
 
-#include "DataStructures\MultithreadQueue.h"
+#include "DataStructures/MPMCQueue.h"
+#include "DataStructures/MultithreadQueue.h"
+#include "DataStructures/WorkStealingDeque.h"
+#include "ClosureArena.h"
+#include "CpuTopology.h"
+#include "Fiber.h"
+#include "FiberStackPool.h"
+#include "JobTrace.h"
 
+#include <array>
 #include <atomic>
 #include <cstdint>
 #include <map>
@@ -10,8 +18,6 @@
 #include <vector>
 #include <thread>
 
-#include <Windows.h>
-
 typedef void(*JobFunction)(void*);
 
 namespace Farlor
@@ -23,76 +29,308 @@ namespace Farlor
         class JobSystem
         {
         public:
-            using FiberPtr = void*;
-            using ThreadHandle = HANDLE;
             using JobArgument = void*;
-            
+
+            // How submitted jobs are queued up for the workers
+            enum class QueueMode : uint32_t
+            {
+                // Every job goes through one mutex guarded queue
+                SharedQueue = 0,
+                // Each worker pushes to its own deque and steals from the others when it runs dry
+                WorkStealing = SharedQueue + 1,
+            };
+
+            // What jobs run on
+            enum class ExecutionMode : uint32_t
+            {
+                // Every job runs on a fiber. Wait parks the fiber and the thread moves on to other work.
+                Fibers = 0,
+                // Jobs run straight on the worker threads' own stacks, Wait runs other jobs inline until its counter
+                // completes. Costs more stack and lets a long job delay the waiter, but debuggers, sanitizers and
+                // profilers see ordinary threads. The fiber sync primitives back off on the thread in this mode.
+                ThreadPool = Fibers + 1,
+            };
+
+            // Jobs are taken strictly in this order, except that background jobs age so they cannot starve
+            enum class Priority : uint32_t
+            {
+                // Frame critical work, always taken before anything else
+                High = 0,
+                Normal = High + 1,
+                // Asset decompression, streaming and the like
+                Background = Normal + 1,
+                Count = Background + 1,
+            };
+            static constexpr uint32_t NumPriorities = static_cast<uint32_t>(Priority::Count);
+
+            // Which stack size a job needs. Most jobs are shallow and run on small stacks, jobs that recurse deeply
+            // or keep big buffers on the stack ask for a large one.
+            enum class StackClass : uint32_t
+            {
+                Small = 0,
+                Large = Small + 1,
+            };
+
+            // Where a job made by MakeJob keeps its lambda
+            enum class ClosureStorage : uint32_t
+            {
+                // A plain function and argument job
+                None = 0,
+                // The captures live in the job itself
+                Inline = None + 1,
+                // The job holds a pointer to captures in a closure arena, freed once the job has run
+                Arena = Inline + 1,
+            };
+            // Captures up to this size that are trivially copyable and destructible are stored inline
+            static constexpr size_t InlineClosureSize = 48;
+            static constexpr size_t InlineClosureAlignment = 16;
+
+            struct Config
+            {
+                explicit Config(uint32_t numFibers = 100, uint32_t maxNumThreads = 0)
+                    : m_numFibers{ numFibers }
+                    , m_numLargeFibers{ 8 }
+                    , m_smallFiberStackSize{ 64 * 1024 }
+                    , m_largeFiberStackSize{ 1024 * 1024 }
+                    , m_maxNumThreads{ maxNumThreads }
+                    , m_pinThreads{ true }
+                    , m_skipSmtSiblings{ false }
+                    , m_queueMode{ QueueMode::WorkStealing }
+                    , m_executionMode{ ExecutionMode::Fibers }
+                    , m_numCounters{ 4096 }
+                    , m_normalJobsPerBackgroundJob{ 8 }
+                    , m_numIdleSpins{ 256 }
+                    , m_numTraceEventsPerThread{ 1 << 16 }
+                {
+                }
+
+                // Fibers with small stacks, including the main fiber. Raised to a few per thread if it is lower.
+                uint32_t m_numFibers;
+                // Fibers with large stacks on top of those, only for jobs that ask for StackClass::Large. At least 1.
+                // A large job keeps its fiber while it waits, so only this many large jobs can wait on other large jobs.
+                uint32_t m_numLargeFibers;
+                // Stacks are reserved up front but only take memory as deep as they have been used
+                size_t m_smallFiberStackSize;
+                size_t m_largeFiberStackSize;
+                // 0 uses every hardware thread the process may run on, see CpuTopology
+                uint32_t m_maxNumThreads;
+                // Pins every thread, including the one calling BootstrapMainTask while it runs, to its own logical CPU.
+                // Threads fill one cache domain before moving to the next, so neighbouring threads share caches.
+                bool m_pinThreads;
+                // One thread per physical core, leaving the second hardware thread of each core alone
+                bool m_skipSmtSiblings;
+                QueueMode m_queueMode;
+                ExecutionMode m_executionMode;
+                // Size of the counter pool, the most submissions that can be in flight at once
+                uint32_t m_numCounters;
+                // How many normal jobs a thread takes in a row before it lets one background job go first.
+                // High priority jobs are never held back for background work.
+                uint32_t m_normalJobsPerBackgroundJob;
+                // How many times an idle thread looks for work, pausing in between, before it goes to sleep
+                uint32_t m_numIdleSpins;
+                // Size of each thread's trace ring, only allocated once tracing is enabled
+                uint32_t m_numTraceEventsPerThread;
+            };
+
+            // How often threads went to sleep for lack of work, and how often submitters woke them back up
+            struct IdleStats
+            {
+                explicit IdleStats()
+                    : m_numParks{ 0 }
+                    , m_numWakes{ 0 }
+                {
+                }
+
+                uint64_t m_numParks;
+                uint64_t m_numWakes;
+            };
+
             struct Counter;
-            
+
+            // Refers to a counter in the job system's pool. The generation catches handles used after the counter
+            // went back to the pool and was handed out again.
+            struct CounterHandle
+            {
+                explicit CounterHandle()
+                    : m_index{ 0 }
+                    , m_generation{ 0 }
+                {
+                }
+
+                bool IsValid() const
+                {
+                    return m_index != 0;
+                }
+
+                // Ranges [1, num counters], 0 is invalid
+                uint32_t m_index;
+                uint32_t m_generation;
+            };
+
+            // Jobs are trivially copyable so they can live directly in the lock free queues
             struct Job
             {
                 explicit Job()
                     : m_jobFunction{}
                     , m_jobArgument{}
-                    , m_spCounter{ nullptr }
+                    , m_pCounter{ nullptr }
+                    , m_priority{ Priority::Normal }
+                    , m_threadAffinity{ 0 }
+                    , m_stackClass{ StackClass::Small }
+                    , m_closureStorage{ ClosureStorage::None }
+                    , m_closure{}
                 {
                 }
 
+                void Run()
+                {
+                    // Closure jobs are handed their own copy of the captures, wherever the job has been copied to
+                    m_jobFunction((m_closureStorage == ClosureStorage::None) ? m_jobArgument : static_cast<void*>(m_closure));
+                }
+
                 JobFunction m_jobFunction;
                 JobArgument m_jobArgument;
-                std::shared_ptr<Counter> m_spCounter;
+                // Set by SubmitJobs, the counter stays alive until every job holding it has finished
+                Counter* m_pCounter;
+                Priority m_priority;
+                // Job system thread id the job must run on, 0 lets any thread take it.
+                // A pinned job that waits is also resumed on that thread.
+                uint32_t m_threadAffinity;
+                StackClass m_stackClass;
+                ClosureStorage m_closureStorage;
+                // Captures of an inline closure, or the pointer to arena closure captures
+                alignas(InlineClosureAlignment) uint8_t m_closure[InlineClosureSize];
             };
 
+            // Pooled job counter.
+            // m_pendingCount holds one reference per unfinished job plus one for the handle returned by SubmitJobs,
+            // so the counter is complete at 1 and goes back to the pool at 0. That folds the lifetime tracking into
+            // the single atomic decrement every finished job already does.
             struct Counter
             {
                 explicit Counter()
-                    : m_atomicCounter{ 0 }
-                    , m_desiredValue{ 0 }
+                    : m_pendingCount{ 0 }
+                    , m_generation{ 0 }
+                    , m_index{ 0 }
+                    , m_nextFreeCounter{ 0 }
+                    , m_waitListLock{ false }
+                    , m_firstWaitingFiber{ 0 }
                 {
                 }
 
-                // Stores the current count for the counter
-                std::atomic<uint32_t> m_atomicCounter;
-                // What we want the counter to be
-                uint32_t m_desiredValue;
+                void LockWaitList()
+                {
+                    while (m_waitListLock.exchange(true, std::memory_order_acquire))
+                    {
+                    }
+                }
+
+                void UnlockWaitList()
+                {
+                    m_waitListLock.store(false, std::memory_order_release);
+                }
+
+                // Unfinished jobs, plus one while the handle is held
+                std::atomic<uint32_t> m_pendingCount;
+                // Bumped every time the counter is returned to the pool
+                std::atomic<uint32_t> m_generation;
+                // Position in the pool, 1 based like the handles
+                uint32_t m_index;
+                // Free list link while the counter is in the pool
+                std::atomic<uint32_t> m_nextFreeCounter;
+
+                // Guards the wait list. Only held for a few instructions while linking or unlinking fibers.
+                std::atomic<bool> m_waitListLock;
+                // Head of the intrusive list of fibers waiting on this counter, linked through Fiber::m_nextWaitingFiber
+                uint32_t m_firstWaitingFiber;
+            };
+
+            // FIFO of fibers suspended on a synchronization primitive, linked through Fiber::m_nextWaitingFiber.
+            // See FiberMutex, FiberSemaphore and FiberEvent.
+            struct FiberWaitList
+            {
+                explicit FiberWaitList()
+                    : m_lock{ false }
+                    , m_firstFiber{ 0 }
+                    , m_lastFiber{ 0 }
+                {
+                }
+
+                void Lock()
+                {
+                    while (m_lock.exchange(true, std::memory_order_acquire))
+                    {
+                    }
+                }
+
+                void Unlock()
+                {
+                    m_lock.store(false, std::memory_order_release);
+                }
+
+                bool Empty() const
+                {
+                    return m_firstFiber == 0;
+                }
+
+                // Only held for a few instructions by whoever changes the primitive's state or the list
+                std::atomic<bool> m_lock;
+                uint32_t m_firstFiber;
+                uint32_t m_lastFiber;
             };
 
             // Wraps a system fiber.
             struct Fiber
             {
                 explicit Fiber()
-                    : m_pFiber{ nullptr }
+                    : m_context{}
                     , m_jobSystemId{ static_cast<uint32_t>(-1) }
                     , m_pJob{ nullptr }
+                    , m_nextWaitingFiber{ 0 }
+                    , m_threadAffinity{ 0 }
+                    , m_priority{ Priority::Normal }
+                    , m_stackClass{ StackClass::Small }
                 {
                 }
 
-                // OS fiber handle
-                FiberPtr m_pFiber;
+                // Platform fiber context
+                FiberContext m_context;
                 // Id Assigned by the job system
                 // Ranges [1, max fibers]
                 uint32_t m_jobSystemId;
                 // Points to the job we are execting
                 Job* m_pJob;
+                // Next fiber waiting on the same counter, 0 ends the list
+                uint32_t m_nextWaitingFiber;
+                // Thread the fiber has to be resumed on, taken from the job it is running. 0 for any thread.
+                uint32_t m_threadAffinity;
+                // Priority of the job it is running, see GetCurrentJobPriority
+                Priority m_priority;
+                // Size of the stack the fiber was created with
+                StackClass m_stackClass;
             };
 
             // Wraps a system thread.
             struct Thread
             {
                 explicit Thread()
-                    : m_thread{ 0 }
+                    : m_thread{}
                     , m_jobSystemId{ 0 }
-                    , m_osThreadId{ 0 }
+                    , m_osThreadId{}
+                    , m_cpuIndex{ 0 }
                 {
                 }
 
-                // OS thread handle
-                ThreadHandle m_thread;
+                // OS thread handle, not joinable for the thread that bootstraps the job system
+                std::thread m_thread;
                 // Id assigned by the job system
                 // Ranges [1, numthreads]
                 uint32_t m_jobSystemId;
                 // Id assigned by the os
-                uint32_t m_osThreadId;
+                std::thread::id m_osThreadId;
+                // Logical CPU in the topology the thread is pinned to
+                // Ranges [1, num logical cpus], 0 is not pinned
+                uint32_t m_cpuIndex;
             };
 
             // Storage local to an individual thread
@@ -100,39 +338,127 @@ namespace Farlor
             {
                 explicit ThreadLocalStorage()
                     : m_currentFiberIndex{ 0 }
-                    , m_threadFiber{nullptr}
+                    , m_threadFiber{}
+                    , m_randomState{ 0 }
+                    , m_stealVictims{}
+                    , m_stealTierEnds{}
+                    , m_normalJobsSinceBackgroundJob{ 0 }
+                    , m_currentJobPriority{ Priority::Normal }
+                    , m_pinnedJobs{}
+                    , m_numPinnedJobs{ 0 }
+                    , m_pinnedReadyFibers{}
+                    , m_numPinnedReadyFibers{ 0 }
+                    , m_parked{ 0 }
+                    , m_closureArena{}
                 {
                 }
 
+                // Job system id of the fiber running on this thread, 0 while on the thread's own context
                 uint32_t m_currentFiberIndex;
-                FiberPtr m_threadFiber;
+                // The context the thread started on, so it can return to it when shutting down
+                FiberContext m_threadFiber;
+                // Used to pick steal victims
+                uint32_t m_randomState;
+                // Every other thread, nearest first. Threads at the same distance form a tier, m_stealTierEnds holds
+                // where each tier ends. Stealing goes through the tiers in order, starting at random within each.
+                std::vector<uint32_t> m_stealVictims;
+                std::vector<uint32_t> m_stealTierEnds;
+                // Ages background jobs, see Config::m_normalJobsPerBackgroundJob
+                uint32_t m_normalJobsSinceBackgroundJob;
+                // Priority of the job the thread is running in thread pool mode, fibers keep their own
+                Priority m_currentJobPriority;
+
+                // Jobs and resumed fibers that may only run on this thread. Any thread pushes, only this one pops.
+                // The counts let the thread skip the locks while nothing is pinned to it.
+                std::array<MultithreadedQueue<Job>, NumPriorities> m_pinnedJobs;
+                std::atomic<uint32_t> m_numPinnedJobs;
+                MultithreadedQueue<uint32_t> m_pinnedReadyFibers;
+                std::atomic<uint32_t> m_numPinnedReadyFibers;
+
+                // 1 while the thread sleeps waiting for work, the futex word it sleeps on.
+                // Whoever flips it back to 0 is responsible for the wake and for m_numParkedThreads.
+                std::atomic<uint32_t> m_parked;
+
+                // Captures of closure jobs made on this thread that do not fit in the job
+                ClosureArena m_closureArena;
             };
 
             // Storage local to an individual fiber
             struct FiberLocalStorage
             {
                 explicit FiberLocalStorage()
-                    : m_spWaitingCounter{ nullptr }
+                    : m_pWaitingCounter{ nullptr }
                     , m_markWaitingIndex{ 0 }
                     , m_markFreeIndex{ 0 }
+                    , m_handoffJob{}
+                    , m_hasHandoffJob{ false }
+                    , m_pUnlockWaitList{ nullptr }
                 {
                 }
 
-                std::shared_ptr<Counter> m_spWaitingCounter;
+                // Counter this fiber is blocked on in Wait
+                Counter* m_pWaitingCounter;
+                // Fiber that switched to us from Wait and still needs parking on its counter
                 uint32_t m_markWaitingIndex;
+                // Fiber that resumed us and can go back on the free list
                 uint32_t m_markFreeIndex;
+                // Large stack job handed over by a small fiber that picked it up, run before anything else
+                Job m_handoffJob;
+                bool m_hasHandoffJob;
+                // Wait list the fiber we came from suspended itself on, unlocked once it is off its stack
+                FiberWaitList* m_pUnlockWaitList;
             };
 
         public:
-            JobSystem(uint32_t numFibers = 100, uint32_t maxNumThreads = 4);
+            JobSystem(uint32_t numFibers = 100, uint32_t maxNumThreads = 0);
+            explicit JobSystem(const Config& config);
             void BootstrapMainTask(JobFunction mainTask, void* pMainTaskArg);
+            void BootstrapMainTask(const Job& mainJob);
+
+            // Wraps a lambda taking no arguments in a job, so the caller does not have to keep an argument struct alive.
+            // Small trivially copyable captures are stored in the job. Anything else is moved into the calling thread's
+            // closure arena and destroyed after the job has run, so such a job must be submitted exactly once.
+            template <class Function>
+            Job MakeJob(Function&& function);
+
+            // The returned handle must be given back with either Wait or ReleaseCounter
+            CounterHandle SubmitJobs(Job* pJobs, uint32_t numJobs);
+            // Hands out a counter that completes once numJobs jobs, submitted later with SubmitReservedJobs, have finished.
+            // Lets jobs launch their own continuations on the counter instead of waiting for them.
+            CounterHandle ReserveCounter(uint32_t numJobs);
+            // Every job submitted here must be one of the jobs the counter was reserved for
+            void SubmitReservedJobs(Job* pJobs, uint32_t numJobs, CounterHandle counterHandle);
+            // Blocks the calling job until every job on the counter has finished, then releases the handle
+            void Wait(CounterHandle counterHandle);
+            // Gives up the handle without waiting, the counter goes back to the pool once its jobs are done
+            void ReleaseCounter(CounterHandle counterHandle);
+            bool IsCounterHandleValid(CounterHandle counterHandle) const;
+            // Whether every job on the counter has finished. Keeps the handle, it still has to be given back.
+            // Lets a thread that cannot suspend, such as one that has to keep its message pump going, poll instead.
+            bool IsCounterComplete(CounterHandle counterHandle) const;
 
-            // Non-owning counter return
-            std::shared_ptr<JobSystem::Counter> SubmitJobs(Job* pJobs, uint32_t numJobs);
-            void Wait(std::shared_ptr<Counter> spCounter);
+            // Building blocks for the fiber synchronization primitives, every call expects the wait list locked.
+            // Appends the calling job's fiber to the list and runs a ready fiber or other work on this thread until
+            // the fiber is resumed. The list is unlocked once the fiber is off its stack, and is not locked again on return.
+            // Returns false without touching the list when there is no fiber to suspend: outside a job, in thread pool
+            // mode, or out of free fibers, with one small fiber per thread kept back for Wait. The caller then has to unlock and back
+            // off some other way.
+            bool TrySuspendOnWaitList(FiberWaitList& waitList);
+            // Takes the first fiber off the list, 0 if it is empty. Resume it after unlocking the list.
+            uint32_t PopWaitingFiber(FiberWaitList& waitList);
+            void ResumeFiber(uint32_t fiberIndex);
 
             uint32_t GetCurrentJobSystemThreadIndex();
             uint32_t GetCurrentJobSystemFiberIndex();
+            // Priority of the job the caller is running, Normal outside a job. Work a job splits off takes this so it
+            // does not queue behind work the job itself was allowed to skip.
+            Priority GetCurrentJobPriority();
+            uint32_t GetNumThreads() const;
+            ExecutionMode GetExecutionMode() const;
+            const CpuTopology& GetCpuTopology() const;
+            IdleStats GetIdleStats() const;
+            // Tracing is off until enabled here, see JobTrace
+            JobTrace& GetTrace();
 
         public:
             struct MainFiberFuncArg
@@ -140,46 +466,167 @@ namespace Farlor
                 JobSystem* pJobSystem;
                 Job bootstrapJob;
             };
-            static void CALLBACK MainFiberFunc(void* pAarg);
+            static void MainFiberFunc(void* pAarg);
 
             struct FiberFuncArg
             {
                 JobSystem* pJobSystem;
             };
 
-            static void CALLBACK FiberFunc(void* pAarg);
+            static void FiberFunc(void* pAarg);
 
             struct ThreadFuncArg
             {
                 JobSystem* pJobSystem;
+                uint32_t jobSystemThreadId;
             };
-            static DWORD WINAPI ThreadFunc(void* pArg);
+            static void ThreadFunc(ThreadFuncArg* pArg);
 
         private:
-            // This is the job queue. It stores all inserted jobs that will be run.
-            MultithreadedQueue<Job> m_jobQueue;
+            // Thread pool mode. Worker threads run jobs until the job system quits, and Wait runs jobs until its
+            // counter completes. Fiber mode's Wait does the same on the waiting fiber once every fiber is taken.
+            void RunWorkerLoop(uint32_t threadIndex);
+            void RunJobsUntilComplete(Counter& counter);
+            // A job that needs a large stack cannot run nested on a small fiber's
+            bool CanRunJobInline(const Job& job);
+            void RunJobInline(uint32_t threadIndex, Job& job);
+
+        private:
+            static uint32_t ComputeNumThreads(uint32_t maxNumThreads, uint32_t numAvailableCpus);
+            // Pins threads to CPUs and orders everyone's steal victims by how close they sit
+            void PlaceThreads();
+            // Pins the calling thread to the CPU PlaceThreads gave the given thread, if any
+            void PinCurrentThread(uint32_t threadIndex);
+
+            // Grabs the next job for the calling thread from whichever queues the queue mode uses
+            bool TryGetJob(uint32_t threadIndex, Job& job);
+            bool TryGetJob(uint32_t threadIndex, Priority priority, Job& job);
+            bool TryStealJob(uint32_t thiefThreadIndex, Priority priority, Job& job);
+            // Grabs a fiber whose counter completed, fibers pinned to the calling thread first
+            bool TryGetReadyFiber(uint32_t threadIndex, uint32_t& fiberIndex);
+
+            // Called by a thread that found nothing to do. Spins for a while, then sleeps until woken.
+            void WaitForWork(uint32_t threadIndex, uint32_t& numIdleSpins);
+            // Whether anything the given thread could run is queued anywhere
+            bool HasWork(uint32_t threadIndex);
+            // Wakes up to numThreads sleeping threads, one per new piece of work
+            void WakeIdleThreads(uint32_t numThreads);
+            // Wakes a specific thread if it is asleep, for work pinned to it
+            void WakeThread(uint32_t threadIndex);
+            bool TryWakeThread(uint32_t threadIndex);
+
+            // Finishes the bookkeeping for the fiber we just switched away from
+            void OnFiberSwitchedIn();
+            // Counter pool
+            Counter* AllocateCounter(uint32_t numJobs);
+            Counter* GetCounter(CounterHandle counterHandle);
+            void FreeCounter(Counter& counter);
+            // Drops one reference, which readies everything waiting once the counter completes
+            void ReleaseCounterReference(Counter& counter);
+            void PushReadyFiber(uint32_t fiberIndex);
+            // Queues jobs whose references are already counted on the counter
+            void EnqueueJobs(Job* pJobs, uint32_t numJobs, Counter* pCounter);
+
+            // Free fiber lists, one per stack class. Popping prefers small stacks and falls back to large ones.
+            bool TryPopFreeFiber(uint32_t& fiberIndex);
+            bool TryPopFreeFiber(StackClass stackClass, uint32_t& fiberIndex);
+            void PushFreeFiber(uint32_t fiberIndex);
+            // Moves a job that needs a large stack from a small fiber onto a free large one
+            bool TryHandOffToLargeFiber(uint32_t fromFiberIndex, const Job& job);
+            // A large fiber that finished its job lets a small fiber take over the thread, keeping the large stacks free.
+            // Returns once the large fiber is resumed again, false straight away when no small fiber is free.
+            bool TryHandBackToSmallFiber(uint32_t fromFiberIndex);
+            // Jobs that need a large stack while every large fiber is busy wait on a list of their own instead of
+            // going back to the queues, and are started as soon as a large fiber comes free
+            void PushBlockedLargeJob(const Job& job);
+            bool TryPopBlockedLargeJob(Job& job);
+            // Hands blocked jobs to free large fibers and readies those fibers
+            void StartBlockedLargeJobs();
+
+            // Switches the calling thread from the fiber it is running to the given fiber (1 based id)
+            void SwitchToJobFiber(uint32_t fromFiberIndex, uint32_t toFiberIndex);
+            // Switches the calling thread from the given fiber back to its original thread context
+            void SwitchToThreadFiber(uint32_t fromFiberIndex);
+
+            // Closure memory from the calling thread's arena, or the heap on threads the job system does not own
+            void* AllocateClosure(size_t size);
+
+            template <class Closure>
+            static void RunInlineClosure(void* pClosure);
+            template <class Closure>
+            static void RunArenaClosure(void* pClosurePointer);
+
+            WorkStealingDeque<Job>& GetWorkerQueue(uint32_t threadIndex, Priority priority);
+            // Jobs queued where the given thread submits to, for tracing
+            uint64_t GetQueueDepth(uint32_t threadIndex);
+
+        private:
+            QueueMode m_queueMode;
+            ExecutionMode m_executionMode;
+            uint32_t m_normalJobsPerBackgroundJob;
+
+            // These are the job queues, one per priority. They store all inserted jobs that will be run.
+            // With work stealing they only receive jobs submitted from threads the job system does not own.
+            std::array<MultithreadedQueue<Job>, NumPriorities> m_jobQueues;
+            // Lets threads skip the queue locks for priorities with nothing queued
+            std::array<std::atomic<uint32_t>, NumPriorities> m_numQueuedJobs;
+            // Per thread deques used by work stealing, one per priority for each thread.
+            // Use GetWorkerQueue to index.
+            std::vector<std::unique_ptr<WorkStealingDeque<Job>>> m_workerQueues;
+
+            // Fixed pool of counters handed out by SubmitJobs
+            std::vector<Counter> m_counters;
+            // Treiber stack of free counter indices, the upper 32 bits are a tag against ABA
+            std::atomic<uint64_t> m_freeCounterHead;
+
+            // What the threads run on, and the CPUs to place them on in order
+            CpuTopology m_cpuTopology;
+            std::vector<uint32_t> m_cpuPlacementOrder;
+            bool m_pinThreads;
+            uint32_t m_numHwThreads;
 
             // This is the numbers of job fibers to create.
+            // Small stack fibers are [1, m_numFibers], large ones follow them. The main fiber is 1 but has a large stack.
             uint32_t m_numFibers;
-            uint32_t m_numHwThreads;
+            uint32_t m_numLargeFibers;
+            size_t m_smallFiberStackSize;
+            size_t m_largeFiberStackSize;
 
             std::atomic<bool> m_quitting;
 
+            // Idle thread parking
+            uint32_t m_numIdleSpins;
+            std::atomic<uint32_t> m_numParkedThreads;
+            std::atomic<uint64_t> m_numParks;
+            std::atomic<uint64_t> m_numWakes;
+
+            // Stack memory for the fibers, declared first so it outlives them
+            FiberStackPool m_smallStackPool;
+            FiberStackPool m_largeStackPool;
+
             // Wrappers around thread and fiber structures
             std::vector<Thread> m_threads;
             std::vector<Fiber> m_fibers;
-            
-            
-            std::vector<std::atomic<bool>> m_freeFibers;
-            std::vector<std::atomic<bool>> m_waitingFibers;
+
+
+            // Fibers not running anything, ready to pick up jobs.
+            // A fiber is in at most one of these at a time, so sized to the fiber counts they never fill up.
+            MPMCQueue<uint32_t> m_freeFibers;
+            MPMCQueue<uint32_t> m_freeLargeFibers;
+            // Fibers whose counter completed, waiting for a thread to resume them
+            MPMCQueue<uint32_t> m_readyFibers;
+            std::atomic<uint32_t> m_numReadyFibers;
+            // Jobs taken off the queues that need a large stack, waiting for a large fiber. Counted once pushed.
+            MultithreadedQueue<Job> m_blockedLargeJobs;
+            std::atomic<uint32_t> m_numBlockedLargeJobs;
 
             // Local storage for fibers and fibers
             std::vector<ThreadLocalStorage> m_threadLocalStorage;
             std::vector<FiberLocalStorage> m_fiberLocalStorage;
 
-            // Id mapping from OS to JobSystem
-            std::unordered_map<uint32_t, uint32_t> m_threadIdMap;
-            std::unordered_map<FiberPtr, uint32_t> m_fiberIdMap;
+            JobTrace m_trace;
         };
     }
-}
\ No newline at end of file
+}
+
+#include "JobSystem.inc"
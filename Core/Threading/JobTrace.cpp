@@ -0,0 +1,274 @@
+#include "JobTrace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        namespace
+        {
+            int64_t SteadyClockNanoseconds()
+            {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            const char* GetInstantEventName(JobTrace::EventType type)
+            {
+                switch (type)
+                {
+                case JobTrace::EventType::Steal:
+                    return "Steal";
+                default:
+                    return "Unknown";
+                }
+            }
+        }
+
+        JobTrace::JobTrace(uint32_t numThreads, uint32_t numFibers, uint32_t numEventsPerThread)
+            : m_enabled{ false }
+            , m_numEventsPerThread{ 1 }
+            , m_startTime{ SteadyClockNanoseconds() }
+            , m_workerTraces( numThreads )
+            , m_fiberReadyTimestamps( numFibers, 0 )
+        {
+            while (m_numEventsPerThread < numEventsPerThread)
+            {
+                m_numEventsPerThread <<= 1;
+            }
+        }
+
+        void JobTrace::SetEnabled(bool enabled)
+        {
+#if !defined(FARLOR_JOBS_TRACING)
+            if (enabled)
+            {
+                std::cout << "Job tracing was compiled out, build with FARLOR_JOBS_TRACING to record anything" << std::endl;
+            }
+#endif
+            if (enabled && !IsEnabled())
+            {
+                for (WorkerTrace& workerTrace : m_workerTraces)
+                {
+                    if (!workerTrace.m_upEvents)
+                    {
+                        workerTrace.m_upEvents = std::make_unique<Event[]>(static_cast<size_t>(m_numEventsPerThread));
+                    }
+                }
+                Reset();
+            }
+            m_enabled.store(enabled, std::memory_order_release);
+        }
+
+        void JobTrace::Reset()
+        {
+            m_startTime.store(SteadyClockNanoseconds(), std::memory_order_relaxed);
+            for (WorkerTrace& workerTrace : m_workerTraces)
+            {
+                workerTrace.m_numEventsWritten.store(0, std::memory_order_relaxed);
+                workerTrace.m_idleStart = 0;
+                workerTrace.m_idleNanoseconds.store(0, std::memory_order_relaxed);
+                workerTrace.m_numJobs.store(0, std::memory_order_relaxed);
+                workerTrace.m_numSteals.store(0, std::memory_order_relaxed);
+                workerTrace.m_numWaits.store(0, std::memory_order_relaxed);
+                workerTrace.m_totalWaitLatencyNanoseconds.store(0, std::memory_order_relaxed);
+                workerTrace.m_maxWaitLatencyNanoseconds.store(0, std::memory_order_relaxed);
+            }
+            std::fill(m_fiberReadyTimestamps.begin(), m_fiberReadyTimestamps.end(), 0);
+        }
+
+        uint64_t JobTrace::Now() const
+        {
+            // Never 0, so 0 can mean "not set" for the timestamps we keep around
+            const int64_t elapsed = SteadyClockNanoseconds() - m_startTime.load(std::memory_order_relaxed);
+            return static_cast<uint64_t>(std::max<int64_t>(elapsed, 1));
+        }
+
+        void JobTrace::Record(uint32_t threadIndex, EventType type, uint32_t fiberIndex, uint64_t value)
+        {
+            // Threads the job system does not own have no ring
+            if (threadIndex == 0)
+            {
+                return;
+            }
+
+            WorkerTrace& workerTrace = m_workerTraces[threadIndex - 1];
+            const uint64_t eventIndex = workerTrace.m_numEventsWritten.load(std::memory_order_relaxed);
+
+            Event& event = workerTrace.m_upEvents[eventIndex & (m_numEventsPerThread - 1)];
+            event.m_timestamp = Now();
+            event.m_value = value;
+            event.m_type = type;
+            event.m_fiberIndex = fiberIndex;
+            workerTrace.m_numEventsWritten.store(eventIndex + 1, std::memory_order_release);
+
+            if (type == EventType::JobBegin)
+            {
+                workerTrace.m_numJobs.store(workerTrace.m_numJobs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+            else if (type == EventType::Steal)
+            {
+                workerTrace.m_numSteals.store(workerTrace.m_numSteals.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+
+        void JobTrace::BeginIdle(uint32_t threadIndex)
+        {
+            WorkerTrace& workerTrace = m_workerTraces[threadIndex - 1];
+            if (workerTrace.m_idleStart == 0)
+            {
+                workerTrace.m_idleStart = Now();
+            }
+        }
+
+        void JobTrace::EndIdle(uint32_t threadIndex)
+        {
+            WorkerTrace& workerTrace = m_workerTraces[threadIndex - 1];
+            if (workerTrace.m_idleStart != 0)
+            {
+                const uint64_t idleNanoseconds = Now() - workerTrace.m_idleStart;
+                workerTrace.m_idleNanoseconds.store(workerTrace.m_idleNanoseconds.load(std::memory_order_relaxed) + idleNanoseconds, std::memory_order_relaxed);
+                workerTrace.m_idleStart = 0;
+            }
+        }
+
+        void JobTrace::MarkFiberReady(uint32_t fiberIndex)
+        {
+            m_fiberReadyTimestamps[fiberIndex - 1] = Now();
+        }
+
+        void JobTrace::RecordWaitEnd(uint32_t threadIndex, uint32_t fiberIndex)
+        {
+            const uint64_t readyTimestamp = m_fiberReadyTimestamps[fiberIndex - 1];
+            m_fiberReadyTimestamps[fiberIndex - 1] = 0;
+
+            // Tracing was turned on while this fiber was already waiting
+            const uint64_t now = Now();
+            const uint64_t latencyNanoseconds = (readyTimestamp != 0 && now > readyTimestamp) ? (now - readyTimestamp) : 0;
+            Record(threadIndex, EventType::WaitEnd, fiberIndex, latencyNanoseconds);
+            if (readyTimestamp == 0)
+            {
+                return;
+            }
+
+            WorkerTrace& workerTrace = m_workerTraces[threadIndex - 1];
+            workerTrace.m_numWaits.store(workerTrace.m_numWaits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            workerTrace.m_totalWaitLatencyNanoseconds.store(workerTrace.m_totalWaitLatencyNanoseconds.load(std::memory_order_relaxed) + latencyNanoseconds, std::memory_order_relaxed);
+            if (latencyNanoseconds > workerTrace.m_maxWaitLatencyNanoseconds.load(std::memory_order_relaxed))
+            {
+                workerTrace.m_maxWaitLatencyNanoseconds.store(latencyNanoseconds, std::memory_order_relaxed);
+            }
+        }
+
+        uint32_t JobTrace::GetNumThreads() const
+        {
+            return static_cast<uint32_t>(m_workerTraces.size());
+        }
+
+        JobTrace::WorkerStats JobTrace::GetWorkerStats(uint32_t threadIndex) const
+        {
+            assert(threadIndex > 0 && threadIndex <= m_workerTraces.size());
+            const WorkerTrace& workerTrace = m_workerTraces[threadIndex - 1];
+
+            WorkerStats workerStats;
+            workerStats.m_idleNanoseconds = workerTrace.m_idleNanoseconds.load(std::memory_order_relaxed);
+            workerStats.m_numJobs = workerTrace.m_numJobs.load(std::memory_order_relaxed);
+            workerStats.m_numSteals = workerTrace.m_numSteals.load(std::memory_order_relaxed);
+            workerStats.m_numWaits = workerTrace.m_numWaits.load(std::memory_order_relaxed);
+            workerStats.m_totalWaitLatencyNanoseconds = workerTrace.m_totalWaitLatencyNanoseconds.load(std::memory_order_relaxed);
+            workerStats.m_maxWaitLatencyNanoseconds = workerTrace.m_maxWaitLatencyNanoseconds.load(std::memory_order_relaxed);
+
+            const uint64_t elapsedNanoseconds = Now();
+            const uint64_t busyNanoseconds = (elapsedNanoseconds > workerStats.m_idleNanoseconds) ? (elapsedNanoseconds - workerStats.m_idleNanoseconds) : 0;
+            workerStats.m_utilisation = static_cast<double>(busyNanoseconds) / static_cast<double>(elapsedNanoseconds);
+            return workerStats;
+        }
+
+        void JobTrace::WriteChromeTrace(std::ostream& outputStream) const
+        {
+            // Job slices are split whenever the fiber switches out in Wait, so they always nest on a thread even
+            // though a job may finish on a different thread than it started on.
+            outputStream << "{\"traceEvents\":[\n";
+            bool firstEvent = true;
+            auto beginEvent = [&outputStream, &firstEvent]()
+            {
+                if (!firstEvent)
+                {
+                    outputStream << ",\n";
+                }
+                firstEvent = false;
+            };
+
+            for (uint32_t threadIndex = 1; threadIndex <= m_workerTraces.size(); ++threadIndex)
+            {
+                beginEvent();
+                outputStream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadIndex
+                    << ",\"args\":{\"name\":\"Job thread " << threadIndex << "\"}}";
+
+                const WorkerTrace& workerTrace = m_workerTraces[threadIndex - 1];
+                if (!workerTrace.m_upEvents)
+                {
+                    continue;
+                }
+
+                const uint64_t numEventsWritten = workerTrace.m_numEventsWritten.load(std::memory_order_acquire);
+                const uint64_t firstEventIndex = (numEventsWritten > m_numEventsPerThread) ? (numEventsWritten - m_numEventsPerThread) : 0;
+                for (uint64_t eventIndex = firstEventIndex; eventIndex < numEventsWritten; ++eventIndex)
+                {
+                    const Event& event = workerTrace.m_upEvents[eventIndex & (m_numEventsPerThread - 1)];
+                    const double timestampMicroseconds = static_cast<double>(event.m_timestamp) / 1000.0;
+
+                    beginEvent();
+                    outputStream << "{\"pid\":1,\"tid\":" << threadIndex << ",\"ts\":" << timestampMicroseconds << ",";
+                    switch (event.m_type)
+                    {
+                    case EventType::JobBegin:
+                        outputStream << "\"ph\":\"B\",\"name\":\"Job\",\"args\":{\"fiber\":" << event.m_fiberIndex
+                            << ",\"function\":\"0x" << std::hex << event.m_value << std::dec << "\"}}";
+                        break;
+                    case EventType::WaitEnd:
+                        outputStream << "\"ph\":\"B\",\"name\":\"Job (resumed)\",\"args\":{\"fiber\":" << event.m_fiberIndex
+                            << ",\"readyLatencyNs\":" << event.m_value << "}}";
+                        break;
+                    case EventType::JobEnd:
+                        outputStream << "\"ph\":\"E\"}";
+                        break;
+                    case EventType::WaitBegin:
+                        outputStream << "\"ph\":\"E\",\"args\":{\"waitOnCounter\":" << event.m_value << "}}";
+                        break;
+                    case EventType::Park:
+                        outputStream << "\"ph\":\"B\",\"name\":\"Parked\"}";
+                        break;
+                    case EventType::Unpark:
+                        outputStream << "\"ph\":\"E\"}";
+                        break;
+                    case EventType::QueueDepth:
+                        outputStream << "\"ph\":\"C\",\"name\":\"Queue depth " << threadIndex << "\",\"args\":{\"jobs\":" << event.m_value << "}}";
+                        break;
+                    default:
+                        outputStream << "\"ph\":\"i\",\"s\":\"t\",\"name\":\"" << GetInstantEventName(event.m_type)
+                            << "\",\"args\":{\"fiber\":" << event.m_fiberIndex << ",\"value\":" << event.m_value << "}}";
+                        break;
+                    }
+                }
+            }
+            outputStream << "\n]}\n";
+        }
+
+        bool JobTrace::WriteChromeTrace(const std::string& filePath) const
+        {
+            std::ofstream outputFile(filePath);
+            if (!outputFile)
+            {
+                std::cout << "Failed to open job trace file: " << filePath << std::endl;
+                return false;
+            }
+            WriteChromeTrace(outputFile);
+            return static_cast<bool>(outputFile);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Wraps a call on a JobTrace so it costs a single load while tracing is disabled,
+// and nothing at all when the job system is built without FARLOR_JOBS_TRACING.
+#if defined(FARLOR_JOBS_TRACING)
+#define FARLOR_JOBS_TRACE(jobTrace, call) do { if ((jobTrace).IsEnabled()) { (jobTrace).call; } } while (false)
+#else
+#define FARLOR_JOBS_TRACE(jobTrace, call) do { } while (false)
+#endif
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Records what the job system's threads are doing into one ring buffer per thread.
+        // Each ring is only ever written by its own thread, so recording is a few plain stores. Once a ring is
+        // full the oldest events are overwritten. Dump with tracing disabled to get a consistent snapshot.
+        class JobTrace
+        {
+        public:
+            enum class EventType : uint32_t
+            {
+                // Value is the job function
+                JobBegin = 0,
+                JobEnd = JobBegin + 1,
+                // The job's fiber switched out in Wait, value is the counter index
+                WaitBegin = JobEnd + 1,
+                // The waiting fiber was resumed, value is how long it sat ready in nanoseconds
+                WaitEnd = WaitBegin + 1,
+                // Value is the job system thread id of the victim
+                Steal = WaitEnd + 1,
+                // Value is the number of jobs queued on the submitting thread after a submission
+                QueueDepth = Steal + 1,
+                Park = QueueDepth + 1,
+                Unpark = Park + 1,
+            };
+
+            struct Event
+            {
+                // Nanoseconds since the trace was enabled or reset
+                uint64_t m_timestamp;
+                uint64_t m_value;
+                EventType m_type;
+                uint32_t m_fiberIndex;
+            };
+
+            // Aggregates since the trace was enabled or reset
+            struct WorkerStats
+            {
+                explicit WorkerStats()
+                    : m_utilisation{ 0.0 }
+                    , m_idleNanoseconds{ 0 }
+                    , m_numJobs{ 0 }
+                    , m_numSteals{ 0 }
+                    , m_numWaits{ 0 }
+                    , m_totalWaitLatencyNanoseconds{ 0 }
+                    , m_maxWaitLatencyNanoseconds{ 0 }
+                {
+                }
+
+                // Fraction of the time the thread was not looking for work or asleep
+                double m_utilisation;
+                uint64_t m_idleNanoseconds;
+                uint64_t m_numJobs;
+                uint64_t m_numSteals;
+                // Wait latency is the time from a counter completing to the waiting fiber running again
+                uint64_t m_numWaits;
+                uint64_t m_totalWaitLatencyNanoseconds;
+                uint64_t m_maxWaitLatencyNanoseconds;
+            };
+
+        public:
+            JobTrace(uint32_t numThreads, uint32_t numFibers, uint32_t numEventsPerThread);
+
+            JobTrace(const JobTrace&) = delete;
+            JobTrace& operator=(const JobTrace&) = delete;
+
+            // The rings are allocated the first time tracing is enabled
+            void SetEnabled(bool enabled);
+            bool IsEnabled() const
+            {
+                return m_enabled.load(std::memory_order_acquire);
+            }
+            // Drops every recorded event and restarts the clock and the stats. Only while nothing is recording.
+            void Reset();
+
+            // Nanoseconds since the trace was enabled or reset
+            uint64_t Now() const;
+
+            // Recording, only from the thread the events belong to (1 based job system thread id)
+            void Record(uint32_t threadIndex, EventType type, uint32_t fiberIndex, uint64_t value);
+            void BeginIdle(uint32_t threadIndex);
+            void EndIdle(uint32_t threadIndex);
+            // A waiting fiber's counter completed, called from whichever thread completed it
+            void MarkFiberReady(uint32_t fiberIndex);
+            // The fiber is running again after a wait, records the event and its wait latency
+            void RecordWaitEnd(uint32_t threadIndex, uint32_t fiberIndex);
+
+            uint32_t GetNumThreads() const;
+            WorkerStats GetWorkerStats(uint32_t threadIndex) const;
+
+            // Writes everything still in the rings in the Chrome trace event format, for chrome://tracing or Perfetto
+            void WriteChromeTrace(std::ostream& outputStream) const;
+            bool WriteChromeTrace(const std::string& filePath) const;
+
+        private:
+            struct alignas(64) WorkerTrace
+            {
+                explicit WorkerTrace()
+                    : m_upEvents{ nullptr }
+                    , m_numEventsWritten{ 0 }
+                    , m_idleStart{ 0 }
+                    , m_idleNanoseconds{ 0 }
+                    , m_numJobs{ 0 }
+                    , m_numSteals{ 0 }
+                    , m_numWaits{ 0 }
+                    , m_totalWaitLatencyNanoseconds{ 0 }
+                    , m_maxWaitLatencyNanoseconds{ 0 }
+                {
+                }
+
+                std::unique_ptr<Event[]> m_upEvents;
+                std::atomic<uint64_t> m_numEventsWritten;
+
+                // Written by the owning thread, read by anyone asking for stats
+                uint64_t m_idleStart;
+                std::atomic<uint64_t> m_idleNanoseconds;
+                std::atomic<uint64_t> m_numJobs;
+                std::atomic<uint64_t> m_numSteals;
+                std::atomic<uint64_t> m_numWaits;
+                std::atomic<uint64_t> m_totalWaitLatencyNanoseconds;
+                std::atomic<uint64_t> m_maxWaitLatencyNanoseconds;
+            };
+
+        private:
+            std::atomic<bool> m_enabled;
+            // Power of two so the write position wraps with a mask
+            uint64_t m_numEventsPerThread;
+            std::atomic<int64_t> m_startTime;
+            std::vector<WorkerTrace> m_workerTraces;
+            // When each fiber was made ready, 0 when it is not waiting or tracing was off at the time.
+            // Handed from the completing thread to the resuming one through the ready queues.
+            std::vector<uint64_t> m_fiberReadyTimestamps;
+        };
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Passing this as the grain size measures the loop body on a small prefix of the range
+        // and picks chunks that each run for about ParallelTargetChunkSeconds.
+        constexpr uint32_t AdaptiveGrainSize = 0;
+        constexpr double ParallelTargetChunkSeconds = 50.0e-6;
+
+        // Calls function(i) for every i in [begin, end), split into chunks of grainSize run as jobs.
+        // From inside a job the caller runs a chunk itself and then waits on the rest through JobSystem::Wait,
+        // so no OS thread blocks. Called from outside the job system the loop simply runs inline.
+        // Chunks run at the calling job's priority, so a high priority job's loop does not queue behind normal work.
+        template <class Function>
+        void ParallelFor(JobSystem& jobSystem, uint32_t begin, uint32_t end, uint32_t grainSize, Function&& function);
+
+        // Folds map(i) for every i in [begin, end) together with reduce, starting from identity.
+        // reduce must be associative. Partial results are combined in range order, so the result does not
+        // depend on which thread ran which chunk.
+        template <class T, class MapFunction, class ReduceFunction>
+        T ParallelReduce(JobSystem& jobSystem, uint32_t begin, uint32_t end, uint32_t grainSize, const T& identity,
+            MapFunction&& map, ReduceFunction&& reduce);
+
+        namespace ParallelInternal
+        {
+            uint32_t NumChunks(uint32_t begin, uint32_t end, uint32_t grainSize);
+
+            // Runs probe(0, probeBegin, probeEnd) on a doubling prefix of the range until it has run long enough
+            // to time. Returns where the rest of the range starts and writes the grain size to use for it.
+            template <class ProbeFunction>
+            uint32_t ProbeGrainSize(JobSystem& jobSystem, uint32_t begin, uint32_t end, ProbeFunction& probe, uint32_t& grainSize);
+
+            // Runs chunkFunction(chunkIndex, chunkBegin, chunkEnd) over every chunk and returns once all are done
+            template <class ChunkFunction>
+            void RunChunks(JobSystem& jobSystem, uint32_t begin, uint32_t end, uint32_t grainSize, ChunkFunction& chunkFunction);
+        }
+    }
+}
+
+#include "Parallel.inc"
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Parallel.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // Ranges up to these sizes are handled serially on the calling thread, splitting them costs more than it saves.
+        // Larger ranges are cut into a few chunks per thread, never smaller than the cutoff.
+        constexpr uint32_t ParallelSortSerialCutoff = 8 * 1024;
+        constexpr uint32_t ParallelScanSerialCutoff = 32 * 1024;
+        constexpr uint32_t ParallelPartitionSerialCutoff = 16 * 1024;
+
+        // Called from outside the job system every algorithm simply runs serially.
+        // The sorts and the partition move elements through a scratch buffer, so T has to be default constructible
+        // and movable.
+
+        // Stable sort. Chunks are sorted as jobs, then merged pairwise with every merge split across jobs as well.
+        template <class T, class Compare = std::less<T>>
+        void ParallelMergeSort(JobSystem& jobSystem, T* pData, uint32_t count, Compare compare = Compare());
+
+        // Stable least significant digit radix sort on keyFunction(element), which has to return an unsigned integer.
+        // One pass per key byte, passes where every key has the same byte are skipped.
+        template <class T, class KeyFunction>
+        void ParallelRadixSort(JobSystem& jobSystem, T* pData, uint32_t count, KeyFunction&& keyFunction);
+
+        // pOutput[i] = identity op pInput[0] op ... op pInput[i - 1]. op must be associative.
+        // pOutput may be the same as pInput.
+        template <class T, class BinaryOp>
+        void ParallelExclusiveScan(JobSystem& jobSystem, const T* pInput, T* pOutput, uint32_t count, const T& identity, BinaryOp&& op);
+
+        // pOutput[i] = pInput[0] op ... op pInput[i]. op must be associative. pOutput may be the same as pInput.
+        template <class T, class BinaryOp>
+        void ParallelInclusiveScan(JobSystem& jobSystem, const T* pInput, T* pOutput, uint32_t count, BinaryOp&& op);
+
+        // Moves the elements that satisfy predicate in front of the ones that don't, keeping the order within both.
+        // Returns how many satisfied it. predicate is called exactly once per element.
+        template <class T, class Predicate>
+        uint32_t ParallelStablePartition(JobSystem& jobSystem, T* pData, uint32_t count, Predicate&& predicate);
+
+        namespace ParallelInternal
+        {
+            // Elements per chunk for a range of count elements. The whole range when it is under the cutoff or
+            // we are outside the job system.
+            uint32_t AlgorithmChunkSize(JobSystem& jobSystem, uint32_t count, uint32_t serialCutoff);
+
+            // Where the first outputIndex elements of merging pA and pB split between the two, ties going to pA
+            template <class T, class Compare>
+            uint32_t MergeSplit(const T* pA, uint32_t countA, const T* pB, uint32_t countB, uint32_t outputIndex, Compare& compare);
+
+            // Moves pSource into pDestination, in chunks run as jobs
+            template <class T>
+            void ParallelMove(JobSystem& jobSystem, T* pSource, T* pDestination, uint32_t count);
+        }
+    }
+}
+
+#include "ParallelAlgorithms.inc"
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "JobSystem.h"
+
+// The job system itself builds as C++17, the coroutine front end is there for code built as C++20
+#if defined(__cpp_impl_coroutine)
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        template <class T = void>
+        class Task;
+
+        namespace TaskInternal
+        {
+            // Resumes whoever awaited the task once it has finished, without growing the stack
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                template <class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept;
+
+                void await_resume() const noexcept
+                {
+                }
+            };
+
+            struct PromiseBase
+            {
+                explicit PromiseBase()
+                    : m_continuation{}
+                {
+                }
+
+                // Tasks are lazy, nothing runs until the task is awaited or handed to the job system
+                std::suspend_always initial_suspend() const noexcept
+                {
+                    return {};
+                }
+
+                FinalAwaiter final_suspend() const noexcept
+                {
+                    return {};
+                }
+
+                // Nothing in the engine throws, an exception escaping a task is a bug
+                void unhandled_exception() const noexcept;
+
+                // Resumed when the task finishes, empty while nothing awaits it
+                std::coroutine_handle<> m_continuation;
+            };
+
+            template <class T>
+            struct Promise : PromiseBase
+            {
+                Task<T> get_return_object() noexcept;
+
+                template <class Value>
+                void return_value(Value&& value)
+                {
+                    m_result.emplace(std::forward<Value>(value));
+                }
+
+                std::optional<T> m_result;
+            };
+
+            template <>
+            struct Promise<void> : PromiseBase
+            {
+                Task<void> get_return_object() noexcept;
+
+                void return_void() const noexcept
+                {
+                }
+            };
+        }
+
+        // The result of an asynchronous job system operation, written as a coroutine.
+        // A task starts when it is first awaited and runs on the awaiting thread until it suspends. co_await Schedule
+        // moves it onto a worker, and WhenAll and WhenAny run tasks in parallel as jobs. While suspended a task only
+        // holds its coroutine frame, usually a few hundred bytes, instead of a fiber and its stack.
+        // Each task is awaited at most once. Destroying a task destroys its frame, so it must not be running.
+        template <class T>
+        class Task
+        {
+        public:
+            using promise_type = TaskInternal::Promise<T>;
+            using Handle = std::coroutine_handle<promise_type>;
+
+        public:
+            explicit Task();
+            explicit Task(Handle handle);
+            ~Task();
+
+            Task(Task&& other) noexcept;
+            Task& operator=(Task&& other) noexcept;
+            Task(const Task&) = delete;
+            Task& operator=(const Task&) = delete;
+
+            bool IsValid() const;
+            bool IsDone() const;
+
+            // Starts the task and suspends the awaiting coroutine until it has finished
+            auto operator co_await() noexcept;
+
+            // Only once the task is done. Moves the result out for tasks with one.
+            T TakeResult();
+
+        private:
+            Handle m_handle;
+        };
+
+        // co_await Schedule(jobSystem) continues the coroutine in a job, on whichever worker picks it up
+        class ScheduleAwaiter
+        {
+        public:
+            ScheduleAwaiter(JobSystem& jobSystem, JobSystem::Priority priority);
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const;
+
+            void await_resume() const noexcept
+            {
+            }
+
+        private:
+            JobSystem& m_jobSystem;
+            JobSystem::Priority m_priority;
+        };
+
+        ScheduleAwaiter Schedule(JobSystem& jobSystem, JobSystem::Priority priority = JobSystem::Priority::Normal);
+
+        // Runs every task as its own job and completes once all of them have. Results come back in task order.
+        template <class T>
+        Task<std::vector<T>> WhenAll(JobSystem& jobSystem, std::vector<Task<T>> tasks);
+        Task<void> WhenAll(JobSystem& jobSystem, std::vector<Task<void>> tasks);
+
+        // Which task of a WhenAny finished first, and what it returned
+        template <class T>
+        struct WhenAnyResult
+        {
+            uint32_t m_index;
+            T m_value;
+        };
+
+        // Runs every task as its own job and completes as soon as the first one has, with its index and result.
+        // The others keep running to completion in the background, so the job system has to outlive them.
+        template <class T>
+        Task<WhenAnyResult<T>> WhenAny(JobSystem& jobSystem, std::vector<Task<T>> tasks);
+        Task<uint32_t> WhenAny(JobSystem& jobSystem, std::vector<Task<void>> tasks);
+
+        // Runs a task from ordinary job code and waits for it through JobSystem::Wait, so the calling job's fiber is
+        // parked (or, in thread pool mode, its thread helps) rather than the thread blocking
+        template <class T>
+        T WaitForTask(JobSystem& jobSystem, Task<T> task);
+    }
+}
+
+#include "Task.inc"
+
+#endif
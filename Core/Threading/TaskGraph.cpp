@@ -0,0 +1,226 @@
+#include "TaskGraph.h"
+
+#include <assert.h>
+#include <iostream>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        namespace
+        {
+            // Successors readied by one task are queued in batches of this many
+            constexpr uint32_t MaxJobsPerBatch = 16;
+        }
+
+        TaskGraph::TaskGraph()
+            : m_tasks{}
+            , m_dependencies{}
+            , m_isFinalized{ false }
+            , m_successors{}
+            , m_rootJobs{}
+            , m_upNumPendingPredecessors{}
+            , m_pJobSystem{ nullptr }
+            , m_counterHandle{}
+            , m_numUnfinishedTasks{ 0 }
+        {
+        }
+
+        TaskGraph::TaskId TaskGraph::AddTask(const JobSystem::Job& job)
+        {
+            assert(!IsRunning());
+            if (job.m_closureStorage == JobSystem::ClosureStorage::Arena)
+            {
+                // Those captures are destroyed after one run, tasks run every submit
+                std::cout << "Task graph tasks must be plain jobs or closures small enough to be stored inline" << std::endl;
+                assert(false);
+            }
+
+            Task task;
+            task.m_job = job;
+            m_tasks.push_back(task);
+            m_isFinalized = false;
+            return static_cast<TaskId>(m_tasks.size());
+        }
+
+        TaskGraph::TaskId TaskGraph::AddTask(JobFunction jobFunction, void* pJobArgument)
+        {
+            JobSystem::Job job;
+            job.m_jobFunction = jobFunction;
+            job.m_jobArgument = pJobArgument;
+            return AddTask(job);
+        }
+
+        void TaskGraph::AddDependency(TaskId before, TaskId after)
+        {
+            assert(!IsRunning());
+            if (before == 0 || after == 0 || before > m_tasks.size() || after > m_tasks.size())
+            {
+                std::cout << "Task graph dependency between unknown tasks " << before << " and " << after << std::endl;
+                assert(false);
+                return;
+            }
+            m_dependencies.push_back(std::make_pair(before, after));
+            m_isFinalized = false;
+        }
+
+        bool TaskGraph::Finalize()
+        {
+            assert(!IsRunning());
+            const uint32_t numTasks = static_cast<uint32_t>(m_tasks.size());
+
+            // Bucket the successors of each task next to each other
+            for (Task& task : m_tasks)
+            {
+                task.m_pGraph = this;
+                task.m_numPredecessors = 0;
+                task.m_numSuccessors = 0;
+            }
+            for (const std::pair<TaskId, TaskId>& dependency : m_dependencies)
+            {
+                ++m_tasks[dependency.first - 1].m_numSuccessors;
+                ++m_tasks[dependency.second - 1].m_numPredecessors;
+            }
+
+            uint32_t firstSuccessor = 0;
+            for (Task& task : m_tasks)
+            {
+                task.m_firstSuccessor = firstSuccessor;
+                firstSuccessor += task.m_numSuccessors;
+            }
+
+            m_successors.assign(m_dependencies.size(), 0);
+            std::vector<uint32_t> numSuccessorsWritten(numTasks, 0);
+            for (const std::pair<TaskId, TaskId>& dependency : m_dependencies)
+            {
+                const Task& task = m_tasks[dependency.first - 1];
+                m_successors[task.m_firstSuccessor + numSuccessorsWritten[dependency.first - 1]++] = dependency.second;
+            }
+
+            // Walk the graph in dependency order, anything never reached is on a cycle
+            std::vector<uint32_t> numPendingPredecessors(numTasks);
+            std::vector<TaskId> readyTasks;
+            m_rootJobs.clear();
+            for (TaskId taskId = 1; taskId <= numTasks; ++taskId)
+            {
+                numPendingPredecessors[taskId - 1] = m_tasks[taskId - 1].m_numPredecessors;
+                if (numPendingPredecessors[taskId - 1] == 0)
+                {
+                    readyTasks.push_back(taskId);
+                    m_rootJobs.push_back(MakeTaskJob(taskId));
+                }
+            }
+
+            uint32_t numVisitedTasks = 0;
+            while (!readyTasks.empty())
+            {
+                const Task& task = m_tasks[readyTasks.back() - 1];
+                readyTasks.pop_back();
+                ++numVisitedTasks;
+
+                for (uint32_t i = 0; i < task.m_numSuccessors; ++i)
+                {
+                    const TaskId successor = m_successors[task.m_firstSuccessor + i];
+                    if (--numPendingPredecessors[successor - 1] == 0)
+                    {
+                        readyTasks.push_back(successor);
+                    }
+                }
+            }
+
+            if (numVisitedTasks != numTasks)
+            {
+                std::cout << "Task graph has a dependency cycle through " << (numTasks - numVisitedTasks) << " tasks" << std::endl;
+                assert(false);
+                m_isFinalized = false;
+                return false;
+            }
+
+            m_upNumPendingPredecessors = std::make_unique<std::atomic<uint32_t>[]>(numTasks);
+            m_isFinalized = true;
+            return true;
+        }
+
+        JobSystem::CounterHandle TaskGraph::Submit(JobSystem& jobSystem)
+        {
+            if (!m_isFinalized || IsRunning())
+            {
+                std::cout << "Task graph submitted before Finalize or while it is still running" << std::endl;
+                assert(false);
+                return JobSystem::CounterHandle();
+            }
+
+            for (uint32_t i = 0; i < m_tasks.size(); ++i)
+            {
+                m_upNumPendingPredecessors[i].store(m_tasks[i].m_numPredecessors, std::memory_order_relaxed);
+            }
+            m_numUnfinishedTasks.store(static_cast<uint32_t>(m_tasks.size()), std::memory_order_relaxed);
+
+            // Every task is counted up front, so tasks can queue their successors on the counter as they go.
+            // Queuing the roots publishes all of the above to whichever threads run them.
+            m_pJobSystem = &jobSystem;
+            m_counterHandle = jobSystem.ReserveCounter(static_cast<uint32_t>(m_tasks.size()));
+            jobSystem.SubmitReservedJobs(m_rootJobs.data(), static_cast<uint32_t>(m_rootJobs.size()), m_counterHandle);
+            return m_counterHandle;
+        }
+
+        bool TaskGraph::IsRunning() const
+        {
+            return m_numUnfinishedTasks.load(std::memory_order_acquire) > 0;
+        }
+
+        uint32_t TaskGraph::GetNumTasks() const
+        {
+            return static_cast<uint32_t>(m_tasks.size());
+        }
+
+        void TaskGraph::TaskEntry(void* pArg)
+        {
+            Task& task = *static_cast<Task*>(pArg);
+            task.m_job.Run();
+            task.m_pGraph->OnTaskFinished(task);
+        }
+
+        void TaskGraph::OnTaskFinished(const Task& task)
+        {
+            JobSystem::Job readyJobs[MaxJobsPerBatch];
+            uint32_t numReadyJobs = 0;
+
+            for (uint32_t i = 0; i < task.m_numSuccessors; ++i)
+            {
+                const TaskId successor = m_successors[task.m_firstSuccessor + i];
+                // The last dependency to finish launches the task
+                if (m_upNumPendingPredecessors[successor - 1].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                {
+                    continue;
+                }
+
+                readyJobs[numReadyJobs++] = MakeTaskJob(successor);
+                if (numReadyJobs == MaxJobsPerBatch)
+                {
+                    m_pJobSystem->SubmitReservedJobs(readyJobs, numReadyJobs, m_counterHandle);
+                    numReadyJobs = 0;
+                }
+            }
+
+            if (numReadyJobs > 0)
+            {
+                m_pJobSystem->SubmitReservedJobs(readyJobs, numReadyJobs, m_counterHandle);
+            }
+
+            // Our successors are counted as unfinished already, so this only reaches 0 on the very last task
+            m_numUnfinishedTasks.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        JobSystem::Job TaskGraph::MakeTaskJob(TaskId taskId)
+        {
+            Task& task = m_tasks[taskId - 1];
+            JobSystem::Job job = task.m_job;
+            job.m_jobFunction = &TaskGraph::TaskEntry;
+            job.m_jobArgument = &task;
+            // The task's own closure is run from TaskEntry
+            job.m_closureStorage = JobSystem::ClosureStorage::None;
+            return job;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Farlor
+{
+    namespace FarlorJobs
+    {
+        // A set of jobs with explicit dependencies, built once and submitted again every frame.
+        // Tasks with no dependencies are queued when the graph is submitted. Every other task is queued by whichever
+        // task finishes its last dependency, so nothing in the graph ever waits and no fiber is parked on the way.
+        // Submitting allocates nothing, all the bookkeeping is laid out by Finalize.
+        class TaskGraph
+        {
+        public:
+            // Ranges [1, num tasks], 0 is invalid
+            using TaskId = uint32_t;
+
+        public:
+            TaskGraph();
+
+            TaskGraph(const TaskGraph&) = delete;
+            TaskGraph& operator=(const TaskGraph&) = delete;
+
+            // Priority, affinity and stack class are taken from the job, the counter is the graph's.
+            // Closure jobs from JobSystem::MakeJob work as long as their captures are stored inline.
+            TaskId AddTask(const JobSystem::Job& job);
+            TaskId AddTask(JobFunction jobFunction, void* pJobArgument);
+            // after only starts once before has finished
+            void AddDependency(TaskId before, TaskId after);
+
+            // Lays out the graph for submission. Fails if the dependencies form a cycle.
+            // Adding tasks or dependencies afterwards needs another Finalize.
+            bool Finalize();
+
+            // Queues every task without dependencies. The returned handle completes once the whole graph has run,
+            // give it back with JobSystem::Wait or ReleaseCounter. A graph can only be running once at a time.
+            JobSystem::CounterHandle Submit(JobSystem& jobSystem);
+            bool IsRunning() const;
+
+            uint32_t GetNumTasks() const;
+
+        private:
+            struct Task
+            {
+                explicit Task()
+                    : m_job{}
+                    , m_pGraph{ nullptr }
+                    , m_numPredecessors{ 0 }
+                    , m_firstSuccessor{ 0 }
+                    , m_numSuccessors{ 0 }
+                {
+                }
+
+                // What the task runs, the job actually queued calls this from TaskEntry
+                JobSystem::Job m_job;
+                TaskGraph* m_pGraph;
+                uint32_t m_numPredecessors;
+                // Range in m_successors
+                uint32_t m_firstSuccessor;
+                uint32_t m_numSuccessors;
+            };
+
+            static void TaskEntry(void* pArg);
+            // Queues every successor whose last dependency this was
+            void OnTaskFinished(const Task& task);
+            // The job that runs the given task through TaskEntry
+            JobSystem::Job MakeTaskJob(TaskId taskId);
+
+        private:
+            std::vector<Task> m_tasks;
+            // (before, after) pairs as they were added
+            std::vector<std::pair<TaskId, TaskId>> m_dependencies;
+            bool m_isFinalized;
+
+            // Laid out by Finalize
+            std::vector<TaskId> m_successors;
+            std::vector<JobSystem::Job> m_rootJobs;
+            // Per task dependencies still running, reset on every submit
+            std::unique_ptr<std::atomic<uint32_t>[]> m_upNumPendingPredecessors;
+
+            // State of the current run
+            JobSystem* m_pJobSystem;
+            JobSystem::CounterHandle m_counterHandle;
+            std::atomic<uint32_t> m_numUnfinishedTasks;
+        };
+    }
+}
@@ -22,11 +22,21 @@ namespace Farlor
     constexpr bool DebugD3D11Mode = true;
     constexpr uint32_t ProfilerNBufferCount = 5;
 
+    // The CPU tracer's CloudLightVolume size, 250m voxels. CloudLightVolume.hlsl works the spacing out from the size.
+    constexpr uint32_t LightVolumeWidth = 240;
+    constexpr uint32_t LightVolumeNumLayers = 60;
+    constexpr uint32_t LightVolumeDepth = 40;
+
+    // March one pixel of each block a frame and reproject the rest from the frame before, Reprojection.hlsl
+    constexpr bool CloudReprojection = true;
+    constexpr uint32_t ReprojectionBlockSize = 4;
+
     D3D11SpatiotemporalFilterBackend::D3D11SpatiotemporalFilterBackend(const Renderer& renderer)
         : D3D11Backend(renderer)
         , m_gpuProfiler{ static_cast<uint32_t>(ProfileEvent::NumEvents), ProfilerNBufferCount }
         , m_frameCount{ 0 }
         , m_iterativeFrameCount{ 0 }
+        , m_isLightVolumeBuilt{ false }
         , m_previousCamera{}
         , m_cpGeometryNormalOSRTV{ nullptr }
         , m_cpGeometryNormalWSRTV{ nullptr }
@@ -41,8 +51,14 @@ namespace Farlor
         , m_cpGeometryVelocityBufferSRV{ nullptr }
         , m_cpCloudBufferUAV{ nullptr }
         , m_cpCloudBufferSRV{ nullptr }
+        , m_cpPreviousCloudBufferUAV{ nullptr }
+        , m_cpPreviousCloudBufferSRV{ nullptr }
+        , m_cpLightVolumeUAV{ nullptr }
+        , m_cpLightVolumeSRV{ nullptr }
         , m_cpClearHDRImageBufferCS{ nullptr }
         , m_cpCloudTraceCS{ nullptr }
+        , m_cpCloudLightVolumeCS{ nullptr }
+        , m_cpCloudReprojectionCS{ nullptr }
         , m_cpGBufferVS{ nullptr }
         , m_cpGBufferPS{ nullptr }
         , m_cpTonemappingVS{ nullptr }
@@ -302,7 +318,8 @@ namespace Farlor
             }
         }
 
-        // Cloud buffer and views
+        // Cloud buffers and views, the one traced this frame and the one traced the frame before that it reprojects
+        // from. They swap at the end of every frame.
         {
             D3D11_BUFFER_DESC pathTracerBufferDesc;
             ZeroMemory(&pathTracerBufferDesc, sizeof(pathTracerBufferDesc));
@@ -313,9 +330,80 @@ namespace Farlor
             pathTracerBufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
             pathTracerBufferDesc.StructureByteStride = sizeof(float) * 4;
 
-            // Create required render targets
-            Microsoft::WRL::ComPtr<ID3D11Buffer> m_cpPathTracerBuffer = nullptr;
-            result = m_cpDevice->CreateBuffer(&pathTracerBufferDesc, 0, m_cpPathTracerBuffer.GetAddressOf());
+            const std::string bufferNames[2] = { std::string("Cloud Buffer"), std::string("Previous Cloud Buffer") };
+            Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView>* pBufferUAVs[2] = { &m_cpCloudBufferUAV, &m_cpPreviousCloudBufferUAV };
+            Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>* pBufferSRVs[2] = { &m_cpCloudBufferSRV, &m_cpPreviousCloudBufferSRV };
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                // Create required render targets
+                Microsoft::WRL::ComPtr<ID3D11Buffer> cpCloudBuffer = nullptr;
+                result = m_cpDevice->CreateBuffer(&pathTracerBufferDesc, 0, cpCloudBuffer.GetAddressOf());
+                if (FAILED(result))
+                {
+                    // TODO: LOG ERROR
+                    return;
+                }
+
+                if constexpr(DebugD3D11Mode)
+                {
+                    D3D11DebugUtils::SetDebugName(cpCloudBuffer.Get(), bufferNames[i]);
+                }
+
+                // Create UAV
+                D3D11_UNORDERED_ACCESS_VIEW_DESC pathTracingUAVDesc;
+                ZeroMemory(&pathTracingUAVDesc, sizeof(pathTracingUAVDesc));
+                pathTracingUAVDesc.Format = DXGI_FORMAT_UNKNOWN;
+                pathTracingUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+                pathTracingUAVDesc.Buffer.FirstElement = 0;
+                pathTracingUAVDesc.Buffer.NumElements = pathTracerBufferDesc.ByteWidth / pathTracerBufferDesc.StructureByteStride;
+                result = m_cpDevice->CreateUnorderedAccessView(cpCloudBuffer.Get(), &pathTracingUAVDesc, pBufferUAVs[i]->GetAddressOf());
+                if (FAILED(result))
+                {
+                    // TODO: LOG ERROR
+                    return;
+                }
+
+                if constexpr(DebugD3D11Mode)
+                {
+                    D3D11DebugUtils::SetDebugName(pBufferUAVs[i]->Get(), bufferNames[i] + std::string(" UAV"));
+                }
+
+                D3D11_SHADER_RESOURCE_VIEW_DESC pathTracingSRVDesc;
+                ZeroMemory(&pathTracingSRVDesc, sizeof(pathTracingSRVDesc));
+                pathTracingSRVDesc.Format = DXGI_FORMAT_UNKNOWN;
+                pathTracingSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+                pathTracingSRVDesc.BufferEx.FirstElement = 0;
+                pathTracingSRVDesc.BufferEx.NumElements = pathTracerBufferDesc.ByteWidth / pathTracerBufferDesc.StructureByteStride;
+                result = m_cpDevice->CreateShaderResourceView(cpCloudBuffer.Get(), &pathTracingSRVDesc, pBufferSRVs[i]->GetAddressOf());
+                if (FAILED(result))
+                {
+                    // TODO: LOG ERROR
+                    return;
+                }
+
+                if constexpr(DebugD3D11Mode)
+                {
+                    D3D11DebugUtils::SetDebugName(pBufferSRVs[i]->Get(), bufferNames[i] + std::string(" SRV"));
+                }
+            }
+        }
+
+        // Cloud light volume and views
+        {
+            D3D11_TEXTURE3D_DESC textureDesc;
+            ZeroMemory(&textureDesc, sizeof(textureDesc));
+            textureDesc.Width = LightVolumeWidth;
+            textureDesc.Height = LightVolumeNumLayers;
+            textureDesc.Depth = LightVolumeDepth;
+            textureDesc.MipLevels = 1;
+            textureDesc.Format = DXGI_FORMAT_R32_FLOAT;
+            textureDesc.Usage = D3D11_USAGE_DEFAULT;
+            textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+            textureDesc.CPUAccessFlags = 0;
+            textureDesc.MiscFlags = 0;
+
+            Microsoft::WRL::ComPtr<ID3D11Texture3D> cpLightVolume = nullptr;
+            result = m_cpDevice->CreateTexture3D(&textureDesc, 0, cpLightVolume.GetAddressOf());
             if (FAILED(result))
             {
                 // TODO: LOG ERROR
@@ -324,17 +412,17 @@ namespace Farlor
 
             if constexpr(DebugD3D11Mode)
             {
-                D3D11DebugUtils::SetDebugName(m_cpPathTracerBuffer.Get(), std::string("Path Tracer Color Buffer"));
+                D3D11DebugUtils::SetDebugName(cpLightVolume.Get(), std::string("Cloud Light Volume"));
             }
 
-            // Create UAV
-            D3D11_UNORDERED_ACCESS_VIEW_DESC pathTracingUAVDesc;
-            ZeroMemory(&pathTracingUAVDesc, sizeof(pathTracingUAVDesc));
-            pathTracingUAVDesc.Format = DXGI_FORMAT_UNKNOWN;
-            pathTracingUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-            pathTracingUAVDesc.Buffer.FirstElement = 0;
-            pathTracingUAVDesc.Buffer.NumElements = pathTracerBufferDesc.ByteWidth / pathTracerBufferDesc.StructureByteStride;
-            result = m_cpDevice->CreateUnorderedAccessView(m_cpPathTracerBuffer.Get(), &pathTracingUAVDesc, m_cpCloudBufferUAV.GetAddressOf());
+            D3D11_UNORDERED_ACCESS_VIEW_DESC lightVolumeUAVDesc;
+            ZeroMemory(&lightVolumeUAVDesc, sizeof(lightVolumeUAVDesc));
+            lightVolumeUAVDesc.Format = textureDesc.Format;
+            lightVolumeUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE3D;
+            lightVolumeUAVDesc.Texture3D.MipSlice = 0;
+            lightVolumeUAVDesc.Texture3D.FirstWSlice = 0;
+            lightVolumeUAVDesc.Texture3D.WSize = LightVolumeDepth;
+            result = m_cpDevice->CreateUnorderedAccessView(cpLightVolume.Get(), &lightVolumeUAVDesc, m_cpLightVolumeUAV.GetAddressOf());
             if (FAILED(result))
             {
                 // TODO: LOG ERROR
@@ -343,16 +431,16 @@ namespace Farlor
 
             if constexpr(DebugD3D11Mode)
             {
-                D3D11DebugUtils::SetDebugName(m_cpCloudBufferUAV.Get(), std::string("Cloud Buffer UAV"));
+                D3D11DebugUtils::SetDebugName(m_cpLightVolumeUAV.Get(), std::string("Cloud Light Volume UAV"));
             }
 
-            D3D11_SHADER_RESOURCE_VIEW_DESC pathTracingSRVDesc;
-            ZeroMemory(&pathTracingSRVDesc, sizeof(pathTracingSRVDesc));
-            pathTracingSRVDesc.Format = DXGI_FORMAT_UNKNOWN;
-            pathTracingSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
-            pathTracingSRVDesc.BufferEx.FirstElement = 0;
-            pathTracingSRVDesc.BufferEx.NumElements = pathTracerBufferDesc.ByteWidth / pathTracerBufferDesc.StructureByteStride;
-            result = m_cpDevice->CreateShaderResourceView(m_cpPathTracerBuffer.Get(), &pathTracingSRVDesc, m_cpCloudBufferSRV.GetAddressOf());
+            D3D11_SHADER_RESOURCE_VIEW_DESC lightVolumeSRVDesc;
+            ZeroMemory(&lightVolumeSRVDesc, sizeof(lightVolumeSRVDesc));
+            lightVolumeSRVDesc.Format = textureDesc.Format;
+            lightVolumeSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE3D;
+            lightVolumeSRVDesc.Texture3D.MostDetailedMip = 0;
+            lightVolumeSRVDesc.Texture3D.MipLevels = 1;
+            result = m_cpDevice->CreateShaderResourceView(cpLightVolume.Get(), &lightVolumeSRVDesc, m_cpLightVolumeSRV.GetAddressOf());
             if (FAILED(result))
             {
                 // TODO: LOG ERROR
@@ -361,7 +449,7 @@ namespace Farlor
 
             if constexpr(DebugD3D11Mode)
             {
-                D3D11DebugUtils::SetDebugName(m_cpCloudBufferSRV.Get(), std::string("Cloud Buffer SRV"));
+                D3D11DebugUtils::SetDebugName(m_cpLightVolumeSRV.Get(), std::string("Cloud Light Volume SRV"));
             }
         }
 
@@ -494,6 +582,71 @@ namespace Farlor
             }
         }
 
+        // Cloud Light Volume CS
+        {
+            std::wstring filename = Utility::StringUtil::StringToWideString(m_resourceDir) + std::wstring(L"/shaders/hlsl/CloudLightVolume.hlsl");
+            Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob = nullptr;
+            Microsoft::WRL::ComPtr<ID3DBlob> errorBlob = nullptr;
+            // It includes CloudTrace.hlsl, whose CSMain still has to compile
+            D3D_SHADER_MACRO macros[] =
+            {
+                "USE_DEFAULT_THREAD_COUNTS", "true",
+                0, 0
+            };
+
+            result = D3DCompileFromFile(filename.c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "CSLightVolume", "cs_5_0", 0, 0, shaderBlob.GetAddressOf(), errorBlob.GetAddressOf());
+            if (FAILED(result))
+            {
+                std::string error(reinterpret_cast<char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
+                std::cout << "Failed to compile shader: " << error << std::endl;
+                return;
+            }
+
+            result = m_cpDevice->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, m_cpCloudLightVolumeCS.GetAddressOf());
+            if (FAILED(result))
+            {
+                // TODO: Log error
+                return;
+            }
+
+            if constexpr(DebugD3D11Mode)
+            {
+                D3D11DebugUtils::SetDebugName(m_cpCloudLightVolumeCS.Get(), std::string("Cloud Light Volume CS"));
+            }
+        }
+
+        // Cloud Reprojection CS
+        {
+            std::wstring filename = Utility::StringUtil::StringToWideString(m_resourceDir) + std::wstring(L"/shaders/hlsl/Reprojection.hlsl");
+            Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob = nullptr;
+            Microsoft::WRL::ComPtr<ID3DBlob> errorBlob = nullptr;
+            D3D_SHADER_MACRO macros[] =
+            {
+                "USE_DEFAULT_THREAD_COUNTS", "true",
+                0, 0
+            };
+
+            result = D3DCompileFromFile(filename.c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "CSReproject", "cs_5_0", 0, 0, shaderBlob.GetAddressOf(), errorBlob.GetAddressOf());
+            if (FAILED(result))
+            {
+                std::string error(reinterpret_cast<char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
+                std::cout << "Failed to compile shader: " << error << std::endl;
+                return;
+            }
+
+            result = m_cpDevice->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, m_cpCloudReprojectionCS.GetAddressOf());
+            if (FAILED(result))
+            {
+                // TODO: Log error
+                return;
+            }
+
+            if constexpr(DebugD3D11Mode)
+            {
+                D3D11DebugUtils::SetDebugName(m_cpCloudReprojectionCS.Get(), std::string("Cloud Reprojection CS"));
+            }
+        }
+
         // G-Buffer VS
         {
             std::wstring filename = Utility::StringUtil::StringToWideString(m_resourceDir) + std::wstring(L"/shaders/hlsl/STD_GeometryDeferred.hlsl");
@@ -828,8 +981,8 @@ namespace Farlor
             CBs::cbTimeValues data;
             data.DeltaTime = 0.0f;
             data.TotalTime = 0.0f;
-            data._pad[0] = 0.0f;
-            data._pad[1] = 0.0f;
+            data.FrameIndex = 0;
+            data.ReprojectHistory = 0;
 
             D3D11_SUBRESOURCE_DATA initialData;
             initialData.pSysMem = &data;
@@ -945,6 +1098,9 @@ namespace Farlor
             }
         }
 
+        // The light volume is built from the low frequency and weather textures just loaded
+        m_isLightVolumeBuilt = false;
+
         // Creat sampler
         {
             D3D11_SAMPLER_DESC samplerDesc;
@@ -1225,6 +1381,95 @@ namespace Farlor
         }
         m_gpuProfiler.EndTimingEvent(static_cast<uint32_t>(ProfileEvent::GBuffer));
 
+        // The previous frame's CloudBuffer can be reprojected from once there is one
+        const bool reprojectHistory = CloudReprojection && (m_frameCount > 0);
+
+        // Time Values, read by the cloud render and cloud reprojection passes
+        {
+            CBs::cbTimeValues timeValues;
+            timeValues.DeltaTime = deltaTime;
+            timeValues.TotalTime = totalTime;
+            timeValues.FrameIndex = m_frameCount;
+            timeValues.ReprojectHistory = reprojectHistory ? 1 : 0;
+
+            D3D11_MAPPED_SUBRESOURCE mappedResource;
+            ZeroMemory(&mappedResource, sizeof(mappedResource));
+            m_cpDeviceContext->Map(m_cpTimeValuesCb.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+            memcpy(mappedResource.pData, &timeValues, sizeof(CBs::cbTimeValues));
+            m_cpDeviceContext->Unmap(m_cpTimeValuesCb.Get(), 0);
+        }
+
+        // Cloud Light Volume Pass, only once the cloud textures are loaded
+        if (!m_isLightVolumeBuilt)
+        {
+            m_gpuProfiler.StartTimingEvent(static_cast<uint32_t>(ProfileEvent::CloudLightVolume));
+
+            // Push the light volume pass state. CloudLightVolume.hlsl includes CloudTrace.hlsl and reads the
+            // textures and sampler from the same slots.
+            {
+                m_cpDeviceContext->CSSetShader(m_cpCloudLightVolumeCS.Get(), 0, 0);
+
+                const uint32_t lightVolumeUAVSlot = 1;
+                const uint32_t numUAVS = 1;
+                ID3D11UnorderedAccessView* pUnorderedAccessViews[numUAVS];
+                pUnorderedAccessViews[0] = m_cpLightVolumeUAV.Get();
+                m_cpDeviceContext->CSSetUnorderedAccessViews(lightVolumeUAVSlot, numUAVS, pUnorderedAccessViews, 0);
+
+                const uint32_t numShaderResourceViews = 4;
+                ID3D11ShaderResourceView* pShaderResourceViews[numShaderResourceViews];
+                pShaderResourceViews[0] = m_cpLowFrequencySRV.Get();
+                pShaderResourceViews[1] = m_cpHighFrequencySRV.Get();
+                pShaderResourceViews[2] = m_cpCurlSRV.Get();
+                pShaderResourceViews[3] = m_cpWeatherSRV.Get();
+                m_cpDeviceContext->CSSetShaderResources(0, numShaderResourceViews, pShaderResourceViews);
+
+                const uint32_t numSamplerStates = 1;
+                ID3D11SamplerState* samplerStates[numSamplerStates];
+                samplerStates[0] = m_cpSamplerWrap.Get();
+                m_cpDeviceContext->CSSetSamplers(0, numSamplerStates, samplerStates);
+            }
+
+            // Dispatch the light volume pass
+            {
+                const uint32_t threadGroupX = 8;
+                const uint32_t threadGroupY = 4;
+                const uint32_t threadGroupZ = 8;
+
+                const uint32_t xDispatch = (LightVolumeWidth + threadGroupX - 1) / threadGroupX;
+                const uint32_t yDispatch = (LightVolumeNumLayers + threadGroupY - 1) / threadGroupY;
+                const uint32_t zDispatch = (LightVolumeDepth + threadGroupZ - 1) / threadGroupZ;
+                m_cpDeviceContext->Dispatch(xDispatch, yDispatch, zDispatch);
+            }
+
+            // Pop the light volume pass state
+            {
+                m_cpDeviceContext->CSSetShader(nullptr, 0, 0);
+
+                const uint32_t lightVolumeUAVSlot = 1;
+                const uint32_t numUAVS = 1;
+                ID3D11UnorderedAccessView* pUnorderedAccessViews[numUAVS];
+                pUnorderedAccessViews[0] = nullptr;
+                m_cpDeviceContext->CSSetUnorderedAccessViews(lightVolumeUAVSlot, numUAVS, pUnorderedAccessViews, 0);
+
+                const uint32_t numShaderResourceViews = 4;
+                ID3D11ShaderResourceView* pShaderResourceViews[numShaderResourceViews];
+                pShaderResourceViews[0] = nullptr;
+                pShaderResourceViews[1] = nullptr;
+                pShaderResourceViews[2] = nullptr;
+                pShaderResourceViews[3] = nullptr;
+                m_cpDeviceContext->CSSetShaderResources(0, numShaderResourceViews, pShaderResourceViews);
+
+                const uint32_t numSamplerStates = 1;
+                ID3D11SamplerState* samplerStates[numSamplerStates];
+                samplerStates[0] = nullptr;
+                m_cpDeviceContext->CSSetSamplers(0, numSamplerStates, samplerStates);
+            }
+
+            m_gpuProfiler.EndTimingEvent(static_cast<uint32_t>(ProfileEvent::CloudLightVolume));
+
+            m_isLightVolumeBuilt = true;
+        }
+
         // Push the Cloud Render Pass State
         m_gpuProfiler.StartTimingEvent(static_cast<uint32_t>(ProfileEvent::CloudTrace));
         {
@@ -1262,21 +1507,6 @@ namespace Farlor
                 m_cpDeviceContext->Unmap(m_cpOldCameraCb.Get(), 0);
             }
 
-            // Time Values
-            {
-                CBs::cbTimeValues timeValues;
-                timeValues.DeltaTime = deltaTime;
-                timeValues.TotalTime = totalTime;
-                timeValues._pad[0] = 0.0f;
-                timeValues._pad[1] = 0.0f;
-
-                D3D11_MAPPED_SUBRESOURCE mappedResource;
-                ZeroMemory(&mappedResource, sizeof(mappedResource));
-                m_cpDeviceContext->Map(m_cpTimeValuesCb.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-                memcpy(mappedResource.pData, &timeValues, sizeof(CBs::cbTimeValues));
-                m_cpDeviceContext->Unmap(m_cpTimeValuesCb.Get(), 0);
-            }
-
             // Set the shader
             m_cpDeviceContext->CSSetShader(m_cpCloudTraceCS.Get(), 0, 0);
 
@@ -1285,12 +1515,13 @@ namespace Farlor
             pUnorderedAccessViews[0] = m_cpCloudBufferUAV.Get();
             m_cpDeviceContext->CSSetUnorderedAccessViews(0, numUAVS, pUnorderedAccessViews, 0);
 
-            const uint32_t numShaderResourceViews = 4;
+            const uint32_t numShaderResourceViews = 5;
             ID3D11ShaderResourceView* pShaderResourceViews[numShaderResourceViews];
             pShaderResourceViews[0] = m_cpLowFrequencySRV.Get();
             pShaderResourceViews[1] = m_cpHighFrequencySRV.Get();
             pShaderResourceViews[2] = m_cpCurlSRV.Get();
             pShaderResourceViews[3] = m_cpWeatherSRV.Get();
+            pShaderResourceViews[4] = m_cpLightVolumeSRV.Get();
             m_cpDeviceContext->CSSetShaderResources(0, numShaderResourceViews, pShaderResourceViews);
 
             const uint32_t numConstBuffers = 3;
@@ -1306,17 +1537,25 @@ namespace Farlor
             m_cpDeviceContext->CSSetSamplers(0, numSamplerStates, samplerStates);
         }
 
-        // Dispatch the Cloud Render pass
+        // Dispatch the Cloud Render pass, a thread per block when it only marches one pixel of each
         {
             const uint32_t threadGroupX = 32;
             const uint32_t threadGroupY = 16;
 
-            uint32_t xDispatch = m_clientWidth / threadGroupX;
-            if (m_clientWidth % threadGroupX)
+            uint32_t traceWidth = m_clientWidth;
+            uint32_t traceHeight = m_clientHeight;
+            if (reprojectHistory)
+            {
+                traceWidth = (m_clientWidth + ReprojectionBlockSize - 1) / ReprojectionBlockSize;
+                traceHeight = (m_clientHeight + ReprojectionBlockSize - 1) / ReprojectionBlockSize;
+            }
+
+            uint32_t xDispatch = traceWidth / threadGroupX;
+            if (traceWidth % threadGroupX)
                 xDispatch++;
 
-            uint32_t yDispatch = m_clientHeight / threadGroupY;
-            if (m_clientHeight % threadGroupY)
+            uint32_t yDispatch = traceHeight / threadGroupY;
+            if (traceHeight % threadGroupY)
                 yDispatch++;
 
             m_cpDeviceContext->Dispatch(xDispatch, yDispatch, 1);
@@ -1331,12 +1570,13 @@ namespace Farlor
             pUnorderedAccessViews[0] = nullptr;
             m_cpDeviceContext->CSSetUnorderedAccessViews(0, numUAVS, pUnorderedAccessViews, 0);
 
-            const uint32_t numShaderResourceViews = 4;
+            const uint32_t numShaderResourceViews = 5;
             ID3D11ShaderResourceView* pShaderResourceViews[numShaderResourceViews];
             pShaderResourceViews[0] = nullptr;
             pShaderResourceViews[1] = nullptr;
             pShaderResourceViews[2] = nullptr;
             pShaderResourceViews[3] = nullptr;
+            pShaderResourceViews[4] = nullptr;
             m_cpDeviceContext->CSSetShaderResources(0, numShaderResourceViews, pShaderResourceViews);
 
             const uint32_t numConstBuffers = 3;
@@ -1353,6 +1593,87 @@ namespace Farlor
         }
         m_gpuProfiler.EndTimingEvent(static_cast<uint32_t>(ProfileEvent::CloudTrace));
 
+        // Cloud Reprojection Pass, the pixels the cloud render pass didn't march taken from the previous frame
+        if (reprojectHistory)
+        {
+            m_gpuProfiler.StartTimingEvent(static_cast<uint32_t>(ProfileEvent::CloudReprojection));
+
+            // Push the cloud reprojection pass state
+            {
+                m_cpDeviceContext->CSSetShader(m_cpCloudReprojectionCS.Get(), 0, 0);
+
+                const uint32_t numUAVS = 1;
+                ID3D11UnorderedAccessView* pUnorderedAccessViews[numUAVS];
+                pUnorderedAccessViews[0] = m_cpCloudBufferUAV.Get();
+                m_cpDeviceContext->CSSetUnorderedAccessViews(0, numUAVS, pUnorderedAccessViews, 0);
+
+                // Rejected pixels are marched, so it needs everything the cloud render pass does
+                const uint32_t numShaderResourceViews = 6;
+                ID3D11ShaderResourceView* pShaderResourceViews[numShaderResourceViews];
+                pShaderResourceViews[0] = m_cpLowFrequencySRV.Get();
+                pShaderResourceViews[1] = m_cpHighFrequencySRV.Get();
+                pShaderResourceViews[2] = m_cpCurlSRV.Get();
+                pShaderResourceViews[3] = m_cpWeatherSRV.Get();
+                pShaderResourceViews[4] = m_cpLightVolumeSRV.Get();
+                pShaderResourceViews[5] = m_cpPreviousCloudBufferSRV.Get();
+                m_cpDeviceContext->CSSetShaderResources(0, numShaderResourceViews, pShaderResourceViews);
+
+                const uint32_t numConstBuffers = 3;
+                ID3D11Buffer* constantBuffers[numConstBuffers];
+                constantBuffers[0] = m_cpNewCameraCb.Get();
+                constantBuffers[1] = m_cpOldCameraCb.Get();
+                constantBuffers[2] = m_cpTimeValuesCb.Get();
+                m_cpDeviceContext->CSSetConstantBuffers(0, numConstBuffers, constantBuffers);
+
+                const uint32_t numSamplerStates = 1;
+                ID3D11SamplerState* samplerStates[numSamplerStates];
+                samplerStates[0] = m_cpSamplerWrap.Get();
+                m_cpDeviceContext->CSSetSamplers(0, numSamplerStates, samplerStates);
+            }
+
+            // Dispatch the cloud reprojection pass
+            {
+                const uint32_t threadGroupX = 32;
+                const uint32_t threadGroupY = 16;
+
+                const uint32_t xDispatch = (m_clientWidth + threadGroupX - 1) / threadGroupX;
+                const uint32_t yDispatch = (m_clientHeight + threadGroupY - 1) / threadGroupY;
+                m_cpDeviceContext->Dispatch(xDispatch, yDispatch, 1);
+            }
+
+            // Pop the cloud reprojection pass state
+            {
+                m_cpDeviceContext->CSSetShader(nullptr, 0, 0);
+
+                const uint32_t numUAVS = 1;
+                ID3D11UnorderedAccessView* pUnorderedAccessViews[numUAVS];
+                pUnorderedAccessViews[0] = nullptr;
+                m_cpDeviceContext->CSSetUnorderedAccessViews(0, numUAVS, pUnorderedAccessViews, 0);
+
+                const uint32_t numShaderResourceViews = 6;
+                ID3D11ShaderResourceView* pShaderResourceViews[numShaderResourceViews];
+                for (uint32_t i = 0; i < numShaderResourceViews; ++i)
+                {
+                    pShaderResourceViews[i] = nullptr;
+                }
+                m_cpDeviceContext->CSSetShaderResources(0, numShaderResourceViews, pShaderResourceViews);
+
+                const uint32_t numConstBuffers = 3;
+                ID3D11Buffer* constantBuffers[numConstBuffers];
+                constantBuffers[0] = nullptr;
+                constantBuffers[1] = nullptr;
+                constantBuffers[2] = nullptr;
+                m_cpDeviceContext->CSSetConstantBuffers(0, numConstBuffers, constantBuffers);
+
+                const uint32_t numSamplerStates = 1;
+                ID3D11SamplerState* samplerStates[numSamplerStates];
+                samplerStates[0] = nullptr;
+                m_cpDeviceContext->CSSetSamplers(0, numSamplerStates, samplerStates);
+            }
+
+            m_gpuProfiler.EndTimingEvent(static_cast<uint32_t>(ProfileEvent::CloudReprojection));
+        }
+
         // Tonemap Pass
         m_gpuProfiler.StartTimingEvent(static_cast<uint32_t>(ProfileEvent::Tonemap));
         {
@@ -1438,6 +1759,13 @@ namespace Farlor
         // Cache the camera data as previous camera data
         m_previousCamera = currentCameraEntry;
 
+        // This frame's CloudBuffer is what the next one reprojects from
+        if constexpr (CloudReprojection)
+        {
+            m_cpCloudBufferUAV.Swap(m_cpPreviousCloudBufferUAV);
+            m_cpCloudBufferSRV.Swap(m_cpPreviousCloudBufferSRV);
+        }
+
         ++m_frameCount;
         ++m_iterativeFrameCount;
     }
@@ -33,6 +33,9 @@ namespace Farlor
         uint32_t m_frameCount;
         uint32_t m_iterativeFrameCount;
 
+        // The light volume is built once from the cloud textures, the wind only moves where it is looked up
+        bool m_isLightVolumeBuilt;
+
         // Temporal cached data
         Farlor::CameraEntry m_previousCamera;
 
@@ -52,15 +55,23 @@ namespace Farlor
         Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_cpGeometryNormalWSSRV;
         Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_cpGeometryVelocityBufferSRV;
 
-        // Cloud Buffer
+        // Cloud Buffer, and the one traced the frame before that it reprojects from
         Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_cpCloudBufferUAV;
         Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_cpCloudBufferSRV;
+        Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_cpPreviousCloudBufferUAV;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_cpPreviousCloudBufferSRV;
+
+        // Cloud light volume
+        Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_cpLightVolumeUAV;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_cpLightVolumeSRV;
 
         // Clear HDR image buffer
         Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cpClearHDRImageBufferCS;
 
         // PathTracing Compute
         Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cpCloudTraceCS;
+        Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cpCloudLightVolumeCS;
+        Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cpCloudReprojectionCS;
             
         // G-Buffer Pass
         Microsoft::WRL::ComPtr<ID3D11VertexShader> m_cpGBufferVS;
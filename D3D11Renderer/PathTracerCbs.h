@@ -38,7 +38,9 @@ namespace Farlor
         {
             float DeltaTime;
             float TotalTime;
-            float _pad[2];
+            uint32_t FrameIndex;
+            // 1 when the previous CloudBuffer can be reprojected from
+            uint32_t ReprojectHistory;
         };
         static_assert(sizeof(cbTimeValues) % 16 == 0, "cbTimeValues is not multiple of 16");
 
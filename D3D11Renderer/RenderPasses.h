@@ -10,6 +10,8 @@ namespace Farlor
         CloudTrace = ClearBuffers + 1,
         Tonemap = CloudTrace + 1,
         GBuffer = Tonemap + 1,
-        NumEvents = GBuffer + 1
+        CloudLightVolume = GBuffer + 1,
+        CloudReprojection = CloudLightVolume + 1,
+        NumEvents = CloudReprojection + 1
     };
 }
\ No newline at end of file
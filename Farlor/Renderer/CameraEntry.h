@@ -1,6 +1,6 @@
 #pragma once
 
-#include <Fmath/FMath.h>
+#include <FMath/FMath.h>
 
 namespace Farlor
 {
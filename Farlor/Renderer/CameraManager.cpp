@@ -42,4 +42,17 @@ namespace Farlor
         m_pCurrentCamera = iter->second.get();
         return m_pCurrentCamera;
     }
+
+    CameraEntry CameraManager::CaptureCamera() const
+    {
+        CameraEntry currentCameraEntry;
+        currentCameraEntry.m_position = m_pCurrentCamera->GetWorldPosition();
+        currentCameraEntry.m_target = m_pCurrentCamera->GetWorldTarget();
+        currentCameraEntry.m_worldUp = m_pCurrentCamera->GetWorldUp();
+        currentCameraEntry.m_fov = m_pCurrentCamera->GetFOV();
+        currentCameraEntry.m_cameraMoved = m_pCurrentCamera->MovedInFrame();
+        currentCameraEntry.m_view = m_pCurrentCamera->GetView();
+        currentCameraEntry.m_proj = m_pCurrentCamera->GetProj();
+        return currentCameraEntry;
+    }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Camera.h"
+#include "CameraEntry.h"
 
 #include <memory>
 #include <string>
@@ -24,6 +25,9 @@ namespace Farlor
 
         Camera* SetMainCamera(std::string& cameraName);
 
+        // What the renderer needs of the current camera this frame
+        CameraEntry CaptureCamera() const;
+
     private:
         Camera* m_pCurrentCamera;
         std::unordered_map<std::string, std::unique_ptr<Camera>> m_registeredCameras;
@@ -0,0 +1,309 @@
+#include "CloudBufferFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace Farlor
+{
+    namespace
+    {
+        bool IsLittleEndian()
+        {
+            const uint32_t value = 1;
+            uint8_t firstByte = 0;
+            std::memcpy(&firstByte, &value, 1);
+            return firstByte == 1;
+        }
+
+        float SwapBytes(float value)
+        {
+            uint8_t bytes[sizeof(float)];
+            std::memcpy(bytes, &value, sizeof(float));
+            std::swap(bytes[0], bytes[3]);
+            std::swap(bytes[1], bytes[2]);
+            std::memcpy(&value, bytes, sizeof(float));
+            return value;
+        }
+
+        // EXR is little endian whatever the host is
+        void AppendLittleEndian(std::vector<uint8_t>& bytes, uint64_t value, uint32_t numBytes)
+        {
+            for (uint32_t i = 0; i < numBytes; ++i)
+            {
+                bytes.push_back(static_cast<uint8_t>(value >> (i * 8)));
+            }
+        }
+
+        void AppendLittleEndian(std::vector<uint8_t>& bytes, float value)
+        {
+            uint32_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(float));
+            AppendLittleEndian(bytes, bits, 4);
+        }
+
+        // PNG is big endian
+        void AppendBigEndian(std::vector<uint8_t>& bytes, uint32_t value)
+        {
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                bytes.push_back(static_cast<uint8_t>(value >> ((3 - i) * 8)));
+            }
+        }
+
+        void AppendString(std::vector<uint8_t>& bytes, const char* pString)
+        {
+            bytes.insert(bytes.end(), pString, pString + std::strlen(pString) + 1);
+        }
+
+        void AppendExrAttribute(std::vector<uint8_t>& bytes, const char* pName, const char* pType, uint32_t size)
+        {
+            AppendString(bytes, pName);
+            AppendString(bytes, pType);
+            AppendLittleEndian(bytes, size, 4);
+        }
+
+        uint32_t Crc32(const uint8_t* pData, size_t size)
+        {
+            uint32_t crc = 0xFFFFFFFFu;
+            for (size_t i = 0; i < size; ++i)
+            {
+                crc ^= pData[i];
+                for (uint32_t bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+                }
+            }
+            return ~crc;
+        }
+
+        void AppendPngChunk(std::vector<uint8_t>& png, const char* pType, const std::vector<uint8_t>& data)
+        {
+            AppendBigEndian(png, static_cast<uint32_t>(data.size()));
+            const size_t typeStart = png.size();
+            png.insert(png.end(), pType, pType + 4);
+            png.insert(png.end(), data.begin(), data.end());
+            // The CRC covers the type and the data, not the length
+            AppendBigEndian(png, Crc32(&png[typeStart], png.size() - typeStart));
+        }
+
+        bool WriteBytes(const std::string& filename, const std::vector<uint8_t>& bytes)
+        {
+            std::ofstream file(filename, std::ios::binary);
+            if (!file)
+            {
+                std::cout << "Failed to open " << filename << " for writing" << std::endl;
+                return false;
+            }
+            file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            return static_cast<bool>(file);
+        }
+    }
+
+    bool WriteCloudBufferPfm(const std::string& filename, const CloudPixel* pCloudBuffer, uint32_t width, uint32_t height)
+    {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Failed to open " << filename << " for writing" << std::endl;
+            return false;
+        }
+
+        // A negative scale marks little endian data
+        file << "PF\n" << width << " " << height << "\n" << (IsLittleEndian() ? "-1.0" : "1.0") << "\n";
+
+        std::vector<float> row(static_cast<size_t>(width) * 3);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            const CloudPixel* pRow = &pCloudBuffer[static_cast<size_t>(height - 1 - y) * width];
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                row[x * 3 + 0] = pRow[x].r;
+                row[x * 3 + 1] = pRow[x].g;
+                row[x * 3 + 2] = pRow[x].b;
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        }
+        return static_cast<bool>(file);
+    }
+
+    bool ReadCloudBufferPfm(const std::string& filename, std::vector<CloudPixel>& cloudBuffer, uint32_t& width, uint32_t& height)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        std::string magic;
+        float scale = 0.0f;
+        file >> magic >> width >> height >> scale;
+        if (!file || magic != "PF" || width == 0 || height == 0)
+        {
+            std::cout << "Failed to read colour PFM " << filename << std::endl;
+            return false;
+        }
+        // Exactly one whitespace character separates the header from the data
+        file.get();
+
+        const bool swapBytes = (scale < 0.0f) != IsLittleEndian();
+        std::vector<float> row(static_cast<size_t>(width) * 3);
+        cloudBuffer.resize(static_cast<size_t>(width) * height);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            if (!file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float)))
+            {
+                std::cout << "Truncated PFM " << filename << std::endl;
+                return false;
+            }
+
+            CloudPixel* pRow = &cloudBuffer[static_cast<size_t>(height - 1 - y) * width];
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                float rgb[3] = { row[x * 3 + 0], row[x * 3 + 1], row[x * 3 + 2] };
+                if (swapBytes)
+                {
+                    for (float& channel : rgb)
+                    {
+                        channel = SwapBytes(channel);
+                    }
+                }
+                pRow[x] = CloudPixel{ rgb[0], rgb[1], rgb[2], 1.0f };
+            }
+        }
+        return true;
+    }
+
+    bool WriteCloudBufferExr(const std::string& filename, const CloudPixel* pCloudBuffer, uint32_t width, uint32_t height)
+    {
+        constexpr uint32_t NumChannels = 3;
+        constexpr uint32_t FloatPixelType = 2;
+
+        std::vector<uint8_t> bytes;
+        // Magic number, then version 2 with no flags, a single part scanline file
+        AppendLittleEndian(bytes, 20000630, 4);
+        AppendLittleEndian(bytes, 2, 4);
+
+        // Channels are listed in alphabetical order, and stored in that order in every scanline
+        const char* channelNames[NumChannels] = { "B", "G", "R" };
+        AppendExrAttribute(bytes, "channels", "chlist", NumChannels * 18 + 1);
+        for (const char* pChannelName : channelNames)
+        {
+            AppendString(bytes, pChannelName);
+            AppendLittleEndian(bytes, FloatPixelType, 4);
+            // pLinear and three reserved bytes, then the x and y sampling
+            AppendLittleEndian(bytes, 0, 4);
+            AppendLittleEndian(bytes, 1, 4);
+            AppendLittleEndian(bytes, 1, 4);
+        }
+        bytes.push_back(0);
+
+        AppendExrAttribute(bytes, "compression", "compression", 1);
+        bytes.push_back(0);
+
+        for (const char* pWindowName : { "dataWindow", "displayWindow" })
+        {
+            AppendExrAttribute(bytes, pWindowName, "box2i", 16);
+            AppendLittleEndian(bytes, 0, 4);
+            AppendLittleEndian(bytes, 0, 4);
+            AppendLittleEndian(bytes, width - 1, 4);
+            AppendLittleEndian(bytes, height - 1, 4);
+        }
+
+        // Increasing y
+        AppendExrAttribute(bytes, "lineOrder", "lineOrder", 1);
+        bytes.push_back(0);
+
+        AppendExrAttribute(bytes, "pixelAspectRatio", "float", 4);
+        AppendLittleEndian(bytes, 1.0f);
+
+        AppendExrAttribute(bytes, "screenWindowCenter", "v2f", 8);
+        AppendLittleEndian(bytes, 0.0f);
+        AppendLittleEndian(bytes, 0.0f);
+
+        AppendExrAttribute(bytes, "screenWindowWidth", "float", 4);
+        AppendLittleEndian(bytes, 1.0f);
+        bytes.push_back(0);
+
+        // One scanline per block, every block the same size, so the offset table can be written up front
+        const uint32_t lineDataSize = width * NumChannels * static_cast<uint32_t>(sizeof(float));
+        const uint64_t firstLineOffset = bytes.size() + static_cast<uint64_t>(height) * sizeof(uint64_t);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            AppendLittleEndian(bytes, firstLineOffset + static_cast<uint64_t>(y) * (8 + lineDataSize), 8);
+        }
+
+        bytes.reserve(bytes.size() + static_cast<size_t>(height) * (8 + lineDataSize));
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            AppendLittleEndian(bytes, y, 4);
+            AppendLittleEndian(bytes, lineDataSize, 4);
+
+            const CloudPixel* pRow = &pCloudBuffer[static_cast<size_t>(y) * width];
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                AppendLittleEndian(bytes, pRow[x].b);
+            }
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                AppendLittleEndian(bytes, pRow[x].g);
+            }
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                AppendLittleEndian(bytes, pRow[x].r);
+            }
+        }
+        return WriteBytes(filename, bytes);
+    }
+
+    bool WriteRgba8Png(const std::string& filename, const uint8_t* pRgba8, uint32_t width, uint32_t height)
+    {
+        // Deflate stored blocks hold at most 65535 bytes
+        constexpr size_t MaxStoredBlockSize = 65535;
+
+        std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+        std::vector<uint8_t> header;
+        AppendBigEndian(header, width);
+        AppendBigEndian(header, height);
+        // 8 bit RGBA, deflate, adaptive filtering, no interlacing
+        header.insert(header.end(), { 8, 6, 0, 0, 0 });
+        AppendPngChunk(png, "IHDR", header);
+
+        // Every scanline starts with its filter type, 0 leaves the row as is
+        const size_t rowSize = static_cast<size_t>(width) * 4;
+        std::vector<uint8_t> scanlines;
+        scanlines.reserve((rowSize + 1) * height);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            scanlines.push_back(0);
+            const uint8_t* pRow = &pRgba8[y * rowSize];
+            scanlines.insert(scanlines.end(), pRow, pRow + rowSize);
+        }
+
+        // zlib stream: header for deflate with a 32K window, stored blocks, then the Adler-32 of the scanlines
+        std::vector<uint8_t> imageData = { 0x78, 0x01 };
+        imageData.reserve(scanlines.size() + (scanlines.size() / MaxStoredBlockSize + 1) * 5 + 6);
+        size_t blockStart = 0;
+        do
+        {
+            const size_t blockSize = std::min(MaxStoredBlockSize, scanlines.size() - blockStart);
+            const bool isFinalBlock = (blockStart + blockSize == scanlines.size());
+            imageData.push_back(isFinalBlock ? 1 : 0);
+            AppendLittleEndian(imageData, blockSize, 2);
+            AppendLittleEndian(imageData, ~blockSize & 0xFFFF, 2);
+            imageData.insert(imageData.end(), scanlines.begin() + blockStart, scanlines.begin() + blockStart + blockSize);
+            blockStart += blockSize;
+        } while (blockStart < scanlines.size());
+
+        uint32_t adlerLow = 1;
+        uint32_t adlerHigh = 0;
+        for (uint8_t byte : scanlines)
+        {
+            adlerLow = (adlerLow + byte) % 65521;
+            adlerHigh = (adlerHigh + adlerLow) % 65521;
+        }
+        AppendBigEndian(imageData, (adlerHigh << 16) | adlerLow);
+        AppendPngChunk(png, "IDAT", imageData);
+
+        AppendPngChunk(png, "IEND", {});
+        return WriteBytes(filename, png);
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "CloudTracer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Farlor
+{
+    // Portable float map of the rgb of a CloudBuffer, the usual way to hand HDR reference frames around.
+    // Rows are written bottom up as the format expects, alpha is dropped since the shader always writes 1.
+    bool WriteCloudBufferPfm(const std::string& filename, const CloudPixel* pCloudBuffer, uint32_t width, uint32_t height);
+
+    // Reads a colour PFM back into CloudBuffer order with alpha 1, converting from big endian if needed
+    bool ReadCloudBufferPfm(const std::string& filename, std::vector<CloudPixel>& cloudBuffer, uint32_t& width, uint32_t& height);
+
+    // Uncompressed scanline OpenEXR of the rgb of a CloudBuffer as 32 bit float channels, top row first
+    bool WriteCloudBufferExr(const std::string& filename, const CloudPixel* pCloudBuffer, uint32_t width, uint32_t height);
+
+    // 8 bit RGBA PNG of a tonemapped frame, top row first. The image data goes into stored deflate blocks,
+    // so the files are as big as the frame but need no zlib.
+    bool WriteRgba8Png(const std::string& filename, const uint8_t* pRgba8, uint32_t width, uint32_t height);
+}
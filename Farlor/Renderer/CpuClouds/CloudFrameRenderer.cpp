@@ -0,0 +1,142 @@
+#include "CloudFrameRenderer.h"
+
+#include "CloudBufferFile.h"
+#include "CloudTonemap.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace Farlor
+{
+    namespace
+    {
+        constexpr uint32_t NumLowFrequencySlices = 128;
+
+        // Loads the first of the DDS files that exists
+        bool LoadDDS(CloudTexture& texture, const std::vector<std::string>& filenames)
+        {
+            for (const std::string& filename : filenames)
+            {
+                if (std::ifstream(filename).good())
+                {
+                    return texture.LoadDDS(filename);
+                }
+            }
+            return false;
+        }
+    }
+
+    bool LoadCloudTextures(const std::string& resourceDir, CloudTexture& lowFrequency, CloudTexture& weatherMap)
+    {
+        const std::string textureDir = resourceDir + "/textures/";
+
+        // The volume DDS is assembled from the slices by texassemble, fall back to the slices when it is missing
+        if (!LoadDDS(lowFrequency, { textureDir + "LowFrequency/LowFrequency.dds" })
+            && !lowFrequency.LoadTgaSlices(textureDir + "LowFrequency/LowFrequency", NumLowFrequencySlices))
+        {
+            return false;
+        }
+
+        // The renderer loads weatherMap.dds, the file on disk is weatherMap.DDS
+        return LoadDDS(weatherMap, { textureDir + "weatherMap.dds", textureDir + "weatherMap.DDS" });
+    }
+
+    CloudFrameRenderer::CloudFrameRenderer(FarlorJobs::JobSystem& jobSystem, const Settings& settings)
+        : m_jobSystem{ jobSystem }
+        , m_settings{ settings }
+        , m_numFramesRendered{ 0 }
+        , m_lowFrequency{}
+        , m_weatherMap{}
+        , m_upTracer{ nullptr }
+        , m_cloudBuffer{}
+        , m_previousCloudBuffer{}
+        , m_previousParams{}
+        , m_tonemappedFrame{}
+        , m_lastFrameStats{}
+    {
+    }
+
+    bool CloudFrameRenderer::Initialize(const std::string& resourceDir)
+    {
+        if (m_settings.m_width == 0 || m_settings.m_height == 0)
+        {
+            std::cout << "Error, cannot render " << m_settings.m_width << "x" << m_settings.m_height << " frames" << std::endl;
+            return false;
+        }
+
+        if (!LoadCloudTextures(resourceDir, m_lowFrequency, m_weatherMap))
+        {
+            std::cout << "Error, could not load the cloud textures from " << resourceDir << std::endl;
+            return false;
+        }
+
+        m_upTracer = std::make_unique<CloudTracer>(m_lowFrequency, m_weatherMap);
+        const size_t numPixels = static_cast<size_t>(m_settings.m_width) * m_settings.m_height;
+        m_cloudBuffer.resize(numPixels);
+        if (m_settings.m_reproject)
+        {
+            m_previousCloudBuffer.resize(numPixels);
+        }
+        m_tonemappedFrame.resize(numPixels * 4);
+        return true;
+    }
+
+    bool CloudFrameRenderer::RenderFrame(CloudTraceParams params)
+    {
+        if (!m_upTracer)
+        {
+            return false;
+        }
+
+        params.m_screenWidth = m_settings.m_width;
+        params.m_screenHeight = m_settings.m_height;
+        params.m_frameIndex = m_numFramesRendered;
+        if (params.m_march.m_useLightVolume)
+        {
+            m_upTracer->UpdateLightVolume(m_jobSystem);
+        }
+
+        if (m_settings.m_reproject)
+        {
+            // The last frame becomes the history, the one before it is traced over
+            m_cloudBuffer.swap(m_previousCloudBuffer);
+            CloudTraceHistory history;
+            history.m_params = m_previousParams;
+            history.m_pCloudBuffer = (m_numFramesRendered > 0) ? m_previousCloudBuffer.data() : nullptr;
+            m_upTracer->TraceReprojected(m_jobSystem, params, history, m_cloudBuffer.data(), &m_lastFrameStats);
+            m_previousParams = params;
+        }
+        else
+        {
+            m_upTracer->Trace(m_jobSystem, params, m_cloudBuffer.data(), &m_lastFrameStats);
+        }
+        TonemapCloudBuffer(m_jobSystem, m_cloudBuffer.data(), m_settings.m_width, m_settings.m_height, m_tonemappedFrame.data());
+
+        bool succeeded = true;
+        if (m_settings.m_writePfm)
+        {
+            succeeded &= WriteCloudBufferPfm(MakeFilename("pfm"), m_cloudBuffer.data(), m_settings.m_width, m_settings.m_height);
+        }
+        if (m_settings.m_writeExr)
+        {
+            succeeded &= WriteCloudBufferExr(MakeFilename("exr"), m_cloudBuffer.data(), m_settings.m_width, m_settings.m_height);
+        }
+        if (m_settings.m_writePng)
+        {
+            succeeded &= WriteRgba8Png(MakeFilename("png"), m_tonemappedFrame.data(), m_settings.m_width, m_settings.m_height);
+        }
+
+        ++m_numFramesRendered;
+        return succeeded;
+    }
+
+    std::string CloudFrameRenderer::MakeFilename(const char* pExtension) const
+    {
+        std::ostringstream filename;
+        filename << m_settings.m_outputDir << "/" << m_settings.m_filePrefix << "_" << std::setw(4) << std::setfill('0')
+            << m_numFramesRendered << "." << pExtension;
+        return filename.str();
+    }
+}
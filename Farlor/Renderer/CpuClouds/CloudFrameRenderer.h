@@ -0,0 +1,101 @@
+#pragma once
+
+#include "CloudTexture.h"
+#include "CloudTracer.h"
+
+#include <JobSystem.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Farlor
+{
+    // Loads the cloud textures the renderer uses out of <resourceDir>/textures. The low frequency volume falls back to
+    // its TGA slices when the assembled DDS is missing.
+    bool LoadCloudTextures(const std::string& resourceDir, CloudTexture& lowFrequency, CloudTexture& weatherMap);
+
+    // Renders whole frames without a GPU: traces the CloudBuffer, tonemaps it like the tonemap pass and writes the
+    // frames out as files. Used by the headless backend, which the offline render tool renders through.
+    class CloudFrameRenderer
+    {
+    public:
+        struct Settings
+        {
+            Settings()
+                : m_width{ 960 }
+                , m_height{ 540 }
+                , m_outputDir{ "." }
+                , m_filePrefix{ "frame" }
+                , m_writePfm{ false }
+                , m_writeExr{ false }
+                , m_writePng{ true }
+                , m_reproject{ true }
+            {
+            }
+
+            uint32_t m_width;
+            uint32_t m_height;
+            // Frames are written to <outputDir>/<filePrefix>_<frame number>.<extension>
+            std::string m_outputDir;
+            std::string m_filePrefix;
+            // HDR CloudBuffer, before tonemapping
+            bool m_writePfm;
+            bool m_writeExr;
+            // The tonemapped frame as it would be presented
+            bool m_writePng;
+            // March one pixel of each 4x4 block a frame and reproject the rest from the frame before, as the GPU does
+            bool m_reproject;
+        };
+
+    public:
+        CloudFrameRenderer(FarlorJobs::JobSystem& jobSystem, const Settings& settings);
+
+        bool Initialize(const std::string& resourceDir);
+
+        // Renders and writes the next frame. The screen size in params is replaced by the settings' size and the frame
+        // index by the number of frames rendered.
+        bool RenderFrame(CloudTraceParams params);
+
+        uint32_t GetNumFramesRendered() const
+        {
+            return m_numFramesRendered;
+        }
+
+        const std::vector<CloudPixel>& GetCloudBuffer() const
+        {
+            return m_cloudBuffer;
+        }
+
+        const std::vector<uint8_t>& GetTonemappedFrame() const
+        {
+            return m_tonemappedFrame;
+        }
+
+        // Samples the last frame's trace took
+        const CloudTraceStats& GetLastFrameStats() const
+        {
+            return m_lastFrameStats;
+        }
+
+    private:
+        std::string MakeFilename(const char* pExtension) const;
+
+    private:
+        FarlorJobs::JobSystem& m_jobSystem;
+        Settings m_settings;
+        uint32_t m_numFramesRendered;
+
+        CloudTexture m_lowFrequency;
+        CloudTexture m_weatherMap;
+        std::unique_ptr<CloudTracer> m_upTracer;
+
+        std::vector<CloudPixel> m_cloudBuffer;
+        // The frame before, what reprojection reprojects from
+        std::vector<CloudPixel> m_previousCloudBuffer;
+        CloudTraceParams m_previousParams;
+        std::vector<uint8_t> m_tonemappedFrame;
+        CloudTraceStats m_lastFrameStats;
+    };
+}
@@ -0,0 +1,116 @@
+#include "CloudLightVolume.h"
+#include "CloudTracerInternal.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace Farlor
+{
+    namespace
+    {
+        constexpr float LayerThickness = (CloudTracerInternal::AtmosphereRadiusOuter - CloudTracerInternal::AtmosphereRadiusInner)
+            / CloudLightVolume::NumLayers;
+        constexpr float VoxelWidth = CloudTracerInternal::WeatherMapScale / CloudLightVolume::Width;
+        constexpr float VoxelDepth = CloudTracerInternal::LowFrequencyScale / CloudLightVolume::Depth;
+
+        // The layers wrap like the other axes. Kept between the first and last layers' centers, a sample never blends
+        // the top of the layer with the bottom.
+        float ClampHeightFraction(float heightFraction)
+        {
+            const float halfLayer = 0.5f / CloudLightVolume::NumLayers;
+            return std::min(std::max(heightFraction, halfLayer), 1.0f - halfLayer);
+        }
+    }
+
+    CloudLightVolume::CloudLightVolume()
+        : m_voxels{}
+        , m_isBuilt{ false }
+    {
+    }
+
+    void CloudLightVolume::Build(FarlorJobs::JobSystem& jobSystem, const CloudTexture& lowFrequency, const CloudTexture& weatherMap)
+    {
+        using namespace CloudTracerInternal;
+
+        m_voxels.resize(static_cast<size_t>(Width) * NumLayers * Depth);
+        // Wind space, the wind's offset at total time 0
+        const CloudVector3 windOffset = GetWindOffset(0.0f);
+
+        // One column of voxels per iteration. The light samples go straight up, so every voxel's samples are the
+        // densities at the centers of its layer and the 5 above it, and each density is only taken once.
+        FarlorJobs::ParallelFor(jobSystem, 0, Width * Depth, 1, [&](uint32_t columnIndex)
+            {
+                const uint32_t x = columnIndex % Width;
+                const uint32_t z = columnIndex / Width;
+
+                float densities[NumLayers + NumLightSamples - 1];
+                for (uint32_t layer = 0; layer < NumLayers + NumLightSamples - 1; ++layer)
+                {
+                    // The flat layer puts the altitude in y
+                    const CloudVector3 layerCenter((x + 0.5f) * VoxelWidth, AtmosphereRadiusInner + (layer + 0.5f) * LayerThickness,
+                        (z + 0.5f) * VoxelDepth);
+                    const float heightFraction = (layer + 0.5f) / NumLayers;
+
+                    float weather[4];
+                    weatherMap.Sample(layerCenter.x / WeatherMapScale, layerCenter.y / WeatherMapScale, 0.0f, weather);
+                    densities[layer] = SampleBaseCloudDensity(lowFrequency, layerCenter, weather, heightFraction, windOffset) * SubstinenceDensity;
+                }
+
+                // PerformCloudMarch's light samples
+                for (uint32_t layer = 0; layer < NumLayers; ++layer)
+                {
+                    float lightDensity = 0.0f;
+                    float combinedColor = 0.0f;
+                    for (uint32_t l = 0; l < NumLightSamples; ++l)
+                    {
+                        lightDensity += densities[layer + l];
+                        combinedColor += std::exp(-LightAbsorption * lightDensity) * LightSampleScale;
+                    }
+                    m_voxels[x + Width * (layer + NumLayers * static_cast<size_t>(z))] = combinedColor;
+                }
+            });
+
+        m_isBuilt = true;
+    }
+
+    void CloudLightVolume::Invalidate()
+    {
+        m_isBuilt = false;
+    }
+
+    float CloudLightVolume::Sample(float x, float heightFraction, float z) const
+    {
+        uint32_t x0 = 0;
+        uint32_t x1 = 0;
+        float weightX = 0.0f;
+        WrapLinear(x / CloudTracerInternal::WeatherMapScale, Width, x0, x1, weightX);
+
+        uint32_t y0 = 0;
+        uint32_t y1 = 0;
+        float weightY = 0.0f;
+        WrapLinear(ClampHeightFraction(heightFraction), NumLayers, y0, y1, weightY);
+
+        uint32_t z0 = 0;
+        uint32_t z1 = 0;
+        float weightZ = 0.0f;
+        WrapLinear(z / CloudTracerInternal::LowFrequencyScale, Depth, z0, z1, weightZ);
+
+        const size_t slicePitch = static_cast<size_t>(Width) * NumLayers;
+        const float* pSlices[2] = { &m_voxels[z0 * slicePitch], &m_voxels[z1 * slicePitch] };
+        float slices[2];
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            const float* pVoxels = pSlices[i];
+            const float c00 = pVoxels[y0 * Width + x0];
+            const float c10 = pVoxels[y0 * Width + x1];
+            const float c01 = pVoxels[y1 * Width + x0];
+            const float c11 = pVoxels[y1 * Width + x1];
+            const float top = c00 + (c10 - c00) * weightX;
+            const float bottom = c01 + (c11 - c01) * weightX;
+            slices[i] = top + (bottom - top) * weightY;
+        }
+        return slices[0] + (slices[1] - slices[0]) * weightZ;
+    }
+}
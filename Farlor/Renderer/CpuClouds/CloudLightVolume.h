@@ -0,0 +1,58 @@
+#pragma once
+
+#include "CloudTexture.h"
+
+#include <JobSystem.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace Farlor
+{
+    // The light the march's 6 samples towards the sun give each point of the cloud layer, worked out once so a lit
+    // sample can look its light up instead of marching. It doesn't depend on the camera or the time: it is built in
+    // wind space, the clouds where they are at total time 0, and looked up with the point moved along with the wind.
+    // That carries the weather map's coverage along with the noise, which the march doesn't, and leaves out the
+    // wind's small upward drift.
+    // The layer is taken as flat: x wraps with the weather map, z with the low frequency noise, both of which the
+    // density repeats with, and y goes through the layer's height fraction, one light step per layer. The sun is
+    // thousands of kilometers up and stays within a fraction of a degree of overhead across the layer, so the light
+    // samples go straight up. They use the true height fraction and that fixed step, not the view ray's, and clouds
+    // far from the origin, where the earth curves away from the flat layer, are only approximated.
+    class CloudLightVolume
+    {
+    public:
+        // 250m across, each layer a 333m light step deep
+        static constexpr uint32_t Width = 240;
+        static constexpr uint32_t NumLayers = 60;
+        static constexpr uint32_t Depth = 40;
+
+    public:
+        CloudLightVolume();
+
+        // Marches every voxel towards the sun, a column of voxels per job iteration. Runs inline outside the job system.
+        void Build(FarlorJobs::JobSystem& jobSystem, const CloudTexture& lowFrequency, const CloudTexture& weatherMap);
+
+        // Forgets the volume, the textures it was built from have changed
+        void Invalidate();
+
+        bool IsBuilt() const
+        {
+            return m_isBuilt;
+        }
+
+        // Trilinear, wrapping in x and z. Height fractions outside the layer take the light of the nearest layer.
+        // x and z are in wind space, the point's plus the wind's offset at the frame's time.
+        float Sample(float x, float heightFraction, float z) const;
+
+        // Light per voxel, row by row, layer by layer
+        const float* GetVoxels() const
+        {
+            return m_voxels.data();
+        }
+
+    private:
+        std::vector<float> m_voxels;
+        bool m_isBuilt;
+    };
+}
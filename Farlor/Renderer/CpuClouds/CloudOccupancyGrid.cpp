@@ -0,0 +1,469 @@
+#include "CloudOccupancyGrid.h"
+#include "CloudTracerInternal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Farlor
+{
+    namespace
+    {
+        // Height fractions the cell bounds are worked out for. Steps past the last one are never skipped.
+        constexpr uint32_t NumHeightFractionBins = 256;
+        constexpr double MaxHeightFraction = 2.0;
+
+        // Cells with coverage outside [0, 1] can't be bounded, Remap divides by 1 - coverage
+        constexpr float NeverEmpty = -1.0f;
+
+        // Slack for the float rounding in the density and in the sample positions
+        constexpr double DensityBoundSlack = 1.0e-3;
+        constexpr float HeightFractionSlack = 1.0e-4f;
+
+        // Bilinear samples read the texels either side of them. Cells also take in the texel beyond those,
+        // so positions that round across a cell's edge are still covered.
+        constexpr int32_t FootprintRadius = 2;
+
+        // c[0] + c[1] h + c[2] h^2 + c[3] h^3
+        struct Cubic
+        {
+            double c[4];
+        };
+
+        // Remap(h, originalMin, originalMax, newMin, newMax) is a line in h
+        Cubic RemapLine(double originalMin, double originalMax, double newMin, double newMax)
+        {
+            const double slope = (newMax - newMin) / (originalMax - originalMin);
+            return Cubic{ { newMin - originalMin * slope, slope, 0.0, 0.0 } };
+        }
+
+        Cubic Add(const Cubic& a, const Cubic& b)
+        {
+            return Cubic{ { a.c[0] + b.c[0], a.c[1] + b.c[1], a.c[2] + b.c[2], a.c[3] + b.c[3] } };
+        }
+
+        Cubic Subtract(const Cubic& a, const Cubic& b)
+        {
+            return Cubic{ { a.c[0] - b.c[0], a.c[1] - b.c[1], a.c[2] - b.c[2], a.c[3] - b.c[3] } };
+        }
+
+        // Only used where the product is at most cubic
+        Cubic Multiply(const Cubic& a, const Cubic& b)
+        {
+            Cubic product{ { 0.0, 0.0, 0.0, 0.0 } };
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                for (uint32_t j = 0; i + j < 4; ++j)
+                {
+                    product.c[i + j] += a.c[i] * b.c[j];
+                }
+            }
+            return product;
+        }
+
+        double Evaluate(const Cubic& cubic, double h)
+        {
+            return ((cubic.c[3] * h + cubic.c[2]) * h + cubic.c[1]) * h + cubic.c[0];
+        }
+
+        // Largest value on [0, maxH], at an end or where the derivative is 0
+        double MaxOnInterval(const Cubic& cubic, double maxH)
+        {
+            double maxValue = std::max(Evaluate(cubic, 0.0), Evaluate(cubic, maxH));
+
+            const double a = 3.0 * cubic.c[3];
+            const double b = 2.0 * cubic.c[2];
+            const double c = cubic.c[1];
+            double roots[2] = { -1.0, -1.0 };
+            if (a == 0.0)
+            {
+                if (b != 0.0)
+                {
+                    roots[0] = -c / b;
+                }
+            }
+            else
+            {
+                const double discriminant = b * b - 4.0 * a * c;
+                if (discriminant >= 0.0)
+                {
+                    roots[0] = (-b - std::sqrt(discriminant)) / (2.0 * a);
+                    roots[1] = (-b + std::sqrt(discriminant)) / (2.0 * a);
+                }
+            }
+
+            for (double root : roots)
+            {
+                if (root > 0.0 && root < maxH)
+                {
+                    maxValue = std::max(maxValue, Evaluate(cubic, root));
+                }
+            }
+            return maxValue;
+        }
+
+        // DensityHeightAtPoint(h, g) = base(h) + a(g) stratusToStrato(h) + b(g) stratoToCumulus(h), where a and b are
+        // its clamped stratusToStratoAmount and stratoToCumulusAmount. Each table holds the largest value of a term
+        // for height fractions in [0, bin * MaxHeightFraction / NumHeightFractionBins].
+        struct HeightGradientBounds
+        {
+            double m_base[NumHeightFractionBins + 1];
+            double m_stratusToStrato[NumHeightFractionBins + 1];
+            double m_stratoToCumulus[NumHeightFractionBins + 1];
+        };
+
+        void MakeHeightGradientBounds(HeightGradientBounds& bounds)
+        {
+            const Cubic stratus = Multiply(RemapLine(0.0, 0.1, 0.0, 1.0), RemapLine(0.2, 0.3, 1.0, 0.0));
+            const Cubic strato = Multiply(RemapLine(0.0, 0.2, 0.0, 1.0), RemapLine(0.45, 0.6, 1.0, 0.0));
+            const Cubic cumulus = Multiply(RemapLine(0.0, 0.1, 0.0, 1.0), RemapLine(0.7, 0.95, 1.0, 0.0));
+
+            // Lerp(Lerp(stratus, strato, a), Lerp(strato, cumulus, b), h) multiplied out
+            const Cubic h{ { 0.0, 1.0, 0.0, 0.0 } };
+            const Cubic oneMinusH{ { 1.0, -1.0, 0.0, 0.0 } };
+            const Cubic base = Add(Multiply(oneMinusH, stratus), Multiply(h, strato));
+            const Cubic stratusToStrato = Multiply(oneMinusH, Subtract(strato, stratus));
+            const Cubic stratoToCumulus = Multiply(h, Subtract(cumulus, strato));
+
+            for (uint32_t bin = 0; bin <= NumHeightFractionBins; ++bin)
+            {
+                const double maxH = bin * MaxHeightFraction / NumHeightFractionBins;
+                bounds.m_base[bin] = MaxOnInterval(base, maxH);
+                bounds.m_stratusToStrato[bin] = MaxOnInterval(stratusToStrato, maxH);
+                bounds.m_stratoToCumulus[bin] = MaxOnInterval(stratoToCumulus, maxH);
+            }
+        }
+
+        // Largest base cloud, Remap(r, -(1 - fBm), 1, 0, 1), the low frequency noise can produce. Filtering keeps r and
+        // the fBm within their texel ranges, and the base cloud is monotonic in each. Negative when it is unbounded
+        // or can go below 0, in which case nothing is skipped.
+        double MaxBaseCloud(const CloudTexture& lowFrequency)
+        {
+            const size_t numTexels = static_cast<size_t>(lowFrequency.GetWidth()) * lowFrequency.GetHeight() * lowFrequency.GetDepth();
+            const float* pTexels = lowFrequency.GetTexels();
+            double minR = std::numeric_limits<double>::infinity();
+            double maxR = -std::numeric_limits<double>::infinity();
+            double minFbm = std::numeric_limits<double>::infinity();
+            double maxFbm = -std::numeric_limits<double>::infinity();
+            for (size_t i = 0; i < numTexels; ++i)
+            {
+                const float* pTexel = &pTexels[i * 4];
+                const double fbm = (pTexel[1] * 0.625) + (pTexel[2] * 0.25) + (pTexel[3] * 0.125);
+                minR = std::min(minR, static_cast<double>(pTexel[0]));
+                maxR = std::max(maxR, static_cast<double>(pTexel[0]));
+                minFbm = std::min(minFbm, fbm);
+                maxFbm = std::max(maxFbm, fbm);
+            }
+
+            if (numTexels == 0 || !(maxFbm < 2.0) || !(maxR < std::numeric_limits<double>::infinity()))
+            {
+                return -1.0;
+            }
+
+            double minBaseCloud = std::numeric_limits<double>::infinity();
+            double maxBaseCloud = -std::numeric_limits<double>::infinity();
+            for (double r : { minR, maxR })
+            {
+                for (double fbm : { minFbm, maxFbm })
+                {
+                    const double baseCloud = (r + 1.0 - fbm) / (2.0 - fbm);
+                    minBaseCloud = std::min(minBaseCloud, baseCloud);
+                    maxBaseCloud = std::max(maxBaseCloud, baseCloud);
+                }
+            }
+            return (minBaseCloud >= 0.0) ? maxBaseCloud : -1.0;
+        }
+
+        // Min and max of one channel over each texel's footprint, wrapping like the sampler
+        void FootprintRange(const CloudTexture& weatherMap, uint32_t channel, std::vector<float>& minValues, std::vector<float>& maxValues)
+        {
+            const int32_t width = static_cast<int32_t>(weatherMap.GetWidth());
+            const int32_t height = static_cast<int32_t>(weatherMap.GetHeight());
+            const float* pTexels = weatherMap.GetTexels();
+
+            std::vector<float> rowMin(static_cast<size_t>(width) * height);
+            std::vector<float> rowMax(rowMin.size());
+            for (int32_t y = 0; y < height; ++y)
+            {
+                for (int32_t x = 0; x < width; ++x)
+                {
+                    float minValue = std::numeric_limits<float>::infinity();
+                    float maxValue = -std::numeric_limits<float>::infinity();
+                    for (int32_t offset = -FootprintRadius; offset <= FootprintRadius; ++offset)
+                    {
+                        const int32_t sampleX = ((x + offset) % width + width) % width;
+                        const float value = pTexels[(static_cast<size_t>(y) * width + sampleX) * 4 + channel];
+                        // NaNs turn into an empty range, which no cell counts as empty
+                        minValue = (value >= minValue) ? minValue : value;
+                        maxValue = (value <= maxValue) ? maxValue : value;
+                    }
+                    rowMin[static_cast<size_t>(y) * width + x] = minValue;
+                    rowMax[static_cast<size_t>(y) * width + x] = maxValue;
+                }
+            }
+
+            minValues.resize(rowMin.size());
+            maxValues.resize(rowMin.size());
+            for (int32_t y = 0; y < height; ++y)
+            {
+                for (int32_t x = 0; x < width; ++x)
+                {
+                    float minValue = std::numeric_limits<float>::infinity();
+                    float maxValue = -std::numeric_limits<float>::infinity();
+                    for (int32_t offset = -FootprintRadius; offset <= FootprintRadius; ++offset)
+                    {
+                        const int32_t sampleY = ((y + offset) % height + height) % height;
+                        const size_t index = static_cast<size_t>(sampleY) * width + x;
+                        minValue = (rowMin[index] >= minValue) ? minValue : rowMin[index];
+                        maxValue = (rowMax[index] <= maxValue) ? maxValue : rowMax[index];
+                    }
+                    minValues[static_cast<size_t>(y) * width + x] = minValue;
+                    maxValues[static_cast<size_t>(y) * width + x] = maxValue;
+                }
+            }
+        }
+
+        float Saturate(float value)
+        {
+            return std::min(std::max(value, 0.0f), 1.0f);
+        }
+
+        // The largest height fraction up to which a cell with these weather ranges has no density
+        float EmptyHeightFraction(const HeightGradientBounds& bounds, double maxBaseCloud,
+            float minCoverage, float maxCoverage, float minType, float maxType)
+        {
+            // The density is max(Remap(baseCloud * gradient, coverage, 1, 0, 1) * coverage, 0). For coverage in [0, 1]
+            // it is only positive where baseCloud * gradient > coverage.
+            if (!(minCoverage >= 0.0f && maxCoverage <= 1.0f && minType <= maxType))
+            {
+                return NeverEmpty;
+            }
+            if (maxCoverage <= 0.0f)
+            {
+                return std::numeric_limits<float>::infinity();
+            }
+
+            const double minStratusToStrato = Saturate(minType * 2.0f);
+            const double maxStratusToStrato = Saturate(maxType * 2.0f);
+            const double minStratoToCumulus = Saturate((minType - 0.5f) * 2.0f);
+            const double maxStratoToCumulus = Saturate((maxType - 0.5f) * 2.0f);
+            auto isEmpty = [&](uint32_t bin)
+            {
+                const double stratusToStrato = bounds.m_stratusToStrato[bin];
+                const double stratoToCumulus = bounds.m_stratoToCumulus[bin];
+                const double maxGradient = bounds.m_base[bin]
+                    + ((stratusToStrato > 0.0) ? maxStratusToStrato : minStratusToStrato) * stratusToStrato
+                    + ((stratoToCumulus > 0.0) ? maxStratoToCumulus : minStratoToCumulus) * stratoToCumulus;
+                return maxGradient <= 0.0 || maxBaseCloud * maxGradient * (1.0 + DensityBoundSlack) <= minCoverage;
+            };
+
+            // The bounds only grow with the bin, so search for the last empty one. At height fraction 0 the gradient
+            // is exactly 0, the first bin is always empty.
+            uint32_t lowBin = 0;
+            uint32_t highBin = NumHeightFractionBins + 1;
+            while (highBin - lowBin > 1)
+            {
+                const uint32_t bin = (lowBin + highBin) / 2;
+                if (isEmpty(bin))
+                {
+                    lowBin = bin;
+                }
+                else
+                {
+                    highBin = bin;
+                }
+            }
+            return static_cast<float>(lowBin * MaxHeightFraction / NumHeightFractionBins);
+        }
+    }
+
+    CloudOccupancyGrid::CloudOccupancyGrid()
+        : m_weatherWidth{ 0 }
+        , m_weatherHeight{ 0 }
+        , m_levels{}
+    {
+    }
+
+    void CloudOccupancyGrid::Build(const CloudTexture& lowFrequency, const CloudTexture& weatherMap)
+    {
+        m_levels.clear();
+        m_weatherWidth = weatherMap.GetWidth();
+        m_weatherHeight = weatherMap.GetHeight();
+        if (!lowFrequency.IsLoaded() || !weatherMap.IsLoaded())
+        {
+            return;
+        }
+
+        const double maxBaseCloud = MaxBaseCloud(lowFrequency);
+        if (maxBaseCloud < 0.0)
+        {
+            return;
+        }
+
+        HeightGradientBounds bounds;
+        MakeHeightGradientBounds(bounds);
+
+        std::vector<float> minCoverage;
+        std::vector<float> maxCoverage;
+        FootprintRange(weatherMap, 0, minCoverage, maxCoverage);
+        std::vector<float> minType;
+        std::vector<float> maxType;
+        FootprintRange(weatherMap, 1, minType, maxType);
+
+        Level finestLevel;
+        finestLevel.m_width = m_weatherWidth;
+        finestLevel.m_height = m_weatherHeight;
+        finestLevel.m_cellSize = 1;
+        finestLevel.m_emptyHeightFractions.resize(minCoverage.size());
+        for (size_t i = 0; i < minCoverage.size(); ++i)
+        {
+            finestLevel.m_emptyHeightFractions[i] = EmptyHeightFraction(bounds, maxBaseCloud, minCoverage[i], maxCoverage[i], minType[i], maxType[i]);
+        }
+        m_levels.push_back(std::move(finestLevel));
+
+        // Each coarser cell is only as empty as the least empty of its 2x2 children
+        while (m_levels.back().m_width > 1 || m_levels.back().m_height > 1)
+        {
+            const Level& fineLevel = m_levels.back();
+            Level coarseLevel;
+            coarseLevel.m_width = (fineLevel.m_width + 1) / 2;
+            coarseLevel.m_height = (fineLevel.m_height + 1) / 2;
+            coarseLevel.m_cellSize = fineLevel.m_cellSize * 2;
+            coarseLevel.m_emptyHeightFractions.resize(static_cast<size_t>(coarseLevel.m_width) * coarseLevel.m_height);
+            for (uint32_t y = 0; y < coarseLevel.m_height; ++y)
+            {
+                for (uint32_t x = 0; x < coarseLevel.m_width; ++x)
+                {
+                    float emptyHeightFraction = std::numeric_limits<float>::infinity();
+                    for (uint32_t fineY = y * 2; fineY < std::min(y * 2 + 2, fineLevel.m_height); ++fineY)
+                    {
+                        for (uint32_t fineX = x * 2; fineX < std::min(x * 2 + 2, fineLevel.m_width); ++fineX)
+                        {
+                            emptyHeightFraction = std::min(emptyHeightFraction, fineLevel.m_emptyHeightFractions[fineY * fineLevel.m_width + fineX]);
+                        }
+                    }
+                    coarseLevel.m_emptyHeightFractions[y * coarseLevel.m_width + x] = emptyHeightFraction;
+                }
+            }
+            m_levels.push_back(std::move(coarseLevel));
+        }
+    }
+
+    CloudOccupancyGrid::MarchRay CloudOccupancyGrid::MakeMarchRay(const CloudVector3& cameraPos, const CloudVector3& startTracePos,
+        const CloudVector3& traceDir, float stepSize) const
+    {
+        MarchRay ray;
+        ray.m_startX = startTracePos.x;
+        ray.m_startY = startTracePos.y;
+        ray.m_stepX = traceDir.x * stepSize;
+        ray.m_stepY = traceDir.y * stepSize;
+
+        if (startTracePos.y < cameraPos.y && traceDir.y * stepSize <= 0.0f)
+        {
+            // Every sample is below the camera, where the height fraction is exactly 0
+            ray.m_heightFractionPerStep = 0.0f;
+            ray.m_heightFractionBias = 0.0f;
+        }
+        else
+        {
+            // The height fraction is |cosTheta| * (|p - camera| - |start - camera|) / thickness,
+            // and |p - camera| - |start - camera| is at most |p - start|
+            const float thickness = CloudTracerInternal::AtmosphereRadiusOuter - CloudTracerInternal::AtmosphereRadiusInner;
+            ray.m_heightFractionPerStep = std::fabs(stepSize) / thickness * (1.0f + HeightFractionSlack);
+            ray.m_heightFractionBias = HeightFractionSlack;
+        }
+        return ray;
+    }
+
+    uint32_t CloudOccupancyGrid::CountEmptySteps(const MarchRay& ray, uint32_t stepIndex, uint32_t numSteps, uint32_t& numStepsToSample) const
+    {
+        const uint32_t stepsLeft = numSteps - stepIndex;
+        numStepsToSample = stepsLeft;
+        if (m_levels.empty())
+        {
+            return 0;
+        }
+
+        // Position in weather map texels, before the sampler's half texel offset
+        const float step = static_cast<float>(stepIndex);
+        const float u = (ray.m_startX + ray.m_stepX * step) / CloudTracerInternal::WeatherMapScale;
+        const float v = (ray.m_startY + ray.m_stepY * step) / CloudTracerInternal::WeatherMapScale;
+        const float s = (u - std::floor(u)) * m_weatherWidth;
+        const float t = (v - std::floor(v)) * m_weatherHeight;
+        const float stepS = ray.m_stepX / CloudTracerInternal::WeatherMapScale * m_weatherWidth;
+        const float stepT = ray.m_stepY / CloudTracerInternal::WeatherMapScale * m_weatherHeight;
+        const float heightFraction = ray.m_heightFractionPerStep * step + ray.m_heightFractionBias;
+
+        uint32_t numEmptySteps = 0;
+        for (size_t levelIndex = 0; levelIndex < m_levels.size(); ++levelIndex)
+        {
+            float emptyHeightFraction = 0.0f;
+            const uint32_t numStepsInCell = CountStepsInCell(m_levels[levelIndex], s, t, stepS, stepT, stepsLeft, emptyHeightFraction);
+
+            // Only the steps whose height fraction can't pass the cell's bound
+            uint32_t numEmptyStepsInCell = 0;
+            if (heightFraction <= emptyHeightFraction)
+            {
+                numEmptyStepsInCell = numStepsInCell;
+                if (ray.m_heightFractionPerStep > 0.0f)
+                {
+                    const float lastEmptyStep = std::floor((emptyHeightFraction - ray.m_heightFractionBias) / ray.m_heightFractionPerStep);
+                    if (lastEmptyStep - step + 1.0f < static_cast<float>(numStepsInCell))
+                    {
+                        numEmptyStepsInCell = static_cast<uint32_t>(std::max(lastEmptyStep - step + 1.0f, 0.0f));
+                    }
+                }
+            }
+
+            if (numEmptyStepsInCell == 0)
+            {
+                // The height fraction only grows, so the rest of an occupied finest cell stays occupied
+                if (levelIndex == 0)
+                {
+                    numStepsToSample = numStepsInCell;
+                }
+                break;
+            }
+            numEmptySteps = std::max(numEmptySteps, numEmptyStepsInCell);
+        }
+        return numEmptySteps;
+    }
+
+    uint32_t CloudOccupancyGrid::CountStepsInCell(const Level& level, float s, float t, float stepS, float stepT, uint32_t stepsLeft,
+        float& emptyHeightFraction) const
+    {
+        const uint32_t cellX = std::min(static_cast<uint32_t>(s) / level.m_cellSize, level.m_width - 1);
+        const uint32_t cellY = std::min(static_cast<uint32_t>(t) / level.m_cellSize, level.m_height - 1);
+        emptyHeightFraction = level.m_emptyHeightFractions[cellY * level.m_width + cellX];
+
+        const float lowS = static_cast<float>(cellX * level.m_cellSize);
+        const float highS = static_cast<float>(std::min((cellX + 1) * level.m_cellSize, m_weatherWidth));
+        const float lowT = static_cast<float>(cellY * level.m_cellSize);
+        const float highT = static_cast<float>(std::min((cellY + 1) * level.m_cellSize, m_weatherHeight));
+
+        float stepsToExit = std::numeric_limits<float>::infinity();
+        if (stepS > 0.0f)
+        {
+            stepsToExit = (highS - s) / stepS;
+        }
+        else if (stepS < 0.0f)
+        {
+            stepsToExit = (s - lowS) / -stepS;
+        }
+        if (stepT > 0.0f)
+        {
+            stepsToExit = std::min(stepsToExit, (highT - t) / stepT);
+        }
+        else if (stepT < 0.0f)
+        {
+            stepsToExit = std::min(stepsToExit, (t - lowT) / -stepT);
+        }
+
+        // The last step counted is on the cell's edge at most, well within the footprint's extra texel
+        if (!(stepsToExit < static_cast<float>(stepsLeft - 1)))
+        {
+            return stepsLeft;
+        }
+        return static_cast<uint32_t>(stepsToExit) + 1;
+    }
+}
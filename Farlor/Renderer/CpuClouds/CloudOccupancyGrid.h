@@ -0,0 +1,64 @@
+#pragma once
+
+#include "CloudTexture.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Farlor
+{
+    struct CloudVector3;
+
+    // Coarse bound on where the march's cheap density samples can be non zero, for jumping over empty space.
+    // The weather map is only sampled with x and y, so the grid is 2D over its texels with coarser levels of 2x2
+    // cells on top. Every cell keeps the largest height fraction up to which nothing in it can have density, worked
+    // out from the cell's coverage and cloud type range, the height gradient and the largest base cloud the low
+    // frequency noise can give. Only samples that would have come out 0 are ever skipped.
+    class CloudOccupancyGrid
+    {
+    public:
+        // What the grid needs to know about one march
+        struct MarchRay
+        {
+            // xy of the first sample and of one step, the weather map's coordinates
+            float m_startX;
+            float m_startY;
+            float m_stepX;
+            float m_stepY;
+            // The height fraction at step i is at most i * m_heightFractionPerStep + m_heightFractionBias
+            float m_heightFractionPerStep;
+            float m_heightFractionBias;
+        };
+
+    public:
+        CloudOccupancyGrid();
+
+        // Has to be called again whenever the weather map or the low frequency noise changes
+        void Build(const CloudTexture& lowFrequency, const CloudTexture& weatherMap);
+
+        MarchRay MakeMarchRay(const CloudVector3& cameraPos, const CloudVector3& startTracePos, const CloudVector3& traceDir, float stepSize) const;
+
+        // The number of steps from stepIndex on that can be skipped, taken from the coarsest level that is empty.
+        // When it is 0, numStepsToSample is how many steps from stepIndex on have to be sampled before it is worth
+        // asking again.
+        uint32_t CountEmptySteps(const MarchRay& ray, uint32_t stepIndex, uint32_t numSteps, uint32_t& numStepsToSample) const;
+
+    private:
+        struct Level
+        {
+            uint32_t m_width;
+            uint32_t m_height;
+            // Cell size in level 0 cells
+            uint32_t m_cellSize;
+            std::vector<float> m_emptyHeightFractions;
+        };
+
+        // Steps from stepIndex on that stay within the cell at level levelIndex, or within a texel of it
+        uint32_t CountStepsInCell(const Level& level, float s, float t, float stepS, float stepT, uint32_t stepsLeft, float& emptyHeightFraction) const;
+
+    private:
+        uint32_t m_weatherWidth;
+        uint32_t m_weatherHeight;
+        std::vector<Level> m_levels;
+    };
+}
@@ -0,0 +1,423 @@
+#include "CloudTexture.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace Farlor
+{
+    namespace
+    {
+        constexpr uint32_t DdsMagic = 0x20534444; // "DDS "
+        constexpr uint32_t DdsHeaderSize = 124;
+        constexpr uint32_t DdsDx10FourCC = 0x30315844; // "DX10"
+        constexpr uint32_t DdsPixelFormatFourCC = 0x4;
+        constexpr uint32_t DdsPixelFormatRgb = 0x40;
+        constexpr uint32_t DdsCaps2Volume = 0x200000;
+
+        // D3DFORMAT values used as FourCCs by legacy float DDS files
+        constexpr uint32_t D3dFormatA16B16G16R16F = 113;
+        constexpr uint32_t D3dFormatA32B32G32R32F = 116;
+
+        constexpr uint32_t DxgiFormatR32G32B32A32Float = 2;
+        constexpr uint32_t DxgiFormatR16G16B16A16Float = 10;
+        constexpr uint32_t DxgiFormatR8G8B8A8Unorm = 28;
+        constexpr uint32_t DxgiFormatB8G8R8A8Unorm = 87;
+
+        constexpr uint8_t TgaUncompressedTrueColor = 2;
+        constexpr uint8_t TgaRleTrueColor = 10;
+        constexpr uint8_t TgaTopLeftOrigin = 0x20;
+
+        enum class TexelFormat : uint32_t
+        {
+            Unknown = 0,
+            Rgba8 = Unknown + 1,
+            Bgra8 = Rgba8 + 1,
+            Rgba16Float = Bgra8 + 1,
+            Rgba32Float = Rgba16Float + 1,
+        };
+
+        uint32_t ReadUint32(const uint8_t* pBytes)
+        {
+            return static_cast<uint32_t>(pBytes[0]) | (static_cast<uint32_t>(pBytes[1]) << 8)
+                | (static_cast<uint32_t>(pBytes[2]) << 16) | (static_cast<uint32_t>(pBytes[3]) << 24);
+        }
+
+        uint16_t ReadUint16(const uint8_t* pBytes)
+        {
+            return static_cast<uint16_t>(pBytes[0] | (pBytes[1] << 8));
+        }
+
+        float HalfToFloat(uint16_t half)
+        {
+            const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+            const uint32_t exponent = (half >> 10) & 0x1f;
+            const uint32_t mantissa = half & 0x3ff;
+
+            float value = 0.0f;
+            if (exponent == 0)
+            {
+                // Zero or denormal
+                value = std::ldexp(static_cast<float>(mantissa), -24);
+            }
+            else if (exponent == 0x1f)
+            {
+                const uint32_t bits = 0x7f800000 | (mantissa << 13);
+                std::memcpy(&value, &bits, sizeof(value));
+            }
+            else
+            {
+                const uint32_t bits = ((exponent + 112) << 23) | (mantissa << 13);
+                std::memcpy(&value, &bits, sizeof(value));
+            }
+            return (sign != 0) ? -value : value;
+        }
+
+        uint32_t BytesPerTexel(TexelFormat format)
+        {
+            switch (format)
+            {
+            case TexelFormat::Rgba8:
+            case TexelFormat::Bgra8:
+                return 4;
+            case TexelFormat::Rgba16Float:
+                return 8;
+            case TexelFormat::Rgba32Float:
+                return 16;
+            default:
+                return 0;
+            }
+        }
+
+        void DecodeTexel(TexelFormat format, const uint8_t* pTexel, float* pRgba)
+        {
+            switch (format)
+            {
+            case TexelFormat::Rgba8:
+                for (uint32_t channel = 0; channel < 4; ++channel)
+                {
+                    pRgba[channel] = pTexel[channel] / 255.0f;
+                }
+                break;
+            case TexelFormat::Bgra8:
+                pRgba[0] = pTexel[2] / 255.0f;
+                pRgba[1] = pTexel[1] / 255.0f;
+                pRgba[2] = pTexel[0] / 255.0f;
+                pRgba[3] = pTexel[3] / 255.0f;
+                break;
+            case TexelFormat::Rgba16Float:
+                for (uint32_t channel = 0; channel < 4; ++channel)
+                {
+                    pRgba[channel] = HalfToFloat(ReadUint16(pTexel + channel * 2));
+                }
+                break;
+            case TexelFormat::Rgba32Float:
+                std::memcpy(pRgba, pTexel, sizeof(float) * 4);
+                break;
+            default:
+                break;
+            }
+        }
+
+        TexelFormat LegacyDdsFormat(const uint8_t* pPixelFormat)
+        {
+            const uint32_t flags = ReadUint32(pPixelFormat + 4);
+            const uint32_t fourCC = ReadUint32(pPixelFormat + 8);
+            const uint32_t bitCount = ReadUint32(pPixelFormat + 12);
+            const uint32_t redMask = ReadUint32(pPixelFormat + 16);
+
+            if ((flags & DdsPixelFormatFourCC) != 0)
+            {
+                if (fourCC == D3dFormatA16B16G16R16F)
+                {
+                    return TexelFormat::Rgba16Float;
+                }
+                if (fourCC == D3dFormatA32B32G32R32F)
+                {
+                    return TexelFormat::Rgba32Float;
+                }
+                return TexelFormat::Unknown;
+            }
+
+            if ((flags & DdsPixelFormatRgb) != 0 && bitCount == 32)
+            {
+                if (redMask == 0x000000ff)
+                {
+                    return TexelFormat::Rgba8;
+                }
+                if (redMask == 0x00ff0000)
+                {
+                    return TexelFormat::Bgra8;
+                }
+            }
+            return TexelFormat::Unknown;
+        }
+
+        TexelFormat DxgiFormat(uint32_t dxgiFormat)
+        {
+            switch (dxgiFormat)
+            {
+            case DxgiFormatR32G32B32A32Float:
+                return TexelFormat::Rgba32Float;
+            case DxgiFormatR16G16B16A16Float:
+                return TexelFormat::Rgba16Float;
+            case DxgiFormatR8G8B8A8Unorm:
+                return TexelFormat::Rgba8;
+            case DxgiFormatB8G8R8A8Unorm:
+                return TexelFormat::Bgra8;
+            default:
+                return TexelFormat::Unknown;
+            }
+        }
+
+        bool ReadFile(const std::string& filename, std::vector<uint8_t>& bytes)
+        {
+            std::ifstream file(filename, std::ios::binary);
+            if (!file)
+            {
+                return false;
+            }
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            return true;
+        }
+
+        // Decodes one 32 bit TGA into rgba8, top row first
+        bool ReadTga(const std::string& filename, uint32_t& width, uint32_t& height, std::vector<uint8_t>& rgba)
+        {
+            std::vector<uint8_t> bytes;
+            if (!ReadFile(filename, bytes) || bytes.size() < 18)
+            {
+                return false;
+            }
+
+            const uint8_t idLength = bytes[0];
+            const uint8_t colorMapType = bytes[1];
+            const uint8_t imageType = bytes[2];
+            width = ReadUint16(&bytes[12]);
+            height = ReadUint16(&bytes[14]);
+            const uint8_t bitsPerPixel = bytes[16];
+            const uint8_t descriptor = bytes[17];
+            if (colorMapType != 0 || bitsPerPixel != 32
+                || (imageType != TgaUncompressedTrueColor && imageType != TgaRleTrueColor))
+            {
+                return false;
+            }
+
+            const size_t numTexels = static_cast<size_t>(width) * height;
+            std::vector<uint8_t> bgra(numTexels * 4);
+            size_t readOffset = 18 + idLength;
+            size_t texelIndex = 0;
+            while (texelIndex < numTexels)
+            {
+                uint32_t runLength = 1;
+                bool isRun = false;
+                if (imageType == TgaRleTrueColor)
+                {
+                    if (readOffset >= bytes.size())
+                    {
+                        return false;
+                    }
+                    const uint8_t packetHeader = bytes[readOffset++];
+                    runLength = (packetHeader & 0x7f) + 1u;
+                    isRun = (packetHeader & 0x80) != 0;
+                }
+
+                for (uint32_t i = 0; i < runLength && texelIndex < numTexels; ++i, ++texelIndex)
+                {
+                    if (readOffset + 4 > bytes.size())
+                    {
+                        return false;
+                    }
+                    std::memcpy(&bgra[texelIndex * 4], &bytes[readOffset], 4);
+                    if (!isRun || i + 1 == runLength)
+                    {
+                        readOffset += 4;
+                    }
+                }
+            }
+
+            rgba.resize(numTexels * 4);
+            const bool flipRows = (descriptor & TgaTopLeftOrigin) == 0;
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                const uint32_t sourceRow = flipRows ? (height - 1 - y) : y;
+                for (uint32_t x = 0; x < width; ++x)
+                {
+                    const uint8_t* pSource = &bgra[(static_cast<size_t>(sourceRow) * width + x) * 4];
+                    uint8_t* pDestination = &rgba[(static_cast<size_t>(y) * width + x) * 4];
+                    pDestination[0] = pSource[2];
+                    pDestination[1] = pSource[1];
+                    pDestination[2] = pSource[0];
+                    pDestination[3] = pSource[3];
+                }
+            }
+            return true;
+        }
+    }
+
+    void WrapLinear(float coordinate, uint32_t size, uint32_t& index0, uint32_t& index1, float& weight)
+    {
+        const float wrapped = coordinate - std::floor(coordinate);
+        const float texel = wrapped * size - 0.5f;
+        const float texelFloor = std::floor(texel);
+        weight = texel - texelFloor;
+
+        const int32_t index = static_cast<int32_t>(texelFloor);
+        index0 = (index < 0) ? size - 1 : static_cast<uint32_t>(index);
+        index1 = (index + 1 >= static_cast<int32_t>(size)) ? 0 : static_cast<uint32_t>(index + 1);
+    }
+
+    CloudTexture::CloudTexture()
+        : m_width{ 0 }
+        , m_height{ 0 }
+        , m_depth{ 0 }
+        , m_texels{}
+    {
+    }
+
+    bool CloudTexture::LoadDDS(const std::string& filename)
+    {
+        std::vector<uint8_t> bytes;
+        if (!ReadFile(filename, bytes) || bytes.size() < 4 + DdsHeaderSize || ReadUint32(&bytes[0]) != DdsMagic)
+        {
+            std::cout << "Failed to read DDS " << filename << std::endl;
+            return false;
+        }
+
+        const uint8_t* pHeader = &bytes[4];
+        const uint32_t height = ReadUint32(pHeader + 8);
+        const uint32_t width = ReadUint32(pHeader + 12);
+        const uint32_t caps2 = ReadUint32(pHeader + 108);
+        const uint32_t depth = ((caps2 & DdsCaps2Volume) != 0) ? ReadUint32(pHeader + 20) : 1;
+        const uint8_t* pPixelFormat = pHeader + 72;
+
+        size_t dataOffset = 4 + DdsHeaderSize;
+        TexelFormat format = TexelFormat::Unknown;
+        if (ReadUint32(pPixelFormat + 8) == DdsDx10FourCC)
+        {
+            if (bytes.size() < dataOffset + 20)
+            {
+                std::cout << "Truncated DX10 header in " << filename << std::endl;
+                return false;
+            }
+            format = DxgiFormat(ReadUint32(&bytes[dataOffset]));
+            dataOffset += 20;
+        }
+        else
+        {
+            format = LegacyDdsFormat(pPixelFormat);
+        }
+
+        if (format == TexelFormat::Unknown)
+        {
+            std::cout << "Unsupported DDS format in " << filename << ", only uncompressed RGBA is supported" << std::endl;
+            return false;
+        }
+
+        // The top mip of every slice comes first, for volumes as well as 2D textures
+        const uint32_t bytesPerTexel = BytesPerTexel(format);
+        const size_t numTexels = static_cast<size_t>(width) * height * depth;
+        if (width == 0 || height == 0 || depth == 0 || bytes.size() < dataOffset + numTexels * bytesPerTexel)
+        {
+            std::cout << "Truncated DDS " << filename << std::endl;
+            return false;
+        }
+
+        m_width = width;
+        m_height = height;
+        m_depth = depth;
+        m_texels.resize(numTexels * 4);
+        for (size_t i = 0; i < numTexels; ++i)
+        {
+            DecodeTexel(format, &bytes[dataOffset + i * bytesPerTexel], &m_texels[i * 4]);
+        }
+        return true;
+    }
+
+    bool CloudTexture::LoadTgaSlices(const std::string& pathPrefix, uint32_t numSlices)
+    {
+        std::vector<float> texels;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> rgba;
+        for (uint32_t slice = 0; slice < numSlices; ++slice)
+        {
+            const std::string filename = pathPrefix + "(" + std::to_string(slice + 1) + ").tga";
+            uint32_t sliceWidth = 0;
+            uint32_t sliceHeight = 0;
+            if (!ReadTga(filename, sliceWidth, sliceHeight, rgba))
+            {
+                std::cout << "Failed to read volume slice " << filename << std::endl;
+                return false;
+            }
+
+            if (slice == 0)
+            {
+                width = sliceWidth;
+                height = sliceHeight;
+                texels.reserve(static_cast<size_t>(width) * height * numSlices * 4);
+            }
+            else if (sliceWidth != width || sliceHeight != height)
+            {
+                std::cout << "Volume slice " << filename << " does not match the size of the first slice" << std::endl;
+                return false;
+            }
+
+            for (uint8_t value : rgba)
+            {
+                texels.push_back(value / 255.0f);
+            }
+        }
+
+        m_width = width;
+        m_height = height;
+        m_depth = numSlices;
+        m_texels = std::move(texels);
+        return !m_texels.empty();
+    }
+
+    void CloudTexture::Sample(float u, float v, float w, float rgba[4]) const
+    {
+        uint32_t x0 = 0;
+        uint32_t x1 = 0;
+        float weightX = 0.0f;
+        WrapLinear(u, m_width, x0, x1, weightX);
+
+        uint32_t y0 = 0;
+        uint32_t y1 = 0;
+        float weightY = 0.0f;
+        WrapLinear(v, m_height, y0, y1, weightY);
+
+        uint32_t z0 = 0;
+        uint32_t z1 = 0;
+        float weightZ = 0.0f;
+        if (m_depth > 1)
+        {
+            WrapLinear(w, m_depth, z0, z1, weightZ);
+        }
+
+        const size_t rowPitch = static_cast<size_t>(m_width) * 4;
+        const size_t slicePitch = rowPitch * m_height;
+        const float* pSlice0 = &m_texels[z0 * slicePitch];
+        const float* pSlice1 = &m_texels[z1 * slicePitch];
+        for (uint32_t channel = 0; channel < 4; ++channel)
+        {
+            float slices[2];
+            const float* pSlices[2] = { pSlice0, pSlice1 };
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                const float* pTexels = pSlices[i];
+                const float c00 = pTexels[y0 * rowPitch + x0 * 4 + channel];
+                const float c10 = pTexels[y0 * rowPitch + x1 * 4 + channel];
+                const float c01 = pTexels[y1 * rowPitch + x0 * 4 + channel];
+                const float c11 = pTexels[y1 * rowPitch + x1 * 4 + channel];
+                const float top = c00 + (c10 - c00) * weightX;
+                const float bottom = c01 + (c11 - c01) * weightX;
+                slices[i] = top + (bottom - top) * weightY;
+            }
+            rgba[channel] = slices[0] + (slices[1] - slices[0]) * weightZ;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Farlor
+{
+    // Texel index pair and weight for one axis of a linear, WRAP sampler, the same math the AVX2 sampler uses
+    void WrapLinear(float coordinate, uint32_t size, uint32_t& index0, uint32_t& index1, float& weight);
+
+    // CPU copy of one of the textures CloudTrace.hlsl samples. Only the top mip is kept, the shader always
+    // samples level 0. Texels are stored as 32 bit float RGBA whatever the file format was.
+    class CloudTexture
+    {
+    public:
+        CloudTexture();
+
+        // Uncompressed 2D or volume DDS, RGBA in 8 bit unorm, 16 bit float or 32 bit float, legacy or DX10 header
+        bool LoadDDS(const std::string& filename);
+
+        // Builds a volume out of numSlices 32 bit TGAs named <pathPrefix>(1).tga to <pathPrefix>(numSlices).tga,
+        // the slices texassemble turns into the volume DDS
+        bool LoadTgaSlices(const std::string& pathPrefix, uint32_t numSlices);
+
+        // SampleLevel with a MIN_MAG_MIP_LINEAR, WRAP sampler. 2D textures ignore w.
+        void Sample(float u, float v, float w, float rgba[4]) const;
+
+        bool IsLoaded() const
+        {
+            return !m_texels.empty();
+        }
+
+        uint32_t GetWidth() const
+        {
+            return m_width;
+        }
+
+        uint32_t GetHeight() const
+        {
+            return m_height;
+        }
+
+        uint32_t GetDepth() const
+        {
+            return m_depth;
+        }
+
+        // RGBA floats, row by row, slice by slice
+        const float* GetTexels() const
+        {
+            return m_texels.data();
+        }
+
+    private:
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_depth;
+        std::vector<float> m_texels;
+    };
+}
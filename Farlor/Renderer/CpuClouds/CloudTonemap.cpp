@@ -0,0 +1,69 @@
+#include "CloudTonemap.h"
+
+#include <Parallel.h>
+
+#include <cmath>
+
+namespace Farlor
+{
+    namespace
+    {
+        // Constants from snippits/TonemappingFunctions.hlsl
+        constexpr float Exposure = 16.0f;
+        constexpr float ExposureBias = 0.01f;
+        constexpr float WhitePoint = 11.2f;
+        constexpr float Gamma = 2.2f;
+
+        // Rows per job
+        constexpr uint32_t RowGrain = 8;
+
+        float Uncharted2TonemapPrivateSupport(float x)
+        {
+            const float A = 0.15f;
+            const float B = 0.50f;
+            const float C = 0.10f;
+            const float D = 0.20f;
+            const float E = 0.02f;
+            const float F = 0.30f;
+            return ((x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F)) - E / F;
+        }
+
+        float UnchartedTwoTonemapping(float baseColor, float whiteScale)
+        {
+            const float current = Uncharted2TonemapPrivateSupport(ExposureBias * (baseColor * Exposure));
+            return std::pow(current * whiteScale, 1.0f / Gamma);
+        }
+
+        // Float to UNORM conversion, NaN goes to 0 like it does on the GPU
+        uint8_t ToUnorm8(float value)
+        {
+            if (!(value > 0.0f))
+            {
+                return 0;
+            }
+            if (value >= 1.0f)
+            {
+                return 255;
+            }
+            return static_cast<uint8_t>(value * 255.0f + 0.5f);
+        }
+    }
+
+    void TonemapCloudBuffer(FarlorJobs::JobSystem& jobSystem, const CloudPixel* pCloudBuffer, uint32_t width, uint32_t height, uint8_t* pRgba8)
+    {
+        const float whiteScale = 1.0f / Uncharted2TonemapPrivateSupport(WhitePoint);
+        FarlorJobs::ParallelFor(jobSystem, 0, height, RowGrain, [&](uint32_t y)
+            {
+                const size_t rowStart = static_cast<size_t>(y) * width;
+                for (uint32_t x = 0; x < width; ++x)
+                {
+                    const CloudPixel& pixel = pCloudBuffer[rowStart + x];
+                    uint8_t* pTexel = &pRgba8[(rowStart + x) * 4];
+                    pTexel[0] = ToUnorm8(UnchartedTwoTonemapping(pixel.r, whiteScale));
+                    pTexel[1] = ToUnorm8(UnchartedTwoTonemapping(pixel.g, whiteScale));
+                    pTexel[2] = ToUnorm8(UnchartedTwoTonemapping(pixel.b, whiteScale));
+                    pTexel[3] = 255;
+                }
+            });
+    }
+}
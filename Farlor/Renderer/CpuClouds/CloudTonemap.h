@@ -0,0 +1,15 @@
+#pragma once
+
+#include "CloudTracer.h"
+
+#include <JobSystem.h>
+
+#include <cstdint>
+
+namespace Farlor
+{
+    // CPU copy of TonemappingPass.hlsl: the Uncharted 2 curve with the shader's hard coded exposure, then gamma.
+    // pRgba8 gets width * height RGBA8 texels, top row first, rounded the way the R8G8B8A8_UNORM back buffer stores
+    // the pixel shader's output. Rows run as jobs, inline outside the job system.
+    void TonemapCloudBuffer(FarlorJobs::JobSystem& jobSystem, const CloudPixel* pCloudBuffer, uint32_t width, uint32_t height, uint8_t* pRgba8);
+}
@@ -0,0 +1,776 @@
+#include "CloudTracer.h"
+#include "CloudTracerInternal.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#if defined(FARLOR_CPU_CLOUDS_AVX2) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace Farlor
+{
+    namespace CloudTracerInternal
+    {
+        namespace
+        {
+            CloudVector3 Add(const CloudVector3& a, const CloudVector3& b)
+            {
+                return CloudVector3(a.x + b.x, a.y + b.y, a.z + b.z);
+            }
+
+            CloudVector3 Subtract(const CloudVector3& a, const CloudVector3& b)
+            {
+                return CloudVector3(a.x - b.x, a.y - b.y, a.z - b.z);
+            }
+
+            CloudVector3 Scale(const CloudVector3& v, float scale)
+            {
+                return CloudVector3(v.x * scale, v.y * scale, v.z * scale);
+            }
+
+            float Dot(const CloudVector3& a, const CloudVector3& b)
+            {
+                return a.x * b.x + a.y * b.y + a.z * b.z;
+            }
+
+            CloudVector3 Cross(const CloudVector3& a, const CloudVector3& b)
+            {
+                return CloudVector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+            }
+
+            float Length(const CloudVector3& v)
+            {
+                return std::sqrt(Dot(v, v));
+            }
+
+            CloudVector3 Normalize(const CloudVector3& v)
+            {
+                const float length = Length(v);
+                return CloudVector3(v.x / length, v.y / length, v.z / length);
+            }
+
+            float Remap(float value, float originalMin, float originalMax, float newMin, float newMax)
+            {
+                return newMin + (((value - originalMin) / (originalMax - originalMin)) * (newMax - newMin));
+            }
+
+            float Lerp(float a, float b, float t)
+            {
+                return a + t * (b - a);
+            }
+
+            float Saturate(float value, float minValue, float maxValue)
+            {
+                return std::min(std::max(value, minValue), maxValue);
+            }
+
+            // RaySphereIntersection, only the distance is used. It keeps the shader's quirks: B is
+            // 2 * dot(dir, dir), and the distance is measured from the ray point in sphere space.
+            // The shader leaves t unset when there is no hit, this returns 0.
+            float RaySphereDistance(const CloudVector3& rayPoint, const CloudVector3& rayDir, const CloudVector3& spherePos, float radius)
+            {
+                const CloudVector3 offset = Subtract(rayPoint, spherePos);
+                const CloudVector3 localPoint(offset.x / radius, offset.y / radius, offset.z / radius);
+
+                const float a = Dot(rayDir, rayDir);
+                const float b = 2.0f * Dot(rayDir, rayDir);
+                const float c = Dot(localPoint, localPoint) - 1.0f;
+                const float discriminant = b * b - 4.0f * a * c;
+                if (discriminant < 0.0f)
+                {
+                    return 0.0f;
+                }
+
+                float t = (-b - std::sqrt(discriminant)) / (2.0f * a);
+                if (t < 0.0f)
+                {
+                    t = (-b + std::sqrt(discriminant)) / (2.0f * a);
+                }
+                if (t < 0.0f)
+                {
+                    return 0.0f;
+                }
+
+                const CloudVector3 hitPoint = Add(Scale(Add(localPoint, Scale(rayDir, t)), radius), spherePos);
+                return Length(Subtract(hitPoint, localPoint));
+            }
+
+            // Distance along a normalised ray to the nearest point of the sphere in front of it, an actual distance
+            // unlike RaySphereDistance. False when the ray misses.
+            bool IntersectSphere(const CloudVector3& rayOrigin, const CloudVector3& rayDir, const CloudVector3& spherePos, float radius,
+                float& distance)
+            {
+                const CloudVector3 offset = Subtract(rayOrigin, spherePos);
+                const float offsetLength = Length(offset);
+                const float b = Dot(offset, rayDir);
+                // dot(offset, offset) - radius^2, which cancels badly at the earth's radius
+                const float c = (offsetLength - radius) * (offsetLength + radius);
+                const float discriminant = b * b - c;
+                if (discriminant < 0.0f)
+                {
+                    return false;
+                }
+
+                const float root = std::sqrt(discriminant);
+                distance = (-b - root >= 0.0f) ? (-b - root) : (-b + root);
+                return distance >= 0.0f;
+            }
+
+            // RayDiskIntersection against the ground disk, normal (0, -1, 0) at the origin
+            bool HitsGroundDisk(const CloudVector3& rayOrigin, const CloudVector3& rayDir)
+            {
+                const CloudVector3 normal(0.0f, -1.0f, 0.0f);
+                const float denominator = Dot(normal, rayDir);
+                if (denominator <= GroundPlaneEpsilon)
+                {
+                    return false;
+                }
+
+                const float t = Dot(Scale(rayOrigin, -1.0f), normal) / denominator;
+                if (t < 0.0f)
+                {
+                    return false;
+                }
+
+                const CloudVector3 hitPoint = Add(rayOrigin, Scale(rayDir, t));
+                return Length(hitPoint) <= GroundDiskRadius;
+            }
+
+            float DensityHeightAtPoint(float densityHeight, float weatherG)
+            {
+                const float stratus = Remap(densityHeight, 0.0f, 0.1f, 0.0f, 1.0f) * Remap(densityHeight, 0.2f, 0.3f, 1.0f, 0.0f);
+                const float strato = Remap(densityHeight, 0.0f, 0.2f, 0.0f, 1.0f) * Remap(densityHeight, 0.45f, 0.6f, 1.0f, 0.0f);
+                const float cumulus = Remap(densityHeight, 0.0f, 0.1f, 0.0f, 1.0f) * Remap(densityHeight, 0.7f, 0.95f, 1.0f, 0.0f);
+
+                const float stratusToStratoAmount = Saturate(weatherG * 2.0f, 0.0f, 1.0f);
+                const float stratoToCumulusAmount = Saturate((weatherG - 0.5f) * 2.0f, 0.0f, 1.0f);
+
+                const float stratusToStratoInterp = Lerp(stratus, strato, stratusToStratoAmount);
+                const float stratoToCumulusInterp = Lerp(strato, cumulus, stratoToCumulusAmount);
+                return Lerp(stratusToStratoInterp, stratoToCumulusInterp, densityHeight);
+            }
+
+            // SampleCloudDensity with doCheaply set, the only way PerformCloudMarch calls it.
+            // rayToInnerShellLength is length(startPosOnInnerShell - eye), which only changes per ray.
+            float SampleCloudDensity(const FrameConstants& frame, const CloudTexture& lowFrequency, CloudVector3 p,
+                const float weather[4], float rayToInnerShellLength, const CloudVector3& rayDir)
+            {
+                // GetHeightFractionForPoint
+                float heightFraction = 0.0f;
+                if (p.y >= frame.m_cameraPos.y)
+                {
+                    const float rayFromCameraLength = Length(Subtract(p, frame.m_cameraPos));
+                    const float cosTheta = Dot(rayDir, Normalize(Subtract(p, frame.m_earthCenter)));
+                    heightFraction = std::fabs(cosTheta * (rayFromCameraLength - rayToInnerShellLength))
+                        / (AtmosphereRadiusOuter - AtmosphereRadiusInner);
+                }
+
+                return SampleBaseCloudDensity(lowFrequency, p, weather, heightFraction, frame.m_windOffset);
+            }
+
+            // Height fraction from the point's altitude, what the light volume is indexed with
+            float GetLayerHeightFraction(const FrameConstants& frame, const CloudVector3& p)
+            {
+                return (Length(Subtract(p, frame.m_earthCenter)) - frame.m_innerRadius) / (frame.m_outerRadius - frame.m_innerRadius);
+            }
+
+            // PerformCloudMarch. The sun is white, so the three radiance channels are identical and only one is kept.
+            // The stepper picks the steps to sample and jumps over the ones the occupancy grid shows to be empty.
+            // The march stops once the ray is all but opaque, and opacity is what the pixel blends over the sky with.
+            void PerformCloudMarch(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+                const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, const CloudVector3& rayDir,
+                float innerDistance, float outerDistance, float& radiance, float& opacity, CloudTraceStats& stats)
+            {
+                const float stepSize = (outerDistance - innerDistance) / NumMarchSteps;
+                const CloudVector3 traceDir = Normalize(rayDir);
+                const CloudVector3 startTracePos = Add(frame.m_cameraPos, Scale(traceDir, innerDistance));
+                const float rayToInnerShellLength = Length(Subtract(startTracePos, frame.m_cameraPos));
+
+                CloudOccupancyGrid::MarchRay marchRay{};
+                if (pOccupancyGrid)
+                {
+                    marchRay = pOccupancyGrid->MakeMarchRay(frame.m_cameraPos, startTracePos, traceDir, stepSize);
+                }
+                MarchStepper stepper;
+                stepper.Start(frame.m_march, pOccupancyGrid, marchRay);
+
+                radiance = 0.0f;
+                float transmittance = 1.0f;
+                uint32_t i = 0;
+                while (stepper.NextStep(i))
+                {
+                    const CloudVector3 samplePoint = Add(startTracePos, Scale(traceDir, stepSize * i));
+                    float weather[4];
+                    weatherMap.Sample(samplePoint.x / WeatherMapScale, samplePoint.y / WeatherMapScale, 0.0f, weather);
+
+                    const float cloudDensity = SampleCloudDensity(frame, lowFrequency, samplePoint, weather, rayToInnerShellLength, rayDir)
+                        * SubstinenceDensity;
+                    ++stats.m_numViewSamples;
+                    if (!stepper.OnSample(cloudDensity > 0.0f))
+                    {
+                        continue;
+                    }
+                    float combinedColor = 0.0f;
+                    if (pLightVolume)
+                    {
+                        combinedColor = pLightVolume->Sample(samplePoint.x + frame.m_windOffset.x, GetLayerHeightFraction(frame, samplePoint),
+                            samplePoint.z + frame.m_windOffset.z);
+                        ++stats.m_numLightSamples;
+                    }
+                    else
+                    {
+                        const CloudVector3 lightDirection = Normalize(Subtract(frame.m_sunPosition, samplePoint));
+                        const CloudVector3 lightStep = Scale(lightDirection, stepSize);
+                        float lightDensity = 0.0f;
+                        for (uint32_t l = 0; l < NumLightSamples; ++l)
+                        {
+                            const CloudVector3 lightSamplePos = Add(samplePoint, Scale(lightStep, static_cast<float>(l)));
+                            float lightWeather[4];
+                            weatherMap.Sample(lightSamplePos.x / WeatherMapScale, lightSamplePos.y / WeatherMapScale, 0.0f, lightWeather);
+
+                            lightDensity += SampleCloudDensity(frame, lowFrequency, lightSamplePos, lightWeather, rayToInnerShellLength, rayDir)
+                                * SubstinenceDensity;
+                            combinedColor += std::exp(-LightAbsorption * lightDensity) * LightSampleScale;
+                        }
+                        stats.m_numLightSamples += NumLightSamples;
+                    }
+
+                    const float dt = std::exp(-LightAbsorption * stepSize * cloudDensity);
+                    radiance += combinedColor * (1.0f - dt) * transmittance;
+                    transmittance *= dt;
+
+                    // Nothing further along can change the pixel much
+                    if (transmittance < frame.m_march.m_transmittanceEpsilon)
+                    {
+                        break;
+                    }
+                }
+                opacity = 1.0f - transmittance;
+            }
+
+            // CSMain's primary ray through pixel (x, y)
+            CloudVector3 GetPrimaryRayDir(const FrameConstants& frame, uint32_t x, uint32_t y)
+            {
+                // Transform to [-1, 1] space from [0, 1] space
+                const float u = static_cast<float>(x) / static_cast<float>(frame.m_screenWidth) * 2.0f - 1.0f;
+                const float v = static_cast<float>(y) / static_cast<float>(frame.m_screenHeight) * 2.0f - 1.0f;
+
+                return Normalize(Add(Add(frame.m_nearForward, Scale(frame.m_nearRight, u)), Scale(frame.m_nearUp, v)));
+            }
+
+            // Each tile counts its own samples, added up once every tile is done
+            void SumTileStats(const std::vector<CloudTraceStats>& tileStats, uint64_t numPixels, CloudTraceStats& stats)
+            {
+                stats = CloudTraceStats();
+                stats.m_numPixels = numPixels;
+                for (const CloudTraceStats& tile : tileStats)
+                {
+                    stats.m_numViewSamples += tile.m_numViewSamples;
+                    stats.m_numLightSamples += tile.m_numLightSamples;
+                    stats.m_numReprojectedPixels += tile.m_numReprojectedPixels;
+                }
+            }
+
+            // The frame each pixel of the 4x4 Bayer matrix is marched on, as (x, y) in the block
+            constexpr uint8_t MarchedPixelX[16] = { 0, 2, 2, 0, 1, 3, 3, 1, 1, 3, 3, 1, 0, 2, 2, 0 };
+            constexpr uint8_t MarchedPixelY[16] = { 0, 2, 0, 2, 1, 3, 1, 3, 0, 2, 0, 2, 1, 3, 1, 3 };
+
+#if defined(FARLOR_CPU_CLOUDS_AVX2)
+            bool CpuSupportsAvx2()
+            {
+#if defined(_MSC_VER)
+                int cpuInfo[4] = {};
+                __cpuid(cpuInfo, 1);
+                const bool hasFma = (cpuInfo[2] & (1 << 12)) != 0;
+                const bool hasOsxsave = (cpuInfo[2] & (1 << 27)) != 0;
+                const bool hasAvx = (cpuInfo[2] & (1 << 28)) != 0;
+                if (!hasFma || !hasOsxsave || !hasAvx)
+                {
+                    return false;
+                }
+
+                // The OS has to save the ymm registers
+                if ((_xgetbv(0) & 0x6) != 0x6)
+                {
+                    return false;
+                }
+
+                __cpuidex(cpuInfo, 7, 0);
+                return (cpuInfo[1] & (1 << 5)) != 0;
+#else
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+            }
+#endif
+        }
+
+        FrameConstants::FrameConstants()
+            : m_screenWidth{ 0 }
+            , m_screenHeight{ 0 }
+            , m_cameraPos{}
+            , m_nearForward{}
+            , m_nearRight{}
+            , m_nearUp{}
+            , m_earthCenter{}
+            , m_innerRadius{ 0.0f }
+            , m_outerRadius{ 0.0f }
+            , m_sunPosition{}
+            , m_windOffset{}
+            , m_march{}
+        {
+        }
+
+        FrameConstants MakeFrameConstants(const CloudTraceParams& params)
+        {
+            FrameConstants frame;
+            frame.m_screenWidth = params.m_screenWidth;
+            frame.m_screenHeight = params.m_screenHeight;
+            frame.m_cameraPos = params.m_cameraPos;
+
+            const float aspectRatio = static_cast<float>(params.m_screenWidth) / static_cast<float>(params.m_screenHeight);
+            const CloudVector3 camForward = Normalize(Subtract(params.m_cameraTarget, params.m_cameraPos));
+            const CloudVector3 camRight = Scale(Normalize(Cross(camForward, params.m_worldUp)), -1.0f);
+            const CloudVector3 camUp = Scale(Normalize(Cross(camForward, camRight)), -1.0f);
+
+            const float horizontalFov = params.m_fovHorizontal;
+            const float verticalFov = horizontalFov / aspectRatio;
+            const float windowTop = std::tan(verticalFov / 2.0f) * NearDistance;
+            const float windowRight = std::tan(horizontalFov / 2.0f) * NearDistance;
+
+            frame.m_nearForward = Scale(camForward, NearDistance);
+            frame.m_nearRight = Scale(camRight, windowRight);
+            frame.m_nearUp = Scale(camUp, windowTop);
+
+            frame.m_earthCenter = Scale(params.m_worldUp, -EarthRadius);
+            frame.m_innerRadius = AtmosphereRadiusInner + EarthRadius;
+            frame.m_outerRadius = AtmosphereRadiusOuter + EarthRadius;
+
+            frame.m_sunPosition = CloudVector3(0.0f, EarthRadius * (4.0f + std::sin(params.m_totalTime)), 0.0f);
+            frame.m_windOffset = GetWindOffset(params.m_totalTime);
+            frame.m_march = params.m_march;
+            return frame;
+        }
+
+        CloudVector3 GetWindOffset(float totalTime)
+        {
+            return Scale(Scale(Scale(CloudVector3(1.0f, 0.1f, 0.0f), totalTime), CloudSpeed), 100.0f);
+        }
+
+        float SampleBaseCloudDensity(const CloudTexture& lowFrequency, CloudVector3 p, const float weather[4], float heightFraction,
+            const CloudVector3& windOffset)
+        {
+            p.x += heightFraction * CloudTopOffset;
+            p = Add(p, windOffset);
+
+            float lowFrequencyNoises[4];
+            lowFrequency.Sample(p.x / LowFrequencyScale, p.y / LowFrequencyScale, p.z / LowFrequencyScale, lowFrequencyNoises);
+
+            const float lowFrequencyFbm = (lowFrequencyNoises[1] * 0.625f) + (lowFrequencyNoises[2] * 0.25f) + (lowFrequencyNoises[3] * 0.125f);
+            float baseCloud = Remap(lowFrequencyNoises[0], -(1.0f - lowFrequencyFbm), 1.0f, 0.0f, 1.0f);
+            baseCloud *= DensityHeightAtPoint(heightFraction, weather[1]);
+
+            const float cloudCoverage = weather[0];
+            const float baseCloudWithCoverage = Remap(baseCloud, cloudCoverage, 1.0f, 0.0f, 1.0f) * cloudCoverage;
+
+            // fmax, like the shader's max, drops the NaN full coverage produces
+            return std::fmax(baseCloudWithCoverage, 0.0f);
+        }
+
+        MarchStepper::MarchStepper()
+            : m_pOccupancyGrid{ nullptr }
+            , m_ray{}
+            , m_coarseStepScale{ 1 }
+            , m_numEmptyStepsBeforeCoarse{ 0 }
+            , m_stepIndex{ 0 }
+            , m_refineFrom{ 0 }
+            , m_refineUntil{ 0 }
+            , m_numEmptySteps{ 0 }
+            , m_sampleUntil{ 0 }
+            , m_isCoarse{ false }
+        {
+        }
+
+        void MarchStepper::Start(const CloudMarchSettings& settings, const CloudOccupancyGrid* pOccupancyGrid, const CloudOccupancyGrid::MarchRay& ray)
+        {
+            m_pOccupancyGrid = pOccupancyGrid;
+            m_ray = ray;
+            m_coarseStepScale = std::max(settings.m_coarseStepScale, 1u);
+            m_numEmptyStepsBeforeCoarse = settings.m_numEmptyStepsBeforeCoarse;
+            m_stepIndex = 0;
+            m_refineFrom = 0;
+            m_refineUntil = 0;
+            m_numEmptySteps = 0;
+            m_sampleUntil = pOccupancyGrid ? 0 : NumMarchSteps;
+            m_isCoarse = m_coarseStepScale > 1;
+        }
+
+        bool MarchStepper::NextStep(uint32_t& stepIndex)
+        {
+            while (m_stepIndex < NumMarchSteps && m_stepIndex >= m_sampleUntil)
+            {
+                uint32_t numStepsToSample = 0;
+                const uint32_t numEmptySteps = m_pOccupancyGrid->CountEmptySteps(m_ray, m_stepIndex, NumMarchSteps, numStepsToSample);
+                if (numEmptySteps == 0)
+                {
+                    m_sampleUntil = m_stepIndex + numStepsToSample;
+                    break;
+                }
+
+                const uint32_t emptyEnd = m_stepIndex + numEmptySteps;
+                while (m_stepIndex < emptyEnd)
+                {
+                    OnEmptySample();
+                }
+            }
+
+            stepIndex = m_stepIndex;
+            return m_stepIndex < NumMarchSteps;
+        }
+
+        bool MarchStepper::OnSample(bool hasDensity)
+        {
+            if (!hasDensity)
+            {
+                OnEmptySample();
+                return false;
+            }
+
+            m_numEmptySteps = 0;
+            if (m_isCoarse)
+            {
+                m_isCoarse = false;
+                if (m_refineFrom < m_stepIndex)
+                {
+                    // Back to the first step after the last empty sample. The grid has only been asked about steps
+                    // from the coarse sample on.
+                    m_refineUntil = m_stepIndex;
+                    m_stepIndex = m_refineFrom;
+                    m_sampleUntil = m_pOccupancyGrid ? m_stepIndex : NumMarchSteps;
+                    return false;
+                }
+            }
+
+            ++m_stepIndex;
+            return true;
+        }
+
+        void MarchStepper::OnEmptySample()
+        {
+            const uint32_t sampledStep = m_stepIndex;
+            if (!m_isCoarse)
+            {
+                ++m_numEmptySteps;
+                if (m_coarseStepScale == 1 || m_numEmptySteps < m_numEmptyStepsBeforeCoarse || sampledStep < m_refineUntil)
+                {
+                    m_stepIndex = sampledStep + 1;
+                    return;
+                }
+                m_isCoarse = true;
+            }
+
+            // The last step is always sampled, so coarse steps can't step over the end of the cloud layer
+            m_refineFrom = sampledStep + 1;
+            m_stepIndex = std::min(sampledStep + m_coarseStepScale, std::max(sampledStep + 1, NumMarchSteps - 1));
+        }
+
+        CloudPixel TracePixel(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t x, uint32_t y, CloudTraceStats& stats)
+        {
+            const CloudVector3 rayDir = GetPrimaryRayDir(frame, x, y);
+
+            if (HitsGroundDisk(frame.m_cameraPos, rayDir))
+            {
+                return CloudPixel{ GroundColor.x, GroundColor.y, GroundColor.z, 1.0f };
+            }
+
+            const float innerDistance = RaySphereDistance(frame.m_cameraPos, rayDir, frame.m_earthCenter, frame.m_innerRadius);
+            const float outerDistance = RaySphereDistance(frame.m_cameraPos, rayDir, frame.m_earthCenter, frame.m_outerRadius);
+
+            float radiance = 0.0f;
+            float opacity = 0.0f;
+            PerformCloudMarch(frame, lowFrequency, weatherMap, pOccupancyGrid, pLightVolume, rayDir, innerDistance, outerDistance,
+                radiance, opacity, stats);
+
+            return CloudPixel{ Lerp(SkyColor.x, radiance, opacity), Lerp(SkyColor.y, radiance, opacity),
+                Lerp(SkyColor.z, radiance, opacity), 1.0f };
+        }
+
+        void GetMarchedPixel(uint32_t frameIndex, uint32_t& blockX, uint32_t& blockY)
+        {
+            blockX = MarchedPixelX[frameIndex % 16];
+            blockY = MarchedPixelY[frameIndex % 16];
+        }
+
+        bool ReprojectPixel(const FrameConstants& frame, const FrameConstants& previousFrame, const CloudPixel* pPreviousCloudBuffer,
+            uint32_t x, uint32_t y, CloudPixel& pixel)
+        {
+            // Ground pixels are no cheaper to reproject than to trace
+            const CloudVector3 rayDir = GetPrimaryRayDir(frame, x, y);
+            if (HitsGroundDisk(frame.m_cameraPos, rayDir))
+            {
+                return false;
+            }
+
+            // Where the ray enters the cloud layer, the clouds are too far away for anywhere deeper to reproject differently
+            float innerDistance = 0.0f;
+            if (!IntersectSphere(frame.m_cameraPos, rayDir, frame.m_earthCenter, frame.m_innerRadius, innerDistance))
+            {
+                return false;
+            }
+            const CloudVector3 cloudPoint = Add(frame.m_cameraPos, Scale(rayDir, innerDistance));
+
+            // Onto the previous camera's near plane, back in [-1, 1] space
+            const CloudVector3 previousRay = Subtract(cloudPoint, previousFrame.m_cameraPos);
+            const float forwardDistance = Dot(previousRay, previousFrame.m_nearForward);
+            if (forwardDistance <= 0.0f)
+            {
+                return false;
+            }
+            const CloudVector3 nearOffset = Subtract(Scale(previousRay, Dot(previousFrame.m_nearForward, previousFrame.m_nearForward) / forwardDistance),
+                previousFrame.m_nearForward);
+            const float previousU = Dot(nearOffset, previousFrame.m_nearRight) / Dot(previousFrame.m_nearRight, previousFrame.m_nearRight);
+            const float previousV = Dot(nearOffset, previousFrame.m_nearUp) / Dot(previousFrame.m_nearUp, previousFrame.m_nearUp);
+
+            // The nearest previous pixel, blending would blur the clouds a little more every frame
+            const float previousX = std::floor((previousU + 1.0f) * 0.5f * static_cast<float>(previousFrame.m_screenWidth) + 0.5f);
+            const float previousY = std::floor((previousV + 1.0f) * 0.5f * static_cast<float>(previousFrame.m_screenHeight) + 0.5f);
+            if (!(previousX >= 0.0f && previousX < static_cast<float>(previousFrame.m_screenWidth)
+                && previousY >= 0.0f && previousY < static_cast<float>(previousFrame.m_screenHeight)))
+            {
+                return false;
+            }
+
+            // Ground pixels are always traced, so the previous pixel is ground exactly when its ray hits the disk
+            const uint32_t previousPixelX = static_cast<uint32_t>(previousX);
+            const uint32_t previousPixelY = static_cast<uint32_t>(previousY);
+            if (HitsGroundDisk(previousFrame.m_cameraPos, GetPrimaryRayDir(previousFrame, previousPixelX, previousPixelY)))
+            {
+                return false;
+            }
+
+            pixel = pPreviousCloudBuffer[previousPixelX + previousPixelY * previousFrame.m_screenWidth];
+            return true;
+        }
+    }
+
+    CloudTracer::CloudTracer(const CloudTexture& lowFrequency, const CloudTexture& weatherMap)
+        : m_lowFrequency{ lowFrequency }
+        , m_weatherMap{ weatherMap }
+        , m_occupancyGrid{}
+        , m_lightVolume{}
+    {
+        RebuildOccupancyGrid();
+    }
+
+    void CloudTracer::RebuildOccupancyGrid()
+    {
+        m_occupancyGrid.Build(m_lowFrequency, m_weatherMap);
+        m_lightVolume.Invalidate();
+    }
+
+    void CloudTracer::UpdateLightVolume(FarlorJobs::JobSystem& jobSystem)
+    {
+        if (!m_lightVolume.IsBuilt())
+        {
+            m_lightVolume.Build(jobSystem, m_lowFrequency, m_weatherMap);
+        }
+    }
+
+    void CloudTracer::Trace(FarlorJobs::JobSystem& jobSystem, const CloudTraceParams& params, CloudPixel* pCloudBuffer,
+        CloudTraceStats* pStats) const
+    {
+        const CloudTracerInternal::FrameConstants frame = CloudTracerInternal::MakeFrameConstants(params);
+        const CloudLightVolume* pLightVolume = GetLightVolume(params);
+        const uint32_t numTilesX = (params.m_screenWidth + TileWidth - 1) / TileWidth;
+        const uint32_t numTilesY = (params.m_screenHeight + TileHeight - 1) / TileHeight;
+        const bool useAvx2 = IsAvx2Enabled();
+
+        std::vector<CloudTraceStats> tileStats(numTilesX * numTilesY);
+        FarlorJobs::ParallelFor(jobSystem, 0, numTilesX * numTilesY, 1, [&](uint32_t tileIndex)
+            {
+                const uint32_t xBegin = (tileIndex % numTilesX) * TileWidth;
+                const uint32_t yBegin = (tileIndex / numTilesX) * TileHeight;
+                const uint32_t xEnd = std::min(xBegin + TileWidth, params.m_screenWidth);
+                const uint32_t yEnd = std::min(yBegin + TileHeight, params.m_screenHeight);
+                CloudTraceStats& stats = tileStats[tileIndex];
+                for (uint32_t y = yBegin; y < yEnd; ++y)
+                {
+                    if (useAvx2)
+                    {
+                        CloudTracerInternal::TraceSpanAvx2(frame, m_lowFrequency, m_weatherMap, &m_occupancyGrid, pLightVolume, y, xBegin, xEnd,
+                            1, pCloudBuffer, stats);
+                        continue;
+                    }
+
+                    for (uint32_t x = xBegin; x < xEnd; ++x)
+                    {
+                        pCloudBuffer[x + y * params.m_screenWidth] = CloudTracerInternal::TracePixel(frame, m_lowFrequency, m_weatherMap,
+                            &m_occupancyGrid, pLightVolume, x, y, stats);
+                    }
+                }
+            });
+
+        if (pStats)
+        {
+            CloudTracerInternal::SumTileStats(tileStats, static_cast<uint64_t>(params.m_screenWidth) * params.m_screenHeight, *pStats);
+        }
+    }
+
+    void CloudTracer::TraceReprojected(FarlorJobs::JobSystem& jobSystem, const CloudTraceParams& params, const CloudTraceHistory& history,
+        CloudPixel* pCloudBuffer, CloudTraceStats* pStats) const
+    {
+        if (!history.m_pCloudBuffer || history.m_params.m_screenWidth != params.m_screenWidth
+            || history.m_params.m_screenHeight != params.m_screenHeight)
+        {
+            Trace(jobSystem, params, pCloudBuffer, pStats);
+            return;
+        }
+
+        const CloudTracerInternal::FrameConstants frame = CloudTracerInternal::MakeFrameConstants(params);
+        const CloudTracerInternal::FrameConstants previousFrame = CloudTracerInternal::MakeFrameConstants(history.m_params);
+        const CloudLightVolume* pLightVolume = GetLightVolume(params);
+        const uint32_t numTilesX = (params.m_screenWidth + TileWidth - 1) / TileWidth;
+        const uint32_t numTilesY = (params.m_screenHeight + TileHeight - 1) / TileHeight;
+        const bool useAvx2 = IsAvx2Enabled();
+
+        uint32_t marchedX = 0;
+        uint32_t marchedY = 0;
+        CloudTracerInternal::GetMarchedPixel(params.m_frameIndex, marchedX, marchedY);
+
+        // Tiles are whole blocks wide and high, so every tile marches the same pixels of its blocks
+        static_assert(TileWidth % ReprojectionBlockSize == 0 && TileHeight % ReprojectionBlockSize == 0, "Tiles have to hold whole blocks");
+        std::vector<CloudTraceStats> tileStats(numTilesX * numTilesY);
+        FarlorJobs::ParallelFor(jobSystem, 0, numTilesX * numTilesY, 1, [&](uint32_t tileIndex)
+            {
+                const uint32_t xBegin = (tileIndex % numTilesX) * TileWidth;
+                const uint32_t yBegin = (tileIndex / numTilesX) * TileHeight;
+                const uint32_t xEnd = std::min(xBegin + TileWidth, params.m_screenWidth);
+                const uint32_t yEnd = std::min(yBegin + TileHeight, params.m_screenHeight);
+                CloudTraceStats& stats = tileStats[tileIndex];
+
+                // Reproject first and keep the pixels that failed, so they can be marched together
+                uint32_t rejectedXs[TileHeight][TileWidth];
+                uint32_t numRowRejected[TileHeight] = {};
+                uint32_t numReprojected = 0;
+                uint32_t numRejected = 0;
+                for (uint32_t y = yBegin; y < yEnd; ++y)
+                {
+                    const bool isMarchedRow = (y % ReprojectionBlockSize) == marchedY;
+                    for (uint32_t x = xBegin; x < xEnd; ++x)
+                    {
+                        if (isMarchedRow && (x % ReprojectionBlockSize) == marchedX)
+                        {
+                            continue;
+                        }
+
+                        CloudPixel& pixel = pCloudBuffer[x + y * params.m_screenWidth];
+                        if (CloudTracerInternal::ReprojectPixel(frame, previousFrame, history.m_pCloudBuffer, x, y, pixel))
+                        {
+                            ++numReprojected;
+                            continue;
+                        }
+                        rejectedXs[y - yBegin][numRowRejected[y - yBegin]++] = x;
+                        ++numRejected;
+                    }
+                }
+
+                // With most of the tile rejected, e.g. after a camera cut, marching whole rows keeps every lane busy
+                if (useAvx2 && numRejected > numReprojected)
+                {
+                    for (uint32_t y = yBegin; y < yEnd; ++y)
+                    {
+                        CloudTracerInternal::TraceSpanAvx2(frame, m_lowFrequency, m_weatherMap, &m_occupancyGrid, pLightVolume, y, xBegin, xEnd,
+                            1, pCloudBuffer, stats);
+                    }
+                    return;
+                }
+
+                stats.m_numReprojectedPixels += numReprojected;
+                for (uint32_t y = yBegin; y < yEnd; ++y)
+                {
+                    const uint32_t* pRejectedXs = rejectedXs[y - yBegin];
+                    const uint32_t numRowPixels = numRowRejected[y - yBegin];
+                    const bool isMarchedRow = (y % ReprojectionBlockSize) == marchedY;
+                    if (useAvx2)
+                    {
+                        if (isMarchedRow)
+                        {
+                            CloudTracerInternal::TraceSpanAvx2(frame, m_lowFrequency, m_weatherMap, &m_occupancyGrid, pLightVolume, y,
+                                xBegin + marchedX, xEnd, ReprojectionBlockSize, pCloudBuffer, stats);
+                        }
+                        CloudTracerInternal::TracePixelsAvx2(frame, m_lowFrequency, m_weatherMap, &m_occupancyGrid, pLightVolume, y, pRejectedXs,
+                            numRowPixels, pCloudBuffer, stats);
+                        continue;
+                    }
+
+                    if (isMarchedRow)
+                    {
+                        for (uint32_t x = xBegin + marchedX; x < xEnd; x += ReprojectionBlockSize)
+                        {
+                            pCloudBuffer[x + y * params.m_screenWidth] = CloudTracerInternal::TracePixel(frame, m_lowFrequency, m_weatherMap,
+                                &m_occupancyGrid, pLightVolume, x, y, stats);
+                        }
+                    }
+                    for (uint32_t i = 0; i < numRowPixels; ++i)
+                    {
+                        const uint32_t x = pRejectedXs[i];
+                        pCloudBuffer[x + y * params.m_screenWidth] = CloudTracerInternal::TracePixel(frame, m_lowFrequency, m_weatherMap,
+                            &m_occupancyGrid, pLightVolume, x, y, stats);
+                    }
+                }
+            });
+
+        if (pStats)
+        {
+            CloudTracerInternal::SumTileStats(tileStats, static_cast<uint64_t>(params.m_screenWidth) * params.m_screenHeight, *pStats);
+        }
+    }
+
+    void CloudTracer::TraceReference(const CloudTraceParams& params, CloudPixel* pCloudBuffer, CloudTraceStats* pStats) const
+    {
+        const CloudTracerInternal::FrameConstants frame = CloudTracerInternal::MakeFrameConstants(params);
+        const CloudLightVolume* pLightVolume = GetLightVolume(params);
+        CloudTraceStats stats;
+        stats.m_numPixels = static_cast<uint64_t>(params.m_screenWidth) * params.m_screenHeight;
+        for (uint32_t y = 0; y < params.m_screenHeight; ++y)
+        {
+            for (uint32_t x = 0; x < params.m_screenWidth; ++x)
+            {
+                pCloudBuffer[x + y * params.m_screenWidth] = CloudTracerInternal::TracePixel(frame, m_lowFrequency, m_weatherMap, nullptr, pLightVolume,
+                    x, y, stats);
+            }
+        }
+
+        if (pStats)
+        {
+            *pStats = stats;
+        }
+    }
+
+    const CloudLightVolume* CloudTracer::GetLightVolume(const CloudTraceParams& params) const
+    {
+        if (!params.m_march.m_useLightVolume)
+        {
+            return nullptr;
+        }
+
+        assert(m_lightVolume.IsBuilt() && "UpdateLightVolume has to be called first");
+        return &m_lightVolume;
+    }
+
+    bool CloudTracer::IsAvx2Enabled()
+    {
+#if defined(FARLOR_CPU_CLOUDS_AVX2)
+        static const bool s_isAvx2Supported = CloudTracerInternal::CpuSupportsAvx2();
+        return s_isAvx2Supported;
+#else
+        return false;
+#endif
+    }
+}
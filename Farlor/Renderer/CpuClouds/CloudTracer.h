@@ -0,0 +1,189 @@
+#pragma once
+
+#include "CloudLightVolume.h"
+#include "CloudOccupancyGrid.h"
+#include "CloudTexture.h"
+
+#include <JobSystem.h>
+
+#include <cstdint>
+
+namespace Farlor
+{
+    struct CloudVector3
+    {
+        CloudVector3()
+            : x{ 0.0f }
+            , y{ 0.0f }
+            , z{ 0.0f }
+        {
+        }
+
+        CloudVector3(float xIn, float yIn, float zIn)
+            : x{ xIn }
+            , y{ yIn }
+            , z{ zIn }
+        {
+        }
+
+        float x;
+        float y;
+        float z;
+    };
+
+    // One element of the float4 CloudBuffer, index x + y * screen width
+    struct CloudPixel
+    {
+        float r;
+        float g;
+        float b;
+        float a;
+    };
+
+    // How PerformCloudMarch steps and lights, the CLOUD_MARCH_ defines in CloudParams.hlsl.
+    // A coarse step of 1 with an epsilon of 0 and no light volume is the old fixed march, every step sampled and lit
+    // by marching towards the sun.
+    struct CloudMarchSettings
+    {
+        CloudMarchSettings()
+            : m_coarseStepScale{ 4 }
+            , m_numEmptyStepsBeforeCoarse{ 2 }
+            , m_transmittanceEpsilon{ 0.01f }
+            , m_useLightVolume{ true }
+        {
+        }
+
+        // Fine steps per coarse step through empty air
+        uint32_t m_coarseStepScale;
+        // Empty fine samples in a row before the march goes back to coarse steps
+        uint32_t m_numEmptyStepsBeforeCoarse;
+        // The march stops once the view ray's transmittance is below this
+        float m_transmittanceEpsilon;
+        // Lit samples look their light up in the CloudLightVolume instead of taking 6 samples towards the sun
+        bool m_useLightVolume;
+    };
+
+    // The NewCamera and TimeValues constants CloudTrace.hlsl reads, and the march settings it is compiled with
+    struct CloudTraceParams
+    {
+        CloudTraceParams()
+            : m_cameraPos{ 0.0f, 0.0f, 0.0f }
+            , m_cameraTarget{ 0.0f, 0.0f, 1.0f }
+            , m_worldUp{ 0.0f, 1.0f, 0.0f }
+            , m_fovHorizontal{ 0.785398f * 2.0f }
+            , m_screenWidth{ 0 }
+            , m_screenHeight{ 0 }
+            , m_totalTime{ 0.0f }
+            , m_frameIndex{ 0 }
+            , m_march{}
+        {
+        }
+
+        CloudVector3 m_cameraPos;
+        CloudVector3 m_cameraTarget;
+        CloudVector3 m_worldUp;
+        // Radians
+        float m_fovHorizontal;
+        uint32_t m_screenWidth;
+        uint32_t m_screenHeight;
+        float m_totalTime;
+        // Frames since the start, picks the pixel of each block TraceReprojected marches
+        uint32_t m_frameIndex;
+        CloudMarchSettings m_march;
+    };
+
+    // The frame TraceReprojected reprojects from, the OldCamera constants and the CloudBuffer traced with them
+    struct CloudTraceHistory
+    {
+        CloudTraceHistory()
+            : m_params{}
+            , m_pCloudBuffer{ nullptr }
+        {
+        }
+
+        CloudTraceParams m_params;
+        // nullptr when there is no frame before, every pixel is marched
+        const CloudPixel* m_pCloudBuffer;
+    };
+
+    // Density samples a trace took, to see what the march costs
+    struct CloudTraceStats
+    {
+        CloudTraceStats()
+            : m_numPixels{ 0 }
+            , m_numViewSamples{ 0 }
+            , m_numLightSamples{ 0 }
+            , m_numReprojectedPixels{ 0 }
+        {
+        }
+
+        double GetSamplesPerPixel() const
+        {
+            return (m_numPixels == 0) ? 0.0 : static_cast<double>(m_numViewSamples + m_numLightSamples) / static_cast<double>(m_numPixels);
+        }
+
+        uint64_t m_numPixels;
+        // Along the view rays and towards the sun, a light volume lookup counts as one
+        uint64_t m_numViewSamples;
+        uint64_t m_numLightSamples;
+        // Pixels taken from the frame before instead of marched
+        uint64_t m_numReprojectedPixels;
+    };
+
+    // CPU port of the CloudTrace.hlsl compute shader, for rendering clouds on machines without a GPU.
+    // Produces the same CloudBuffer the shader writes: ground, sky and the cheap cloud march with its light samples.
+    class CloudTracer
+    {
+    public:
+        // Tiles match the shader's 32x16 thread groups, each tile is one job
+        static constexpr uint32_t TileWidth = 32;
+        static constexpr uint32_t TileHeight = 16;
+        // TraceReprojected marches one pixel of each block a frame, every pixel once in 16 frames
+        static constexpr uint32_t ReprojectionBlockSize = 4;
+
+        // The shader only takes cheap density samples, so the high frequency and curl noise are never read
+        CloudTracer(const CloudTexture& lowFrequency, const CloudTexture& weatherMap);
+
+        // The occupancy grid is built from both textures when the tracer is made.
+        // Call this after changing either texture's texels, a stale grid skips the wrong steps. It also drops the
+        // light volume, which has to be updated again.
+        void RebuildOccupancyGrid();
+
+        // Builds the light volume, unless it already is. It only depends on the textures, the wind moves where it is
+        // looked up, so this only builds again after RebuildOccupancyGrid. Has to be called before tracing with the
+        // light volume.
+        void UpdateLightVolume(FarlorJobs::JobSystem& jobSystem);
+
+        // Fills pCloudBuffer, screen width * screen height pixels. Tiles run as jobs and trace 8 rays at once
+        // with AVX2 when the CPU has it, one ray at a time otherwise. Runs inline outside the job system.
+        // Steps the occupancy grid shows to be empty are skipped, they would have added nothing.
+        // pStats, when given, gets the samples the trace took.
+        void Trace(FarlorJobs::JobSystem& jobSystem, const CloudTraceParams& params, CloudPixel* pCloudBuffer,
+            CloudTraceStats* pStats = nullptr) const;
+
+        // Trace, but only one pixel of each 4x4 block is marched, the one params' frame index picks. The rest are
+        // reprojected from history: where the view ray enters the cloud layer is found in the old camera's view and
+        // the nearest of its pixels taken. Pixels that land off the old screen, behind the old camera or on the ground
+        // are marched, a tile where most pixels fail is marched whole. Without a history of the same size every pixel is marched.
+        // pCloudBuffer can't be history's CloudBuffer, keep two and swap them each frame.
+        void TraceReprojected(FarlorJobs::JobSystem& jobSystem, const CloudTraceParams& params, const CloudTraceHistory& history,
+            CloudPixel* pCloudBuffer, CloudTraceStats* pStats = nullptr) const;
+
+        // One pixel at a time on the calling thread, a line by line port of the shader that takes every step it does.
+        // This is what the vectorised and skipping paths are checked against.
+        void TraceReference(const CloudTraceParams& params, CloudPixel* pCloudBuffer, CloudTraceStats* pStats = nullptr) const;
+
+        // Whether Trace takes the AVX2 path on this machine
+        static bool IsAvx2Enabled();
+
+    private:
+        // The light volume when params light with it, nullptr to march towards the sun
+        const CloudLightVolume* GetLightVolume(const CloudTraceParams& params) const;
+
+    private:
+        const CloudTexture& m_lowFrequency;
+        const CloudTexture& m_weatherMap;
+        CloudOccupancyGrid m_occupancyGrid;
+        CloudLightVolume m_lightVolume;
+    };
+}
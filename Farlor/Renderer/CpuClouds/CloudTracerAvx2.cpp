@@ -0,0 +1,613 @@
+// Only this file is built with AVX2 and FMA enabled, CloudTracer checks the CPU before calling into it
+
+#include "CloudTracerInternal.h"
+
+#if defined(FARLOR_CPU_CLOUDS_AVX2)
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <bitset>
+
+namespace Farlor
+{
+    namespace CloudTracerInternal
+    {
+        namespace
+        {
+            constexpr uint32_t NumLanes = 8;
+
+            struct Vector3x8
+            {
+                __m256 x;
+                __m256 y;
+                __m256 z;
+            };
+
+            Vector3x8 Broadcast(const CloudVector3& v)
+            {
+                return Vector3x8{ _mm256_set1_ps(v.x), _mm256_set1_ps(v.y), _mm256_set1_ps(v.z) };
+            }
+
+            Vector3x8 Add(const Vector3x8& a, const Vector3x8& b)
+            {
+                return Vector3x8{ _mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z) };
+            }
+
+            Vector3x8 Subtract(const Vector3x8& a, const Vector3x8& b)
+            {
+                return Vector3x8{ _mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z) };
+            }
+
+            Vector3x8 Scale(const Vector3x8& v, __m256 scale)
+            {
+                return Vector3x8{ _mm256_mul_ps(v.x, scale), _mm256_mul_ps(v.y, scale), _mm256_mul_ps(v.z, scale) };
+            }
+
+            __m256 Dot(const Vector3x8& a, const Vector3x8& b)
+            {
+                return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+            }
+
+            __m256 Length(const Vector3x8& v)
+            {
+                return _mm256_sqrt_ps(Dot(v, v));
+            }
+
+            Vector3x8 Normalize(const Vector3x8& v)
+            {
+                const __m256 length = Length(v);
+                return Vector3x8{ _mm256_div_ps(v.x, length), _mm256_div_ps(v.y, length), _mm256_div_ps(v.z, length) };
+            }
+
+            Vector3x8 Select(__m256 mask, const Vector3x8& ifTrue, const Vector3x8& ifFalse)
+            {
+                return Vector3x8{ _mm256_blendv_ps(ifFalse.x, ifTrue.x, mask), _mm256_blendv_ps(ifFalse.y, ifTrue.y, mask),
+                    _mm256_blendv_ps(ifFalse.z, ifTrue.z, mask) };
+            }
+
+            __m256 Remap(__m256 value, __m256 originalMin, __m256 originalMax, __m256 newMin, __m256 newMax)
+            {
+                return _mm256_add_ps(newMin,
+                    _mm256_mul_ps(_mm256_div_ps(_mm256_sub_ps(value, originalMin), _mm256_sub_ps(originalMax, originalMin)),
+                        _mm256_sub_ps(newMax, newMin)));
+            }
+
+            __m256 Remap(__m256 value, float originalMin, float originalMax, float newMin, float newMax)
+            {
+                return Remap(value, _mm256_set1_ps(originalMin), _mm256_set1_ps(originalMax), _mm256_set1_ps(newMin), _mm256_set1_ps(newMax));
+            }
+
+            __m256 Lerp(__m256 a, __m256 b, __m256 t)
+            {
+                return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+            }
+
+            __m256 Saturate(__m256 value)
+            {
+                return _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+            }
+
+            // expf to within a couple of ulp, Cephes' range reduction and polynomial
+            __m256 Exp(__m256 x)
+            {
+                x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3365f)), _mm256_set1_ps(88.3762f));
+
+                // x = n * ln2 + r, with ln2 split in two so r keeps its precision
+                const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+                __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+                r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+                __m256 polynomial = _mm256_set1_ps(1.9875691500e-4f);
+                polynomial = _mm256_fmadd_ps(polynomial, r, _mm256_set1_ps(1.3981999507e-3f));
+                polynomial = _mm256_fmadd_ps(polynomial, r, _mm256_set1_ps(8.3334519073e-3f));
+                polynomial = _mm256_fmadd_ps(polynomial, r, _mm256_set1_ps(4.1665795894e-2f));
+                polynomial = _mm256_fmadd_ps(polynomial, r, _mm256_set1_ps(1.6666665459e-1f));
+                polynomial = _mm256_fmadd_ps(polynomial, r, _mm256_set1_ps(5.0000001201e-1f));
+                polynomial = _mm256_fmadd_ps(polynomial, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+                // Scale by 2^n, built directly in the exponent bits. n is at least -126 after the clamp above.
+                const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+                return _mm256_mul_ps(polynomial, _mm256_castsi256_ps(exponent));
+            }
+
+            // The scalar CloudTexture::Sample's texel pair and weight for one axis, per lane.
+            // Indices come back premultiplied by stride.
+            __m256 WrapLinear(__m256 coordinate, uint32_t size, uint32_t stride, __m256i& index0, __m256i& index1)
+            {
+                const __m256 wrapped = _mm256_sub_ps(coordinate, _mm256_floor_ps(coordinate));
+                const __m256 texel = _mm256_sub_ps(_mm256_mul_ps(wrapped, _mm256_set1_ps(static_cast<float>(size))), _mm256_set1_ps(0.5f));
+                const __m256 texelFloor = _mm256_floor_ps(texel);
+
+                const __m256i index = _mm256_cvttps_epi32(texelFloor);
+                const __m256i sizeVector = _mm256_set1_epi32(static_cast<int32_t>(size));
+                // index is at least -1, which wraps to size - 1
+                const __m256i wrappedIndex0 = _mm256_add_epi32(index, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), index), sizeVector));
+                const __m256i next = _mm256_add_epi32(index, _mm256_set1_epi32(1));
+                const __m256i wrappedIndex1 = _mm256_andnot_si256(_mm256_cmpgt_epi32(next, _mm256_sub_epi32(sizeVector, _mm256_set1_epi32(1))), next);
+
+                const __m256i strideVector = _mm256_set1_epi32(static_cast<int32_t>(stride));
+                index0 = _mm256_mullo_epi32(wrappedIndex0, strideVector);
+                index1 = _mm256_mullo_epi32(wrappedIndex1, strideVector);
+                return _mm256_sub_ps(texel, texelFloor);
+            }
+
+            uint32_t CountLanes(int laneMask)
+            {
+                return static_cast<uint32_t>(std::bitset<NumLanes>(static_cast<unsigned long>(laneMask)).count());
+            }
+
+            __m256 Gather(const float* pTexels, __m256i index)
+            {
+                return _mm256_i32gather_ps(pTexels, index, sizeof(float));
+            }
+
+            // Bilinear sample of the first numChannels channels of a 2D texture
+            void Sample2D(const CloudTexture& texture, __m256 u, __m256 v, uint32_t numChannels, __m256* pChannels)
+            {
+                __m256i x0;
+                __m256i x1;
+                const __m256 weightX = WrapLinear(u, texture.GetWidth(), 4, x0, x1);
+                __m256i y0;
+                __m256i y1;
+                const __m256 weightY = WrapLinear(v, texture.GetHeight(), texture.GetWidth() * 4, y0, y1);
+
+                const __m256i index00 = _mm256_add_epi32(y0, x0);
+                const __m256i index10 = _mm256_add_epi32(y0, x1);
+                const __m256i index01 = _mm256_add_epi32(y1, x0);
+                const __m256i index11 = _mm256_add_epi32(y1, x1);
+                for (uint32_t channel = 0; channel < numChannels; ++channel)
+                {
+                    const float* pTexels = texture.GetTexels() + channel;
+                    const __m256 top = Lerp(Gather(pTexels, index00), Gather(pTexels, index10), weightX);
+                    const __m256 bottom = Lerp(Gather(pTexels, index01), Gather(pTexels, index11), weightX);
+                    pChannels[channel] = Lerp(top, bottom, weightY);
+                }
+            }
+
+            // Trilinear sample of all four channels of a volume
+            void Sample3D(const CloudTexture& texture, __m256 u, __m256 v, __m256 w, __m256* pChannels)
+            {
+                const uint32_t rowPitch = texture.GetWidth() * 4;
+                const uint32_t slicePitch = rowPitch * texture.GetHeight();
+
+                __m256i x0;
+                __m256i x1;
+                const __m256 weightX = WrapLinear(u, texture.GetWidth(), 4, x0, x1);
+                __m256i y0;
+                __m256i y1;
+                const __m256 weightY = WrapLinear(v, texture.GetHeight(), rowPitch, y0, y1);
+                __m256i z0;
+                __m256i z1;
+                const __m256 weightZ = WrapLinear(w, texture.GetDepth(), slicePitch, z0, z1);
+
+                const __m256i slices[2] = { z0, z1 };
+                __m256i indices[2][4];
+                for (uint32_t i = 0; i < 2; ++i)
+                {
+                    indices[i][0] = _mm256_add_epi32(slices[i], _mm256_add_epi32(y0, x0));
+                    indices[i][1] = _mm256_add_epi32(slices[i], _mm256_add_epi32(y0, x1));
+                    indices[i][2] = _mm256_add_epi32(slices[i], _mm256_add_epi32(y1, x0));
+                    indices[i][3] = _mm256_add_epi32(slices[i], _mm256_add_epi32(y1, x1));
+                }
+
+                for (uint32_t channel = 0; channel < 4; ++channel)
+                {
+                    const float* pTexels = texture.GetTexels() + channel;
+                    __m256 sliceValues[2];
+                    for (uint32_t i = 0; i < 2; ++i)
+                    {
+                        const __m256 top = Lerp(Gather(pTexels, indices[i][0]), Gather(pTexels, indices[i][1]), weightX);
+                        const __m256 bottom = Lerp(Gather(pTexels, indices[i][2]), Gather(pTexels, indices[i][3]), weightX);
+                        sliceValues[i] = Lerp(top, bottom, weightY);
+                    }
+                    pChannels[channel] = Lerp(sliceValues[0], sliceValues[1], weightZ);
+                }
+            }
+
+            // Trilinear lookup in the light volume, the scalar CloudLightVolume::Sample per lane with p moved into wind space
+            __m256 SampleLightVolume(const CloudLightVolume& lightVolume, const Vector3x8& p, __m256 heightFraction, const CloudVector3& windOffset)
+            {
+                const float halfLayer = 0.5f / CloudLightVolume::NumLayers;
+                const __m256 clampedHeightFraction = _mm256_min_ps(_mm256_max_ps(heightFraction, _mm256_set1_ps(halfLayer)),
+                    _mm256_set1_ps(1.0f - halfLayer));
+
+                __m256i x0;
+                __m256i x1;
+                const __m256 weightX = WrapLinear(_mm256_div_ps(_mm256_add_ps(p.x, _mm256_set1_ps(windOffset.x)), _mm256_set1_ps(WeatherMapScale)),
+                    CloudLightVolume::Width, 1, x0, x1);
+                __m256i y0;
+                __m256i y1;
+                const __m256 weightY = WrapLinear(clampedHeightFraction, CloudLightVolume::NumLayers, CloudLightVolume::Width, y0, y1);
+                __m256i z0;
+                __m256i z1;
+                const __m256 weightZ = WrapLinear(_mm256_div_ps(_mm256_add_ps(p.z, _mm256_set1_ps(windOffset.z)), _mm256_set1_ps(LowFrequencyScale)), CloudLightVolume::Depth,
+                    CloudLightVolume::Width * CloudLightVolume::NumLayers, z0, z1);
+
+                const float* pVoxels = lightVolume.GetVoxels();
+                const __m256i slices[2] = { z0, z1 };
+                __m256 sliceValues[2];
+                for (uint32_t i = 0; i < 2; ++i)
+                {
+                    const __m256 top = Lerp(Gather(pVoxels, _mm256_add_epi32(slices[i], _mm256_add_epi32(y0, x0))),
+                        Gather(pVoxels, _mm256_add_epi32(slices[i], _mm256_add_epi32(y0, x1))), weightX);
+                    const __m256 bottom = Lerp(Gather(pVoxels, _mm256_add_epi32(slices[i], _mm256_add_epi32(y1, x0))),
+                        Gather(pVoxels, _mm256_add_epi32(slices[i], _mm256_add_epi32(y1, x1))), weightX);
+                    sliceValues[i] = Lerp(top, bottom, weightY);
+                }
+                return Lerp(sliceValues[0], sliceValues[1], weightZ);
+            }
+
+            // Coverage and cloud type, the only weather channels the density reads
+            void SampleWeather(const CloudTexture& weatherMap, const Vector3x8& p, __m256* pWeather)
+            {
+                const __m256 scale = _mm256_set1_ps(WeatherMapScale);
+                Sample2D(weatherMap, _mm256_div_ps(p.x, scale), _mm256_div_ps(p.y, scale), 2, pWeather);
+            }
+
+            __m256 DensityHeightAtPoint(__m256 densityHeight, __m256 weatherG)
+            {
+                const __m256 stratus = _mm256_mul_ps(Remap(densityHeight, 0.0f, 0.1f, 0.0f, 1.0f), Remap(densityHeight, 0.2f, 0.3f, 1.0f, 0.0f));
+                const __m256 strato = _mm256_mul_ps(Remap(densityHeight, 0.0f, 0.2f, 0.0f, 1.0f), Remap(densityHeight, 0.45f, 0.6f, 1.0f, 0.0f));
+                const __m256 cumulus = _mm256_mul_ps(Remap(densityHeight, 0.0f, 0.1f, 0.0f, 1.0f), Remap(densityHeight, 0.7f, 0.95f, 1.0f, 0.0f));
+
+                const __m256 two = _mm256_set1_ps(2.0f);
+                const __m256 stratusToStratoAmount = Saturate(_mm256_mul_ps(weatherG, two));
+                const __m256 stratoToCumulusAmount = Saturate(_mm256_mul_ps(_mm256_sub_ps(weatherG, _mm256_set1_ps(0.5f)), two));
+
+                const __m256 stratusToStratoInterp = Lerp(stratus, strato, stratusToStratoAmount);
+                const __m256 stratoToCumulusInterp = Lerp(strato, cumulus, stratoToCumulusAmount);
+                return Lerp(stratusToStratoInterp, stratoToCumulusInterp, densityHeight);
+            }
+
+            // Eight lanes of the scalar SampleCloudDensity
+            __m256 SampleCloudDensity(const FrameConstants& frame, const CloudTexture& lowFrequency, Vector3x8 p,
+                const __m256* pWeather, __m256 rayToInnerShellLength, const Vector3x8& rayDir)
+            {
+                const Vector3x8 cameraPos = Broadcast(frame.m_cameraPos);
+                const __m256 rayFromCameraLength = Length(Subtract(p, cameraPos));
+                const __m256 cosTheta = Dot(rayDir, Normalize(Subtract(p, Broadcast(frame.m_earthCenter))));
+                const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+                __m256 heightFraction = _mm256_div_ps(
+                    _mm256_and_ps(_mm256_mul_ps(cosTheta, _mm256_sub_ps(rayFromCameraLength, rayToInnerShellLength)), absMask),
+                    _mm256_set1_ps(AtmosphereRadiusOuter - AtmosphereRadiusInner));
+                heightFraction = _mm256_and_ps(heightFraction, _mm256_cmp_ps(p.y, cameraPos.y, _CMP_GE_OQ));
+
+                p.x = _mm256_add_ps(p.x, _mm256_mul_ps(heightFraction, _mm256_set1_ps(CloudTopOffset)));
+                p = Add(p, Broadcast(frame.m_windOffset));
+
+                const __m256 scale = _mm256_set1_ps(LowFrequencyScale);
+                __m256 lowFrequencyNoises[4];
+                Sample3D(lowFrequency, _mm256_div_ps(p.x, scale), _mm256_div_ps(p.y, scale), _mm256_div_ps(p.z, scale), lowFrequencyNoises);
+
+                const __m256 lowFrequencyFbm = _mm256_add_ps(_mm256_add_ps(
+                    _mm256_mul_ps(lowFrequencyNoises[1], _mm256_set1_ps(0.625f)),
+                    _mm256_mul_ps(lowFrequencyNoises[2], _mm256_set1_ps(0.25f))),
+                    _mm256_mul_ps(lowFrequencyNoises[3], _mm256_set1_ps(0.125f)));
+                const __m256 one = _mm256_set1_ps(1.0f);
+                const __m256 dilation = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_sub_ps(one, lowFrequencyFbm));
+                __m256 baseCloud = Remap(lowFrequencyNoises[0], dilation, one, _mm256_setzero_ps(), one);
+                baseCloud = _mm256_mul_ps(baseCloud, DensityHeightAtPoint(heightFraction, pWeather[1]));
+
+                const __m256 cloudCoverage = pWeather[0];
+                const __m256 baseCloudWithCoverage = _mm256_mul_ps(Remap(baseCloud, cloudCoverage, one, _mm256_setzero_ps(), one), cloudCoverage);
+
+                // maxps returns its second operand for NaN lanes, so full coverage ends up at 0 as in the shader
+                return _mm256_max_ps(baseCloudWithCoverage, _mm256_setzero_ps());
+            }
+
+            // RaySphereIntersection distance per lane, 0 on a miss
+            __m256 RaySphereDistance(const CloudVector3& rayPoint, const Vector3x8& rayDir, const CloudVector3& spherePos, float radius)
+            {
+                const CloudVector3 localPoint((rayPoint.x - spherePos.x) / radius, (rayPoint.y - spherePos.y) / radius, (rayPoint.z - spherePos.z) / radius);
+                const Vector3x8 localPoint8 = Broadcast(localPoint);
+
+                const __m256 a = Dot(rayDir, rayDir);
+                const __m256 b = _mm256_mul_ps(_mm256_set1_ps(2.0f), Dot(rayDir, rayDir));
+                const __m256 c = _mm256_set1_ps((localPoint.x * localPoint.x + localPoint.y * localPoint.y + localPoint.z * localPoint.z) - 1.0f);
+                const __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), a), c));
+                const __m256 hasRoots = _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ);
+
+                const __m256 zero = _mm256_setzero_ps();
+                const __m256 rootDiscriminant = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+                const __m256 twoA = _mm256_mul_ps(_mm256_set1_ps(2.0f), a);
+                const __m256 negativeB = _mm256_sub_ps(zero, b);
+                const __m256 nearT = _mm256_div_ps(_mm256_sub_ps(negativeB, rootDiscriminant), twoA);
+                const __m256 farT = _mm256_div_ps(_mm256_add_ps(negativeB, rootDiscriminant), twoA);
+                const __m256 t = _mm256_blendv_ps(nearT, farT, _mm256_cmp_ps(nearT, zero, _CMP_LT_OQ));
+                const __m256 isHit = _mm256_and_ps(hasRoots, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+
+                const __m256 radiusVector = _mm256_set1_ps(radius);
+                const Vector3x8 hitPoint = Add(Scale(Add(localPoint8, Scale(rayDir, t)), radiusVector), Broadcast(spherePos));
+                return _mm256_and_ps(Length(Subtract(hitPoint, localPoint8)), isHit);
+            }
+
+            __m256 HitsGroundDisk(const CloudVector3& rayOrigin, const Vector3x8& rayDir)
+            {
+                const CloudVector3 normal(0.0f, -1.0f, 0.0f);
+                const __m256 denominator = Dot(Broadcast(normal), rayDir);
+                const float originDotNormal = (-rayOrigin.x) * normal.x + (-rayOrigin.y) * normal.y + (-rayOrigin.z) * normal.z;
+                const __m256 t = _mm256_div_ps(_mm256_set1_ps(originDotNormal), denominator);
+
+                const Vector3x8 hitPoint = Add(Broadcast(rayOrigin), Scale(rayDir, t));
+                __m256 isHit = _mm256_cmp_ps(denominator, _mm256_set1_ps(GroundPlaneEpsilon), _CMP_GT_OQ);
+                isHit = _mm256_and_ps(isHit, _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GE_OQ));
+                return _mm256_and_ps(isHit, _mm256_cmp_ps(Length(hitPoint), _mm256_set1_ps(GroundDiskRadius), _CMP_LE_OQ));
+            }
+
+            // Eight lanes of the scalar PerformCloudMarch. Every lane has its own stepper, so each iteration samples
+            // each lane at its own step. Lanes outside activeMask are never sampled, a lane stops marching once it is
+            // all but opaque, and the light samples are skipped altogether when no lane needs them.
+            void PerformCloudMarch(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+                const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, const Vector3x8& rayDir,
+                __m256 innerDistance, __m256 outerDistance, __m256 activeMask, __m256& radiance, __m256& opacity, CloudTraceStats& stats)
+            {
+                const __m256 stepSize = _mm256_div_ps(_mm256_sub_ps(outerDistance, innerDistance), _mm256_set1_ps(static_cast<float>(NumMarchSteps)));
+                const Vector3x8 traceDir = Normalize(rayDir);
+                const Vector3x8 cameraPos = Broadcast(frame.m_cameraPos);
+                const Vector3x8 startTracePos = Add(cameraPos, Scale(traceDir, innerDistance));
+                const __m256 rayToInnerShellLength = Length(Subtract(startTracePos, cameraPos));
+                const Vector3x8 sunPosition = Broadcast(frame.m_sunPosition);
+                const Vector3x8 earthCenter = Broadcast(frame.m_earthCenter);
+                const __m256 innerRadius = _mm256_set1_ps(frame.m_innerRadius);
+                const __m256 outerRadius = _mm256_set1_ps(frame.m_outerRadius);
+                const __m256 substinenceDensity = _mm256_set1_ps(SubstinenceDensity);
+                const __m256 negativeAbsorption = _mm256_set1_ps(-LightAbsorption);
+                const __m256 transmittanceEpsilon = _mm256_set1_ps(frame.m_march.m_transmittanceEpsilon);
+                const __m256 zero = _mm256_setzero_ps();
+                const __m256 one = _mm256_set1_ps(1.0f);
+
+                alignas(32) float startX[NumLanes];
+                alignas(32) float startY[NumLanes];
+                alignas(32) float startZ[NumLanes];
+                alignas(32) float dirX[NumLanes];
+                alignas(32) float dirY[NumLanes];
+                alignas(32) float dirZ[NumLanes];
+                alignas(32) float stepSizes[NumLanes];
+                _mm256_store_ps(startX, startTracePos.x);
+                _mm256_store_ps(startY, startTracePos.y);
+                _mm256_store_ps(startZ, startTracePos.z);
+                _mm256_store_ps(dirX, traceDir.x);
+                _mm256_store_ps(dirY, traceDir.y);
+                _mm256_store_ps(dirZ, traceDir.z);
+                _mm256_store_ps(stepSizes, stepSize);
+
+                MarchStepper steppers[NumLanes];
+                bool isMarching[NumLanes] = {};
+                const int activeLanes = _mm256_movemask_ps(activeMask);
+                for (uint32_t lane = 0; lane < NumLanes; ++lane)
+                {
+                    isMarching[lane] = (activeLanes & (1 << lane)) != 0;
+                    CloudOccupancyGrid::MarchRay marchRay{};
+                    if (isMarching[lane] && pOccupancyGrid)
+                    {
+                        marchRay = pOccupancyGrid->MakeMarchRay(frame.m_cameraPos, CloudVector3(startX[lane], startY[lane], startZ[lane]),
+                            CloudVector3(dirX[lane], dirY[lane], dirZ[lane]), stepSizes[lane]);
+                    }
+                    steppers[lane].Start(frame.m_march, pOccupancyGrid, marchRay);
+                }
+
+                radiance = zero;
+                __m256 transmittance = one;
+                while (true)
+                {
+                    alignas(32) float stepIndices[NumLanes];
+                    alignas(32) int32_t laneSamples[NumLanes];
+                    for (uint32_t lane = 0; lane < NumLanes; ++lane)
+                    {
+                        uint32_t stepIndex = 0;
+                        isMarching[lane] = isMarching[lane] && steppers[lane].NextStep(stepIndex);
+                        stepIndices[lane] = static_cast<float>(stepIndex);
+                        laneSamples[lane] = isMarching[lane] ? -1 : 0;
+                    }
+
+                    const __m256 sampleMask = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(laneSamples)));
+                    const int sampledLanes = _mm256_movemask_ps(sampleMask);
+                    if (sampledLanes == 0)
+                    {
+                        break;
+                    }
+                    stats.m_numViewSamples += CountLanes(sampledLanes);
+
+                    const Vector3x8 samplePoint = Add(startTracePos, Scale(traceDir, _mm256_mul_ps(stepSize, _mm256_load_ps(stepIndices))));
+                    __m256 weather[2];
+                    SampleWeather(weatherMap, samplePoint, weather);
+
+                    const __m256 cloudDensity = _mm256_mul_ps(
+                        SampleCloudDensity(frame, lowFrequency, samplePoint, weather, rayToInnerShellLength, rayDir), substinenceDensity);
+                    const int denseLanes = _mm256_movemask_ps(_mm256_cmp_ps(cloudDensity, zero, _CMP_GT_OQ));
+
+                    alignas(32) int32_t laneIntegrates[NumLanes];
+                    for (uint32_t lane = 0; lane < NumLanes; ++lane)
+                    {
+                        laneIntegrates[lane] = (isMarching[lane] && steppers[lane].OnSample((denseLanes & (1 << lane)) != 0)) ? -1 : 0;
+                    }
+
+                    const __m256 lightMask = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(laneIntegrates)));
+                    const int litLanes = _mm256_movemask_ps(lightMask);
+                    if (litLanes == 0)
+                    {
+                        continue;
+                    }
+                    __m256 combinedColor = zero;
+                    if (pLightVolume)
+                    {
+                        stats.m_numLightSamples += CountLanes(litLanes);
+                        const __m256 heightFraction = _mm256_div_ps(_mm256_sub_ps(Length(Subtract(samplePoint, earthCenter)), innerRadius),
+                            _mm256_sub_ps(outerRadius, innerRadius));
+                        combinedColor = SampleLightVolume(*pLightVolume, samplePoint, heightFraction, frame.m_windOffset);
+                    }
+                    else
+                    {
+                        stats.m_numLightSamples += CountLanes(litLanes) * NumLightSamples;
+
+                        const Vector3x8 lightDirection = Normalize(Subtract(sunPosition, samplePoint));
+                        const Vector3x8 lightStep = Scale(lightDirection, stepSize);
+                        __m256 lightDensity = zero;
+                        for (uint32_t l = 0; l < NumLightSamples; ++l)
+                        {
+                            const Vector3x8 lightSamplePos = Add(samplePoint, Scale(lightStep, _mm256_set1_ps(static_cast<float>(l))));
+                            __m256 lightWeather[2];
+                            SampleWeather(weatherMap, lightSamplePos, lightWeather);
+
+                            lightDensity = _mm256_add_ps(lightDensity, _mm256_mul_ps(
+                                SampleCloudDensity(frame, lowFrequency, lightSamplePos, lightWeather, rayToInnerShellLength, rayDir), substinenceDensity));
+                            combinedColor = _mm256_add_ps(combinedColor,
+                                _mm256_mul_ps(Exp(_mm256_mul_ps(negativeAbsorption, lightDensity)), _mm256_set1_ps(LightSampleScale)));
+                        }
+                    }
+
+                    const __m256 dt = Exp(_mm256_mul_ps(_mm256_mul_ps(negativeAbsorption, stepSize), cloudDensity));
+                    const __m256 scattered = _mm256_mul_ps(_mm256_mul_ps(combinedColor, _mm256_sub_ps(one, dt)), transmittance);
+                    radiance = _mm256_add_ps(radiance, _mm256_and_ps(scattered, lightMask));
+                    transmittance = _mm256_blendv_ps(transmittance, _mm256_mul_ps(transmittance, dt), lightMask);
+
+                    // As in the scalar march, lanes that are all but opaque are done
+                    const int opaqueLanes = litLanes & _mm256_movemask_ps(_mm256_cmp_ps(transmittance, transmittanceEpsilon, _CMP_LT_OQ));
+                    for (uint32_t lane = 0; lane < NumLanes; ++lane)
+                    {
+                        isMarching[lane] = isMarching[lane] && (opaqueLanes & (1 << lane)) == 0;
+                    }
+                }
+                opacity = _mm256_sub_ps(one, transmittance);
+            }
+
+            __m256 LaneIndices()
+            {
+                return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+            }
+
+            // The vertical part of the primary ray origin is shared by a whole row
+            Vector3x8 GetRowNearUp(const FrameConstants& frame, uint32_t y)
+            {
+                const float v = static_cast<float>(y) / static_cast<float>(frame.m_screenHeight) * 2.0f - 1.0f;
+                return Broadcast(CloudVector3(frame.m_nearUp.x * v, frame.m_nearUp.y * v, frame.m_nearUp.z * v));
+            }
+
+            // CSMain for the pixels at pixelX in the row nearUpV belongs to. Only the first numActiveLanes lanes are
+            // marched and written to pPixels.
+            void TraceLanes(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+                const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, const Vector3x8& nearUpV, __m256 pixelX,
+                uint32_t numActiveLanes, CloudPixel* pPixels, CloudTraceStats& stats)
+            {
+                // Transform to [-1, 1] space from [0, 1] space
+                const __m256 u = _mm256_sub_ps(_mm256_mul_ps(_mm256_div_ps(pixelX, _mm256_set1_ps(static_cast<float>(frame.m_screenWidth))),
+                    _mm256_set1_ps(2.0f)), _mm256_set1_ps(1.0f));
+
+                const Vector3x8 rayDir = Normalize(Add(Add(Broadcast(frame.m_nearForward), Scale(Broadcast(frame.m_nearRight), u)), nearUpV));
+
+                const __m256 groundMask = HitsGroundDisk(frame.m_cameraPos, rayDir);
+                const __m256 laneMask = _mm256_cmp_ps(LaneIndices(), _mm256_set1_ps(static_cast<float>(numActiveLanes)), _CMP_LT_OQ);
+                const __m256 activeMask = _mm256_andnot_ps(groundMask, laneMask);
+                __m256 radiance = _mm256_setzero_ps();
+                __m256 opacity = _mm256_setzero_ps();
+                if (_mm256_movemask_ps(activeMask) != 0)
+                {
+                    const __m256 innerDistance = RaySphereDistance(frame.m_cameraPos, rayDir, frame.m_earthCenter, frame.m_innerRadius);
+                    const __m256 outerDistance = RaySphereDistance(frame.m_cameraPos, rayDir, frame.m_earthCenter, frame.m_outerRadius);
+                    PerformCloudMarch(frame, lowFrequency, weatherMap, pOccupancyGrid, pLightVolume, rayDir, innerDistance, outerDistance,
+                        activeMask, radiance, opacity, stats);
+                }
+
+                const Vector3x8 skyColor = Broadcast(SkyColor);
+                const Vector3x8 marchColor{ radiance, radiance, radiance };
+                const Vector3x8 cloudColor{ Lerp(skyColor.x, marchColor.x, opacity), Lerp(skyColor.y, marchColor.y, opacity),
+                    Lerp(skyColor.z, marchColor.z, opacity) };
+                const Vector3x8 finalColor = Select(groundMask, Broadcast(GroundColor), cloudColor);
+
+                alignas(32) float red[NumLanes];
+                alignas(32) float green[NumLanes];
+                alignas(32) float blue[NumLanes];
+                _mm256_store_ps(red, finalColor.x);
+                _mm256_store_ps(green, finalColor.y);
+                _mm256_store_ps(blue, finalColor.z);
+                for (uint32_t lane = 0; lane < numActiveLanes; ++lane)
+                {
+                    pPixels[lane] = CloudPixel{ red[lane], green[lane], blue[lane], 1.0f };
+                }
+            }
+        }
+
+        void TraceSpanAvx2(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t y, uint32_t xBegin, uint32_t xEnd,
+            uint32_t xStep, CloudPixel* pCloudBuffer, CloudTraceStats& stats)
+        {
+            const __m256 laneOffsets = _mm256_mul_ps(LaneIndices(), _mm256_set1_ps(static_cast<float>(xStep)));
+            const Vector3x8 nearUpV = GetRowNearUp(frame, y);
+
+            for (uint32_t x = xBegin; x < xEnd; x += NumLanes * xStep)
+            {
+                const uint32_t numActiveLanes = std::min(NumLanes, (xEnd - x + xStep - 1) / xStep);
+                const __m256 pixelX = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+
+                CloudPixel pixels[NumLanes];
+                TraceLanes(frame, lowFrequency, weatherMap, pOccupancyGrid, pLightVolume, nearUpV, pixelX, numActiveLanes, pixels, stats);
+
+                CloudPixel* pPixels = &pCloudBuffer[x + y * frame.m_screenWidth];
+                for (uint32_t lane = 0; lane < numActiveLanes; ++lane)
+                {
+                    pPixels[lane * xStep] = pixels[lane];
+                }
+            }
+        }
+
+        void TracePixelsAvx2(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t y, const uint32_t* pXs,
+            uint32_t numPixels, CloudPixel* pCloudBuffer, CloudTraceStats& stats)
+        {
+            const Vector3x8 nearUpV = GetRowNearUp(frame, y);
+
+            for (uint32_t first = 0; first < numPixels; first += NumLanes)
+            {
+                const uint32_t numActiveLanes = std::min(NumLanes, numPixels - first);
+                alignas(32) float pixelXs[NumLanes] = {};
+                for (uint32_t lane = 0; lane < numActiveLanes; ++lane)
+                {
+                    pixelXs[lane] = static_cast<float>(pXs[first + lane]);
+                }
+
+                CloudPixel pixels[NumLanes];
+                TraceLanes(frame, lowFrequency, weatherMap, pOccupancyGrid, pLightVolume, nearUpV, _mm256_load_ps(pixelXs), numActiveLanes,
+                    pixels, stats);
+
+                CloudPixel* pRow = &pCloudBuffer[y * frame.m_screenWidth];
+                for (uint32_t lane = 0; lane < numActiveLanes; ++lane)
+                {
+                    pRow[pXs[first + lane]] = pixels[lane];
+                }
+            }
+        }
+    }
+}
+
+#else
+
+namespace Farlor
+{
+    namespace CloudTracerInternal
+    {
+        // Never called, CloudTracer::IsAvx2Enabled is false without FARLOR_CPU_CLOUDS_AVX2
+        void TraceSpanAvx2(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t y, uint32_t xBegin, uint32_t xEnd,
+            uint32_t xStep, CloudPixel* pCloudBuffer, CloudTraceStats& stats)
+        {
+            for (uint32_t x = xBegin; x < xEnd; x += xStep)
+            {
+                pCloudBuffer[x + y * frame.m_screenWidth] = TracePixel(frame, lowFrequency, weatherMap, pOccupancyGrid, pLightVolume, x, y, stats);
+            }
+        }
+
+        void TracePixelsAvx2(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t y, const uint32_t* pXs,
+            uint32_t numPixels, CloudPixel* pCloudBuffer, CloudTraceStats& stats)
+        {
+            for (uint32_t i = 0; i < numPixels; ++i)
+            {
+                pCloudBuffer[pXs[i] + y * frame.m_screenWidth] = TracePixel(frame, lowFrequency, weatherMap, pOccupancyGrid, pLightVolume,
+                    pXs[i], y, stats);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "CloudLightVolume.h"
+#include "CloudOccupancyGrid.h"
+#include "CloudTexture.h"
+#include "CloudTracer.h"
+
+#include <cstdint>
+
+namespace Farlor
+{
+    namespace CloudTracerInternal
+    {
+        // CloudParams.hlsl
+        constexpr float EarthRadius = 6371000.0f;
+        constexpr float AtmosphereRadiusInner = 15000.0f;
+        constexpr float AtmosphereRadiusOuter = 35000.0f;
+
+        // CSMain
+        constexpr float NearDistance = 0.1f;
+        constexpr float GroundDiskRadius = 10000.0f;
+        constexpr float GroundPlaneEpsilon = 1e-6f;
+        const CloudVector3 GroundColor(0.333333f, 0.419608f, 0.184314f);
+        const CloudVector3 SkyColor(0.529412f, 0.807843f, 0.921569f);
+
+        // PerformCloudMarch
+        constexpr uint32_t NumMarchSteps = 60;
+        constexpr uint32_t NumLightSamples = 6;
+        constexpr float SubstinenceDensity = 0.1f;
+        constexpr float LightAbsorption = 0.9f;
+        constexpr float LightSampleScale = 0.8f;
+        constexpr float WeatherMapScale = 60000.0f;
+
+        // SampleCloudDensity
+        constexpr float CloudTopOffset = 500.0f;
+        constexpr float CloudSpeed = 10.0f;
+        constexpr float LowFrequencyScale = 10000.0f;
+
+        // Everything CSMain derives from the constant buffers before it looks at its pixel
+        struct FrameConstants
+        {
+            FrameConstants();
+
+            uint32_t m_screenWidth;
+            uint32_t m_screenHeight;
+            CloudVector3 m_cameraPos;
+            // camForward * nearDistance, camRight * windowRight and camUp * windowTop. The primary rays are built from
+            // them relative to the camera, at the camera's world position they would round to blocks of pixels.
+            CloudVector3 m_nearForward;
+            CloudVector3 m_nearRight;
+            CloudVector3 m_nearUp;
+            CloudVector3 m_earthCenter;
+            float m_innerRadius;
+            float m_outerRadius;
+            CloudVector3 m_sunPosition;
+            // (windDirection + (0, 0.1, 0)) * TotalTime * cloudSpeed * 100
+            CloudVector3 m_windOffset;
+            CloudMarchSettings m_march;
+        };
+
+        FrameConstants MakeFrameConstants(const CloudTraceParams& params);
+
+        // How far the wind has carried the noise at totalTime
+        CloudVector3 GetWindOffset(float totalTime);
+
+        // The cheap density at a known height fraction, everything SampleCloudDensity does once it has the height
+        float SampleBaseCloudDensity(const CloudTexture& lowFrequency, CloudVector3 p, const float weather[4], float heightFraction,
+            const CloudVector3& windOffset);
+
+        // Which steps PerformCloudMarch samples. Coarse steps cross empty air. The first coarse sample with density
+        // sends the march back to just past the last empty one, to refine with fine steps, and it goes back to
+        // coarse steps after enough empty fine samples in a row once it is past that coarse sample, so the fine steps
+        // always reach the density the coarse sample found. The scalar and AVX2 marches share it so both take
+        // the same samples. Steps the occupancy grid shows to be empty are stepped through as if they had been
+        // sampled and come out empty, so the grid never changes which samples are taken.
+        class MarchStepper
+        {
+        public:
+            MarchStepper();
+
+            void Start(const CloudMarchSettings& settings, const CloudOccupancyGrid* pOccupancyGrid, const CloudOccupancyGrid::MarchRay& ray);
+
+            // The next step to sample, false once the march is over
+            bool NextStep(uint32_t& stepIndex);
+
+            // Moves past the step NextStep gave. True when the sample goes into the integral, coarse samples only
+            // find where to refine.
+            bool OnSample(bool hasDensity);
+
+        private:
+            void OnEmptySample();
+
+        private:
+            const CloudOccupancyGrid* m_pOccupancyGrid;
+            CloudOccupancyGrid::MarchRay m_ray;
+            uint32_t m_coarseStepScale;
+            uint32_t m_numEmptyStepsBeforeCoarse;
+            uint32_t m_stepIndex;
+            // Where to refine from if the coarse sample at m_stepIndex has density
+            uint32_t m_refineFrom;
+            // The coarse sample with density that started the refinement, steps stay fine until past it
+            uint32_t m_refineUntil;
+            uint32_t m_numEmptySteps;
+            // Steps before this don't need to ask the occupancy grid
+            uint32_t m_sampleUntil;
+            bool m_isCoarse;
+        };
+
+        // Bodies of CSMain, the scalar one for a single pixel, the AVX2 one for every xStep'th pixel of [xBegin, xEnd)
+        // in row y. With no occupancy grid every step the march comes to is sampled, with no light volume every lit
+        // sample marches towards the sun. Both add the samples they take to stats.
+        CloudPixel TracePixel(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t x, uint32_t y, CloudTraceStats& stats);
+
+        void TraceSpanAvx2(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t y, uint32_t xBegin, uint32_t xEnd,
+            uint32_t xStep, CloudPixel* pCloudBuffer, CloudTraceStats& stats);
+
+        // TraceSpanAvx2 for the numPixels pixels of row y listed in pXs, eight at a time
+        void TracePixelsAvx2(const FrameConstants& frame, const CloudTexture& lowFrequency, const CloudTexture& weatherMap,
+            const CloudOccupancyGrid* pOccupancyGrid, const CloudLightVolume* pLightVolume, uint32_t y, const uint32_t* pXs,
+            uint32_t numPixels, CloudPixel* pCloudBuffer, CloudTraceStats& stats);
+
+        // The pixel of each reprojection block marched on frameIndex. Consecutive frames go through the blocks in
+        // Bayer order, so the pixels marched over any few frames are spread across the block.
+        void GetMarchedPixel(uint32_t frameIndex, uint32_t& blockX, uint32_t& blockY);
+
+        // CSReproject: pixel (x, y) of frame taken from the previous frame's CloudBuffer. False when it's rejected
+        // and has to be marched.
+        bool ReprojectPixel(const FrameConstants& frame, const FrameConstants& previousFrame, const CloudPixel* pPreviousCloudBuffer,
+            uint32_t x, uint32_t y, CloudPixel& pixel);
+    }
+}
@@ -1,6 +1,7 @@
 #include "D3D11Backend.h"
 #include "CBStructures.h"
 
+#include <IWindow.h>
 #include <Renderer.h>
 
 #include <StringUtil.h>
@@ -0,0 +1,87 @@
+#include "HeadlessBackend.h"
+
+#include <iostream>
+
+namespace Farlor
+{
+    namespace
+    {
+        CloudVector3 ToCloudVector3(const Vector3& vector)
+        {
+            return CloudVector3(vector.x, vector.y, vector.z);
+        }
+    }
+
+    HeadlessBackend::HeadlessBackend(const Renderer& renderer, FarlorJobs::JobSystem& jobSystem, const CloudFrameRenderer::Settings& settings)
+        : IGraphicsBackend(renderer)
+        , m_isInitialized{ false }
+        , m_numFailedFrames{ 0 }
+        , m_jobSystem{ jobSystem }
+        , m_settings{ settings }
+        , m_resourceDir{}
+        , m_upFrameRenderer{ nullptr }
+        , m_idToBackendGeometry{}
+        , m_currentGeometryId{ 0 }
+    {
+    }
+
+    HeadlessBackend::~HeadlessBackend()
+    {
+    }
+
+    void HeadlessBackend::Initialize(IWindow *pWindow, std::string& resourceDir)
+    {
+        m_resourceDir = resourceDir;
+        m_numFailedFrames = 0;
+
+        m_upFrameRenderer = std::make_unique<CloudFrameRenderer>(m_jobSystem, m_settings);
+        if (!m_upFrameRenderer->Initialize(m_resourceDir))
+        {
+            std::cout << "Failed to initialize the headless backend" << std::endl;
+            m_upFrameRenderer.reset();
+            return;
+        }
+        m_isInitialized = true;
+    }
+
+    void HeadlessBackend::Shutdown()
+    {
+        m_upFrameRenderer.reset();
+        m_isInitialized = false;
+    }
+
+    void HeadlessBackend::Render(const VisibleSet& visibleSet, const LightSet& lightSet, const CameraEntry& currentCameraEntry, float deltaTime, float totalTime)
+    {
+        if (!m_isInitialized)
+        {
+            return;
+        }
+
+        // The same camera and time values the cloud trace pass puts in its constant buffers
+        CloudTraceParams params;
+        params.m_cameraPos = ToCloudVector3(currentCameraEntry.m_position);
+        params.m_cameraTarget = ToCloudVector3(currentCameraEntry.m_target);
+        params.m_worldUp = ToCloudVector3(currentCameraEntry.m_worldUp);
+        params.m_fovHorizontal = currentCameraEntry.m_fov;
+        params.m_totalTime = totalTime;
+
+        if (!m_upFrameRenderer->RenderFrame(params))
+        {
+            ++m_numFailedFrames;
+            std::cout << "Failed to write headless frame " << (m_upFrameRenderer->GetNumFramesRendered() - 1) << std::endl;
+        }
+    }
+
+    Geometry::GeometryHandle HeadlessBackend::RegisterGeometry(Geometry* pGeometry)
+    {
+        // Ensure we have geometry
+        if (!pGeometry)
+        {
+            return -1;
+        }
+
+        m_idToBackendGeometry.insert(std::make_pair(m_currentGeometryId, pGeometry));
+        ++m_currentGeometryId;
+        return (m_currentGeometryId - 1);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "../IGraphicsBackend.h"
+
+#include <CloudFrameRenderer.h>
+#include <JobSystem.h>
+
+#include <Geometry.h>
+
+#include <map>
+#include <memory>
+
+namespace Farlor
+{
+    // Backend without a device or a window, for rendering frames offline. Every frame the renderer submits is traced on
+    // the CPU, tonemapped and written out as files instead of presented. Only needs the platform neutral RendererCore,
+    // so it builds wherever the CPU cloud tracer does. See tools/HeadlessRender.
+    // Like the spatiotemporal filter backend's final image, frames only show the clouds. Geometry is registered
+    // so handles stay valid, but it is never drawn: on the GPU it only ever reaches the G-buffer.
+    class HeadlessBackend : public IGraphicsBackend
+    {
+    public:
+        HeadlessBackend(const Renderer& renderer, FarlorJobs::JobSystem& jobSystem, const CloudFrameRenderer::Settings& settings);
+        virtual ~HeadlessBackend();
+
+        // Frames are the size in the settings, pWindow is not used and may be null
+        virtual void Initialize(IWindow *pWindow, std::string& resourceDir) override;
+        virtual void Shutdown() override;
+
+        virtual void Render(const VisibleSet& visibleSet, const LightSet& lightSet, const CameraEntry& currentCameraEntry, float deltaTime, float totalTime) override;
+
+        virtual Geometry::GeometryHandle RegisterGeometry(Geometry* pGeometry) override;
+
+        // False until Initialize has loaded the cloud textures
+        bool IsInitialized() const
+        {
+            return m_isInitialized;
+        }
+
+        // Frames that could not be written out since Initialize
+        uint32_t GetNumFailedFrames() const
+        {
+            return m_numFailedFrames;
+        }
+
+        // The frame renderer behind the backend, null until initialized
+        const CloudFrameRenderer* GetFrameRenderer() const
+        {
+            return m_upFrameRenderer.get();
+        }
+
+    protected:
+        bool m_isInitialized;
+        uint32_t m_numFailedFrames;
+
+        FarlorJobs::JobSystem& m_jobSystem;
+        CloudFrameRenderer::Settings m_settings;
+        std::string m_resourceDir;
+
+        std::unique_ptr<CloudFrameRenderer> m_upFrameRenderer;
+
+        std::map<Geometry::GeometryHandle, Geometry*> m_idToBackendGeometry;
+        Geometry::GeometryHandle m_currentGeometryId;
+    };
+}
@@ -1,7 +1,5 @@
 #pragma once
 
-#include <IWindow.h>
-
 #include "RenderParams.h"
 
 #include "CameraEntry.h"
@@ -9,8 +7,12 @@
 #include "LightSet.h"
 #include "VisibleSet.h"
 
+#include <string>
+
 namespace Farlor
 {
+    // Only backends that present to a window need its definition
+    class IWindow;
     class Renderer;
 
     class IGraphicsBackend
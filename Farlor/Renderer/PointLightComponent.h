@@ -2,6 +2,8 @@
 
 #include <FMath/FMath.h>
 
+#include <cstdint>
+
 namespace Farlor
 {
     class Renderer;
@@ -1,21 +1,15 @@
 #include "CameraEntry.h"
 #include "Renderer.h"
-#include "FrameGraph.h"
 #include "LightSet.h"
 #include "VisibleSet.h"
 
-#include <FEnvVar.h>
-
-#include <WindowFactory.h>
-
 #include <iostream>
 
 namespace Farlor
 {
-    Renderer::Renderer(CameraManager& cameraManager, const std::string& resourceDir)
+    Renderer::Renderer(const std::string& resourceDir)
         : m_resourceDir{ resourceDir }
         , m_pGraphicsBackend{ nullptr }
-        , m_cameraManager{ cameraManager }
         , m_agnosticGeometry{}
         , m_nextAgnosticGeometryHandle{ Geometry::s_InvalidHandle + 1 }
         , m_rendererGeomIdToBackendGeomId{}
@@ -119,12 +113,23 @@ namespace Farlor
 
     // This is the actual rendering function
     // This utilizes a render frame structure
-    void Renderer::RenderFrame(float deltaTime, float totalTime)
+    void Renderer::RenderFrame(const CameraEntry& cameraEntry, float deltaTime, float totalTime)
+    {
+        FrameData frameData;
+        frameData.m_cameraEntry = cameraEntry;
+        frameData.m_deltaTime = deltaTime;
+        frameData.m_totalTime = totalTime;
+        PrepareFrame(frameData);
+        SubmitFrame(frameData);
+    }
+
+    void Renderer::PrepareFrame(FrameData& frameData) const
     {
         // Grab the visible set of render components
         // At this point, we want to copy out the geometry ids of the meshes to render, as well as the transforms of the meshes.
         // From this point on, the backend will treat this visible set as read only.
-        VisibleSet visibleSet;
+        // Frame data is reused from frame to frame, so start from empty sets.
+        frameData.m_visibleSet = VisibleSet();
         for (const auto& renderComponent : m_renderComponents)
         {
             if (!renderComponent.second.IsVisible())
@@ -132,34 +137,25 @@ namespace Farlor
                 continue;
             }
             // Temporary transform
-            Transform tempTransform;
-            visibleSet.AddRenderComponent(renderComponent.second, tempTransform);
+            frameData.m_visibleSet.AddRenderComponent(renderComponent.second, Matrix4x4::s_Identity);
         }
 
         // Now, we must also cache the light components
-        LightSet lightSet;
+        frameData.m_lightSet = LightSet();
         for (const auto& pointLightComponent : m_pointLightComponents)
         {
-            lightSet.AddPointLightComponent(*pointLightComponent.second.get());
+            frameData.m_lightSet.AddPointLightComponent(*pointLightComponent.second.get());
         }
 
         for (const auto& directionalLightComponent : m_directionalLightComponents)
         {
-            lightSet.AddDirectionalLightComponent(*directionalLightComponent.second.get());
+            frameData.m_lightSet.AddDirectionalLightComponent(*directionalLightComponent.second.get());
         }
+    }
 
-        CameraEntry currentCameraEntry;
-        Camera* pCurrentCamera = m_cameraManager.GetCurrentCamera();
-
-        currentCameraEntry.m_position = pCurrentCamera->GetWorldPosition();
-        currentCameraEntry.m_target = pCurrentCamera->GetWorldTarget();
-        currentCameraEntry.m_worldUp = pCurrentCamera->GetWorldUp();
-        currentCameraEntry.m_fov = pCurrentCamera->GetFOV();
-        currentCameraEntry.m_cameraMoved = pCurrentCamera->MovedInFrame();
-        currentCameraEntry.m_view = pCurrentCamera->GetView();
-        currentCameraEntry.m_proj = pCurrentCamera->GetProj();
-
-        m_pGraphicsBackend->Render(visibleSet, lightSet, currentCameraEntry, deltaTime, totalTime);
+    void Renderer::SubmitFrame(const FrameData& frameData)
+    {
+        m_pGraphicsBackend->Render(frameData.m_visibleSet, frameData.m_lightSet, frameData.m_cameraEntry, frameData.m_deltaTime, frameData.m_totalTime);
     }
 
     Geometry& Renderer::GetAgnosticGeometry(Geometry::GeometryHandle handle) const
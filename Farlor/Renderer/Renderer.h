@@ -7,21 +7,47 @@
 #include "PointLightComponent.h"
 #include "DirectionalLightComponent.h"
 
-#include "CameraManager.h"
-#include "Transform.h"
+#include "CameraEntry.h"
+#include "LightSet.h"
+#include "VisibleSet.h"
 
 #include <functional>
 #include <memory>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 namespace Farlor
 {
-    // Responsible for managing high level rendering tasks, defining rendering passes, and exposing high level rendering functionality
+    // Responsible for managing high level rendering tasks, defining rendering passes, and exposing high level rendering functionality.
+    // Platform neutral, the camera comes in as a CameraEntry so the renderer doesn't depend on the game's camera and input.
     class Renderer
     {
     public:
-        explicit Renderer(CameraManager& cameraManager, const std::string& resourceDir);
+        // Everything the backend needs to draw one frame. It is a copy, so the game can simulate the next frame
+        // while this one is prepared and submitted.
+        struct FrameData
+        {
+            explicit FrameData()
+                : m_frameIndex{ 0 }
+                , m_visibleSet{}
+                , m_lightSet{}
+                , m_cameraEntry{}
+                , m_deltaTime{ 0.0f }
+                , m_totalTime{ 0.0f }
+            {
+            }
+
+            uint64_t m_frameIndex;
+            VisibleSet m_visibleSet;
+            LightSet m_lightSet;
+            CameraEntry m_cameraEntry;
+            float m_deltaTime;
+            float m_totalTime;
+        };
+
+    public:
+        explicit Renderer(const std::string& resourceDir);
         ~Renderer();
 
         bool Initialize(IWindow* pGameWindow, IGraphicsBackend* pGraphicsBackend);
@@ -33,7 +59,15 @@ namespace Farlor
         DirectionalLightComponent* RegisterDirectionalLightGameObject(uint32_t id);
         DirectionalLightComponent* GetDirectionalLightComponent(uint32_t id);
 
-        void RenderFrame(float deltaTime, float totalTime);
+        // Prepares and submits a frame seen from cameraEntry in one go
+        void RenderFrame(const CameraEntry& cameraEntry, float deltaTime, float totalTime);
+
+        // The frame split into its stages, for running them on different frames at once.
+        // The camera has to be captured on the simulation side, before the next frame moves it, see CameraManager.
+        // Render prep, only reads the registered components so it can run alongside a submit
+        void PrepareFrame(FrameData& frameData) const;
+        // Backend submit, one frame at a time
+        void SubmitFrame(const FrameData& frameData);
 
         Geometry::GeometryHandle RegisterGeometry(Geometry* pGeometry);
 
@@ -44,8 +78,6 @@ namespace Farlor
         std::string m_resourceDir;
         IGraphicsBackend* m_pGraphicsBackend;
 
-        CameraManager& m_cameraManager;
-
         // The renderer is resonsible for managing agnostic meshes and textures
         std::map<Geometry::GeometryHandle, Geometry*> m_agnosticGeometry;
         Geometry::GeometryHandle m_nextAgnosticGeometryHandle;
@@ -10,11 +10,11 @@ namespace Farlor
     {
     }
 
-    void VisibleSet::AddRenderComponent(const RenderComponent& renderComponent, const Transform& transform)
+    void VisibleSet::AddRenderComponent(const RenderComponent& renderComponent, const Matrix4x4& worldTransform)
     {
         VisibleEntry entry;
         entry.m_agnosticHandle = renderComponent.GetAgnosticHandle();
-        entry.m_transformMatrix = transform.GetWorld();
+        entry.m_transformMatrix = worldTransform;
         m_entries.push_back(entry);
     }
 
@@ -2,7 +2,8 @@
 
 #include "Geometry.h"
 #include "RenderComponent.h"
-#include "Transform.h"
+
+#include <FMath/FMath.h>
 
 #include <vector>
 
@@ -25,7 +26,7 @@ namespace Farlor
 
         const std::vector<VisibleEntry>& GetVisibleEntries() const;
 
-        void AddRenderComponent(const RenderComponent& renderComponent, const Transform& transform);
+        void AddRenderComponent(const RenderComponent& renderComponent, const Matrix4x4& worldTransform);
 
     private:
         std::vector<VisibleEntry> m_entries;
@@ -3,43 +3,132 @@
 
 #include "Log.h"
 
+#include <FEnvVar.h>
+
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include <filesystem>
 
-int main(int argc, char** argv)
+namespace
 {
-    Farlor::Game game;
+    // Environment variables that size the job system, the command line options below take precedence
+    const char* const NumFibersEnvVar = "FARLOR_NUM_FIBERS";
+    const char* const NumThreadsEnvVar = "FARLOR_NUM_THREADS";
+    const char* const JobModeEnvVar = "FARLOR_JOB_MODE";
 
-    const std::filesystem::path currentPath = std::filesystem::current_path();
-    const std::filesystem::path resourceDir = currentPath / "assets";
+    const std::string NumFibersOption = "--fibers";
+    const std::string NumThreadsOption = "--threads";
+    const std::string JobModeOption = "--job-mode";
+
+    bool ParseCount(const std::string& text, uint32_t& count)
+    {
+        if (text.empty())
+        {
+            return false;
+        }
 
-    const uint32_t numFibers = 1;
-    const uint32_t maxNumThreads = 0;
+        char* pEnd = nullptr;
+        const unsigned long value = std::strtoul(text.c_str(), &pEnd, 10);
+        if (*pEnd != '\0' || value > UINT32_MAX)
+        {
+            return false;
+        }
+        count = static_cast<uint32_t>(value);
+        return true;
+    }
 
-    Farlor::FarlorJobs::JobSystem jobSystem(numFibers, maxNumThreads);
+    bool ParseJobMode(const std::string& text, Farlor::FarlorJobs::JobSystem::ExecutionMode& executionMode)
+    {
+        if (text == "fibers")
+        {
+            executionMode = Farlor::FarlorJobs::JobSystem::ExecutionMode::Fibers;
+            return true;
+        }
+        if (text == "threadpool")
+        {
+            executionMode = Farlor::FarlorJobs::JobSystem::ExecutionMode::ThreadPool;
+            return true;
+        }
+        return false;
+    }
 
-    struct MainTaskArg
+    // Applies one setting, from the environment or the command line, warning about values that don't parse
+    void ApplyJobSetting(const std::string& name, const std::string& value, Farlor::FarlorJobs::JobSystem::Config& config)
     {
-        Farlor::Game* m_pGame;
-        std::string m_resourceDir;
-        Farlor::FarlorJobs::JobSystem* m_pJobSystem;
-    };
+        bool parsed = false;
+        if (name == NumFibersOption || name == NumFibersEnvVar)
+        {
+            parsed = ParseCount(value, config.m_numFibers);
+        }
+        else if (name == NumThreadsOption || name == NumThreadsEnvVar)
+        {
+            parsed = ParseCount(value, config.m_maxNumThreads);
+        }
+        else if (name == JobModeOption || name == JobModeEnvVar)
+        {
+            parsed = ParseJobMode(value, config.m_executionMode);
+        }
+
+        if (!parsed)
+        {
+            std::cout << "Ignoring " << name << " " << value << ", expected a count, or fibers or threadpool for the job mode" << std::endl;
+        }
+    }
+
+    Farlor::FarlorJobs::JobSystem::Config MakeJobSystemConfig(int argc, char** argv)
+    {
+        // 0 threads uses every hardware thread the process may run on
+        Farlor::FarlorJobs::JobSystem::Config config;
+
+        for (const char* pEnvVar : { NumFibersEnvVar, NumThreadsEnvVar, JobModeEnvVar })
+        {
+            const std::string value = Farlor::Utility::FEnvVar::GetEnvVar(pEnvVar);
+            if (!value.empty())
+            {
+                ApplyJobSetting(pEnvVar, value, config);
+            }
+        }
+
+        for (int argIndex = 1; argIndex < argc; ++argIndex)
+        {
+            const std::string option = argv[argIndex];
+            if (option != NumFibersOption && option != NumThreadsOption && option != JobModeOption)
+            {
+                std::cout << "Unknown option " << option << std::endl;
+                continue;
+            }
+
+            if (argIndex + 1 >= argc)
+            {
+                std::cout << "Missing value for " << option << std::endl;
+                break;
+            }
+            ApplyJobSetting(option, argv[++argIndex], config);
+        }
+        return config;
+    }
+}
+
+// Usage: CloudRenderer [--fibers N] [--threads N] [--job-mode fibers|threadpool]
+int main(int argc, char** argv)
+{
+    const std::filesystem::path currentPath = std::filesystem::current_path();
+    const std::filesystem::path resourceDir = currentPath / "assets";
 
-    MainTaskArg mainTaskArg;
-    mainTaskArg.m_pGame = &game;
-    mainTaskArg.m_resourceDir = resourceDir.string();
-    mainTaskArg.m_pJobSystem = nullptr;
+    Farlor::FarlorJobs::JobSystem jobSystem(MakeJobSystemConfig(argc, argv));
+    Farlor::Game game(jobSystem);
 
-    auto MainTask = [](void* pArg) -> void
+    // The game runs as the main task, on the main fiber. It stays on this thread, which owns the window.
+    auto MainTask = [&game, resourceDir = resourceDir.string()]() -> void
     {
-        MainTaskArg* pFuncArg = static_cast<MainTaskArg*>(pArg);
-        ASSERT(pFuncArg->m_pGame->Initialize(pFuncArg->m_resourceDir), "Failed to initialize game object");
-        pFuncArg->m_pGame->Run();
+        ASSERT(game.Initialize(resourceDir), "Failed to initialize game object");
+        game.Run();
     };
-    MainTask(&mainTaskArg);
+    jobSystem.BootstrapMainTask(jobSystem.MakeJob(MainTask));
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,56 @@
+#ifndef CLOUDLIGHTVOLUME_HLSL
+#define CLOUDLIGHTVOLUME_HLSL
+
+// Builds the light volume CloudTrace.hlsl looks its lit samples up in, the light PerformCloudMarch's 6 samples
+// towards the sun give each voxel. The cloud layer is laid flat: x wraps every 60000m with the weather map, z every
+// 10000m with the low frequency noise, and y goes through the layer one light step per layer. The sun stays within a
+// fraction of a degree of overhead across the layer, so the light samples go straight up. The volume is built once
+// with the clouds where they are at TotalTime 0, and SampleLightVolume moves its lookups along with the wind. That
+// carries the weather map's coverage along with the noise, which the march doesn't, and leaves out the wind's small
+// upward drift.
+
+#include "CloudTrace.hlsl"
+
+RWTexture3D<float> LightVolume : register(u1);
+
+// X : 8
+// Y : 4
+// Z : 8
+// Total, Group Size : 256 threads
+[numthreads(8, 4, 8)] void CSLightVolume(uint3 dispatchThreadID
+                                         : SV_DispatchThreadID) {
+    uint width;
+    uint numLayers;
+    uint depth;
+    LightVolume.GetDimensions(width, numLayers, depth);
+    if (any(dispatchThreadID >= uint3(width, numLayers, depth)))
+    {
+        return;
+    }
+
+    float layerThickness = (ATMOSPHERE_RADIUS_OUTER - ATMOSPHERE_RADIUS_INNER) / numLayers;
+    float3 voxelCenter = float3((dispatchThreadID.x + 0.5f) * 60000.0f / width,
+        ATMOSPHERE_RADIUS_INNER + (dispatchThreadID.y + 0.5f) * layerThickness,
+        (dispatchThreadID.z + 0.5f) * 10000.0f / depth);
+
+    float substinenceDensity = 0.1f;
+    float k = 0.9f;
+
+    int numLightSamples = 6;
+    float lightDensity = 0.0f;
+    float combinedColor = 0.0f;
+    for (int l = 0; l < numLightSamples; ++l)
+    {
+        float3 lightSamplePos = voxelCenter + float3(0.0f, layerThickness * l, 0.0f);
+        float heightFraction = (dispatchThreadID.y + l + 0.5f) / numLayers;
+        float3 lightWeather = weatherMapTex.SampleLevel(textureSampler, lightSamplePos.xy / 60000.0f, 0).xyz;
+
+        float baseCloud;
+        lightDensity += max(SampleBaseCloudDensity(lightSamplePos, heightFraction, lightWeather, float3(0.0f, 0.0f, 0.0f), baseCloud), 0.0f) * substinenceDensity;
+        combinedColor += exp(-1.0f * k * lightDensity) * 0.8f;
+    }
+
+    LightVolume[dispatchThreadID] = combinedColor;
+}
+
+#endif
@@ -9,4 +9,22 @@
 #define ATMOSPHERE_RADIUS_INNER 15000.0f //paper suggests values of 15000-35000m above
 #define ATMOSPHERE_RADIUS_OUTER 35000.0f
 
+//Global Defines for the cloud march, can be overridden with shader macros
+//Fine steps per coarse step through empty air, 1 samples every step
+#ifndef CLOUD_MARCH_COARSE_STEP_SCALE
+#define CLOUD_MARCH_COARSE_STEP_SCALE 4
+#endif
+//Empty fine samples in a row before the march goes back to coarse steps
+#ifndef CLOUD_MARCH_EMPTY_STEPS_BEFORE_COARSE
+#define CLOUD_MARCH_EMPTY_STEPS_BEFORE_COARSE 2
+#endif
+//The march stops once the view ray's transmittance is below this, 0 marches every ray to the end of the layer
+#ifndef CLOUD_MARCH_TRANSMITTANCE_EPSILON
+#define CLOUD_MARCH_TRANSMITTANCE_EPSILON 0.01f
+#endif
+//1 looks lit samples up in the light volume CloudLightVolume.hlsl builds, 0 marches 6 samples towards the sun
+#ifndef CLOUD_MARCH_LIGHT_VOLUME
+#define CLOUD_MARCH_LIGHT_VOLUME 1
+#endif
+
 #endif
\ No newline at end of file
@@ -31,13 +31,16 @@ cbuffer TimeValues : register(b2)
 {
     float DeltaTime;
     float TotalTime;
-    float2 _TimePad;
+    uint FrameIndex;
+    // 1 when there is a previous CloudBuffer to reproject from, CSMain then only marches one pixel of each block
+    uint ReprojectHistory;
 }
 
 Texture3D lowFreqTex : register(t0);
 Texture3D highFreqTex : register(t1);
 Texture2D curlNoiseTex : register(t2);
 Texture2D weatherMapTex : register(t3);
+Texture3D<float> lightVolumeTex : register(t4);
 
 SamplerState textureSampler : register(s0);
 
@@ -102,25 +105,30 @@ float DensityHeightAtPoint(float densityHeight, float3 weather)
     return cloudTypeHeightWeight;
 }
 
-// Does not optimize by only grabbing the low freq value
-// Assumes that the y value of p is from the earth center!
-float SampleCloudDensity(float3 p, float3 earthCenter, float3 weather_data, bool doCheaply, float3 startPosOnInnerShell, float3 rayDir, float3 eye)
+// How far the wind has carried the clouds by totalTime
+float3 GetWindOffset(float totalTime)
 {
-    // get height fraction
-    float height_fraction = GetHeightFractionForPoint(p, earthCenter, startPosOnInnerShell, rayDir, eye);
-    
     // wind settings
     float3 wind_direction = float3(1.0, 0.0, 0.0);
     float cloud_speed = 10.0;
 
+    //animate clouds in wind direction and add a small upward bias to the wind direction
+    return (wind_direction + float3(0.0, 0.1, 0.0) ) * totalTime * cloud_speed * 100.0f;
+}
+
+// The cheap density at a known height fraction. p comes back moved by the wind and base_cloud is the shape before
+// coverage, for the detail noise.
+float SampleBaseCloudDensity(inout float3 p, float height_fraction, float3 weather_data, float3 wind_offset, out float base_cloud)
+{
+    float3 wind_direction = float3(1.0, 0.0, 0.0);
+
     // cloud_top offset - push the tops of the clouds along this wind direction by this many units.
     float cloud_top_offset = 500.0;
 
     // skew in wind direction
     p += height_fraction * wind_direction * cloud_top_offset;
 
-    //animate clouds in wind direction and add a small upward bias to the wind direction
-    p += (wind_direction + float3(0.0, 0.1, 0.0) ) * TotalTime * cloud_speed * 100.0f;
+    p += wind_offset;
 
     // read the low frequency Perlin-Worley and Worley noises
     float4 low_frequency_noises = lowFreqTex.SampleLevel(textureSampler, p.xyz / 10000.0f, 0).rgba;
@@ -129,7 +137,7 @@ float SampleCloudDensity(float3 p, float3 earthCenter, float3 weather_data, bool
     float low_freq_fBm = ( low_frequency_noises.g * 0.625 ) + ( low_frequency_noises.b * 0.25 ) + ( low_frequency_noises.a * 0.125 );
 
     // define the base cloud shape by dilating it with the low frequency fBm made of Worley noise.
-    float base_cloud = Remap( low_frequency_noises.r, - ( 1.0 -  low_freq_fBm), 1.0, 0.0, 1.0 );
+    base_cloud = Remap( low_frequency_noises.r, - ( 1.0 -  low_freq_fBm), 1.0, 0.0, 1.0 );
 
     // Get the density-height gradient using the density-height function
     float density_height_gradient = DensityHeightAtPoint(height_fraction, weather_data);
@@ -146,8 +154,19 @@ float SampleCloudDensity(float3 p, float3 earthCenter, float3 weather_data, bool
     //Multiply result by cloud coverage so that smaller clouds are lighter and more aesthetically pleasing.
     base_cloud_with_coverage *= cloud_coverage;
 
+    return base_cloud_with_coverage;
+}
+
+// Does not optimize by only grabbing the low freq value
+// Assumes that the y value of p is from the earth center!
+float SampleCloudDensity(float3 p, float3 earthCenter, float3 weather_data, bool doCheaply, float3 startPosOnInnerShell, float3 rayDir, float3 eye)
+{
+    // get height fraction
+    float height_fraction = GetHeightFractionForPoint(p, earthCenter, startPosOnInnerShell, rayDir, eye);
+
     //define final cloud value
-    float final_cloud = base_cloud_with_coverage;
+    float base_cloud;
+    float final_cloud = SampleBaseCloudDensity(p, height_fraction, weather_data, GetWindOffset(TotalTime), base_cloud);
 
     // only do detail work if we are taking expensive samples!
     if(!doCheaply)
@@ -175,6 +194,19 @@ float SampleCloudDensity(float3 p, float3 earthCenter, float3 weather_data, bool
     return max(final_cloud, 0.0f);
 }
 
+// The light CloudLightVolume.hlsl worked out for the point. The volume is the cloud layer laid flat, indexed with the
+// point's height fraction from its altitude. It was built with the clouds where they are at TotalTime 0, so the point
+// is moved along with the wind first. The sampler wraps, so the height fraction is kept between the first and last
+// layers' centers.
+float SampleLightVolume(float3 p, float3 earthCenter, float numLayers)
+{
+    float heightFraction = (length(p - earthCenter) - EARTH_RADIUS - ATMOSPHERE_RADIUS_INNER) / (ATMOSPHERE_RADIUS_OUTER - ATMOSPHERE_RADIUS_INNER);
+    float halfLayer = 0.5f / numLayers;
+    float3 windOffset = GetWindOffset(TotalTime);
+    float3 uvw = float3((p.x + windOffset.x) / 60000.0f, clamp(heightFraction, halfLayer, 1.0f - halfLayer), (p.z + windOffset.z) / 10000.0f);
+    return lightVolumeTex.SampleLevel(textureSampler, uvw, 0);
+}
+
 float GetLightEnergy( float3 p, float height_fraction, float lightDensity, float cloudDensity, float phase_probability, float cos_angle, float step_size, float brightness)
 {
     // attenuation – difference from slides – reduce the secondary component when we look toward the sun.
@@ -197,9 +229,15 @@ float GetLightEnergy( float3 p, float height_fraction, float lightDensity, float
 }
 
 
+// Adaptive march. Coarse steps of CLOUD_MARCH_COARSE_STEP_SCALE fine steps cross empty air. The first coarse sample with
+// density steps back to just past the last empty one and the march refines with fine steps, going back to coarse steps
+// after CLOUD_MARCH_EMPTY_STEPS_BEFORE_COARSE empty fine samples in a row, but never before it is past the coarse sample
+// that had density. Only fine samples are integrated, and the march stops once the ray's transmittance is below
+// CLOUD_MARCH_TRANSMITTANCE_EPSILON. Returns the radiance and the opacity.
+// numSamples counts every density sample taken, the light samples included, a light volume lookup as one.
 float4 PerformCloudMarch(Ray cloudRay,
     float3 earthCenter, float3 eye, Intersection innerInter,
-    Intersection outerInter)
+    Intersection outerInter, out uint numSamples)
 {
     int numSteps = 60;
     float tDist = outerInter.t - innerInter.t;
@@ -218,16 +256,71 @@ float4 PerformCloudMarch(Ray cloudRay,
 
     float3 sunPosition = float3(0.0f, EARTH_RADIUS * (4.0f + sin(TotalTime)), 0.0f);
 
+#if CLOUD_MARCH_LIGHT_VOLUME
+    uint lightVolumeWidth;
+    uint lightVolumeLayers;
+    uint lightVolumeDepth;
+    lightVolumeTex.GetDimensions(lightVolumeWidth, lightVolumeLayers, lightVolumeDepth);
+#endif
+
+    const int coarseStepScale = max(CLOUD_MARCH_COARSE_STEP_SCALE, 1);
+    bool isCoarse = coarseStepScale > 1;
+    // Where to refine from if the next coarse sample has density
+    int refineFrom = 0;
+    // The coarse sample that sent the march back, stays fine until past it
+    int refineUntil = 0;
+    int numEmptySteps = 0;
+
     // Can probably optimize a little later
     float3 radiance = float3(0.0f, 0.0f, 0.0f);
     float3 transmittence = float3(1.0f, 1.0f, 1.0f);
-    float totalDensity = 0.0f;
-    for (int i = 0; i < numSteps; ++i)
+    numSamples = 0;
+    int i = 0;
+    while (i < numSteps)
     {
         float3 samplePoint = startTracePos + stepSize * i * traceDir;
         float3 weather = weatherMapTex.SampleLevel(textureSampler, samplePoint.xy / 60000.0f, 0).xyz;
         //weather.b = 0.0f;
 
+        float cloudDensity = SampleCloudDensity(samplePoint, earthCenter, weather, true, startTracePos, cloudRay.direction, eye) * substinenceDensity;
+        ++numSamples;
+
+        // Only light the point if we have density at that location
+        if (!(cloudDensity > 0.0f))
+        {
+            if (!isCoarse)
+            {
+                ++numEmptySteps;
+                isCoarse = coarseStepScale > 1 && numEmptySteps >= CLOUD_MARCH_EMPTY_STEPS_BEFORE_COARSE && i >= refineUntil;
+            }
+
+            if (isCoarse)
+            {
+                // The last step is always sampled, so coarse steps can't step over the end of the cloud layer
+                refineFrom = i + 1;
+                i = min(i + coarseStepScale, max(i + 1, numSteps - 1));
+            }
+            else
+            {
+                ++i;
+            }
+            continue;
+        }
+
+        numEmptySteps = 0;
+        if (isCoarse)
+        {
+            isCoarse = false;
+            if (refineFrom < i)
+            {
+                // Step back and refine
+                refineUntil = i;
+                i = refineFrom;
+                continue;
+            }
+        }
+        ++i;
+
         float3 lightDirection = normalize(sunPosition - samplePoint);
         float cosAngle = dot(normalize(cloudRay.direction), lightDirection);
         const float eccentricity = 0.6;
@@ -235,37 +328,43 @@ float4 PerformCloudMarch(Ray cloudRay,
         const float silver_spread = 0.1;
         const float hgmVal = HGM(cosAngle, eccentricity, silver_intensity, silver_spread);
 
-        float cloudDensity = SampleCloudDensity(samplePoint, earthCenter, weather, true, startTracePos, cloudRay.direction, eye) * substinenceDensity;
-
-        // Only light the point if we have density at that location
-        if (cloudDensity > 0.0f)
+#if CLOUD_MARCH_LIGHT_VOLUME
+        // The 6 light samples below, looked up
+        float3 combinedColor = sunColor * SampleLightVolume(samplePoint, earthCenter, lightVolumeLayers);
+        numSamples += 1;
+#else
+        // We also need to trace a light ray to the sun as well
+        // We only trace 6 samples, super low
+        int numLightSamples = 6;
+        float lightDensity = 0.0f;
+        float3 combinedColor = float3(0.0f, 0.0f, 0.0f);
+        for (int l = 0; l < numLightSamples; ++l)
         {
-            totalDensity += cloudDensity;
-
-            // We also need to trace a light ray to the sun as well
-            // We only trace 6 samples, super low
-            int numLightSamples = 6;
-            float lightDensity = 0.0f;
-            float3 combinedColor = float3(0.0f, 0.0f, 0.0f);
-            for (int l = 0; l < numLightSamples; ++l)
-            {
-                float3 lightSamplePos = samplePoint + lightDirection * stepSize * l * 1.0f;
-                float3 lightWeather = weatherMapTex.SampleLevel(textureSampler, lightSamplePos.xy / 60000.0f, 0).xyz;
+            float3 lightSamplePos = samplePoint + lightDirection * stepSize * l * 1.0f;
+            float3 lightWeather = weatherMapTex.SampleLevel(textureSampler, lightSamplePos.xy / 60000.0f, 0).xyz;
 
-                float fullLightDensity = SampleCloudDensity(lightSamplePos, earthCenter, lightWeather, true, startTracePos, cloudRay.direction, eye) * substinenceDensity;
-                lightDensity += fullLightDensity;
+            float fullLightDensity = SampleCloudDensity(lightSamplePos, earthCenter, lightWeather, true, startTracePos, cloudRay.direction, eye) * substinenceDensity;
+            lightDensity += fullLightDensity;
 
-                float scaledLightDensity = exp(-1.0f * k * lightDensity);
-                combinedColor += sunColor * scaledLightDensity * 0.8f;
-            }
+            float scaledLightDensity = exp(-1.0f * k * lightDensity);
+            combinedColor += sunColor * scaledLightDensity * 0.8f;
+        }
+        numSamples += numLightSamples;
+#endif
+
+        float dt = exp(-1.0f * k * stepSize * cloudDensity);
+        radiance += combinedColor * (1.0f - dt) * transmittence;
+        transmittence *= dt;
 
-            float dt = exp(-1.0f * k * stepSize * cloudDensity);
-            radiance += combinedColor * (1.0f - dt) * transmittence;
-            transmittence *= dt;
+        // Nothing further along can change the pixel much, the ray is all but opaque
+        if (transmittence.x < CLOUD_MARCH_TRANSMITTANCE_EPSILON)
+        {
+            break;
         }
     }
 
-    return float4(radiance, totalDensity);
+    // The opacity CSMain blends the clouds over the sky with
+    return float4(radiance, 1.0f - transmittence.x);
 }
 
 // In meters
@@ -282,69 +381,87 @@ float3 planeEdgeLength = 1000.0f;
 
 #endif
 
-// X : 32
-// Y : 16
-// Z : 1
-// Total, Group Size : 512 threads
-[numthreads(XThreadCount, YThreadCount, ZThreadCount)] void CSMain(uint3 dispatchThreadID
-                                                                   : SV_DispatchThreadID, uint3 groupID
-                                                                   : SV_GroupID) {
-    // Seed the random number generator
-    // Hash using the thread id, then use wang_hash to make the seed go wide
-    uint index = (dispatchThreadID.x + dispatchThreadID.y * NewScreenWidth);
-
-    int pixelX = dispatchThreadID.x;
-    int pixelY = dispatchThreadID.y;
-
-    int2 dim = int2(NewScreenWidth, NewScreenWidth);
-
-    float2 uv = float2(pixelX, pixelY) / dim;
-
-    const float aspectRatio = (float)(NewScreenWidth) / (float)(NewScreenHeight);
+// The near plane offsets from a camera: forward * nearDistance, right * windowRight and up * windowTop.
+// The primary rays are built from them relative to the camera, at the camera's world position they would round
+// to blocks of pixels away from the origin.
+void GetNearPlane(float3 cameraPos, float3 cameraTarget, float3 worldUp, float fovHorizontal, uint screenWidth, uint screenHeight,
+    out float3 nearForward, out float3 nearRight, out float3 nearUp)
+{
+    const float aspectRatio = (float)(screenWidth) / (float)(screenHeight);
 
-    float3 camForward = normalize(NewCameraTarget - NewCameraPos);
-    float3 camRight = -1.0f * normalize(cross(camForward, NewWorldUp));
+    float3 camForward = normalize(cameraTarget - cameraPos);
+    float3 camRight = -1.0f * normalize(cross(camForward, worldUp));
     float3 camUp = -1.0f * normalize(cross(camForward, camRight));
 
-    float horFov = NewFOV_Horizontal;
+    float horFov = fovHorizontal;
     float vertFov = horFov / aspectRatio;
     float nearDistance = 0.1f;
 
     float windowTop = tan(vertFov / 2.0f) * nearDistance;
     float windowRight = tan(horFov / 2.0f) * nearDistance;
 
-    uint xVal = dispatchThreadID.x;
-    uint yVal = dispatchThreadID.y;
+    nearForward = camForward * nearDistance;
+    nearRight = camRight * windowRight;
+    nearUp = camUp * windowTop;
+}
 
-    float u = (float)xVal / float(NewScreenWidth);
-    float v = (float)yVal / float(NewScreenHeight);
+float3 GetPrimaryRayDirection(uint2 pixel, uint2 screenSize, float3 nearForward, float3 nearRight, float3 nearUp)
+{
+    float u = (float)pixel.x / float(screenSize.x);
+    float v = (float)pixel.y / float(screenSize.y);
 
     // Transform to [-1, 1] space from [0, 1] space
     u = u * 2.0f - 1.0f;
     v = v * 2.0f - 1.0f;
 
-    float3 skyBlue = float3(0.529412f, 0.807843f, 0.921569f);
-    float3 primaryRayOrigin = {0.0f, 0.0f, 0.0f};
-    float3 primaryRayDirection = {0.0f, 0.0f, 0.0f};
+    return normalize(nearForward + nearRight * u + nearUp * v);
+}
 
-    primaryRayOrigin = NewCameraPos + camForward * nearDistance;
-    primaryRayOrigin = primaryRayOrigin + camRight * windowRight * u;
-    primaryRayOrigin = primaryRayOrigin + camUp * windowTop * v;
-    primaryRayDirection = normalize(primaryRayOrigin - NewCameraPos);
+bool HitsGroundDisk(Ray ray)
+{
+    return RayDiskIntersection(float3(0.0f, -1.0f, 0.0f), float3(0.0f, 0.0f, 0.0f), 10000.0f, ray);
+}
+
+// Reprojecting, CSMain marches one pixel of each block a frame and CSReproject fills in the rest
+#define REPROJECTION_BLOCK_SIZE 4
+
+// The pixel of each block marched on frameIndex. Consecutive frames go through the block in Bayer order, so the
+// pixels marched over any few frames are spread across it.
+uint2 GetMarchedPixel(uint frameIndex)
+{
+    static const uint2 marchedPixels[16] =
+    {
+        uint2(0, 0), uint2(2, 2), uint2(2, 0), uint2(0, 2), uint2(1, 1), uint2(3, 3), uint2(3, 1), uint2(1, 3),
+        uint2(1, 0), uint2(3, 2), uint2(3, 0), uint2(1, 2), uint2(0, 1), uint2(2, 3), uint2(2, 1), uint2(0, 3)
+    };
+    return marchedPixels[frameIndex % 16];
+}
+
+// The color of one pixel of the CloudBuffer: ground, sky and the cloud march
+float4 TraceCloudPixel(uint2 pixel)
+{
+    int2 dim = int2(NewScreenWidth, NewScreenWidth);
+
+    float2 uv = float2(pixel) / dim;
+
+    float3 nearForward;
+    float3 nearRight;
+    float3 nearUp;
+    GetNearPlane(NewCameraPos, NewCameraTarget, NewWorldUp, NewFOV_Horizontal, NewScreenWidth, NewScreenHeight, nearForward, nearRight, nearUp);
+
+    float3 skyBlue = float3(0.529412f, 0.807843f, 0.921569f);
 
     Ray cloudRay;
     cloudRay.origin = NewCameraPos;
-    cloudRay.direction = primaryRayDirection;
+    cloudRay.direction = GetPrimaryRayDirection(pixel, uint2(NewScreenWidth, NewScreenHeight), nearForward, nearRight, nearUp);
 
 
     float3 finalColor = float3(0.0f, 0.0f, 0.0f);
 
-    bool diskInter = RayDiskIntersection(float3(0.0f, -1.0f, 0.0f), float3(0.0f, 0.0f, 0.0f), 10000.0f, cloudRay); 
-    if (diskInter)
+    if (HitsGroundDisk(cloudRay))
     {
         finalColor = float3(0.333333, 0.419608, 0.184314);
-        CloudBuffer[index] = float4(finalColor, 1.0f);
-        return;
+        return float4(finalColor, 1.0f);
     }
 
     float horizonAngle = dot(NewWorldUp, cloudRay.direction);
@@ -358,8 +475,7 @@ float3 planeEdgeLength = 1000.0f;
     // {
     //     // Simply draw out black
     //     finalColor = float3(0.0f, 0.0f, 0.0f);
-    //     CloudBuffer[index] = float4(finalColor, 1.0f);
-    //     return;
+    //     return float4(finalColor, 1.0f);
     // }
     // else
     {
@@ -378,7 +494,8 @@ float3 planeEdgeLength = 1000.0f;
         earthCenter, ATMOSPHERE_RADIUS_OUTER + EARTH_RADIUS);
 
     // Ray March
-    float4 rayMarchResult = PerformCloudMarch(cloudRay, earthCenter, NewCameraPos, innerInter, outerInter);
+    uint numMarchSamples = 0;
+    float4 rayMarchResult = PerformCloudMarch(cloudRay, earthCenter, NewCameraPos, innerInter, outerInter, numMarchSamples);
 
     finalColor = lerp(finalColor, rayMarchResult.xyz, rayMarchResult.w);
 
@@ -388,6 +505,7 @@ float3 planeEdgeLength = 1000.0f;
 #define TEXTURE_HIGH_FREQ 0
 #define TEXTURE_CURL_NOISE 0
 #define TEXTURE_WEATHER_NOISE 0
+#define MARCH_SAMPLE_COUNT 0
 
     // Begin debug renders
 #if TEXTURE_LOW_FREQ
@@ -404,10 +522,36 @@ float3 planeEdgeLength = 1000.0f;
     finalColor = float4(weatherVal.xyz, 1.0f);
 #elif CLOUD_DENSITY
     finalColor = float4(float3(rayMarchResult.w, rayMarchResult.w, rayMarchResult.w), 1.0);
+#elif MARCH_SAMPLE_COUNT
+    // White is the 420 samples the fixed march took on a ray where every step had density
+    float sampleFraction = numMarchSamples / 420.0f;
+    finalColor = float4(float3(sampleFraction, sampleFraction, sampleFraction), 1.0);
 #endif
 
+    return float4(finalColor, 1.0f);
+}
+
+// X : 32
+// Y : 16
+// Z : 1
+// Total, Group Size : 512 threads
+// Reprojecting, the dispatch covers the blocks instead of the pixels
+[numthreads(XThreadCount, YThreadCount, ZThreadCount)] void CSMain(uint3 dispatchThreadID
+                                                                   : SV_DispatchThreadID, uint3 groupID
+                                                                   : SV_GroupID) {
+    uint2 pixel = dispatchThreadID.xy;
+    if (ReprojectHistory)
+    {
+        pixel = pixel * REPROJECTION_BLOCK_SIZE + GetMarchedPixel(FrameIndex);
+    }
+
+    if (any(pixel >= uint2(NewScreenWidth, NewScreenHeight)))
+    {
+        return;
+    }
+
     // Write out the color to the correct spot in the color buffer
-    CloudBuffer[index] = float4(finalColor, 1.0f);
+    CloudBuffer[pixel.x + pixel.y * NewScreenWidth] = TraceCloudPixel(pixel);
 }
 
 #endif
\ No newline at end of file
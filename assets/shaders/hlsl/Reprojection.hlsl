@@ -1,81 +1,127 @@
 #ifndef REPROJECTION_HLSL
 #define REPROJECTION_HLSL
 
-cbuffer CamNew : register(b0)
-{
-    float4x4 NewView;
-    float4x4 NewProj;
-    float4 NewEye;
-    float2 NewFov;
-    float2 _NewPad;
-};
-
-cbuffer CamOld : register(b1)
-{
-    float4x4 NewView;
-    float4x4 NewProj;
-    float4 NewEye;
-    float2 NewFov;
-    float2 _NewPad;
-};
-
-cbuffer TimeBuffer : register(b2)
+// Fills in the pixels CSMain didn't march this frame, 15 of each 4x4 block, from the previous frame's CloudBuffer.
+// Where the pixel's view ray enters the cloud layer is found in the old camera's view and the nearest of its pixels
+// taken. Pixels that land off the old screen, behind the old camera or on the ground are marched here instead.
+// Dispatched over every pixel after CSMain, only while ReprojectHistory is set.
+
+#include "CloudTrace.hlsl"
+
+StructuredBuffer<float4> PreviousCloudBuffer : register(t5);
+
+// Distance along a normalised ray to the nearest point of the sphere in front of it, an actual distance unlike
+// RaySphereIntersection's
+bool IntersectSphere(float3 rayOrigin, float3 rayDir, float3 spherePos, float radius, out float hitDistance)
 {
-    float2 Time;
-    float2 _TimePad;
-};
+    hitDistance = 0.0f;
+
+    float3 offset = rayOrigin - spherePos;
+    float offsetLength = length(offset);
+    float b = dot(offset, rayDir);
+    // dot(offset, offset) - radius^2, which cancels badly at the earth's radius
+    float c = (offsetLength - radius) * (offsetLength + radius);
+    float disc = b * b - c;
+    if (disc < 0.0f)
+    {
+        return false;
+    }
+
+    float root = sqrt(disc);
+    hitDistance = (-b - root >= 0.0f) ? (-b - root) : (-b + root);
+    return hitDistance >= 0.0f;
+}
 
-void main()
+// The previous frame's color for pixel, false when it's rejected and has to be marched
+bool ReprojectPixel(uint2 pixel, out float4 color)
 {
-    //3 options: - do a full resolution launch and calculate for every pixel and overwrite the value of one pixel with an actual raymarch
-    //           - do all the work for 15 reprojection pixel fills on one thread
-    //           - do full resolution but only work for 15 pixels and terminate early for the one that will be filled by raymarching
-    //The last one is the best but it is hard to determine which pixel to skip --> equate the pixel selected with the regular invocation ID --> to determine which to skip
-    ivec2 dim = imageSize(currentFrameResultImage);
-    vec2 uv = vec2(gl_GlobalInvocationID.xy) / dim;
-    //Do not invert uv's because we already do this in the cloudCompute shader and so things are stored in accordance to openGL convention of uv's
-
-    int pixelID = frameCountMod16;
-
-	vec3 eyePos = -camera.eye.xyz;
-	Ray ray = castRay(uv, eyePos, camera.view, camera.tanFovBy2, pixelID, dim);
-
-	// Hit the inner sphere with the ray you just found to get some basis world position along your current ray
-	vec3 earthCenter = eyePos;
-	earthCenter.y = -EARTH_RADIUS; //move earth below camera
-	Intersection atmosphereInnerIsect = raySphereIntersection(ray.origin, ray.direction, earthCenter, ATMOSPHERE_RADIUS_INNER);
-
-    vec3 oldCameraRayDir = normalize((cameraOld.view * vec4(atmosphereInnerIsect.point, 1.0f)).xyz);
-
-    // We have a normalized ray that we need to convert into uv space
-    // We can achieve this by multiplying the xy componentes of the ray by the camera's Right and Up basis vectors  and scaling it down to a 0 to 1 range
-    // In other words the ray goes from camera space <x,y,z> to uv space <u,v,1> using the R U F basis that defines the camera
-    oldCameraRayDir /= -oldCameraRayDir.z; //-z because in camera space we look down negative z and so we don't want
-                                           //to divide by a negative number --> that would make our uv's negative
-    float old_u = (oldCameraRayDir.x / (camera.tanFovBy2.x)) * 0.5 + 0.5;
-    float old_v = (oldCameraRayDir.y / (camera.tanFovBy2.y)) * 0.5 + 0.5;
-    vec2 old_uv = vec2(old_u, old_v); //if old_uv is out of range -> the texture sampler simply returns black --> keep in mind when porting
-
-    // if(old_u > 1.0f || old_u < 0.0f || old_v > 1.0f || old_v < 0.0f)
-    // {
-    //     imageStore( currentFrameResultImage, ivec2(gl_GlobalInvocationID.xy), vec4(0,0,1,0) );
-    //     return;
-    // }
-
-    vec2 motionVec = old_uv - uv;
-    vec4 blurColor = vec4(0.0);
-    vec2 blurOffset = vec2(0.0);
-    vec2 imageUV = round(old_uv * dim);
-
-    for(int i=0; i<NUM_MOTION_BLUR_SAMPLES; i++)
+    color = float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    float3 nearForward;
+    float3 nearRight;
+    float3 nearUp;
+    GetNearPlane(NewCameraPos, NewCameraTarget, NewWorldUp, NewFOV_Horizontal, NewScreenWidth, NewScreenHeight, nearForward, nearRight, nearUp);
+
+    Ray cloudRay;
+    cloudRay.origin = NewCameraPos;
+    cloudRay.direction = GetPrimaryRayDirection(pixel, uint2(NewScreenWidth, NewScreenHeight), nearForward, nearRight, nearUp);
+
+    // Ground pixels are no cheaper to reproject than to trace
+    if (HitsGroundDisk(cloudRay))
+    {
+        return false;
+    }
+
+    // Where the ray enters the cloud layer, the clouds are too far away for anywhere deeper to reproject differently
+    float3 earthCenter = float3(0.0f, 0.0f, 0.0f) - NewWorldUp * EARTH_RADIUS;
+    float innerDistance;
+    if (!IntersectSphere(cloudRay.origin, cloudRay.direction, earthCenter, ATMOSPHERE_RADIUS_INNER + EARTH_RADIUS, innerDistance))
+    {
+        return false;
+    }
+    float3 cloudPoint = cloudRay.origin + cloudRay.direction * innerDistance;
+
+    // Onto the old camera's near plane, back in [-1, 1] space
+    float3 oldNearForward;
+    float3 oldNearRight;
+    float3 oldNearUp;
+    GetNearPlane(OldCameraPos, OldCameraTarget, OldWorldUp, OldFOV_Horizontal, OldScreenWidth, OldScreenHeight, oldNearForward, oldNearRight, oldNearUp);
+
+    float3 oldRay = cloudPoint - OldCameraPos;
+    float forwardDistance = dot(oldRay, oldNearForward);
+    if (forwardDistance <= 0.0f)
+    {
+        return false;
+    }
+    float3 nearOffset = oldRay * (dot(oldNearForward, oldNearForward) / forwardDistance) - oldNearForward;
+    float oldU = dot(nearOffset, oldNearRight) / dot(oldNearRight, oldNearRight);
+    float oldV = dot(nearOffset, oldNearUp) / dot(oldNearUp, oldNearUp);
+
+    // The nearest old pixel, blending would blur the clouds a little more every frame
+    float2 oldScreenSize = float2(OldScreenWidth, OldScreenHeight);
+    float2 oldPixel = floor((float2(oldU, oldV) + 1.0f) * 0.5f * oldScreenSize + 0.5f);
+    if (any(oldPixel < 0.0f) || any(oldPixel >= oldScreenSize))
+    {
+        return false;
+    }
+
+    // Ground pixels are always traced, so the old pixel is ground exactly when its ray hits the disk
+    Ray oldRayToPixel;
+    oldRayToPixel.origin = OldCameraPos;
+    oldRayToPixel.direction = GetPrimaryRayDirection(uint2(oldPixel), uint2(OldScreenWidth, OldScreenHeight), oldNearForward, oldNearRight, oldNearUp);
+    if (HitsGroundDisk(oldRayToPixel))
+    {
+        return false;
+    }
+
+    color = PreviousCloudBuffer[(uint)oldPixel.x + (uint)oldPixel.y * OldScreenWidth];
+    return true;
+}
+
+// X : 32
+// Y : 16
+// Z : 1
+// Total, Group Size : 512 threads
+[numthreads(XThreadCount, YThreadCount, ZThreadCount)] void CSReproject(uint3 dispatchThreadID
+                                                                        : SV_DispatchThreadID) {
+    uint2 pixel = dispatchThreadID.xy;
+    if (any(pixel >= uint2(NewScreenWidth, NewScreenHeight)))
     {
-        blurOffset = motionVec * (float(i)/float(NUM_MOTION_BLUR_SAMPLES));
-        imageUV = round( (old_uv - blurOffset) * dim);
-        blurColor += imageLoad(previousFrameResultImage, clamp(ivec2(imageUV), ivec2(0, 0), ivec2(dim.x - 1,  dim.y - 1)));
+        return;
     }
-    blurColor /= NUM_MOTION_BLUR_SAMPLES;
 
-    imageStore( currentFrameResultImage, ivec2(gl_GlobalInvocationID.xy), blurColor );
+    // CSMain marched this one
+    if (all(pixel % REPROJECTION_BLOCK_SIZE == GetMarchedPixel(FrameIndex)))
+    {
+        return;
+    }
+
+    float4 color;
+    if (!ReprojectPixel(pixel, color))
+    {
+        color = TraceCloudPixel(pixel);
+    }
+    CloudBuffer[pixel.x + pixel.y * NewScreenWidth] = color;
 }
 
-#endif
\ No newline at end of file
+#endif
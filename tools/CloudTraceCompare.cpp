@@ -0,0 +1,266 @@
+// Checks the CPU cloud tracer. Every frame is traced through the tiled, vectorised path and through the scalar
+// reference, and the two have to agree. Reprojecting a frame onto itself has to give the frame back. The first frame, the renderer's start up camera, can also be compared
+// against a reference PFM, for example a CloudBuffer read back from the compute shader, and written out as one.
+// Usage: CloudTraceCompare [assetDir] [width] [height] [numThreads] [reference.pfm] [output.pfm]
+
+#include "JobSystem.h"
+
+#include <CloudBufferFile.h>
+#include <CloudFrameRenderer.h>
+#include <CloudTexture.h>
+#include <CloudTracer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Farlor::CloudPixel;
+using Farlor::CloudTexture;
+using Farlor::CloudTraceHistory;
+using Farlor::CloudTraceParams;
+using Farlor::CloudTraceStats;
+using Farlor::CloudTracer;
+using Farlor::CloudVector3;
+using Farlor::FarlorJobs::JobSystem;
+
+namespace
+{
+    // Both CPU paths run the same float math, the only difference is the vectorised exp
+    constexpr float CpuTolerance = 1.0e-4f;
+    // The GPU filters with fixed point weights and its own transcendentals
+    constexpr float GpuRmsTolerance = 1.0e-2f;
+
+    struct CompareArg
+    {
+        JobSystem* m_pJobSystem;
+        std::string m_assetDir;
+        uint32_t m_width;
+        uint32_t m_height;
+        std::string m_referenceFile;
+        std::string m_outputFile;
+        bool m_passed;
+    };
+
+    struct Difference
+    {
+        float m_maxError;
+        double m_rmsError;
+        uint32_t m_numOverTolerance;
+    };
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Absolute error, relative once values pass 1 since the march's radiance is unbounded
+    Difference Compare(const std::vector<CloudPixel>& result, const std::vector<CloudPixel>& expected, float tolerance)
+    {
+        Difference difference{ 0.0f, 0.0, 0 };
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            const float resultChannels[3] = { result[i].r, result[i].g, result[i].b };
+            const float expectedChannels[3] = { expected[i].r, expected[i].g, expected[i].b };
+            for (uint32_t channel = 0; channel < 3; ++channel)
+            {
+                const float error = std::fabs(resultChannels[channel] - expectedChannels[channel])
+                    / std::max(1.0f, std::fabs(expectedChannels[channel]));
+                // Written so a NaN counts as over tolerance
+                if (!(error <= tolerance))
+                {
+                    ++difference.m_numOverTolerance;
+                }
+                difference.m_maxError = std::max(difference.m_maxError, error);
+                difference.m_rmsError += static_cast<double>(error) * error;
+            }
+        }
+        difference.m_rmsError = std::sqrt(difference.m_rmsError / (result.size() * 3.0));
+        return difference;
+    }
+
+    void Report(const std::string& name, const Difference& difference)
+    {
+        std::cout << "    " << name << ": max error " << difference.m_maxError << ", rms " << difference.m_rmsError
+            << ", " << difference.m_numOverTolerance << " channels over tolerance" << std::endl;
+    }
+
+    std::vector<CloudTraceParams> MakeFrames(uint32_t width, uint32_t height)
+    {
+        CloudTraceParams params;
+        params.m_screenWidth = width;
+        params.m_screenHeight = height;
+
+        // The start up camera, half ground and half sky
+        std::vector<CloudTraceParams> frames;
+        frames.push_back(params);
+
+        // Looking up into the clouds as the wind and the sun move
+        params.m_cameraPos = CloudVector3(0.0f, 500.0f, 0.0f);
+        params.m_cameraTarget = CloudVector3(300.0f, 1500.0f, 1000.0f);
+        params.m_totalTime = 12.5f;
+        frames.push_back(params);
+
+        // Off the ground disk, near the horizon
+        params.m_cameraPos = CloudVector3(20000.0f, 2000.0f, -15000.0f);
+        params.m_cameraTarget = CloudVector3(19000.0f, 2200.0f, -14000.0f);
+        params.m_totalTime = 100.0f;
+        frames.push_back(params);
+        return frames;
+    }
+
+    void CompareMain(void* pArg)
+    {
+        CompareArg* pCompareArg = static_cast<CompareArg*>(pArg);
+        JobSystem& jobSystem = *pCompareArg->m_pJobSystem;
+
+        CloudTexture lowFrequency;
+        CloudTexture weatherMap;
+        if (!Farlor::LoadCloudTextures(pCompareArg->m_assetDir, lowFrequency, weatherMap))
+        {
+            std::cout << "Error, could not load the cloud textures from " << pCompareArg->m_assetDir << std::endl;
+            pCompareArg->m_passed = false;
+            return;
+        }
+
+        CloudTracer tracer(lowFrequency, weatherMap);
+        std::cout << "Tracing " << pCompareArg->m_width << "x" << pCompareArg->m_height << " on " << jobSystem.GetNumThreads()
+            << " threads, " << (CloudTracer::IsAvx2Enabled() ? "AVX2" : "scalar") << std::endl;
+
+        const size_t numPixels = static_cast<size_t>(pCompareArg->m_width) * pCompareArg->m_height;
+        std::vector<CloudPixel> cloudBuffer(numPixels);
+        std::vector<CloudPixel> referenceBuffer(numPixels);
+        std::vector<CloudPixel> fixedBuffer(numPixels);
+        std::vector<CloudPixel> unterminatedBuffer(numPixels);
+        std::vector<CloudPixel> reprojectedBuffer(numPixels);
+        std::vector<CloudPixel> movedBuffer(numPixels);
+        const std::vector<CloudTraceParams> frames = MakeFrames(pCompareArg->m_width, pCompareArg->m_height);
+
+        // Built once, the wind only moves where it is looked up
+        auto start = std::chrono::steady_clock::now();
+        tracer.UpdateLightVolume(jobSystem);
+        std::cout << "Light volume: " << (SecondsSince(start) * 1000.0) << " ms" << std::endl;
+
+        for (size_t frameIndex = 0; frameIndex < frames.size(); ++frameIndex)
+        {
+            CloudTraceStats traceStats;
+            start = std::chrono::steady_clock::now();
+            tracer.Trace(jobSystem, frames[frameIndex], cloudBuffer.data(), &traceStats);
+            const double traceSeconds = SecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            tracer.TraceReference(frames[frameIndex], referenceBuffer.data());
+            const double referenceSeconds = SecondsSince(start);
+
+            // The same march taken to the end of the cloud layer, for the samples early ray termination saves
+            CloudTraceParams unterminatedParams = frames[frameIndex];
+            unterminatedParams.m_march.m_transmittanceEpsilon = 0.0f;
+            CloudTraceStats unterminatedStats;
+            tracer.Trace(jobSystem, unterminatedParams, unterminatedBuffer.data(), &unterminatedStats);
+
+            // The fixed march the adaptive one replaced, every step sampled and lit by marching towards the sun.
+            // It only gives a sample count and how far the light volume moves the image, it isn't expected to match.
+            CloudTraceParams fixedParams = frames[frameIndex];
+            fixedParams.m_march.m_coarseStepScale = 1;
+            fixedParams.m_march.m_transmittanceEpsilon = 0.0f;
+            fixedParams.m_march.m_useLightVolume = false;
+            CloudTraceStats fixedStats;
+            tracer.TraceReference(fixedParams, fixedBuffer.data(), &fixedStats);
+
+            std::cout << "Frame " << frameIndex << ": " << (traceSeconds * 1000.0) << " ms, scalar reference "
+                << (referenceSeconds * 1000.0) << " ms" << std::endl;
+            std::cout << "    " << traceStats.GetSamplesPerPixel() << " samples per pixel, " << unterminatedStats.GetSamplesPerPixel()
+                << " without early ray termination, the fixed march takes " << fixedStats.GetSamplesPerPixel() << std::endl;
+            const Difference difference = Compare(cloudBuffer, referenceBuffer, CpuTolerance);
+            Report("against the scalar reference", difference);
+            pCompareArg->m_passed &= (difference.m_numOverTolerance == 0);
+            Report("against the march without early ray termination", Compare(cloudBuffer, unterminatedBuffer, CpuTolerance));
+            Report("against the fixed march", Compare(cloudBuffer, fixedBuffer, CpuTolerance));
+
+            // With the camera and time held every pixel reprojects onto itself, and the marched ones are traced again
+            CloudTraceHistory history;
+            history.m_params = frames[frameIndex];
+            history.m_pCloudBuffer = cloudBuffer.data();
+            tracer.TraceReprojected(jobSystem, frames[frameIndex], history, reprojectedBuffer.data());
+            const Difference heldDifference = Compare(reprojectedBuffer, cloudBuffer, CpuTolerance);
+            Report("reprojected onto itself", heldDifference);
+            pCompareArg->m_passed &= (heldDifference.m_numOverTolerance == 0);
+
+            // The next frame at 30 fps, the camera turning a little. The wind moves the clouds between the frames, so
+            // this only shows how far the reprojected pixels are from marched ones.
+            CloudTraceParams movedParams = frames[frameIndex];
+            movedParams.m_cameraTarget.x += 0.01f * (movedParams.m_cameraTarget.z - movedParams.m_cameraPos.z);
+            movedParams.m_totalTime += 1.0f / 30.0f;
+            movedParams.m_frameIndex = frames[frameIndex].m_frameIndex + 1;
+            tracer.Trace(jobSystem, movedParams, movedBuffer.data());
+
+            CloudTraceStats reprojectedStats;
+            start = std::chrono::steady_clock::now();
+            tracer.TraceReprojected(jobSystem, movedParams, history, reprojectedBuffer.data(), &reprojectedStats);
+            const double reprojectedSeconds = SecondsSince(start);
+            std::cout << "    next frame reprojected: " << (reprojectedSeconds * 1000.0) << " ms, " << reprojectedStats.GetSamplesPerPixel()
+                << " samples per pixel, " << (100.0 * reprojectedStats.m_numReprojectedPixels / reprojectedStats.m_numPixels)
+                << "% of pixels reprojected" << std::endl;
+            Report("against the next frame marched", Compare(reprojectedBuffer, movedBuffer, CpuTolerance));
+
+            if (frameIndex != 0)
+            {
+                continue;
+            }
+
+            if (!pCompareArg->m_referenceFile.empty())
+            {
+                std::vector<CloudPixel> fileBuffer;
+                uint32_t fileWidth = 0;
+                uint32_t fileHeight = 0;
+                if (!Farlor::ReadCloudBufferPfm(pCompareArg->m_referenceFile, fileBuffer, fileWidth, fileHeight)
+                    || fileWidth != pCompareArg->m_width || fileHeight != pCompareArg->m_height)
+                {
+                    std::cout << "Error, " << pCompareArg->m_referenceFile << " is not a " << pCompareArg->m_width << "x"
+                        << pCompareArg->m_height << " PFM" << std::endl;
+                    pCompareArg->m_passed = false;
+                }
+                else
+                {
+                    const Difference fileDifference = Compare(cloudBuffer, fileBuffer, GpuRmsTolerance);
+                    Report("against " + pCompareArg->m_referenceFile, fileDifference);
+                    pCompareArg->m_passed &= (fileDifference.m_rmsError <= GpuRmsTolerance);
+                }
+            }
+
+            if (!pCompareArg->m_outputFile.empty())
+            {
+                pCompareArg->m_passed &= Farlor::WriteCloudBufferPfm(pCompareArg->m_outputFile, cloudBuffer.data(),
+                    pCompareArg->m_width, pCompareArg->m_height);
+            }
+        }
+
+        std::cout << (pCompareArg->m_passed ? "Passed" : "Failed") << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t numThreads = (argc > 4) ? static_cast<uint32_t>(std::atoi(argv[4])) : 0;
+    JobSystem jobSystem(JobSystem::Config(100, numThreads));
+
+    CompareArg compareArg;
+    compareArg.m_pJobSystem = &jobSystem;
+    compareArg.m_assetDir = (argc > 1) ? argv[1] : "./assets";
+    // The window size the game opens with
+    compareArg.m_width = (argc > 2) ? static_cast<uint32_t>(std::atoi(argv[2])) : 960;
+    compareArg.m_height = (argc > 3) ? static_cast<uint32_t>(std::atoi(argv[3])) : 540;
+    compareArg.m_referenceFile = (argc > 5) ? argv[5] : "";
+    compareArg.m_outputFile = (argc > 6) ? argv[6] : "";
+    compareArg.m_passed = true;
+
+    JobSystem::Job mainJob;
+    mainJob.m_jobFunction = &CompareMain;
+    mainJob.m_jobArgument = &compareArg;
+    jobSystem.BootstrapMainTask(mainJob);
+    return compareArg.m_passed ? 0 : 1;
+}
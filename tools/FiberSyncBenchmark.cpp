@@ -0,0 +1,175 @@
+// Compares blocking std primitives against FiberMutex and FiberSemaphore when jobs contend for them.
+// The mixed workloads queue jobs that need the lock alongside jobs that don't. A blocked worker thread can't run
+// those other jobs, a suspended fiber leaves its thread free to.
+// In thread pool mode the fiber primitives back off on the thread, which shows what suspending buys.
+// Usage: FiberSyncBenchmark [numThreads] [numFibers] [fibers|threadpool]
+
+#include "FiberMutex.h"
+#include "FiberSemaphore.h"
+#include "JobSystem.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using Farlor::FarlorJobs::FiberMutex;
+using Farlor::FarlorJobs::FiberSemaphore;
+using Farlor::FarlorJobs::JobSystem;
+
+namespace
+{
+    constexpr uint32_t NumShortSectionJobs = 200000;
+    constexpr uint32_t NumMixedJobs = 2000;
+    constexpr uint32_t MixedWorkMicroseconds = 20;
+    constexpr uint32_t NumSemaphorePermits = 2;
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void Report(const std::string& name, double seconds, uint32_t numJobs)
+    {
+        std::cout << name << ": " << (seconds * 1000.0) << " ms, "
+            << (seconds * 1.0e9 / numJobs) << " ns/job" << std::endl;
+    }
+
+    // Stands in for real work, keeps the core busy instead of sleeping
+    void BusyWork(uint32_t microseconds)
+    {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+        while (std::chrono::steady_clock::now() < end)
+        {
+        }
+    }
+
+    // Counting semaphore out of std parts, C++17 has none of its own
+    class BlockingSemaphore
+    {
+    public:
+        explicit BlockingSemaphore(uint32_t initialCount)
+            : m_count{ initialCount }
+        {
+        }
+
+        void Acquire()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_count > 0; });
+            --m_count;
+        }
+
+        void Release()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_count;
+            }
+            m_condition.notify_one();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        uint32_t m_count;
+    };
+
+    // Lots of tiny critical sections, measures the cost of the lock itself under contention
+    template <class Mutex>
+    void ShortSections(JobSystem& jobSystem, Mutex& mutex, const std::string& name)
+    {
+        uint64_t sharedCounter = 0;
+        std::vector<JobSystem::Job> jobs(NumShortSectionJobs, jobSystem.MakeJob([&mutex, &sharedCounter]()
+            {
+                std::lock_guard<Mutex> lock(mutex);
+                ++sharedCounter;
+            }));
+
+        const auto start = std::chrono::steady_clock::now();
+        jobSystem.Wait(jobSystem.SubmitJobs(jobs.data(), NumShortSectionJobs));
+        Report(name + " short sections", SecondsSince(start), NumShortSectionJobs);
+
+        if (sharedCounter != NumShortSectionJobs)
+        {
+            std::cout << "Error, counted " << sharedCounter << " instead of " << NumShortSectionJobs << std::endl;
+        }
+    }
+
+    // Long critical sections interleaved with the same amount of work that needs no lock
+    template <class Mutex>
+    void MixedSections(JobSystem& jobSystem, Mutex& mutex, const std::string& name)
+    {
+        std::vector<JobSystem::Job> jobs;
+        jobs.reserve(NumMixedJobs * 2);
+        for (uint32_t i = 0; i < NumMixedJobs; ++i)
+        {
+            jobs.push_back(jobSystem.MakeJob([&mutex]()
+                {
+                    std::lock_guard<Mutex> lock(mutex);
+                    BusyWork(MixedWorkMicroseconds);
+                }));
+            jobs.push_back(jobSystem.MakeJob([]() { BusyWork(MixedWorkMicroseconds); }));
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        jobSystem.Wait(jobSystem.SubmitJobs(jobs.data(), static_cast<uint32_t>(jobs.size())));
+        Report(name + " mixed sections", SecondsSince(start), static_cast<uint32_t>(jobs.size()));
+    }
+
+    // Jobs that need one of a few permits, interleaved with jobs that need none
+    template <class Semaphore>
+    void MixedPermits(JobSystem& jobSystem, Semaphore& semaphore, const std::string& name)
+    {
+        std::vector<JobSystem::Job> jobs;
+        jobs.reserve(NumMixedJobs * 2);
+        for (uint32_t i = 0; i < NumMixedJobs; ++i)
+        {
+            jobs.push_back(jobSystem.MakeJob([&semaphore]()
+                {
+                    semaphore.Acquire();
+                    BusyWork(MixedWorkMicroseconds);
+                    semaphore.Release();
+                }));
+            jobs.push_back(jobSystem.MakeJob([]() { BusyWork(MixedWorkMicroseconds); }));
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        jobSystem.Wait(jobSystem.SubmitJobs(jobs.data(), static_cast<uint32_t>(jobs.size())));
+        Report(name + " mixed permits", SecondsSince(start), static_cast<uint32_t>(jobs.size()));
+    }
+
+    void BenchmarkMain(JobSystem& jobSystem)
+    {
+        std::mutex stdMutex;
+        FiberMutex fiberMutex(jobSystem);
+        ShortSections(jobSystem, stdMutex, "std::mutex");
+        ShortSections(jobSystem, fiberMutex, "FiberMutex");
+        MixedSections(jobSystem, stdMutex, "std::mutex");
+        MixedSections(jobSystem, fiberMutex, "FiberMutex");
+
+        BlockingSemaphore blockingSemaphore(NumSemaphorePermits);
+        FiberSemaphore fiberSemaphore(jobSystem, NumSemaphorePermits);
+        MixedPermits(jobSystem, blockingSemaphore, "Blocking semaphore");
+        MixedPermits(jobSystem, fiberSemaphore, "FiberSemaphore");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t numThreads = (argc > 1) ? static_cast<uint32_t>(std::atoi(argv[1])) : 0;
+    const uint32_t numFibers = (argc > 2) ? static_cast<uint32_t>(std::atoi(argv[2])) : 256;
+
+    JobSystem::Config config(numFibers, numThreads);
+    if (argc > 3 && std::string(argv[3]) == "threadpool")
+    {
+        config.m_executionMode = JobSystem::ExecutionMode::ThreadPool;
+    }
+    JobSystem jobSystem(config);
+    jobSystem.BootstrapMainTask(jobSystem.MakeJob([&jobSystem]() { BenchmarkMain(jobSystem); }));
+    return 0;
+}
@@ -0,0 +1,375 @@
+// Renders frames offline without a GPU or a window. The camera follows a path of keyframes, the built in fly through
+// or one read from a file. Every frame goes through Renderer::RenderFrame to the HeadlessBackend, which traces it on the
+// CPU and writes it out as PNG, PFM and/or EXR.
+// Path files hold one keyframe per line: time position.x position.y position.z target.x target.y target.z,
+// with the times in seconds and increasing. Lines starting with # are skipped.
+// Frames are reprojected as the GPU reprojects them, one pixel of each 4x4 block marched a frame, unless reprojection
+// is turned off.
+// Usage: HeadlessRender [--assets dir] [--frames N] [--fps N] [--width N] [--height N] [--fov radians]
+//     [--path file] [--out dir] [--prefix name] [--format png|pfm|exr]... [--reproject on|off] [--threads N]
+
+#include "JobSystem.h"
+
+#include <CloudFrameRenderer.h>
+#include <CloudTracer.h>
+#include <HeadlessBackend.h>
+#include <Renderer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Farlor::CameraEntry;
+using Farlor::CloudFrameRenderer;
+using Farlor::CloudTraceParams;
+using Farlor::CloudTracer;
+using Farlor::CloudVector3;
+using Farlor::FarlorJobs::JobSystem;
+using Farlor::HeadlessBackend;
+using Farlor::Renderer;
+using Farlor::Vector3;
+
+namespace
+{
+    struct Keyframe
+    {
+        float m_time;
+        CloudVector3 m_position;
+        CloudVector3 m_target;
+    };
+
+    struct RenderArg
+    {
+        JobSystem* m_pJobSystem;
+        std::string m_assetDir;
+        std::string m_pathFile;
+        uint32_t m_numFrames;
+        float m_framesPerSecond;
+        float m_fovHorizontal;
+        CloudFrameRenderer::Settings m_settings;
+        bool m_passed;
+    };
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Starts at the renderer's start up camera, climbs towards the cloud layer and banks along under it
+    std::vector<Keyframe> MakeDefaultPath()
+    {
+        return {
+            { 0.0f, CloudVector3(0.0f, 0.0f, 0.0f), CloudVector3(0.0f, 0.0f, 1.0f) },
+            { 4.0f, CloudVector3(0.0f, 500.0f, 1000.0f), CloudVector3(300.0f, 1500.0f, 3000.0f) },
+            { 8.0f, CloudVector3(2000.0f, 1200.0f, 4000.0f), CloudVector3(5000.0f, 1800.0f, 5000.0f) },
+            { 12.0f, CloudVector3(6000.0f, 1500.0f, 5000.0f), CloudVector3(8000.0f, 1400.0f, 3000.0f) },
+        };
+    }
+
+    bool ReadPath(const std::string& filename, std::vector<Keyframe>& path)
+    {
+        std::ifstream file(filename);
+        if (!file)
+        {
+            std::cout << "Error, could not open the camera path " << filename << std::endl;
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            std::istringstream lineStream(line);
+            Keyframe keyframe;
+            lineStream >> keyframe.m_time >> keyframe.m_position.x >> keyframe.m_position.y >> keyframe.m_position.z
+                >> keyframe.m_target.x >> keyframe.m_target.y >> keyframe.m_target.z;
+            if (!lineStream || (!path.empty() && keyframe.m_time <= path.back().m_time))
+            {
+                std::cout << "Error, bad keyframe in " << filename << ": " << line << std::endl;
+                return false;
+            }
+            path.push_back(keyframe);
+        }
+
+        if (path.empty())
+        {
+            std::cout << "Error, " << filename << " has no keyframes" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    float CatmullRom(float p0, float p1, float p2, float p3, float t)
+    {
+        return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t * t
+            + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t * t * t);
+    }
+
+    CloudVector3 CatmullRom(const CloudVector3& p0, const CloudVector3& p1, const CloudVector3& p2, const CloudVector3& p3, float t)
+    {
+        return CloudVector3(CatmullRom(p0.x, p1.x, p2.x, p3.x, t), CatmullRom(p0.y, p1.y, p2.y, p3.y, t),
+            CatmullRom(p0.z, p1.z, p2.z, p3.z, t));
+    }
+
+    Vector3 ToVector3(const CloudVector3& vector)
+    {
+        return Vector3(vector.x, vector.y, vector.z);
+    }
+
+    // Smooth curve through the keyframes, holding the end keyframes outside the path's time range
+    void SampleCameraPath(const std::vector<Keyframe>& path, float time, CloudVector3& position, CloudVector3& target)
+    {
+        if (time <= path.front().m_time)
+        {
+            position = path.front().m_position;
+            target = path.front().m_target;
+            return;
+        }
+        if (time >= path.back().m_time)
+        {
+            position = path.back().m_position;
+            target = path.back().m_target;
+            return;
+        }
+
+        size_t segment = 0;
+        while (path[segment + 1].m_time < time)
+        {
+            ++segment;
+        }
+
+        const Keyframe& k0 = path[(segment == 0) ? 0 : segment - 1];
+        const Keyframe& k1 = path[segment];
+        const Keyframe& k2 = path[segment + 1];
+        const Keyframe& k3 = path[std::min(segment + 2, path.size() - 1)];
+        const float t = (time - k1.m_time) / (k2.m_time - k1.m_time);
+        position = CatmullRom(k0.m_position, k1.m_position, k2.m_position, k3.m_position, t);
+        target = CatmullRom(k0.m_target, k1.m_target, k2.m_target, k3.m_target, t);
+    }
+
+    void RenderMain(void* pArg)
+    {
+        RenderArg* pRenderArg = static_cast<RenderArg*>(pArg);
+        JobSystem& jobSystem = *pRenderArg->m_pJobSystem;
+
+        std::vector<Keyframe> path;
+        if (pRenderArg->m_pathFile.empty())
+        {
+            path = MakeDefaultPath();
+        }
+        else if (!ReadPath(pRenderArg->m_pathFile, path))
+        {
+            pRenderArg->m_passed = false;
+            return;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::create_directories(pRenderArg->m_settings.m_outputDir, errorCode);
+        if (errorCode)
+        {
+            std::cout << "Error, could not create " << pRenderArg->m_settings.m_outputDir << ": " << errorCode.message() << std::endl;
+            pRenderArg->m_passed = false;
+            return;
+        }
+
+        Renderer renderer(pRenderArg->m_assetDir);
+        HeadlessBackend backend(renderer, jobSystem, pRenderArg->m_settings);
+        renderer.Initialize(nullptr, &backend);
+        if (!backend.IsInitialized())
+        {
+            pRenderArg->m_passed = false;
+            return;
+        }
+
+        std::cout << "Rendering " << pRenderArg->m_numFrames << " " << pRenderArg->m_settings.m_width << "x"
+            << pRenderArg->m_settings.m_height << " frames to " << pRenderArg->m_settings.m_outputDir << " on "
+            << jobSystem.GetNumThreads() << " threads, " << (CloudTracer::IsAvx2Enabled() ? "AVX2" : "scalar") << std::endl;
+
+        const auto renderStart = std::chrono::steady_clock::now();
+        double totalSamplesPerPixel = 0.0;
+        for (uint32_t frameIndex = 0; frameIndex < pRenderArg->m_numFrames; ++frameIndex)
+        {
+            // Time drives both the camera and the wind and sun, as the game's total time does
+            const float deltaTime = 1.0f / pRenderArg->m_framesPerSecond;
+            const float totalTime = path.front().m_time + frameIndex / pRenderArg->m_framesPerSecond;
+            CloudVector3 position;
+            CloudVector3 target;
+            SampleCameraPath(path, totalTime, position, target);
+
+            CameraEntry cameraEntry;
+            cameraEntry.m_position = ToVector3(position);
+            cameraEntry.m_target = ToVector3(target);
+            cameraEntry.m_fov = pRenderArg->m_fovHorizontal;
+
+            const auto frameStart = std::chrono::steady_clock::now();
+            renderer.RenderFrame(cameraEntry, deltaTime, totalTime);
+            const double samplesPerPixel = backend.GetFrameRenderer()->GetLastFrameStats().GetSamplesPerPixel();
+            totalSamplesPerPixel += samplesPerPixel;
+            std::cout << "Frame " << frameIndex << ": " << (SecondsSince(frameStart) * 1000.0) << " ms, "
+                << samplesPerPixel << " samples per pixel" << std::endl;
+        }
+
+        pRenderArg->m_passed &= (backend.GetNumFailedFrames() == 0);
+        const double renderSeconds = SecondsSince(renderStart);
+        std::cout << "Rendered " << pRenderArg->m_numFrames << " frames in " << renderSeconds << " s";
+        if (pRenderArg->m_numFrames > 0)
+        {
+            std::cout << ", " << (totalSamplesPerPixel / pRenderArg->m_numFrames) << " samples per pixel on average";
+        }
+        std::cout << std::endl;
+    }
+
+    bool ParseCount(const std::string& text, uint32_t& count)
+    {
+        char* pEnd = nullptr;
+        const unsigned long value = std::strtoul(text.c_str(), &pEnd, 10);
+        if (text.empty() || *pEnd != '\0' || value > UINT32_MAX)
+        {
+            return false;
+        }
+        count = static_cast<uint32_t>(value);
+        return true;
+    }
+
+    bool ParsePositive(const std::string& text, float& number)
+    {
+        char* pEnd = nullptr;
+        const float value = std::strtof(text.c_str(), &pEnd);
+        if (text.empty() || *pEnd != '\0' || !(value > 0.0f))
+        {
+            return false;
+        }
+        number = value;
+        return true;
+    }
+
+    // Applies one option, false when the value doesn't parse or the option is unknown
+    bool ApplyOption(const std::string& option, const std::string& value, RenderArg& renderArg, uint32_t& numThreads, bool& formatGiven)
+    {
+        CloudFrameRenderer::Settings& settings = renderArg.m_settings;
+        if (option == "--assets")
+        {
+            renderArg.m_assetDir = value;
+            return true;
+        }
+        if (option == "--frames")
+        {
+            return ParseCount(value, renderArg.m_numFrames);
+        }
+        if (option == "--fps")
+        {
+            return ParsePositive(value, renderArg.m_framesPerSecond);
+        }
+        if (option == "--width")
+        {
+            return ParseCount(value, settings.m_width);
+        }
+        if (option == "--height")
+        {
+            return ParseCount(value, settings.m_height);
+        }
+        if (option == "--fov")
+        {
+            return ParsePositive(value, renderArg.m_fovHorizontal);
+        }
+        if (option == "--path")
+        {
+            renderArg.m_pathFile = value;
+            return true;
+        }
+        if (option == "--out")
+        {
+            settings.m_outputDir = value;
+            return true;
+        }
+        if (option == "--prefix")
+        {
+            settings.m_filePrefix = value;
+            return true;
+        }
+        if (option == "--reproject")
+        {
+            settings.m_reproject = (value == "on");
+            return (value == "on") || (value == "off");
+        }
+        if (option == "--threads")
+        {
+            return ParseCount(value, numThreads);
+        }
+        if (option == "--format")
+        {
+            // The first format given replaces the default
+            if (!formatGiven)
+            {
+                settings.m_writePng = false;
+                formatGiven = true;
+            }
+
+            if (value == "png")
+            {
+                settings.m_writePng = true;
+                return true;
+            }
+            if (value == "pfm")
+            {
+                settings.m_writePfm = true;
+                return true;
+            }
+            if (value == "exr")
+            {
+                settings.m_writeExr = true;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    RenderArg renderArg;
+    renderArg.m_pJobSystem = nullptr;
+    renderArg.m_assetDir = "./assets";
+    renderArg.m_pathFile = "";
+    renderArg.m_numFrames = 60;
+    renderArg.m_framesPerSecond = 30.0f;
+    renderArg.m_fovHorizontal = CloudTraceParams().m_fovHorizontal;
+    renderArg.m_passed = true;
+
+    uint32_t numThreads = 0;
+    bool formatGiven = false;
+    for (int argIndex = 1; argIndex < argc; argIndex += 2)
+    {
+        const std::string option = argv[argIndex];
+        if (argIndex + 1 >= argc)
+        {
+            std::cout << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        if (!ApplyOption(option, argv[argIndex + 1], renderArg, numThreads, formatGiven))
+        {
+            std::cout << "Bad option " << option << " " << argv[argIndex + 1] << std::endl;
+            return 1;
+        }
+    }
+
+    JobSystem jobSystem(JobSystem::Config(100, numThreads));
+    renderArg.m_pJobSystem = &jobSystem;
+
+    JobSystem::Job mainJob;
+    mainJob.m_jobFunction = &RenderMain;
+    mainJob.m_jobArgument = &renderArg;
+    jobSystem.BootstrapMainTask(mainJob);
+    return renderArg.m_passed ? 0 : 1;
+}
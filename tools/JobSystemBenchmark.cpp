@@ -0,0 +1,181 @@
+// Measures the per job overhead of the job system.
+// Usage: JobSystemBenchmark [numThreads] [numFibers] [chromeTraceFile] [fibers|threadpool]
+// Pass an empty trace file to pick the execution mode without tracing.
+
+#include "JobSystem.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Farlor::FarlorJobs::JobSystem;
+
+namespace
+{
+    constexpr uint32_t NumTinyJobs = 1000000;
+
+    std::atomic<uint32_t> g_tinyJobsRun{ 0 };
+
+    void TinyJob(void*)
+    {
+        g_tinyJobsRun.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct BenchmarkArg
+    {
+        JobSystem* m_pJobSystem;
+        // Empty to run without tracing
+        std::string m_traceFilePath;
+    };
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void Report(const std::string& name, double seconds, uint32_t numJobs)
+    {
+        std::cout << name << ": " << (seconds * 1000.0) << " ms, "
+            << (seconds * 1.0e9 / numJobs) << " ns/job" << std::endl;
+    }
+
+    // One submission per job, a counter is created and waited on every time
+    void SingleJobSubmissions(JobSystem& jobSystem)
+    {
+        g_tinyJobsRun.store(0);
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < NumTinyJobs; ++i)
+        {
+            JobSystem::Job job;
+            job.m_jobFunction = &TinyJob;
+            auto counter = jobSystem.SubmitJobs(&job, 1);
+            jobSystem.Wait(counter);
+        }
+        Report("1M single job submissions", SecondsSince(start), NumTinyJobs);
+    }
+
+    // Batches of jobs sharing a counter, batchSize must divide NumTinyJobs
+    void BatchedSubmissions(JobSystem& jobSystem, uint32_t batchSize)
+    {
+        std::vector<JobSystem::Job> jobs(batchSize);
+        for (JobSystem::Job& job : jobs)
+        {
+            job.m_jobFunction = &TinyJob;
+        }
+
+        g_tinyJobsRun.store(0);
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t submitted = 0; submitted < NumTinyJobs; submitted += batchSize)
+        {
+            auto counter = jobSystem.SubmitJobs(jobs.data(), batchSize);
+            jobSystem.Wait(counter);
+        }
+
+        Report("1M jobs in batches of " + std::to_string(batchSize), SecondsSince(start), NumTinyJobs);
+    }
+
+    // The same loop through ParallelFor and ParallelReduce with adaptive grain sizing
+    void ParallelLoops(JobSystem& jobSystem)
+    {
+        std::vector<uint64_t> values(NumTinyJobs);
+
+        auto start = std::chrono::steady_clock::now();
+        Farlor::FarlorJobs::ParallelFor(jobSystem, 0, NumTinyJobs, Farlor::FarlorJobs::AdaptiveGrainSize,
+            [&values](uint32_t i) { values[i] = i; });
+        Report("ParallelFor over 1M items", SecondsSince(start), NumTinyJobs);
+
+        start = std::chrono::steady_clock::now();
+        const uint64_t sum = Farlor::FarlorJobs::ParallelReduce(jobSystem, 0, NumTinyJobs, Farlor::FarlorJobs::AdaptiveGrainSize, uint64_t(0),
+            [&values](uint32_t i) { return values[i]; },
+            [](uint64_t a, uint64_t b) { return a + b; });
+        Report("ParallelReduce over 1M items", SecondsSince(start), NumTinyJobs);
+
+        const uint64_t expectedSum = static_cast<uint64_t>(NumTinyJobs) * (NumTinyJobs - 1) / 2;
+        if (sum != expectedSum)
+        {
+            std::cout << "Error, ParallelReduce gave " << sum << " instead of " << expectedSum << std::endl;
+        }
+    }
+
+    void ReportTrace(JobSystem& jobSystem, const std::string& traceFilePath)
+    {
+        Farlor::FarlorJobs::JobTrace& jobTrace = jobSystem.GetTrace();
+        jobTrace.SetEnabled(false);
+
+        for (uint32_t threadIndex = 1; threadIndex <= jobTrace.GetNumThreads(); ++threadIndex)
+        {
+            const Farlor::FarlorJobs::JobTrace::WorkerStats workerStats = jobTrace.GetWorkerStats(threadIndex);
+            const double averageWaitLatency = workerStats.m_numWaits ? static_cast<double>(workerStats.m_totalWaitLatencyNanoseconds) / workerStats.m_numWaits : 0.0;
+            std::cout << "Thread " << threadIndex << ": " << (workerStats.m_utilisation * 100.0) << "% busy, "
+                << (workerStats.m_idleNanoseconds / 1000000.0) << " ms idle, "
+                << workerStats.m_numJobs << " jobs, " << workerStats.m_numSteals << " steals, "
+                << "wait latency avg " << averageWaitLatency << " ns max " << workerStats.m_maxWaitLatencyNanoseconds << " ns" << std::endl;
+        }
+
+        if (jobTrace.WriteChromeTrace(traceFilePath))
+        {
+            std::cout << "Wrote " << traceFilePath << std::endl;
+        }
+    }
+
+    void BenchmarkMain(void* pArg)
+    {
+        const BenchmarkArg& benchmarkArg = *static_cast<BenchmarkArg*>(pArg);
+        JobSystem& jobSystem = *benchmarkArg.m_pJobSystem;
+
+        if (!benchmarkArg.m_traceFilePath.empty())
+        {
+            jobSystem.GetTrace().SetEnabled(true);
+        }
+
+        const Farlor::FarlorJobs::CpuTopology& cpuTopology = jobSystem.GetCpuTopology();
+        const bool isThreadPool = jobSystem.GetExecutionMode() == JobSystem::ExecutionMode::ThreadPool;
+        std::cout << (isThreadPool ? "Thread pool, " : "Fibers, ") << jobSystem.GetNumThreads() << " threads on " << cpuTopology.GetNumLogicalCpus() << " logical cpus, "
+            << cpuTopology.GetNumCores() << " cores, " << cpuTopology.GetNumCacheDomains() << " cache domains, "
+            << cpuTopology.GetNumNumaNodes() << " numa nodes, " << cpuTopology.GetNumPackages() << " packages" << std::endl;
+
+        SingleJobSubmissions(jobSystem);
+        BatchedSubmissions(jobSystem, 64);
+        BatchedSubmissions(jobSystem, 1000);
+        BatchedSubmissions(jobSystem, NumTinyJobs);
+
+        if (g_tinyJobsRun.load() != NumTinyJobs)
+        {
+            std::cout << "Error, ran " << g_tinyJobsRun.load() << " jobs" << std::endl;
+        }
+
+        ParallelLoops(jobSystem);
+
+        const JobSystem::IdleStats idleStats = jobSystem.GetIdleStats();
+        std::cout << "Idle threads parked " << idleStats.m_numParks << " times, woken " << idleStats.m_numWakes << " times" << std::endl;
+
+        if (!benchmarkArg.m_traceFilePath.empty())
+        {
+            ReportTrace(jobSystem, benchmarkArg.m_traceFilePath);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t numThreads = (argc > 1) ? static_cast<uint32_t>(std::atoi(argv[1])) : 0;
+    const uint32_t numFibers = (argc > 2) ? static_cast<uint32_t>(std::atoi(argv[2])) : 64;
+
+    JobSystem::Config config(numFibers, numThreads);
+    if (argc > 4 && std::string(argv[4]) == "threadpool")
+    {
+        config.m_executionMode = JobSystem::ExecutionMode::ThreadPool;
+    }
+    JobSystem jobSystem(config);
+
+    BenchmarkArg benchmarkArg;
+    benchmarkArg.m_pJobSystem = &jobSystem;
+    benchmarkArg.m_traceFilePath = (argc > 3) ? argv[3] : "";
+    jobSystem.BootstrapMainTask(&BenchmarkMain, &benchmarkArg);
+    return 0;
+}
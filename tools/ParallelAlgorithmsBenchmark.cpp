@@ -0,0 +1,195 @@
+// Times the parallel sorts, scans and partition against their std counterparts, serial and, where the standard
+// library has them, with std::execution::par. Every result is checked against the serial std one.
+// Usage: ParallelAlgorithmsBenchmark [numThreads] [maxCount] [fibers|threadpool]
+
+#include "JobSystem.h"
+#include "ParallelAlgorithms.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(FARLOR_BENCHMARK_STD_PAR)
+#include <execution>
+#endif
+
+using Farlor::FarlorJobs::JobSystem;
+
+namespace
+{
+    constexpr uint32_t MinCount = 1000;
+    constexpr uint32_t DefaultMaxCount = 100000000;
+    // Small sizes are repeated until roughly this many elements have gone through each algorithm
+    constexpr uint32_t NumElementsPerMeasurement = 10000000;
+
+    struct BenchmarkArg
+    {
+        JobSystem* m_pJobSystem;
+        uint32_t m_maxCount;
+    };
+
+    bool IsEven(uint32_t value)
+    {
+        return (value & 1) == 0;
+    }
+
+    // Average milliseconds per run of algorithm(work), with work reset to input before every run
+    template <class Algorithm>
+    double Measure(const std::vector<uint32_t>& input, std::vector<uint32_t>& work, Algorithm&& algorithm)
+    {
+        const uint32_t numRuns = std::max(NumElementsPerMeasurement / static_cast<uint32_t>(input.size()), 1u);
+        double seconds = 0.0;
+        for (uint32_t run = 0; run < numRuns; ++run)
+        {
+            work = input;
+            const auto start = std::chrono::steady_clock::now();
+            algorithm(work);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        return seconds * 1000.0 / numRuns;
+    }
+
+    void Check(const std::string& name, const std::vector<uint32_t>& result, const std::vector<uint32_t>& expected)
+    {
+        if (result != expected)
+        {
+            std::cout << "Error, " << name << " does not match the std result" << std::endl;
+        }
+    }
+
+    void PrintRow(const std::string& name, double milliseconds)
+    {
+        std::cout << "    " << std::left << std::setw(32) << name << std::right << std::setw(12) << milliseconds << " ms" << std::endl;
+    }
+
+    void BenchmarkSorts(JobSystem& jobSystem, const std::vector<uint32_t>& input, std::vector<uint32_t>& work)
+    {
+        std::vector<uint32_t> expected = input;
+        std::sort(expected.begin(), expected.end());
+
+        PrintRow("std::sort", Measure(input, work, [](std::vector<uint32_t>& data) { std::sort(data.begin(), data.end()); }));
+#if defined(FARLOR_BENCHMARK_STD_PAR)
+        PrintRow("std::sort par", Measure(input, work, [](std::vector<uint32_t>& data)
+            {
+                std::sort(std::execution::par, data.begin(), data.end());
+            }));
+#endif
+        PrintRow("ParallelMergeSort", Measure(input, work, [&jobSystem](std::vector<uint32_t>& data)
+            {
+                Farlor::FarlorJobs::ParallelMergeSort(jobSystem, data.data(), static_cast<uint32_t>(data.size()));
+            }));
+        Check("ParallelMergeSort", work, expected);
+        PrintRow("ParallelRadixSort", Measure(input, work, [&jobSystem](std::vector<uint32_t>& data)
+            {
+                Farlor::FarlorJobs::ParallelRadixSort(jobSystem, data.data(), static_cast<uint32_t>(data.size()),
+                    [](uint32_t value) { return value; });
+            }));
+        Check("ParallelRadixSort", work, expected);
+    }
+
+    void BenchmarkScans(JobSystem& jobSystem, const std::vector<uint32_t>& input, std::vector<uint32_t>& work)
+    {
+        std::vector<uint32_t> expected(input.size());
+        std::inclusive_scan(input.begin(), input.end(), expected.begin());
+
+        PrintRow("std::inclusive_scan", Measure(input, work, [](std::vector<uint32_t>& data)
+            {
+                std::inclusive_scan(data.begin(), data.end(), data.begin());
+            }));
+#if defined(FARLOR_BENCHMARK_STD_PAR)
+        PrintRow("std::inclusive_scan par", Measure(input, work, [](std::vector<uint32_t>& data)
+            {
+                std::inclusive_scan(std::execution::par, data.begin(), data.end(), data.begin());
+            }));
+#endif
+        PrintRow("ParallelInclusiveScan", Measure(input, work, [&jobSystem](std::vector<uint32_t>& data)
+            {
+                Farlor::FarlorJobs::ParallelInclusiveScan(jobSystem, data.data(), data.data(), static_cast<uint32_t>(data.size()),
+                    [](uint32_t a, uint32_t b) { return a + b; });
+            }));
+        Check("ParallelInclusiveScan", work, expected);
+
+        std::exclusive_scan(input.begin(), input.end(), expected.begin(), 0u);
+        PrintRow("ParallelExclusiveScan", Measure(input, work, [&jobSystem](std::vector<uint32_t>& data)
+            {
+                Farlor::FarlorJobs::ParallelExclusiveScan(jobSystem, data.data(), data.data(), static_cast<uint32_t>(data.size()), 0u,
+                    [](uint32_t a, uint32_t b) { return a + b; });
+            }));
+        Check("ParallelExclusiveScan", work, expected);
+    }
+
+    void BenchmarkPartitions(JobSystem& jobSystem, const std::vector<uint32_t>& input, std::vector<uint32_t>& work)
+    {
+        std::vector<uint32_t> expected = input;
+        std::stable_partition(expected.begin(), expected.end(), IsEven);
+
+        PrintRow("std::stable_partition", Measure(input, work, [](std::vector<uint32_t>& data)
+            {
+                std::stable_partition(data.begin(), data.end(), IsEven);
+            }));
+#if defined(FARLOR_BENCHMARK_STD_PAR)
+        PrintRow("std::stable_partition par", Measure(input, work, [](std::vector<uint32_t>& data)
+            {
+                std::stable_partition(std::execution::par, data.begin(), data.end(), IsEven);
+            }));
+#endif
+        PrintRow("ParallelStablePartition", Measure(input, work, [&jobSystem](std::vector<uint32_t>& data)
+            {
+                Farlor::FarlorJobs::ParallelStablePartition(jobSystem, data.data(), static_cast<uint32_t>(data.size()), IsEven);
+            }));
+        Check("ParallelStablePartition", work, expected);
+    }
+
+    void BenchmarkMain(void* pArg)
+    {
+        BenchmarkArg* pBenchmarkArg = static_cast<BenchmarkArg*>(pArg);
+        JobSystem& jobSystem = *pBenchmarkArg->m_pJobSystem;
+        std::cout << "Running on " << jobSystem.GetNumThreads() << " threads" << std::endl;
+
+        std::mt19937 randomEngine(1234);
+        // 64 bit so the last step up to the largest size cannot wrap
+        for (uint64_t count = MinCount; count <= pBenchmarkArg->m_maxCount; count *= 10)
+        {
+            std::vector<uint32_t> input(static_cast<size_t>(count));
+            for (uint32_t& value : input)
+            {
+                value = randomEngine();
+            }
+            std::vector<uint32_t> work;
+
+            std::cout << count << " elements" << std::endl;
+            BenchmarkSorts(jobSystem, input, work);
+            BenchmarkScans(jobSystem, input, work);
+            BenchmarkPartitions(jobSystem, input, work);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t numThreads = (argc > 1) ? static_cast<uint32_t>(std::atoi(argv[1])) : 0;
+
+    JobSystem::Config config(256, numThreads);
+    if (argc > 3 && std::string(argv[3]) == "threadpool")
+    {
+        config.m_executionMode = JobSystem::ExecutionMode::ThreadPool;
+    }
+    JobSystem jobSystem(config);
+
+    BenchmarkArg benchmarkArg;
+    benchmarkArg.m_pJobSystem = &jobSystem;
+    benchmarkArg.m_maxCount = (argc > 2) ? static_cast<uint32_t>(std::atoll(argv[2])) : DefaultMaxCount;
+
+    JobSystem::Job mainJob;
+    mainJob.m_jobFunction = &BenchmarkMain;
+    mainJob.m_jobArgument = &benchmarkArg;
+    jobSystem.BootstrapMainTask(mainJob);
+    return 0;
+}
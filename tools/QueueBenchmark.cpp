@@ -0,0 +1,188 @@
+// Compares the mutex guarded MultithreadedQueue against the lock free MPMCQueue.
+// Every run has the same number of producers and consumers, passing a fixed number of items through the queue.
+// Usage: QueueBenchmark [maxNumThreadsPerSide] [numItems]
+
+#include "DataStructures/MPMCQueue.h"
+#include "DataStructures/MultithreadQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using Farlor::MPMCQueue;
+using Farlor::MultithreadedQueue;
+
+namespace
+{
+    constexpr uint32_t QueueCapacity = 4096;
+    constexpr uint32_t BulkSize = 32;
+
+    // Pushes and pops one item at a time, through whichever queue it wraps
+    template <class Queue>
+    struct SingleItemPolicy
+    {
+        static void Produce(Queue& queue, uint64_t firstItem, uint64_t numItems)
+        {
+            for (uint64_t item = firstItem; item < firstItem + numItems; ++item)
+            {
+                uint64_t value = item;
+                queue.Push(value);
+            }
+        }
+
+        static uint64_t TryConsume(Queue& queue, uint64_t& checksum)
+        {
+            uint64_t value = 0;
+            if (!queue.TryPop(value))
+            {
+                return 0;
+            }
+            checksum += value;
+            return 1;
+        }
+    };
+
+    struct BulkPolicy
+    {
+        static void Produce(MPMCQueue<uint64_t>& queue, uint64_t firstItem, uint64_t numItems)
+        {
+            uint64_t items[BulkSize];
+            uint64_t nextItem = firstItem;
+            const uint64_t endItem = firstItem + numItems;
+            while (nextItem < endItem)
+            {
+                uint32_t numToPush = 0;
+                for (; numToPush < BulkSize && nextItem + numToPush < endItem; ++numToPush)
+                {
+                    items[numToPush] = nextItem + numToPush;
+                }
+
+                uint32_t numPushed = 0;
+                while (numPushed < numToPush)
+                {
+                    const uint32_t numPushedNow = queue.TryPushBulk(items + numPushed, numToPush - numPushed);
+                    if (numPushedNow == 0)
+                    {
+                        std::this_thread::yield();
+                    }
+                    numPushed += numPushedNow;
+                }
+                nextItem += numToPush;
+            }
+        }
+
+        static uint64_t TryConsume(MPMCQueue<uint64_t>& queue, uint64_t& checksum)
+        {
+            uint64_t items[BulkSize];
+            const uint32_t numPopped = queue.TryPopBulk(items, BulkSize);
+            for (uint32_t i = 0; i < numPopped; ++i)
+            {
+                checksum += items[i];
+            }
+            return numPopped;
+        }
+    };
+
+    // Returns the run time in seconds, or a negative value if items went missing
+    template <class Policy, class Queue>
+    double Run(Queue& queue, uint32_t numThreadsPerSide, uint64_t numItems)
+    {
+        std::atomic<uint64_t> numConsumed{ 0 };
+        std::atomic<uint64_t> checksum{ 0 };
+        std::atomic<bool> start{ false };
+
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < numThreadsPerSide; ++i)
+        {
+            const uint64_t firstItem = numItems * i / numThreadsPerSide;
+            const uint64_t endItem = numItems * (i + 1) / numThreadsPerSide;
+            threads.emplace_back([&queue, &start, firstItem, endItem]()
+            {
+                while (!start.load(std::memory_order_acquire))
+                {
+                    std::this_thread::yield();
+                }
+                Policy::Produce(queue, firstItem, endItem - firstItem);
+            });
+
+            threads.emplace_back([&queue, &start, &numConsumed, &checksum, numItems]()
+            {
+                while (!start.load(std::memory_order_acquire))
+                {
+                    std::this_thread::yield();
+                }
+
+                uint64_t localChecksum = 0;
+                while (numConsumed.load(std::memory_order_relaxed) < numItems)
+                {
+                    const uint64_t numPopped = Policy::TryConsume(queue, localChecksum);
+                    if (numPopped == 0)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    numConsumed.fetch_add(numPopped, std::memory_order_relaxed);
+                }
+                checksum.fetch_add(localChecksum, std::memory_order_relaxed);
+            });
+        }
+
+        const auto startTime = std::chrono::steady_clock::now();
+        start.store(true, std::memory_order_release);
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        const uint64_t expectedChecksum = numItems * (numItems - 1) / 2;
+        return (checksum.load() == expectedChecksum) ? seconds : -1.0;
+    }
+
+    void Report(double seconds, uint64_t numItems)
+    {
+        std::cout << std::setw(14);
+        if (seconds < 0.0)
+        {
+            std::cout << "LOST ITEMS";
+        }
+        else
+        {
+            std::cout << (seconds * 1.0e9 / static_cast<double>(numItems));
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t maxNumThreadsPerSide = (argc > 1) ? static_cast<uint32_t>(std::atoi(argv[1])) : 64;
+    const uint64_t numItems = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+
+    std::cout << "ns per item, " << numItems << " items, capacity " << QueueCapacity << ", bulk size " << BulkSize << std::endl;
+    std::cout << std::setw(10) << "threads" << std::setw(14) << "mutex" << std::setw(14) << "mpmc" << std::setw(14) << "mpmc bulk" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (uint32_t numThreadsPerSide = 1; numThreadsPerSide <= maxNumThreadsPerSide; numThreadsPerSide *= 2)
+    {
+        std::cout << std::setw(10) << numThreadsPerSide;
+        {
+            MultithreadedQueue<uint64_t> queue;
+            Report(Run<SingleItemPolicy<MultithreadedQueue<uint64_t>>>(queue, numThreadsPerSide, numItems), numItems);
+        }
+        {
+            MPMCQueue<uint64_t> queue(QueueCapacity);
+            Report(Run<SingleItemPolicy<MPMCQueue<uint64_t>>>(queue, numThreadsPerSide, numItems), numItems);
+        }
+        {
+            MPMCQueue<uint64_t> queue(QueueCapacity);
+            Report(Run<BulkPolicy>(queue, numThreadsPerSide, numItems), numItems);
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
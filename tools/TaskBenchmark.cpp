@@ -0,0 +1,137 @@
+// Compares a recursive fan out written with jobs and Wait against the same fan out written with tasks and WhenAll.
+// Every waiting job holds on to a fiber and its stack, a waiting task only holds its coroutine frame.
+// Usage: TaskBenchmark [numThreads] [numFibers] [fibers|threadpool]
+
+#include "JobSystem.h"
+#include "Task.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Farlor::FarlorJobs::JobSystem;
+using Farlor::FarlorJobs::Task;
+
+namespace
+{
+    constexpr uint32_t FanOut = 4;
+    // Every inner node waits on its children, so the job tree has up to 341 fibers waiting at once
+    constexpr uint32_t TreeDepth = 4;
+    constexpr uint32_t NumRepeats = 200;
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint32_t NumTreeNodes(uint32_t depth)
+    {
+        uint32_t numNodes = 1;
+        uint32_t numNodesAtDepth = 1;
+        for (uint32_t i = 0; i < depth; ++i)
+        {
+            numNodesAtDepth *= FanOut;
+            numNodes += numNodesAtDepth;
+        }
+        return numNodes;
+    }
+
+    void Report(const std::string& name, double seconds, uint32_t numNodes)
+    {
+        std::cout << name << ": " << (seconds * 1000.0) << " ms, "
+            << (seconds * 1.0e9 / numNodes) << " ns/node" << std::endl;
+    }
+
+    uint64_t JobTree(JobSystem& jobSystem, uint32_t depth)
+    {
+        if (depth == 0)
+        {
+            return 1;
+        }
+
+        uint64_t childSums[FanOut] = {};
+        std::vector<JobSystem::Job> jobs;
+        jobs.reserve(FanOut);
+        for (uint32_t i = 0; i < FanOut; ++i)
+        {
+            uint64_t* pChildSum = &childSums[i];
+            jobs.push_back(jobSystem.MakeJob([&jobSystem, pChildSum, depth]() { *pChildSum = JobTree(jobSystem, depth - 1); }));
+        }
+        jobSystem.Wait(jobSystem.SubmitJobs(jobs.data(), FanOut));
+
+        uint64_t sum = 1;
+        for (uint64_t childSum : childSums)
+        {
+            sum += childSum;
+        }
+        return sum;
+    }
+
+    Task<uint64_t> TaskTree(JobSystem& jobSystem, uint32_t depth)
+    {
+        if (depth == 0)
+        {
+            co_return 1;
+        }
+
+        std::vector<Task<uint64_t>> children;
+        children.reserve(FanOut);
+        for (uint32_t i = 0; i < FanOut; ++i)
+        {
+            children.push_back(TaskTree(jobSystem, depth - 1));
+        }
+        const std::vector<uint64_t> childSums = co_await WhenAll(jobSystem, std::move(children));
+
+        uint64_t sum = 1;
+        for (uint64_t childSum : childSums)
+        {
+            sum += childSum;
+        }
+        co_return sum;
+    }
+
+    void BenchmarkMain(JobSystem& jobSystem)
+    {
+        const uint32_t numNodes = NumTreeNodes(TreeDepth);
+        const uint32_t numTotalNodes = numNodes * NumRepeats;
+
+        uint64_t jobSum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < NumRepeats; ++i)
+        {
+            jobSum += JobTree(jobSystem, TreeDepth);
+        }
+        Report("Job tree", SecondsSince(start), numTotalNodes);
+
+        uint64_t taskSum = 0;
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < NumRepeats; ++i)
+        {
+            taskSum += WaitForTask(jobSystem, TaskTree(jobSystem, TreeDepth));
+        }
+        Report("Task tree", SecondsSince(start), numTotalNodes);
+
+        if (jobSum != numTotalNodes || taskSum != numTotalNodes)
+        {
+            std::cout << "Error, counted " << jobSum << " and " << taskSum << " nodes instead of " << numTotalNodes << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t numThreads = (argc > 1) ? static_cast<uint32_t>(std::atoi(argv[1])) : 0;
+    const uint32_t numFibers = (argc > 2) ? static_cast<uint32_t>(std::atoi(argv[2])) : 512;
+
+    JobSystem::Config config(numFibers, numThreads);
+    if (argc > 3 && std::string(argv[3]) == "threadpool")
+    {
+        config.m_executionMode = JobSystem::ExecutionMode::ThreadPool;
+    }
+    JobSystem jobSystem(config);
+    jobSystem.BootstrapMainTask(jobSystem.MakeJob([&jobSystem]() { BenchmarkMain(jobSystem); }));
+    return 0;
+}